@@ -0,0 +1,101 @@
+// Compare loading a saved AST file against analyzing the source again.
+// Usage: bench-astfile <input file> [iterations]
+
+#include "lafun/astfile.h"
+#include "lafun/codegen.h"
+#include "lafun/compile.h"
+#include "Input.h"
+#include "OutputBuffer.h"
+#include "bench.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		std::cerr << "Usage: " << argv[0] << " <input file> [iterations]\n";
+		return 1;
+	}
+
+	size_t iterations = argc == 3 ? strtoul(argv[2], nullptr, 10) : 20;
+	if (iterations == 0) {
+		std::cerr << "Invalid number of iterations: " << argv[2] << '\n';
+		return 1;
+	}
+
+	Input input;
+	if (!input.open(argv[1])) {
+		std::cerr << "Opening file " << argv[1] << " failed\n";
+		return 1;
+	}
+
+	std::string_view source = input.view();
+	char astPath[] = "/tmp/lafun-bench-XXXXXX";
+	int fd = mkstemp(astPath);
+	if (fd < 0) {
+		std::cerr << "Creating a temporary file failed\n";
+		return 1;
+	}
+	close(fd);
+
+	{
+		lafun::ast::LafunDocument document;
+		lafun::analyze(source, document);
+		std::ofstream os(astPath, std::ios::binary);
+		lafun::writeAstFile(os, source, document);
+		if (!os.flush()) {
+			std::cerr << "Writing " << astPath << " failed\n";
+			unlink(astPath);
+			return 1;
+		}
+
+		std::cout << argv[1] << ": " << source.size() << " bytes, AST file "
+			<< os.tellp() << " bytes, median of " << iterations << " runs\n";
+	}
+
+	double reparse = bench::measure(iterations, [&] {
+		lafun::ast::LafunDocument document;
+		lafun::analyze(source, document);
+	});
+
+	double open = bench::measure(iterations, [&] {
+		lafun::AstFile file;
+		file.open(astPath);
+	});
+
+	double load = bench::measure(iterations, [&] {
+		lafun::AstFile file;
+		file.open(astPath);
+		lafun::ast::LafunDocument document;
+		file.load(document);
+	});
+
+	OutputBuffer latex;
+	double reparseLatex = bench::measure(iterations, [&] {
+		latex.clear();
+		lafun::ast::LafunDocument document;
+		lafun::analyze(source, document);
+		lafun::codegen(latex, source, document);
+	});
+
+	double openLatex = bench::measure(iterations, [&] {
+		latex.clear();
+		lafun::AstFile file;
+		file.open(astPath);
+		lafun::codegen(latex, file);
+	});
+
+	unlink(astPath);
+
+	std::cout << "Syntax trees:\n";
+	bench::report("lex, parse and resolve", reparse);
+	bench::report("map and validate", open, reparse);
+	bench::report("map, validate and build trees", load, reparse);
+	std::cout << "LaTeX:\n";
+	bench::report("from source", reparseLatex);
+	bench::report("from AST file", openLatex, reparseLatex);
+	return 0;
+}
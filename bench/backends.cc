@@ -0,0 +1,74 @@
+// Compare generating javascript and LaTeX one after the other against
+// generating them at the same time, from one analyzed document.
+// Usage: bench-backends <input file> [iterations]
+
+#include "lafun/compile.h"
+#include "Input.h"
+#include "bench.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		std::cerr << "Usage: " << argv[0] << " <input file> [iterations]\n";
+		return 1;
+	}
+
+	size_t iterations = argc == 3 ? strtoul(argv[2], nullptr, 10) : 20;
+	if (iterations == 0) {
+		std::cerr << "Invalid number of iterations: " << argv[2] << '\n';
+		return 1;
+	}
+
+	Input input;
+	if (!input.open(argv[1])) {
+		std::cerr << "Opening file " << argv[1] << " failed\n";
+		return 1;
+	}
+
+	std::string_view source = input.view();
+	lafun::ast::LafunDocument document;
+	lafun::analyze(source, document);
+
+	// Written to /dev/null, so that the numbers include writing the
+	// buffers out, but not the disk
+	std::ofstream js("/dev/null");
+	std::ofstream latex("/dev/null");
+	lafun::CompileOptions opts;
+
+	lafun::CompileOutputs jsOut;
+	jsOut.js = &js;
+	lafun::CompileOutputs latexOut;
+	latexOut.latex = &latex;
+	lafun::CompileOutputs bothOut;
+	bothOut.js = &js;
+	bothOut.latex = &latex;
+
+	double jsOnly = bench::measure(iterations, [&] {
+		lafun::generate(source, document, opts, jsOut);
+	});
+
+	double latexOnly = bench::measure(iterations, [&] {
+		lafun::generate(source, document, opts, latexOut);
+	});
+
+	double sequential = bench::measure(iterations, [&] {
+		lafun::generate(source, document, opts, jsOut);
+		lafun::generate(source, document, opts, latexOut);
+	});
+
+	double concurrent = bench::measure(iterations, [&] {
+		lafun::generate(source, document, opts, bothOut);
+	});
+
+	std::cout << argv[1] << ": " << source.size() << " bytes, median of "
+		<< iterations << " runs\n";
+	bench::report("javascript", jsOnly);
+	bench::report("LaTeX", latexOnly);
+	bench::report("one after the other", sequential);
+	bench::report("at the same time", concurrent, sequential);
+	return 0;
+}
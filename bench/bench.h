@@ -0,0 +1,57 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+// What the benchmarks share: timing runs, and printing the results
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+// Milliseconds since start
+inline double elapsed(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+inline double median(std::vector<double> times) {
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+// The median run, in milliseconds
+inline double measure(size_t iterations, const std::function<void()> &func) {
+	std::vector<double> times;
+	for (size_t i = 0; i < iterations; ++i) {
+		auto start = Clock::now();
+		func();
+		times.push_back(elapsed(start));
+	}
+
+	return median(std::move(times));
+}
+
+// With how many times faster than the baseline it is, if there is one
+inline void report(const char *name, double ms, double baseline = 0) {
+	std::cout << "  " << name << ": " << ms << " ms";
+	if (baseline > 0 && ms > 0) {
+		std::cout << " (" << baseline / ms << "x)";
+	}
+	std::cout << '\n';
+}
+
+// With the throughput over some bytes
+inline void reportThroughput(const char *name, double ms, size_t bytes) {
+	std::cout << "  " << name << ": " << ms << " ms";
+	if (ms > 0) {
+		std::cout << " (" << bytes / ms / 1000 << " MB/s)";
+	}
+	std::cout << '\n';
+}
+
+}
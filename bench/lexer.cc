@@ -0,0 +1,188 @@
+// Measure the lexer's scanning of whitespace, identifiers and strings, with
+// and without SIMD, and the lexer as a whole, on a large synthetic FuN
+// declaration with long names, deep indentation and long strings. Then
+// compare tracking lines and columns for every byte lexed, as the lexer
+// used to, to finding them with a LineIndex when they're needed.
+// Usage: bench-lexer [statements] [iterations]
+
+#include "fun/Lexer.h"
+#include "LineIndex.h"
+#include "Scan.h"
+#include "bench.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+static std::string synthesize(size_t statements) {
+	static const char *const names[] = {
+		"accumulatedDistanceSquared", "temporary_value_for_the_loop", "x", "normalizedVector",
+		"numberOfIterationsRemaining", "i", "resultOfTheComputation", "previousElementInTheList",
+	};
+
+	std::string source = "\\fun{main}{}{\n";
+	for (size_t i = 0; i < statements; ++i) {
+		std::string indent((i % 8 + 1) * 4, ' ');
+		const char *lhs = names[i % 8];
+		const char *rhs = names[(i * 3 + 1) % 8];
+		switch (i % 4) {
+		case 0:
+			source += indent + lhs + " := " + rhs + " + " + std::to_string(i) + ";\n";
+			break;
+		case 1:
+			source += indent + "print(\"The value of the accumulated distance is now: \", " + lhs + ");\n";
+			break;
+		case 2:
+			source += indent + lhs + " = '" + "A much longer string literal, which goes on for a while, "
+				"with an escape\\n in the middle of it and then keeps going' + " + rhs + ";\n";
+			break;
+		case 3:
+			source += "\t\t" + indent + "\n" + indent + lhs + "." + rhs + " = " + rhs + ";\n";
+			break;
+		}
+	}
+
+	source += "}\n";
+	return source;
+}
+
+int main(int argc, char **argv) {
+	if (argc > 3) {
+		std::cerr << "Usage: " << argv[0] << " [statements] [iterations]\n";
+		return 1;
+	}
+
+	size_t statements = argc >= 2 ? strtoul(argv[1], nullptr, 10) : 100000;
+	size_t iterations = argc == 3 ? strtoul(argv[2], nullptr, 10) : 20;
+	if (statements == 0 || iterations == 0) {
+		std::cerr << "Invalid number of statements or iterations\n";
+		return 1;
+	}
+
+	std::string source = synthesize(statements);
+	std::string_view view = source;
+
+	// Each scan starts where the lexer would start it: at the start of each
+	// run of whitespace or identifier characters outside strings, and at
+	// the start of each string's contents
+	std::vector<size_t> whitespaceStarts, identStarts, stringStarts;
+	char quote = 0;
+	for (size_t i = 0; i < source.size(); ++i) {
+		char ch = source[i];
+		char prev = i == 0 ? 0 : source[i - 1];
+		if (quote != 0) {
+			if (ch == '\\') {
+				i += 1;
+			} else if (ch == quote) {
+				quote = 0;
+			}
+		} else if (ch == '"') {
+			quote = ch;
+			stringStarts.push_back(i + 1);
+		} else if (ch == '\'') {
+			quote = ch;
+		} else if (scan::isWhitespace(ch) && !scan::isWhitespace(prev)) {
+			whitespaceStarts.push_back(i);
+		} else if (scan::isIdentChar(ch) && !scan::isIdentChar(prev)) {
+			identStarts.push_back(i);
+		}
+	}
+
+	// Keeps the scans from being optimized away
+	volatile size_t sink = 0;
+	auto scanAll = [&](const std::vector<size_t> &starts, auto &&func) {
+		return bench::measure(iterations, [&] {
+			for (size_t start: starts) {
+				sink += func(view, start);
+			}
+		});
+	};
+
+	double whitespacePortable = scanAll(whitespaceStarts, scan::whitespacePortable);
+	double whitespace = scanAll(whitespaceStarts, scan::whitespace);
+	double identPortable = scanAll(identStarts, scan::identPortable);
+	double ident = scanAll(identStarts, scan::ident);
+	auto stringPortable = [](std::string_view str, size_t idx) { return scan::stringPortable(str, idx, '"'); };
+	auto string = [](std::string_view str, size_t idx) { return scan::string(str, idx, '"'); };
+	double stringsPortable = scanAll(stringStarts, stringPortable);
+	double strings = scanAll(stringStarts, string);
+
+	size_t tokens = 0;
+	double lex = bench::measure(iterations, [&] {
+		fun::Lexer lexer(view);
+		tokens = 0;
+		while (lexer.kind() != fun::TokKind::E_O_F) {
+			lexer.consume();
+			tokens += 1;
+		}
+	});
+
+	// Eager tracking looks at every byte the lexer consumes, like the
+	// reader's readCh() did before the LineIndex
+	Location eager{0, 0};
+	double lexEager = bench::measure(iterations, [&] {
+		fun::Lexer lexer(view);
+		Location loc{0, 0};
+		size_t idx = 0;
+		while (lexer.kind() != fun::TokKind::E_O_F) {
+			lexer.consume();
+			for (size_t end = lexer.offset(); idx < end; ++idx) {
+				loc.column += 1;
+				if (view[idx] == '\n') {
+					loc.column = 0;
+					loc.line += 1;
+				}
+			}
+		}
+		eager = loc;
+	});
+
+	// Lazily, only an error pays for the index, once
+	double lexLazy = bench::measure(iterations, [&] {
+		fun::Lexer lexer(view);
+		while (lexer.kind() != fun::TokKind::E_O_F) {
+			lexer.consume();
+		}
+		Location loc = LineIndex(view).locate(lexer.offset());
+		sink += loc.line + loc.column;
+	});
+
+	std::vector<size_t> offsets;
+	fun::Lexer lexer(view);
+	while (lexer.kind() != fun::TokKind::E_O_F) {
+		lexer.consume();
+		offsets.push_back(lexer.offset());
+	}
+
+	double locateAll = bench::measure(iterations, [&] {
+		LineIndex index(view);
+		for (size_t offset: offsets) {
+			Location loc = index.locate(offset);
+			sink += loc.line + loc.column;
+		}
+	});
+
+	Location lazy = LineIndex(view).locate(offsets.empty() ? 0 : offsets.back());
+	if (lazy.line != eager.line || lazy.column != eager.column) {
+		std::cerr << "Eager and lazy tracking disagree: " << eager.line << ':' << eager.column
+			<< " against " << lazy.line << ':' << lazy.column << '\n';
+		return 1;
+	}
+
+	std::cout << source.size() << " bytes of synthetic FuN, " << tokens << " tokens, median of "
+		<< iterations << " runs\n";
+	bench::report("whitespace, portable", whitespacePortable);
+	bench::report("whitespace", whitespace, whitespacePortable);
+	bench::report("identifiers, portable", identPortable);
+	bench::report("identifiers", ident, identPortable);
+	bench::report("strings, portable", stringsPortable);
+	bench::report("strings", strings, stringsPortable);
+	bench::reportThroughput("lexing", lex, source.size());
+	std::cout << "Lines and columns:\n";
+	bench::report("lexing, tracking every byte", lexEager);
+	bench::report("lexing", lex, lexEager);
+	bench::report("lexing, then locating an error", lexLazy, lexEager);
+	bench::report("locating every token", locateAll);
+	return 0;
+}
@@ -0,0 +1,200 @@
+// Measure the FuN front end: scanning a document for its top-level blocks,
+// then lexing, and lexing and parsing, every FuN block, and parsing the
+// whole document on one thread and on several. Also counts the
+// allocations made by parsing, and times freeing the parsed trees. Then
+// parses a few synthetic expressions: very long chains of binary operators,
+// and deeply nested ones.
+// Usage: bench-parse <input file> [iterations]
+
+#include "lafun/parse.h"
+#include "fun/parse.h"
+#include "fun/Lexer.h"
+#include "Input.h"
+#include "Reader.h"
+#include "bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+
+#include <sys/resource.h>
+
+static std::atomic<size_t> allocations{0};
+static std::atomic<size_t> allocatedBytes{0};
+
+void *operator new(size_t size) {
+	allocations += 1;
+	allocatedBytes += size;
+	if (void *ptr = malloc(size)) {
+		return ptr;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	free(ptr);
+}
+
+// A function whose body is the given statement, repeated
+static std::string synthesize(const std::string &statm, size_t count) {
+	std::string source = "\\fun{f}{a}{\n";
+	for (size_t i = 0; i < count; ++i) {
+		source += statm;
+	}
+
+	source += "}";
+	return source;
+}
+
+static void reportSynthetic(const char *name, const std::string &source, size_t iterations) {
+	double ms = bench::measure(iterations, [&] {
+		fun::Lexer lexer(source);
+		Arena arena;
+		fun::ast::Declaration decl;
+		fun::parseDeclaration(lexer, arena, decl);
+	});
+
+	bench::reportThroughput(name, ms, source.size());
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		std::cerr << "Usage: " << argv[0] << " <input file> [iterations]\n";
+		return 1;
+	}
+
+	size_t iterations = argc == 3 ? strtoul(argv[2], nullptr, 10) : 20;
+	if (iterations == 0) {
+		std::cerr << "Invalid number of iterations: " << argv[2] << '\n';
+		return 1;
+	}
+
+	Input input;
+	if (!input.open(argv[1])) {
+		std::cerr << "Opening file " << argv[1] << " failed\n";
+		return 1;
+	}
+
+	std::string_view source = input.view();
+	std::vector<lafun::ast::FunBlock> blocks;
+	size_t funBytes = 0;
+	Reader reader{source};
+	lafun::ast::LafunBlock block;
+	while (lafun::scanLafunBlock(reader, block)) {
+		if (auto funBlock = std::get_if<lafun::ast::FunBlock>(&block)) {
+			funBytes += funBlock->range.end - funBlock->range.start;
+			blocks.push_back(std::move(*funBlock));
+		}
+	}
+
+	double scan = bench::measure(iterations, [&] {
+		Reader reader{source};
+		lafun::ast::LafunBlock block;
+		while (lafun::scanLafunBlock(reader, block)) {}
+	});
+
+	size_t tokens = 0;
+	double lex = bench::measure(iterations, [&] {
+		tokens = 0;
+		for (lafun::ast::FunBlock &funBlock: blocks) {
+			Reader reader{source};
+			reader.idx = funBlock.range.start;
+			fun::Lexer lexer(reader);
+			while (lexer.offset() < funBlock.range.end) {
+				lexer.consume();
+				tokens += 1;
+			}
+		}
+	});
+
+	double parse = bench::measure(iterations, [&] {
+		for (lafun::ast::FunBlock &funBlock: blocks) {
+			lafun::parseFunBlock(source, funBlock);
+		}
+	});
+
+	size_t threads = std::max(2u, std::thread::hardware_concurrency());
+	auto parseDocument = [&](size_t threads) {
+		return bench::measure(iterations, [&] {
+			Reader reader{source};
+			lafun::ast::LafunDocument document;
+			lafun::parseLafun(reader, document, threads);
+		});
+	};
+	double sequential = parseDocument(1);
+	double parallel = parseDocument(threads);
+
+	size_t allocationsBefore = allocations;
+	size_t bytesBefore = allocatedBytes;
+	for (lafun::ast::FunBlock &funBlock: blocks) {
+		lafun::parseFunBlock(source, funBlock);
+	}
+	size_t parseAllocations = allocations - allocationsBefore;
+	size_t parseBytes = allocatedBytes - bytesBefore;
+
+	// Freeing every tree at once, like the end of a compile
+	std::vector<double> times;
+	for (size_t i = 0; i < iterations; ++i) {
+		std::vector<lafun::ast::FunBlock> parsed(blocks.size());
+		for (size_t j = 0; j < blocks.size(); ++j) {
+			parsed[j].range = blocks[j].range;
+			lafun::parseFunBlock(source, parsed[j]);
+		}
+
+		auto start = bench::Clock::now();
+		parsed.clear();
+		times.push_back(bench::elapsed(start));
+	}
+	double teardown = bench::median(std::move(times));
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	std::cout << argv[1] << ": " << source.size() << " bytes, "
+		<< blocks.size() << " FuN blocks of " << funBytes << " bytes, median of "
+		<< iterations << " runs\n";
+	bench::reportThroughput("scanning the document", scan, source.size());
+	bench::reportThroughput("lexing the FuN blocks", lex, funBytes);
+	std::cout << "    " << tokens << " tokens\n";
+	bench::reportThroughput("lexing and parsing the FuN blocks", parse, funBytes);
+	std::cout << "    " << parseAllocations << " allocations of " << parseBytes << " bytes\n";
+	std::cout << "  freeing the parsed blocks: " << teardown << " ms\n";
+	bench::reportThroughput("parsing the document", sequential, source.size());
+	std::string name = "parsing the document on " + std::to_string(threads) + " threads";
+	bench::reportThroughput(name.c_str(), parallel, source.size());
+
+	// Kilobytes on Linux
+	std::cout << "  peak RSS: " << usage.ru_maxrss / 1024 << " MB\n";
+
+	// One expression with a million terms, then many nested 500 deep
+	std::string chain = "return a";
+	for (size_t i = 0; i < 1000000; ++i) {
+		chain += i % 3 == 0 ? " + a" : i % 3 == 1 ? " * 2" : " - a";
+	}
+	chain += ";\n";
+
+	std::string nested;
+	for (size_t i = 0; i < 500; ++i) {
+		nested += "a + (a * (";
+	}
+	nested += "a";
+	for (size_t i = 0; i < 500; ++i) {
+		nested += "))";
+	}
+	nested += ";\n";
+
+	std::cout << "Synthetic expressions:\n";
+	reportSynthetic("a million terms", synthesize(chain, 1), iterations);
+	reportSynthetic("nested 1000 deep", synthesize(nested, 200), iterations);
+	return 0;
+}
@@ -0,0 +1,349 @@
+// Compare passes over the regular syntax trees against the same passes over
+// their flattened copies: visiting every node, collecting the names the '@'
+// and '!' searches look for, and printing. Checks that both give the same
+// results first. Also compares visiting every node by recursion to doing it
+// with a walker, and resolving names then collecting them in a second walk
+// to doing both in one.
+// Usage: bench-traverse <input file> [iterations]
+
+#include "lafun/compile.h"
+#include "fun/flat.h"
+#include "fun/prelude.h"
+#include "fun/print.h"
+#include "fun/walk.h"
+#include "Input.h"
+#include "bench.h"
+#include "util.h"
+
+#include <array>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+using namespace fun::ast;
+namespace flat = fun::flat;
+
+// The number of nodes of each kind, and the sum of the number literals
+struct Counts {
+	std::array<size_t, flat::CODE_BLOCK + 1> kinds{};
+	double sum = 0;
+
+	bool operator==(const Counts &other) const { return kinds == other.kinds && sum == other.sum; }
+};
+
+static void count(const CodeBlock &block, Counts &counts);
+static void count(const Declaration &decl, Counts &counts);
+
+static void count(const Expression &expr, Counts &counts) {
+	std::visit(overloaded {
+		[&](const StringLiteralExpr &) { counts.kinds[flat::STRING_LITERAL] += 1; },
+		[&](const NumberLiteralExpr &num) {
+			counts.kinds[flat::NUMBER_LITERAL] += 1;
+			counts.sum += num.num;
+		},
+		[&](const IdentifierExpr &) { counts.kinds[flat::IDENTIFIER] += 1; },
+		[&](const BinaryExpr &bin) {
+			forEachInChain(bin,
+				[&](const Expression &lhs) { count(lhs, counts); },
+				[&](const BinaryExpr &inner) {
+					counts.kinds[flat::BINARY] += 1;
+					count(*inner.rhs, counts);
+				});
+		},
+		[&](const FuncCallExpr &call) {
+			counts.kinds[flat::FUNC_CALL] += 1;
+			count(*call.func, counts);
+			for (const Expression &arg: call.args) {
+				count(arg, counts);
+			}
+		},
+		[&](const AssignmentExpr &assignment) {
+			counts.kinds[flat::ASSIGNMENT] += 1;
+			count(*assignment.lhs, counts);
+			count(*assignment.rhs, counts);
+		},
+		[&](const DeclAssignmentExpr &assignment) {
+			counts.kinds[flat::DECL_ASSIGNMENT] += 1;
+			count(*assignment.rhs, counts);
+		},
+		[&](const LookupExpr &lookup) {
+			counts.kinds[flat::LOOKUP] += 1;
+			count(*lookup.lhs, counts);
+		},
+	}, expr);
+}
+
+static void count(const Statement &statm, Counts &counts) {
+	std::visit(overloaded {
+		[&](const Expression &expr) { count(expr, counts); },
+		[&](const IfStatm &ifStatm) {
+			counts.kinds[flat::IF] += 1;
+			count(ifStatm.condition, counts);
+			count(*ifStatm.ifBody, counts);
+			if (ifStatm.elseBody) {
+				count(*ifStatm.elseBody, counts);
+			}
+		},
+		[&](const WhileStatm &whileStatm) {
+			counts.kinds[flat::WHILE] += 1;
+			count(whileStatm.condition, counts);
+			count(*whileStatm.body, counts);
+		},
+		[&](const ReturnStatm &ret) {
+			counts.kinds[flat::RETURN] += 1;
+			count(ret.expr, counts);
+		},
+		[&](const Declaration &decl) { count(decl, counts); },
+	}, statm);
+}
+
+static void count(const CodeBlock &block, Counts &counts) {
+	counts.kinds[flat::CODE_BLOCK] += 1;
+	for (const Statement &statm: block.statms) {
+		count(statm, counts);
+	}
+}
+
+static void count(const Declaration &decl, Counts &counts) {
+	std::visit(overloaded {
+		[&](const ClassDecl &classDecl) {
+			counts.kinds[flat::CLASS_DECL] += 1;
+			count(*classDecl.body, counts);
+		},
+		[&](const FuncDecl &funcDecl) {
+			counts.kinds[flat::FUNC_DECL] += 1;
+			count(*funcDecl.body, counts);
+		},
+		[&](const MethodDecl &methodDecl) {
+			counts.kinds[flat::METHOD_DECL] += 1;
+			count(*methodDecl.body, counts);
+		},
+	}, decl);
+}
+
+// The same, with a walker instead of recursion
+class CountPass: public fun::walk::Pass {
+public:
+	using fun::walk::Pass::enter;
+
+	CountPass(Counts &counts): counts_(counts) {}
+
+	void enter(const StringLiteralExpr &) { counts_.kinds[flat::STRING_LITERAL] += 1; }
+
+	void enter(const NumberLiteralExpr &num) {
+		counts_.kinds[flat::NUMBER_LITERAL] += 1;
+		counts_.sum += num.num;
+	}
+
+	void enter(const IdentifierExpr &) { counts_.kinds[flat::IDENTIFIER] += 1; }
+	void enter(const BinaryExpr &) { counts_.kinds[flat::BINARY] += 1; }
+	void enter(const FuncCallExpr &) { counts_.kinds[flat::FUNC_CALL] += 1; }
+	void enter(const AssignmentExpr &) { counts_.kinds[flat::ASSIGNMENT] += 1; }
+	void enter(const DeclAssignmentExpr &) { counts_.kinds[flat::DECL_ASSIGNMENT] += 1; }
+	void enter(const LookupExpr &) { counts_.kinds[flat::LOOKUP] += 1; }
+	void enter(const IfStatm &) { counts_.kinds[flat::IF] += 1; }
+	void enter(const WhileStatm &) { counts_.kinds[flat::WHILE] += 1; }
+	void enter(const ReturnStatm &) { counts_.kinds[flat::RETURN] += 1; }
+	void enter(const CodeBlock &) { counts_.kinds[flat::CODE_BLOCK] += 1; }
+	void enter(const ClassDecl &) { counts_.kinds[flat::CLASS_DECL] += 1; }
+	void enter(const FuncDecl &) { counts_.kinds[flat::FUNC_DECL] += 1; }
+	void enter(const MethodDecl &) { counts_.kinds[flat::METHOD_DECL] += 1; }
+
+private:
+	Counts &counts_;
+};
+
+// The flat tree needs no recursion: every node is in one array
+static void count(const flat::Tree &tree, Counts &counts) {
+	for (const flat::Node &node: tree.nodes) {
+		counts.kinds[node.kind] += 1;
+		if (node.kind == flat::NUMBER_LITERAL) {
+			counts.sum += tree.numbers[node.value];
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		std::cerr << "Usage: " << argv[0] << " <input file> [iterations]\n";
+		return 1;
+	}
+
+	size_t iterations = argc == 3 ? strtoul(argv[2], nullptr, 10) : 20;
+	if (iterations == 0) {
+		std::cerr << "Invalid number of iterations: " << argv[2] << '\n';
+		return 1;
+	}
+
+	Input input;
+	if (!input.open(argv[1])) {
+		std::cerr << "Opening file " << argv[1] << " failed\n";
+		return 1;
+	}
+
+	std::string_view source = input.view();
+	lafun::ast::LafunDocument document;
+	lafun::analyze(source, document);
+
+	std::vector<Declaration *> decls;
+	size_t arenaBytes = 0;
+	for (lafun::ast::LafunBlock &block: document.blocks) {
+		if (auto funBlock = std::get_if<lafun::ast::FunBlock>(&block)) {
+			decls.push_back(&funBlock->decl);
+			arenaBytes += funBlock->arena.capacity();
+		}
+	}
+
+	flat::Tree tree;
+	for (const Declaration *decl: decls) {
+		flat::flatten(*decl, tree);
+	}
+
+	Counts treeCounts, walkCounts, flatCounts;
+	CountPass countPass(walkCounts);
+	for (const Declaration *decl: decls) {
+		count(*decl, treeCounts);
+		fun::walk::walk(*decl, countPass);
+	}
+	count(tree, flatCounts);
+
+	std::ostringstream treeOut, flatOut;
+	for (size_t i = 0; i < decls.size(); ++i) {
+		fun::printDeclaration(treeOut, *decls[i]);
+		fun::printDeclaration(flatOut, tree, tree.decls[i]);
+
+		fun::DeclNames treeNames, flatNames;
+		fun::collectNamesInDecl(*decls[i], treeNames);
+		flat::collectNames(tree, tree.decls[i], flatNames);
+		if (treeNames != flatNames) {
+			std::cerr << "The flattened trees have different names\n";
+			return 1;
+		}
+	}
+
+	if (!(treeCounts == walkCounts)) {
+		std::cerr << "The walker visits different nodes\n";
+		return 1;
+	}
+
+	if (!(treeCounts == flatCounts) || treeOut.str() != flatOut.str()) {
+		std::cerr << "The flattened trees differ from the regular ones\n";
+		return 1;
+	}
+
+	double flatten = bench::measure(iterations, [&] {
+		flat::Tree tree;
+		for (const Declaration *decl: decls) {
+			flat::flatten(*decl, tree);
+		}
+	});
+
+	double treeCount = bench::measure(iterations, [&] {
+		Counts counts;
+		for (const Declaration *decl: decls) {
+			count(*decl, counts);
+		}
+		treeCounts = counts;
+	});
+
+	double walkCount = bench::measure(iterations, [&] {
+		Counts counts;
+		CountPass pass(counts);
+		fun::walk::Walker<true> walker;
+		for (const Declaration *decl: decls) {
+			walker(*decl, pass);
+		}
+		walkCounts = counts;
+	});
+
+	double flatCount = bench::measure(iterations, [&] {
+		Counts counts;
+		count(tree, counts);
+		flatCounts = counts;
+	});
+
+	size_t names = 0;
+	double treeNames = bench::measure(iterations, [&] {
+		names = 0;
+		for (const Declaration *decl: decls) {
+			fun::DeclNames declNames;
+			fun::collectNamesInDecl(*decl, declNames);
+			names += declNames.size();
+		}
+	});
+
+	double flatNames = bench::measure(iterations, [&] {
+		names = 0;
+		for (const flat::Decl &decl: tree.decls) {
+			fun::DeclNames declNames;
+			flat::collectNames(tree, decl, declNames);
+			names += declNames.size();
+		}
+	});
+
+	// Names are resolved again on every run, which gives them the same ids
+	auto resolve = [&](std::vector<const Identifier *> *targets) {
+		fun::IdentResolver resolver;
+		resolver.addBuiltins(fun::preludeNameSet);
+		for (Declaration *decl: decls) {
+			resolver.add(decl);
+		}
+		resolver.finalize(targets);
+	};
+
+	double separateNames = bench::measure(iterations, [&] {
+		resolve(nullptr);
+		names = 0;
+		for (const Declaration *decl: decls) {
+			fun::DeclNames declNames;
+			fun::collectNamesInDecl(*decl, declNames);
+			names += declNames.size();
+		}
+	});
+
+	double fusedNames = bench::measure(iterations, [&] {
+		std::vector<const Identifier *> targets;
+		resolve(&targets);
+		names = targets.size();
+	});
+
+	double treePrint = bench::measure(iterations, [&] {
+		std::ostringstream os;
+		for (const Declaration *decl: decls) {
+			fun::printDeclaration(os, *decl);
+		}
+	});
+
+	double flatPrint = bench::measure(iterations, [&] {
+		std::ostringstream os;
+		for (const flat::Decl &decl: tree.decls) {
+			fun::printDeclaration(os, tree, decl);
+		}
+	});
+
+	size_t nodes = 0;
+	for (size_t kind: flatCounts.kinds) {
+		nodes += kind;
+	}
+
+	std::cout << argv[1] << ": " << source.size() << " bytes, " << decls.size() << " declarations, "
+		<< nodes << " nodes, median of " << iterations << " runs\n";
+	std::cout << "  arenas: " << arenaBytes << " bytes, flattened: " << tree.bytes() << " bytes\n";
+	bench::report("flattening", flatten);
+	std::cout << "Visiting every node:\n";
+	bench::report("tree", treeCount);
+	bench::report("walker", walkCount, treeCount);
+	bench::report("flat", flatCount, treeCount);
+	std::cout << "Collecting names:\n";
+	bench::report("tree", treeNames);
+	bench::report("flat", flatNames, treeNames);
+	std::cout << "Resolving and collecting names:\n";
+	bench::report("separate walks", separateNames);
+	bench::report("one walk", fusedNames, separateNames);
+	std::cout << "Printing:\n";
+	bench::report("tree", treePrint);
+	bench::report("flat", flatPrint, treePrint);
+	return 0;
+}
@@ -0,0 +1,26 @@
+#include "Arena.h"
+
+#include <algorithm>
+
+void *Arena::allocateSlow(size_t size, size_t) {
+	// A fresh chunk is aligned for anything the arena holds
+	size_t capacity = std::clamp(capacity_ / 2, MIN_CHUNK, MAX_CHUNK);
+
+	// Objects bigger than a chunk get a chunk of their own, and leave the
+	// current chunk's space for what comes after them
+	if (size > capacity) {
+		Chunk chunk{std::unique_ptr<char[]>(new char[size]), size};
+		capacity_ += size;
+		void *data = chunk.data.get();
+		chunks_.insert(chunks_.empty() ? chunks_.end() : chunks_.end() - 1, std::move(chunk));
+		return data;
+	}
+
+	Chunk &chunk = chunks_.emplace_back();
+	chunk.data.reset(new char[capacity]);
+	chunk.capacity = capacity;
+	capacity_ += capacity;
+	pos_ = chunk.data.get() + size;
+	end_ = chunk.data.get() + capacity;
+	return chunk.data.get();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// A bump allocator for objects which never need destroying. Objects are
+// carved out of chunks which are never moved once allocated, and are all
+// freed at once with the arena. Moving an arena leaves everything in it
+// where it is.
+class Arena {
+public:
+	Arena() = default;
+	Arena(Arena &&) = default;
+	Arena &operator=(Arena &&) = default;
+
+	template<typename T, typename... Args>
+	T *make(Args &&...args) {
+		static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+		static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+		return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	// Default-construct count objects next to each other
+	template<typename T>
+	T *makeArray(size_t count) {
+		static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+		static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+		if (count == 0) {
+			return nullptr;
+		}
+
+		T *items = static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+		for (size_t i = 0; i < count; ++i) {
+			new (items + i) T();
+		}
+
+		return items;
+	}
+
+	// Copy count objects into the arena
+	template<typename T>
+	T *copy(const T *data, size_t count) {
+		static_assert(std::is_trivially_copyable_v<T>, "arena objects are copied with memcpy");
+		static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+		if (count == 0) {
+			return nullptr;
+		}
+
+		T *items = static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+		memcpy(static_cast<void *>(items), data, sizeof(T) * count);
+		return items;
+	}
+
+	std::string_view copy(std::string_view str) {
+		return {copy(str.data(), str.size()), str.size()};
+	}
+
+	// Bytes allocated from the system, for measuring
+	size_t capacity() const { return capacity_; }
+
+private:
+	void *allocate(size_t size, size_t align) {
+		uintptr_t pos = (reinterpret_cast<uintptr_t>(pos_) + align - 1) & ~(uintptr_t)(align - 1);
+		if (pos + size <= reinterpret_cast<uintptr_t>(end_)) {
+			pos_ = reinterpret_cast<char *>(pos + size);
+			return reinterpret_cast<void *>(pos);
+		}
+
+		return allocateSlow(size, align);
+	}
+
+	void *allocateSlow(size_t size, size_t align);
+
+	struct Chunk {
+		std::unique_ptr<char[]> data;
+		size_t capacity;
+	};
+
+	// Each chunk is half the size of the ones before it put together, so
+	// at most about a third of the arena is left unused. Most declarations
+	// are small, and fit in a few of the smallest chunks.
+	static constexpr size_t MIN_CHUNK = 512;
+	static constexpr size_t MAX_CHUNK = 64 * 1024;
+
+	std::vector<Chunk> chunks_;
+	size_t capacity_ = 0;
+	char *pos_ = nullptr;
+	char *end_ = nullptr;
+};
@@ -0,0 +1,110 @@
+#include "Input.h"
+
+#include <utility>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+Input &Input::operator=(Input &&other) noexcept {
+	if (this != &other) {
+		close();
+		map_ = std::exchange(other.map_, nullptr);
+		mapSize_ = std::exchange(other.mapSize_, 0);
+		buffer_ = std::exchange(other.buffer_, nullptr);
+		view_ = std::exchange(other.view_, {});
+	}
+
+	return *this;
+}
+
+bool Input::open(const char *path, bool allowMap) {
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+
+	bool ok = openFd(fd, allowMap);
+	int err = errno;
+	::close(fd);
+	errno = err;
+	return ok;
+}
+
+bool Input::openFd(int fd, bool allowMap) {
+	close();
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		return false;
+	}
+
+	if (allowMap && S_ISREG(st.st_mode)) {
+		if (st.st_size == 0) {
+			return true;
+		}
+
+		void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			map_ = map;
+			mapSize_ = st.st_size;
+			view_ = std::string_view((const char *)map, mapSize_);
+			return true;
+		}
+
+		// Some regular files (e.g on special file systems) can't be mapped;
+		// fall through and read them like a pipe
+	}
+
+	size_t size = 0;
+	size_t cap = 64 * 1024;
+	char *buf = (char *)malloc(cap);
+	if (!buf) {
+		return false;
+	}
+
+	while (true) {
+		if (size == cap) {
+			cap *= 2;
+			char *newBuf = (char *)realloc(buf, cap);
+			if (!newBuf) {
+				free(buf);
+				return false;
+			}
+			buf = newBuf;
+		}
+
+		ssize_t n = read(fd, buf + size, cap - size);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			free(buf);
+			return false;
+		} else if (n == 0) {
+			break;
+		}
+
+		size += n;
+	}
+
+	buffer_ = buf;
+	view_ = std::string_view(buffer_, size);
+	return true;
+}
+
+void Input::close() {
+	if (map_) {
+		munmap(map_, mapSize_);
+		map_ = nullptr;
+		mapSize_ = 0;
+	}
+
+	free(buffer_);
+	buffer_ = nullptr;
+	view_ = {};
+}
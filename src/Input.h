@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+
+// The bytes of an input document. Regular files are memory mapped,
+// anything else (pipes, stdin) is read into one growing buffer.
+// Either way, the contents are exposed as a string_view without
+// any further copies.
+class Input {
+public:
+	Input() = default;
+	Input(Input &&other) noexcept { *this = std::move(other); }
+	Input &operator=(Input &&other) noexcept;
+	~Input() { close(); }
+
+	// With allowMap set to false, the file is always read into memory.
+	// Use that for inputs which are kept around while the file may change.
+	bool open(const char *path, bool allowMap = true);
+	bool openFd(int fd, bool allowMap = true);
+	void close();
+
+	std::string_view view() const { return view_; }
+
+private:
+	void *map_ = nullptr;
+	size_t mapSize_ = 0;
+	char *buffer_ = nullptr;
+	std::string_view view_;
+};
@@ -0,0 +1,378 @@
+#include "Json.h"
+
+#include <sstream>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static const std::string emptyString;
+static const Json::Array emptyArray;
+static const Json::Object emptyObject;
+static const Json nullJson;
+
+bool Json::asBool() const {
+	if (auto b = std::get_if<bool>(&value_)) {
+		return *b;
+	}
+
+	return false;
+}
+
+double Json::asNumber() const {
+	if (auto num = std::get_if<double>(&value_)) {
+		return *num;
+	}
+
+	return 0;
+}
+
+const std::string &Json::asString() const {
+	if (auto str = std::get_if<std::string>(&value_)) {
+		return *str;
+	}
+
+	return emptyString;
+}
+
+const Json::Array &Json::asArray() const {
+	if (auto arr = std::get_if<Array>(&value_)) {
+		return *arr;
+	}
+
+	return emptyArray;
+}
+
+const Json::Object &Json::asObject() const {
+	if (auto obj = std::get_if<Object>(&value_)) {
+		return *obj;
+	}
+
+	return emptyObject;
+}
+
+const Json &Json::operator[](std::string_view key) const {
+	for (auto &[name, value]: asObject()) {
+		if (name == key) {
+			return value;
+		}
+	}
+
+	return nullJson;
+}
+
+void Json::set(std::string key, Json value) {
+	if (isNull()) {
+		value_ = Object();
+	}
+
+	std::get<Object>(value_).emplace_back(std::move(key), std::move(value));
+}
+
+static void writeString(std::ostream &os, const std::string &str) {
+	os << '"';
+	for (char ch: str) {
+		if (ch == '"' || ch == '\\') {
+			os << '\\' << ch;
+		} else if (ch == '\n') {
+			os << "\\n";
+		} else if (ch == '\r') {
+			os << "\\r";
+		} else if (ch == '\t') {
+			os << "\\t";
+		} else if ((unsigned char)ch < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)ch);
+			os << buf;
+		} else {
+			os << ch;
+		}
+	}
+	os << '"';
+}
+
+void Json::write(std::ostream &os) const {
+	std::visit([&](auto &&value) {
+		using T = std::decay_t<decltype(value)>;
+		if constexpr (std::is_same_v<T, std::nullptr_t>) {
+			os << "null";
+		} else if constexpr (std::is_same_v<T, bool>) {
+			os << (value ? "true" : "false");
+		} else if constexpr (std::is_same_v<T, double>) {
+			char buf[32];
+			if (!std::isfinite(value)) {
+				snprintf(buf, sizeof(buf), "null");
+			} else if (value == std::trunc(value) && std::abs(value) < 1e15) {
+				snprintf(buf, sizeof(buf), "%lld", (long long)value);
+			} else {
+				snprintf(buf, sizeof(buf), "%.17g", value);
+			}
+			os << buf;
+		} else if constexpr (std::is_same_v<T, std::string>) {
+			writeString(os, value);
+		} else if constexpr (std::is_same_v<T, Array>) {
+			os << '[';
+			for (size_t i = 0; i < value.size(); ++i) {
+				if (i != 0) {
+					os << ',';
+				}
+				value[i].write(os);
+			}
+			os << ']';
+		} else {
+			os << '{';
+			for (size_t i = 0; i < value.size(); ++i) {
+				if (i != 0) {
+					os << ',';
+				}
+				writeString(os, value[i].first);
+				os << ':';
+				value[i].second.write(os);
+			}
+			os << '}';
+		}
+	}, value_);
+}
+
+std::string Json::toString() const {
+	std::ostringstream os;
+	write(os);
+	return os.str();
+}
+
+namespace {
+
+class JsonParser {
+public:
+	JsonParser(std::string_view str): str_(str) {}
+
+	Json parseDocument() {
+		Json value = parseValue(0);
+		skipSpace();
+		if (idx_ != str_.size()) {
+			fail("Trailing data after value");
+		}
+
+		return value;
+	}
+
+private:
+	static constexpr int MAX_DEPTH = 256;
+
+	[[noreturn]] void fail(std::string message) {
+		throw JsonError(idx_, std::move(message));
+	}
+
+	void skipSpace() {
+		while (idx_ < str_.size() && (
+				str_[idx_] == ' ' || str_[idx_] == '\t' ||
+				str_[idx_] == '\n' || str_[idx_] == '\r')) {
+			idx_ += 1;
+		}
+	}
+
+	void expect(char ch) {
+		skipSpace();
+		if (idx_ >= str_.size() || str_[idx_] != ch) {
+			fail(std::string("Expected '") + ch + "'");
+		}
+
+		idx_ += 1;
+	}
+
+	bool consume(std::string_view word) {
+		if (str_.substr(idx_, word.size()) == word) {
+			idx_ += word.size();
+			return true;
+		}
+
+		return false;
+	}
+
+	Json parseValue(int depth) {
+		if (depth > MAX_DEPTH) {
+			fail("Nested too deeply");
+		}
+
+		skipSpace();
+		if (idx_ >= str_.size()) {
+			fail("Unexpected end of input");
+		}
+
+		char ch = str_[idx_];
+		if (ch == '{') {
+			idx_ += 1;
+			Json::Object obj;
+			skipSpace();
+			if (idx_ < str_.size() && str_[idx_] == '}') {
+				idx_ += 1;
+				return obj;
+			}
+
+			while (true) {
+				skipSpace();
+				std::string key = parseString();
+				expect(':');
+				obj.emplace_back(std::move(key), parseValue(depth + 1));
+				skipSpace();
+				if (idx_ < str_.size() && str_[idx_] == ',') {
+					idx_ += 1;
+				} else {
+					expect('}');
+					return obj;
+				}
+			}
+		} else if (ch == '[') {
+			idx_ += 1;
+			Json::Array arr;
+			skipSpace();
+			if (idx_ < str_.size() && str_[idx_] == ']') {
+				idx_ += 1;
+				return arr;
+			}
+
+			while (true) {
+				arr.push_back(parseValue(depth + 1));
+				skipSpace();
+				if (idx_ < str_.size() && str_[idx_] == ',') {
+					idx_ += 1;
+				} else {
+					expect(']');
+					return arr;
+				}
+			}
+		} else if (ch == '"') {
+			return parseString();
+		} else if (consume("true")) {
+			return true;
+		} else if (consume("false")) {
+			return false;
+		} else if (consume("null")) {
+			return nullptr;
+		} else if (ch == '-' || (ch >= '0' && ch <= '9')) {
+			return parseNumber();
+		}
+
+		fail(std::string("Unexpected character '") + ch + "'");
+	}
+
+	double parseNumber() {
+		size_t start = idx_;
+		while (idx_ < str_.size() && str_[idx_] != '\0' && strchr("+-0123456789.eE", str_[idx_])) {
+			idx_ += 1;
+		}
+
+		std::string num(str_.substr(start, idx_ - start));
+		char *end;
+		double value = strtod(num.c_str(), &end);
+		if (*end != '\0') {
+			idx_ = start;
+			fail("Invalid number");
+		}
+
+		return value;
+	}
+
+	unsigned parseHex4() {
+		if (idx_ + 4 > str_.size()) {
+			fail("Unterminated escape");
+		}
+
+		unsigned value = 0;
+		for (int i = 0; i < 4; ++i) {
+			char ch = str_[idx_++];
+			value <<= 4;
+			if (ch >= '0' && ch <= '9') {
+				value |= ch - '0';
+			} else if (ch >= 'a' && ch <= 'f') {
+				value |= ch - 'a' + 10;
+			} else if (ch >= 'A' && ch <= 'F') {
+				value |= ch - 'A' + 10;
+			} else {
+				fail("Invalid escape");
+			}
+		}
+
+		return value;
+	}
+
+	static void appendUtf8(std::string &str, unsigned cp) {
+		if (cp < 0x80) {
+			str += (char)cp;
+		} else if (cp < 0x800) {
+			str += (char)(0xc0 | (cp >> 6));
+			str += (char)(0x80 | (cp & 0x3f));
+		} else if (cp < 0x10000) {
+			str += (char)(0xe0 | (cp >> 12));
+			str += (char)(0x80 | ((cp >> 6) & 0x3f));
+			str += (char)(0x80 | (cp & 0x3f));
+		} else {
+			str += (char)(0xf0 | (cp >> 18));
+			str += (char)(0x80 | ((cp >> 12) & 0x3f));
+			str += (char)(0x80 | ((cp >> 6) & 0x3f));
+			str += (char)(0x80 | (cp & 0x3f));
+		}
+	}
+
+	std::string parseString() {
+		if (idx_ >= str_.size() || str_[idx_] != '"') {
+			fail("Expected string");
+		}
+
+		idx_ += 1;
+		std::string str;
+		while (true) {
+			if (idx_ >= str_.size()) {
+				fail("Unterminated string");
+			}
+
+			char ch = str_[idx_++];
+			if (ch == '"') {
+				return str;
+			} else if (ch != '\\') {
+				str += ch;
+				continue;
+			}
+
+			if (idx_ >= str_.size()) {
+				fail("Unterminated string");
+			}
+
+			ch = str_[idx_++];
+			switch (ch) {
+			case '"': case '\\': case '/': str += ch; break;
+			case 'b': str += '\b'; break;
+			case 'f': str += '\f'; break;
+			case 'n': str += '\n'; break;
+			case 'r': str += '\r'; break;
+			case 't': str += '\t'; break;
+			case 'u': {
+				unsigned cp = parseHex4();
+				if (cp >= 0xd800 && cp < 0xdc00 && consume("\\u")) {
+					unsigned low = parseHex4();
+					if (low >= 0xdc00 && low < 0xe000) {
+						cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+					} else {
+						appendUtf8(str, cp);
+						cp = low;
+					}
+				}
+
+				appendUtf8(str, cp);
+				break;
+			}
+			default:
+				fail("Invalid escape");
+			}
+		}
+	}
+
+	std::string_view str_;
+	size_t idx_ = 0;
+};
+
+}
+
+Json Json::parse(std::string_view str) {
+	return JsonParser(str).parseDocument();
+}
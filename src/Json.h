@@ -0,0 +1,71 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <cstddef>
+
+struct JsonError: public std::exception {
+	JsonError(size_t offset, std::string message): offset(offset) {
+		error = std::to_string(offset);
+		error += ": ";
+		error += message;
+	}
+
+	size_t offset;
+	std::string error;
+
+	const char *what() const noexcept override { return error.c_str(); }
+};
+
+// A JSON value. Objects keep their members in order, and are searched
+// linearly, since they're small in everything we deal with.
+class Json {
+public:
+	using Array = std::vector<Json>;
+	using Object = std::vector<std::pair<std::string, Json>>;
+
+	Json() = default;
+	Json(std::nullptr_t) {}
+	Json(bool b): value_(b) {}
+	Json(int num): value_((double)num) {}
+	Json(long num): value_((double)num) {}
+	Json(unsigned long num): value_((double)num) {}
+	Json(double num): value_(num) {}
+	Json(const char *str): value_(std::string(str)) {}
+	Json(std::string str): value_(std::move(str)) {}
+	Json(std::string_view str): value_(std::string(str)) {}
+	Json(Array arr): value_(std::move(arr)) {}
+	Json(Object obj): value_(std::move(obj)) {}
+
+	bool isNull() const { return std::holds_alternative<std::nullptr_t>(value_); }
+	bool isBool() const { return std::holds_alternative<bool>(value_); }
+	bool isNumber() const { return std::holds_alternative<double>(value_); }
+	bool isString() const { return std::holds_alternative<std::string>(value_); }
+	bool isArray() const { return std::holds_alternative<Array>(value_); }
+	bool isObject() const { return std::holds_alternative<Object>(value_); }
+
+	// These return a default value if the value has some other type
+	bool asBool() const;
+	double asNumber() const;
+	const std::string &asString() const;
+	const Array &asArray() const;
+	const Object &asObject() const;
+
+	// Member lookup, which gives null for missing members and non-objects
+	const Json &operator[](std::string_view key) const;
+
+	// Add a member to an object, replacing a null value with an empty object
+	void set(std::string key, Json value);
+
+	void write(std::ostream &os) const;
+	std::string toString() const;
+
+	static Json parse(std::string_view str);
+
+private:
+	std::variant<std::nullptr_t, bool, double, std::string, Array, Object> value_;
+};
@@ -0,0 +1,48 @@
+#include "LineIndex.h"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+LineIndex::LineIndex(std::string_view string): size_(string.size()) {
+	const char *data = string.data();
+	size_t size = string.size();
+	size_t idx = 0;
+
+#ifdef __SSE2__
+	const __m128i newline = _mm_set1_epi8('\n');
+	for (; idx + 16 <= size; idx += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(data + idx));
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+		while (mask) {
+			newlines_.push_back(idx + __builtin_ctz(mask));
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	for (; idx < size; ++idx) {
+		if (data[idx] == '\n') {
+			newlines_.push_back(idx);
+		}
+	}
+}
+
+Location LineIndex::locate(size_t offset) const {
+	auto it = std::lower_bound(newlines_.begin(), newlines_.end(), offset);
+	int line = it - newlines_.begin();
+	size_t start = line == 0 ? 0 : newlines_[line - 1] + 1;
+	return {line, (int)(offset - start)};
+}
+
+size_t LineIndex::lineStart(int line) const {
+	if (line <= 0) {
+		return 0;
+	} else if ((size_t)line > newlines_.size()) {
+		return size_;
+	}
+
+	return newlines_[line - 1] + 1;
+}
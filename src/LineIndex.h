@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+struct Location {
+	int line;
+	int column;
+};
+
+// The offset of every newline in a document, so that line and column
+// numbers only have to be computed when something needs to report them.
+class LineIndex {
+public:
+	LineIndex(std::string_view string);
+
+	// Lines and columns both count from zero;
+	// the column is the number of bytes since the start of the line
+	Location locate(size_t offset) const;
+
+	// The offset of the start of a line, clamped to the end of the document
+	size_t lineStart(int line) const;
+
+	size_t lineCount() const { return newlines_.size() + 1; }
+
+private:
+	std::vector<size_t> newlines_;
+	size_t size_;
+};
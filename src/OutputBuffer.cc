@@ -0,0 +1,86 @@
+#include "OutputBuffer.h"
+
+#include <algorithm>
+#include <charconv>
+
+void OutputBuffer::appendSlow(const char *data, size_t len) {
+	if (len == 0) {
+		return;
+	} else if (avail_ > 0) {
+		memcpy(pos_, data, avail_);
+		data += avail_;
+		len -= avail_;
+	}
+
+	size_t capacity = chunks_.empty() ? MIN_CHUNK : std::min(chunks_.back().capacity * 2, MAX_CHUNK);
+	capacity = std::max(capacity, len);
+
+	Chunk &chunk = chunks_.emplace_back();
+	chunk.data = std::make_unique<char[]>(capacity);
+	chunk.capacity = capacity;
+
+	memcpy(chunk.data.get(), data, len);
+	pos_ = chunk.data.get() + len;
+	avail_ = capacity - len;
+}
+
+void OutputBuffer::appendSigned(long long num) {
+	if (num < 0) {
+		append("-", 1);
+		appendUnsigned(-(unsigned long long)num);
+	} else {
+		appendUnsigned(num);
+	}
+}
+
+void OutputBuffer::appendUnsigned(unsigned long long num) {
+	char buf[20];
+	char *end = buf + sizeof(buf);
+	char *start = end;
+	do {
+		*--start = '0' + num % 10;
+		num /= 10;
+	} while (num != 0);
+
+	append(start, end - start);
+}
+
+OutputBuffer &OutputBuffer::operator<<(double num) {
+	char buf[32];
+	auto result = std::to_chars(buf, buf + sizeof(buf), num);
+	append(buf, result.ptr - buf);
+	return *this;
+}
+
+size_t OutputBuffer::size() const {
+	size_t size = 0;
+	for (const Chunk &chunk: chunks_) {
+		size += chunk.capacity;
+	}
+
+	return size - avail_;
+}
+
+std::string OutputBuffer::str() const {
+	std::string str;
+	str.reserve(size());
+	for (size_t i = 0; i < chunks_.size(); ++i) {
+		size_t len = i + 1 == chunks_.size() ? chunks_[i].capacity - avail_ : chunks_[i].capacity;
+		str.append(chunks_[i].data.get(), len);
+	}
+
+	return str;
+}
+
+void OutputBuffer::clear() {
+	chunks_.clear();
+	pos_ = nullptr;
+	avail_ = 0;
+}
+
+void OutputBuffer::writeTo(std::ostream &os) const {
+	for (size_t i = 0; i < chunks_.size(); ++i) {
+		size_t len = i + 1 == chunks_.size() ? chunks_[i].capacity - avail_ : chunks_[i].capacity;
+		os.write(chunks_[i].data.get(), len);
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+
+// Generated output, kept in a list of chunks which are never moved once
+// written. Appending is a bounds check and a memcpy, much cheaper than
+// going through a std::ostream, and the result is written out with one
+// large write per chunk. The code generators write into these, so that
+// each backend can run on its own thread, and the outputs are written
+// in order afterwards.
+class OutputBuffer {
+public:
+	OutputBuffer() = default;
+	OutputBuffer(OutputBuffer &&) = default;
+	OutputBuffer &operator=(OutputBuffer &&) = default;
+
+	void append(const char *data, size_t len) {
+		if (len <= avail_ && len != 0) {
+			memcpy(pos_, data, len);
+			pos_ += len;
+			avail_ -= len;
+		} else {
+			appendSlow(data, len);
+		}
+	}
+
+	OutputBuffer &operator<<(std::string_view str) {
+		append(str.data(), str.size());
+		return *this;
+	}
+
+	OutputBuffer &operator<<(char ch) {
+		append(&ch, 1);
+		return *this;
+	}
+
+	// Formatted like std::ostream formats them by default
+	template<typename Int, typename = std::enable_if_t<
+			std::is_integral_v<Int> && !std::is_same_v<Int, char> &&
+			!std::is_same_v<Int, signed char> && !std::is_same_v<Int, unsigned char>>>
+	OutputBuffer &operator<<(Int num) {
+		if constexpr (std::is_signed_v<Int>) {
+			appendSigned(num);
+		} else {
+			appendUnsigned(num);
+		}
+
+		return *this;
+	}
+
+	// The shortest form which reads back as the same double
+	OutputBuffer &operator<<(double num);
+
+	size_t size() const;
+	bool empty() const { return size() == 0; }
+	std::string str() const;
+	void clear();
+
+	void writeTo(std::ostream &os) const;
+
+private:
+	void appendSlow(const char *data, size_t len);
+	void appendSigned(long long num);
+	void appendUnsigned(unsigned long long num);
+
+	// Every chunk but the last is full
+	struct Chunk {
+		std::unique_ptr<char[]> data;
+		size_t capacity;
+	};
+
+	// Small outputs stay small; big ones get big chunks
+	static constexpr size_t MIN_CHUNK = 1024;
+	static constexpr size_t MAX_CHUNK = 256 * 1024;
+
+	std::vector<Chunk> chunks_;
+	char *pos_ = nullptr;
+	size_t avail_ = 0;
+};
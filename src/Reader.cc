@@ -2,8 +2,6 @@
 
 void Reader::reset() {
 	idx = 0;
-	line = 0;
-	column = 0;
 }
 
 int Reader::readCh() {
@@ -11,14 +9,7 @@ int Reader::readCh() {
 		return EOF;
 	}
 
-	char ch = string_[idx++];
-	column += 1;
-	if (ch == '\n') {
-		column = 0;
-		line += 1;
-	}
-
-	return ch;
+	return string_[idx++];
 }
 
 int Reader::peekCh(size_t n) const {
@@ -28,3 +19,11 @@ int Reader::peekCh(size_t n) const {
 
 	return string_[idx + n];
 }
+
+Location Reader::location(size_t offset) const {
+	if (!lineIndex_) {
+		lineIndex_ = std::make_shared<LineIndex>(string_);
+	}
+
+	return lineIndex_->locate(offset);
+}
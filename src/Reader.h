@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string>
+#include <memory>
+
+#include "LineIndex.h"
 
 class Reader {
 public:
@@ -10,10 +13,15 @@ public:
 	int readCh();
 	int peekCh(size_t n) const;
 
+	// Line and column of a byte offset. The line index is built on first
+	// use, and shared with any copies of the reader made after that.
+	Location location(size_t offset) const;
+
+	std::string_view string() const { return string_; }
+
 	size_t idx = 0;
-	int line = 0;
-	int column = 0;
 
 private:
 	std::string_view string_;
+	mutable std::shared_ptr<const LineIndex> lineIndex_;
 };
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <string_view>
+#include <cstddef>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Find the end of a run of bytes of some class, 16 bytes at a time where
+// SSE2 is available. Each function returns the offset of the first byte
+// at or after idx which isn't in the class, or the size of the string.
+// The portable versions give the same results one byte at a time, and are
+// used for the last few bytes of the string.
+//
+// Bytes are compared as the lexer sees them, as signed chars, so no byte
+// from 0x80 up is whitespace or part of an identifier.
+namespace scan {
+
+inline bool isWhitespace(char ch) {
+	return ch == ' ' || ch == '\t' || ch == '\n';
+}
+
+inline bool isIdentChar(char ch) {
+	return
+		(ch >= 'a' && ch <= 'z') ||
+		(ch >= 'A' && ch <= 'Z') ||
+		(ch >= '0' && ch <= '9') ||
+		ch == '_';
+}
+
+// A string literal's contents run up to its quote or a backslash, or up to
+// a 0xff byte, which reads as EOF
+inline bool isStringChar(char ch, char quote) {
+	return ch != quote && ch != '\\' && ch != (char)0xff;
+}
+
+// Raw LaTeX runs up to the next byte the LaFuN parser acts on: a backslash,
+// a reference, an opening brace, or a 0xff byte. Within braces, only braces
+// count, and within a FuN block's braces, the quotes of string literals too.
+inline bool isLatexChar(char ch) {
+	return ch != '\\' && ch != '@' && ch != '!' && ch != '{' && ch != (char)0xff;
+}
+
+inline bool isLatexGroupChar(char ch) {
+	return ch != '{' && ch != '}' && ch != (char)0xff;
+}
+
+inline bool isCodeGroupChar(char ch) {
+	return ch != '{' && ch != '}' && ch != '"' && ch != '\'' && ch != (char)0xff;
+}
+
+template<typename Class>
+inline size_t runPortable(std::string_view str, size_t idx, Class inClass) {
+	while (idx < str.size() && inClass(str[idx])) {
+		idx += 1;
+	}
+
+	return idx;
+}
+
+inline size_t whitespacePortable(std::string_view str, size_t idx) {
+	while (idx < str.size() && isWhitespace(str[idx])) {
+		idx += 1;
+	}
+
+	return idx;
+}
+
+inline size_t identPortable(std::string_view str, size_t idx) {
+	while (idx < str.size() && isIdentChar(str[idx])) {
+		idx += 1;
+	}
+
+	return idx;
+}
+
+inline size_t stringPortable(std::string_view str, size_t idx, char quote) {
+	while (idx < str.size() && isStringChar(str[idx], quote)) {
+		idx += 1;
+	}
+
+	return idx;
+}
+
+#ifdef __SSE2__
+
+// A mask with a bit set for each byte which is *not* in the class;
+// the class ends at the lowest set bit
+inline unsigned whitespaceMask(__m128i bytes) {
+	__m128i match = _mm_or_si128(
+			_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+			_mm_or_si128(
+				_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t')),
+				_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))));
+	return ~(unsigned)_mm_movemask_epi8(match) & 0xffff;
+}
+
+// Between lo and hi inclusive, with signed bytes
+inline __m128i inRange(__m128i bytes, char lo, char hi) {
+	return _mm_and_si128(
+			_mm_cmpgt_epi8(bytes, _mm_set1_epi8(lo - 1)),
+			_mm_cmplt_epi8(bytes, _mm_set1_epi8(hi + 1)));
+}
+
+inline unsigned identMask(__m128i bytes) {
+	// Setting bit 5 maps upper case letters onto lower case ones,
+	// and no other byte onto a letter
+	__m128i letter = inRange(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 'z');
+	__m128i match = _mm_or_si128(
+			_mm_or_si128(letter, inRange(bytes, '0', '9')),
+			_mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')));
+	return ~(unsigned)_mm_movemask_epi8(match) & 0xffff;
+}
+
+inline unsigned stringMask(__m128i bytes, char quote) {
+	__m128i special = _mm_or_si128(
+			_mm_cmpeq_epi8(bytes, _mm_set1_epi8(quote)),
+			_mm_or_si128(
+				_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\')),
+				_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)0xff))));
+	return (unsigned)_mm_movemask_epi8(special);
+}
+
+// A mask with a bit set for each byte which is any of chars
+template<typename... Chars>
+inline unsigned anyOfMask(__m128i bytes, Chars... chars) {
+	__m128i match = _mm_setzero_si128();
+	((match = _mm_or_si128(match, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(chars)))), ...);
+	return (unsigned)_mm_movemask_epi8(match);
+}
+
+template<typename Mask>
+inline size_t run(std::string_view str, size_t idx, Mask mask) {
+	while (idx + 16 <= str.size()) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(str.data() + idx));
+		unsigned bits = mask(bytes);
+		if (bits != 0) {
+			return idx + __builtin_ctz(bits);
+		}
+
+		idx += 16;
+	}
+
+	return idx;
+}
+
+// Most whitespace between tokens is a single space or none, and most
+// identifiers are short, so the first few bytes are checked one at a time
+inline size_t whitespace(std::string_view str, size_t idx) {
+	if (idx < str.size() && !isWhitespace(str[idx])) {
+		return idx;
+	} else if (idx + 1 < str.size() && !isWhitespace(str[idx + 1])) {
+		return idx + 1;
+	}
+
+	idx = run(str, idx, whitespaceMask);
+	return whitespacePortable(str, idx);
+}
+
+inline size_t ident(std::string_view str, size_t idx) {
+	for (size_t end = std::min(idx + 4, str.size()); idx < end; ++idx) {
+		if (!isIdentChar(str[idx])) {
+			return idx;
+		}
+	}
+
+	idx = run(str, idx, identMask);
+	return identPortable(str, idx);
+}
+
+inline size_t string(std::string_view str, size_t idx, char quote) {
+	idx = run(str, idx, [quote](__m128i bytes) { return stringMask(bytes, quote); });
+	return stringPortable(str, idx, quote);
+}
+
+inline size_t latex(std::string_view str, size_t idx) {
+	idx = run(str, idx, [](__m128i bytes) { return anyOfMask(bytes, '\\', '@', '!', '{', (char)0xff); });
+	return runPortable(str, idx, isLatexChar);
+}
+
+inline size_t latexGroup(std::string_view str, size_t idx) {
+	idx = run(str, idx, [](__m128i bytes) { return anyOfMask(bytes, '{', '}', (char)0xff); });
+	return runPortable(str, idx, isLatexGroupChar);
+}
+
+inline size_t codeGroup(std::string_view str, size_t idx) {
+	idx = run(str, idx, [](__m128i bytes) { return anyOfMask(bytes, '{', '}', '"', '\'', (char)0xff); });
+	return runPortable(str, idx, isCodeGroupChar);
+}
+
+#else
+
+inline size_t whitespace(std::string_view str, size_t idx) {
+	return whitespacePortable(str, idx);
+}
+
+inline size_t ident(std::string_view str, size_t idx) {
+	return identPortable(str, idx);
+}
+
+inline size_t string(std::string_view str, size_t idx, char quote) {
+	return stringPortable(str, idx, quote);
+}
+
+inline size_t latex(std::string_view str, size_t idx) {
+	return runPortable(str, idx, isLatexChar);
+}
+
+inline size_t latexGroup(std::string_view str, size_t idx) {
+	return runPortable(str, idx, isLatexGroupChar);
+}
+
+inline size_t codeGroup(std::string_view str, size_t idx) {
+	return runPortable(str, idx, isCodeGroupChar);
+}
+
+#endif
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+class Sha256 {
+public:
+	Sha256();
+
+	void update(const void *data, size_t len);
+	void update(std::string_view str) { update(str.data(), str.size()); }
+
+	// Feed a value with its length first, so that consecutive
+	// fields can't run into each other
+	void updateField(std::string_view str);
+	void updateField(uint64_t num);
+
+	// The digest as 64 lowercase hex characters.
+	// Nothing can be added after this.
+	std::string hexDigest();
+
+private:
+	void compress(const uint8_t *block);
+
+	uint32_t state_[8];
+	uint8_t buffer_[64];
+	size_t bufferLen_ = 0;
+	uint64_t totalLen_ = 0;
+};
@@ -0,0 +1,103 @@
+#include "ThreadPool.h"
+
+static thread_local const ThreadPool *currentPool = nullptr;
+static thread_local size_t currentWorker = 0;
+
+ThreadPool::ThreadPool(size_t threads) {
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+
+	queues_.resize(threads);
+	for (size_t i = 0; i < threads; ++i) {
+		threads_.emplace_back([this, i] { run(i); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::unique_lock<std::mutex> lock(mut_);
+		stopping_ = true;
+	}
+
+	workCond_.notify_all();
+	for (std::thread &thread: threads_) {
+		thread.join();
+	}
+}
+
+void ThreadPool::submit(Job job) {
+	{
+		std::unique_lock<std::mutex> lock(mut_);
+		size_t idx;
+		if (currentPool == this) {
+			idx = currentWorker;
+		} else {
+			idx = nextQueue_++ % queues_.size();
+		}
+
+		queues_[idx].push_back(std::move(job));
+		queued_ += 1;
+		unfinished_ += 1;
+	}
+
+	workCond_.notify_one();
+}
+
+void ThreadPool::wait() {
+	std::unique_lock<std::mutex> lock(mut_);
+	idleCond_.wait(lock, [&] { return unfinished_ == 0; });
+}
+
+ThreadPool::Job ThreadPool::take(size_t self) {
+	Job job;
+
+	// Newest job from our own queue, or the oldest job from someone else's
+	std::deque<Job> &own = queues_[self];
+	if (!own.empty()) {
+		job = std::move(own.back());
+		own.pop_back();
+	} else {
+		for (size_t i = 1; i < queues_.size(); ++i) {
+			std::deque<Job> &other = queues_[(self + i) % queues_.size()];
+			if (!other.empty()) {
+				job = std::move(other.front());
+				other.pop_front();
+				break;
+			}
+		}
+	}
+
+	queued_ -= 1;
+	return job;
+}
+
+void ThreadPool::run(size_t self) {
+	currentPool = this;
+	currentWorker = self;
+
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mut_);
+			workCond_.wait(lock, [&] { return stopping_ || queued_ > 0; });
+			if (queued_ == 0) {
+				return;
+			}
+
+			job = take(self);
+		}
+
+		job();
+		job = nullptr;
+
+		std::unique_lock<std::mutex> lock(mut_);
+		unfinished_ -= 1;
+		if (unfinished_ == 0) {
+			idleCond_.notify_all();
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+// A fixed set of worker threads, each with its own job queue.
+// Workers take jobs from the back of their own queue, and steal from
+// the front of the other queues when theirs is empty.
+// Jobs submitted from a worker go on that worker's queue.
+class ThreadPool {
+public:
+	using Job = std::function<void()>;
+
+	// Zero threads means one per hardware thread
+	explicit ThreadPool(size_t threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	void submit(Job job);
+
+	// Block until every submitted job has finished.
+	// Must not be called from a job.
+	void wait();
+
+	size_t size() const { return threads_.size(); }
+
+private:
+	void run(size_t self);
+	Job take(size_t self);
+
+	// All queues are guarded by mut_; jobs are expected to be coarse
+	// enough (a whole file or block) that this lock is never contended
+	std::vector<std::deque<Job>> queues_;
+	std::vector<std::thread> threads_;
+
+	std::mutex mut_;
+	std::condition_variable workCond_;
+	std::condition_variable idleCond_;
+	size_t queued_ = 0;
+	size_t unfinished_ = 0;
+	size_t nextQueue_ = 0;
+	bool stopping_ = false;
+};
@@ -1,10 +1,19 @@
 #include "Codegen.h"
 
+#include <cmath>
+
 namespace fun {
 
-void Codegen::generate(std::ostream &os) {
+void Codegen::generate(OutputBuffer &os) {
 	for (const auto &[_, classAndMethods] : classes_) {
-		generateClass(os, classAndMethods);
+		if (classAndMethods.first) {
+			generateClass(os, classAndMethods);
+		} else {
+			// A class from another module, which has been generated already
+			for (const auto &[_, method] : classAndMethods.second) {
+				generateDetachedMethod(os, method);
+			}
+		}
 	}
 
 	for (const auto &fun : funs_) {
@@ -16,32 +25,49 @@ void Codegen::generate(std::ostream &os) {
 	}
 }
 
-void Codegen::generateStatement(std::ostream &os, const ast::Statement *statm) {
+void Codegen::generateDetached(OutputBuffer &os, const ast::Declaration *decl) {
+	std::visit(overloaded {
+		[&](const ast::ClassDecl &clas) { generateClass(os, {&clas, {}}); },
+		[&](const ast::FuncDecl &fun) { generateFun(os, &fun); },
+		[&](const ast::MethodDecl &method) { generateDetachedMethod(os, &method); },
+	}, *decl);
+}
+
+void Codegen::generateDetachedMethod(OutputBuffer &os, const ast::MethodDecl *method) {
+	os << "FUNclass_" << method->classIdent.name.str() << ".prototype." << method->ident.name.str() << " = function (";
+	generateParameters(os, method->args);
+	os << ") {\n";
+	os << "let FUN_self = this;\n";
+	generateCodeBlock(os, method->body);
+	os << "};\n";
+}
+
+void Codegen::generateStatement(OutputBuffer &os, const ast::Statement *statm) {
 	std::visit(overloaded {
 		[&](const ast::Declaration &) {}, // decls are handled in a separate code path
 		[&](const auto &statm) { generateStatement(os, &statm); }
 	}, *statm);
 }
 
-void Codegen::generateStatement(std::ostream &os, const ast::Expression *statm) {
+void Codegen::generateStatement(OutputBuffer &os, const ast::Expression *statm) {
 	generateExpressionName(os, generateExpression(os, statm));
 	os << ";\n";
 }
 
-void Codegen::generateStatement(std::ostream &os, const ast::IfStatm *statm) {
+void Codegen::generateStatement(OutputBuffer &os, const ast::IfStatm *statm) {
 	// Temporarily swap out the list of names declared in this scope
-	std::unordered_set<std::string> outerDeclaredNames(std::move(alreadyDeclared_));
+	std::unordered_set<Symbol> outerDeclaredNames(std::move(alreadyDeclared_));
 
 	os << "{\n";
 	auto name = generateExpression(os, &statm->condition);
 	os << "if (";
 	generateExpressionName(os, name);
 	os << ") {\n";
-	generateCodeBlock(os, statm->ifBody.get());
+	generateCodeBlock(os, statm->ifBody);
 	os << "}\n";
 	if (statm->elseBody) {
 		os << "else {\n";
-		generateCodeBlock(os, statm->elseBody.get());
+		generateCodeBlock(os, statm->elseBody);
 		os << "}\n";
 	}
 	os << "}\n";
@@ -50,9 +76,9 @@ void Codegen::generateStatement(std::ostream &os, const ast::IfStatm *statm) {
 	alreadyDeclared_ = std::move(outerDeclaredNames);
 }
 
-void Codegen::generateStatement(std::ostream &os, const ast::WhileStatm *statm) {
+void Codegen::generateStatement(OutputBuffer &os, const ast::WhileStatm *statm) {
 	// Temporarily swap out the list of names declared in this scope
-	std::unordered_set<std::string> outerDeclaredNames(std::move(alreadyDeclared_));
+	std::unordered_set<Symbol> outerDeclaredNames(std::move(alreadyDeclared_));
 
 	os << "while (true) {\n";
 	auto name = generateExpression(os, &statm->condition);
@@ -60,7 +86,7 @@ void Codegen::generateStatement(std::ostream &os, const ast::WhileStatm *statm)
 	generateExpressionName(os, name);
 	os << ")) { break; }\n";
 	os << "{\n";
-	generateCodeBlock(os, statm->body.get());
+	generateCodeBlock(os, statm->body);
 	os << "}\n";
 	os << "}\n";
 
@@ -68,148 +94,156 @@ void Codegen::generateStatement(std::ostream &os, const ast::WhileStatm *statm)
 	alreadyDeclared_ = std::move(outerDeclaredNames);
 }
 
-void Codegen::generateStatement(std::ostream &os, const ast::ReturnStatm *statm) {
+void Codegen::generateStatement(OutputBuffer &os, const ast::ReturnStatm *statm) {
 	auto name = generateExpression(os, &statm->expr);
 	os << "return ";
 	generateExpressionName(os, name);
 	os << ";\n";
 }
 
-void Codegen::generateExpressionName(std::ostream &os, ExpressionName name) {
+void Codegen::generateExpressionName(OutputBuffer &os, ExpressionName name) {
 	std::visit(overloaded {
 		[&](TemporaryId temp) { os << "temp" << temp; },
-		[&](NameLookup &lookup) { os << "temp" << lookup.first << "." << *lookup.second; },
-		[&](const ast::Identifier *temp) { os << "FUN_" << temp->name; },
-		[&](const ast::Expression *temp) {
-			std::visit(overloaded {
-				[&](const ast::StringLiteralExpr &str) { generateStringLiteral(os, str.str); },
-				[&](const ast::NumberLiteralExpr &num) { os << num.num; },
-				[&](const ast::IdentifierExpr &ident) { os << "FUN_" << ident.ident.name; },
-				[&](const auto &) { error("Encountered illegal expression name in codegen"); },
-			}, *temp);
-		},
+		[&](NameLookup &lookup) { os << "temp" << lookup.first << "." << lookup.second.str(); },
+		[&](const ast::Identifier *temp) { os << "FUN_" << temp->name.str(); },
+		[&](const ast::StringLiteralExpr *str) { generateStringLiteral(os, str->str); },
+		[&](const ast::NumberLiteralExpr *num) { generateNumberLiteral(os, num->num); },
 	}, name);
 }
 
-Codegen::ExpressionName Codegen::generateExpression(std::ostream &os, const ast::Expression *expr) {
-	return std::visit(overloaded {
-		[&](const ast::StringLiteralExpr &) -> ExpressionName { return expr; },
-		[&](const ast::NumberLiteralExpr &) -> ExpressionName { return expr; },
-		[&](const ast::IdentifierExpr &) -> ExpressionName { return expr; },
-		[&](const ast::BinaryExpr &expr2) -> ExpressionName {
-			// Recursively generate the two operands to get the expression names lhs and rhs
-			// Emit temp = lhs + rhs
-			// Return temp as the expression name
-			auto lhsName = generateExpression(os, expr2.lhs.get());
-			auto rhsName = generateExpression(os, expr2.rhs.get());
-			auto temp = count();
-			os << "const temp" << temp << " = ";
-			generateExpressionName(os, lhsName);
-			switch (expr2.op) {
-				case ast::BinaryExpr::EQ: os << " == "; break;
-				case ast::BinaryExpr::NEQ: os << " != "; break;
-				case ast::BinaryExpr::GT: os << " > "; break;
-				case ast::BinaryExpr::GTEQ: os << " >= "; break;
-				case ast::BinaryExpr::LT: os << " < "; break;
-				case ast::BinaryExpr::LTEQ: os << " <= "; break;
-				case ast::BinaryExpr::ADD: os << " + "; break;
-				case ast::BinaryExpr::SUB: os << " - "; break;
-				case ast::BinaryExpr::MULT: os << " * "; break;
-				case ast::BinaryExpr::DIV: os << " / "; break;
-			}
-			generateExpressionName(os, rhsName);
-			os << ";\n";
-			return temp;
-		},
-		[&](const ast::FuncCallExpr &expr2) -> ExpressionName {
-			// Recursively generate the function and arguments
-			// Emit temp = fun(args...)
-			// Return temp as the expression name
-			auto funName = generateExpression(os, expr2.func.get());
-			std::vector<ExpressionName> argNames;
-			for (const auto &arg : expr2.args) {
-				argNames.emplace_back(generateExpression(os, arg.get()));
-			}
-			auto temp = count();
-			os << "const temp" << temp << " = ";
-			generateExpressionName(os, funName);
-			os << "(";
-			bool first = true;
-			for (const auto &argName : argNames) {
-				if (!first) {
-					os << ", ";
-				}
-				generateExpressionName(os, argName);
-				first = false;
-			}
-			os << ");\n";
-			return temp;
-		},
-		[&](const ast::AssignmentExpr &expr2) -> ExpressionName {
-			// Recursively generate the rhs
-			// Emit lhs = rhsName
-			// Return lhs as the expression name
-			auto rhsName = generateExpression(os, expr2.rhs.get());
-			auto lhsName = generateLvalue(os, expr2.lhs.get());
-			generateExpressionName(os, lhsName);
-			os << " = ";
-			generateExpressionName(os, rhsName);
-			os << ";\n";
-			return lhsName;
-		},
-		[&](const ast::DeclAssignmentExpr &expr2) -> ExpressionName {
-			// Recursively generate the rhs
-			// Emit declaration if not already declared
-			// Emit lhs = rhsName
-			// Return lhs as the expression name
-			auto rhsName = generateExpression(os, expr2.rhs.get());
-			if (alreadyDeclared_.find(expr2.ident.name) == alreadyDeclared_.end()) {
-				alreadyDeclared_.insert(expr2.ident.name);
-				os << "let ";
-				generateExpressionName(os, &expr2.ident);
-				os << ";\n";
+class Codegen::ExpressionPass: public walk::Pass {
+public:
+	using walk::Pass::enter;
+	using walk::Pass::between;
+	using walk::Pass::leave;
+
+	ExpressionPass(Codegen &codegen, OutputBuffer &os): codegen_(codegen), os_(os), names_(codegen.names_) {}
+
+	void enter(const ast::StringLiteralExpr &str) { names_.push_back(&str); }
+	void enter(const ast::NumberLiteralExpr &num) { names_.push_back(&num); }
+	void enter(const ast::IdentifierExpr &ident) { names_.push_back(&ident.ident); }
+
+	// Emit temp = lhs + rhs
+	// Return temp as the expression name
+	// Down a chain like a + b + c, each temp is the next one's lhs
+	void leave(const ast::BinaryExpr &bin) {
+		auto rhsName = pop();
+		auto lhsName = pop();
+		auto temp = codegen_.count();
+		os_ << "const temp" << temp << " = ";
+		codegen_.generateExpressionName(os_, lhsName);
+		switch (bin.op) {
+			case ast::BinaryExpr::EQ: os_ << " == "; break;
+			case ast::BinaryExpr::NEQ: os_ << " != "; break;
+			case ast::BinaryExpr::GT: os_ << " > "; break;
+			case ast::BinaryExpr::GTEQ: os_ << " >= "; break;
+			case ast::BinaryExpr::LT: os_ << " < "; break;
+			case ast::BinaryExpr::LTEQ: os_ << " <= "; break;
+			case ast::BinaryExpr::ADD: os_ << " + "; break;
+			case ast::BinaryExpr::SUB: os_ << " - "; break;
+			case ast::BinaryExpr::MULT: os_ << " * "; break;
+			case ast::BinaryExpr::DIV: os_ << " / "; break;
+		}
+		codegen_.generateExpressionName(os_, rhsName);
+		os_ << ";\n";
+		names_.push_back(temp);
+	}
+
+	// Emit temp = fun(args...)
+	// Return temp as the expression name
+	void leave(const ast::FuncCallExpr &call) {
+		size_t args = names_.size() - call.args.size();
+		auto temp = codegen_.count();
+		os_ << "const temp" << temp << " = ";
+		codegen_.generateExpressionName(os_, names_[args - 1]);
+		os_ << "(";
+		for (size_t i = args; i < names_.size(); ++i) {
+			if (i != args) {
+				os_ << ", ";
 			}
-			generateExpressionName(os, &expr2.ident);
-			os << " = ";
-			generateExpressionName(os, rhsName);
-			os << ";\n";
-			return &expr2.ident;
-		},
-		[&](const ast::LookupExpr &expr2) -> ExpressionName {
-			auto lhsName = generateExpression(os, expr2.lhs.get());
-			auto temp = count();
-			os << "const temp" << temp << " = ";
-			generateExpressionName(os, lhsName);
-			os << ";\n";
-			return NameLookup{temp, &expr2.name};
-		},
-	}, *expr);
-}
+			codegen_.generateExpressionName(os_, names_[i]);
+		}
+		os_ << ");\n";
+		names_.resize(args - 1);
+		names_.push_back(temp);
+	}
+
+	// The rhs is generated first, then the lhs, which has to be a name or
+	// a lookup
+	void between(const ast::AssignmentExpr &assignment, size_t) {
+		if (!std::holds_alternative<ast::IdentifierExpr>(*assignment.lhs) &&
+				!std::holds_alternative<ast::LookupExpr>(*assignment.lhs)) {
+			codegen_.error("Invalid lvalue in codegen");
+		}
+	}
+
+	// Emit lhs = rhsName
+	// Return lhs as the expression name
+	void leave(const ast::AssignmentExpr &) {
+		auto lhsName = pop();
+		auto rhsName = pop();
+		codegen_.generateExpressionName(os_, lhsName);
+		os_ << " = ";
+		codegen_.generateExpressionName(os_, rhsName);
+		os_ << ";\n";
+		names_.push_back(lhsName);
+	}
+
+	// Emit declaration if not already declared
+	// Emit lhs = rhsName
+	// Return lhs as the expression name
+	void leave(const ast::DeclAssignmentExpr &expr) {
+		auto rhsName = pop();
+		if (codegen_.alreadyDeclared_.find(expr.ident.name) == codegen_.alreadyDeclared_.end()) {
+			codegen_.alreadyDeclared_.insert(expr.ident.name);
+			os_ << "let ";
+			codegen_.generateExpressionName(os_, &expr.ident);
+			os_ << ";\n";
+		}
+		codegen_.generateExpressionName(os_, &expr.ident);
+		os_ << " = ";
+		codegen_.generateExpressionName(os_, rhsName);
+		os_ << ";\n";
+		names_.push_back(&expr.ident);
+	}
+
+	void leave(const ast::LookupExpr &lookup) {
+		auto lhsName = pop();
+		auto temp = codegen_.count();
+		os_ << "const temp" << temp << " = ";
+		codegen_.generateExpressionName(os_, lhsName);
+		os_ << ";\n";
+		names_.push_back(NameLookup{temp, lookup.name});
+	}
+
+private:
+	ExpressionName pop() {
+		ExpressionName name = names_.back();
+		names_.pop_back();
+		return name;
+	}
 
-Codegen::ExpressionName Codegen::generateLvalue(std::ostream &os, const ast::Expression *expr) {
-	return std::visit(overloaded {
-		[&](const ast::IdentifierExpr &) -> ExpressionName { return expr; },
-		[&](const ast::LookupExpr &lookup) -> ExpressionName {
-			auto lhsName = generateExpression(os, lookup.lhs.get());
-			auto temp = count();
-			os << "const temp" << temp << " = ";
-			generateExpressionName(os, lhsName);
-			os << ";\n";
-			return NameLookup{temp, &lookup.name};
-		},
-		[&](const auto &) -> ExpressionName { error("Invalid lvalue in codegen"); },
-	}, *expr);
+	Codegen &codegen_;
+	OutputBuffer &os_;
+	std::vector<ExpressionName> &names_;
+};
+
+Codegen::ExpressionName Codegen::generateExpression(OutputBuffer &os, const ast::Expression *expr) {
+	ExpressionPass pass(*this, os);
+	names_.clear();
+	walker_(*expr, pass);
+	return names_.back();
 }
 
-void Codegen::generateFun(std::ostream &os, const ast::FuncDecl *fun) {
-	os << "function FUN_" << fun->ident.name << "(";
+void Codegen::generateFun(OutputBuffer &os, const ast::FuncDecl *fun) {
+	os << "function FUN_" << fun->ident.name.str() << "(";
 	generateParameters(os, fun->args);
 	os << ") {\n";
-	generateCodeBlock(os, fun->body.get());
+	generateCodeBlock(os, fun->body);
 	os << "}\n";
 }
 
-void Codegen::generateCodeBlock(std::ostream &os, const ast::CodeBlock *block) {
+void Codegen::generateCodeBlock(OutputBuffer &os, const ast::CodeBlock *block) {
 	Codegen codegen;
 	for (const auto &statm : block->statms) {
 		codegen.add(&statm);
@@ -217,7 +251,7 @@ void Codegen::generateCodeBlock(std::ostream &os, const ast::CodeBlock *block) {
 	codegen.generate(os);
 }
 
-void Codegen::generateClass(std::ostream &os, const ClassAndMethods &clas) {
+void Codegen::generateClass(OutputBuffer &os, const ClassAndMethods &clas) {
 	generateClassStart(os, clas.first);
 	for (const auto &[_, method] : clas.second) {
 		generateClassMethods(os, method);
@@ -225,46 +259,55 @@ void Codegen::generateClass(std::ostream &os, const ClassAndMethods &clas) {
 	generateClassEnd(os, clas.first);
 }
 
-void Codegen::generateClassStart(std::ostream &os, const ast::ClassDecl *clas) {
-	os << "class FUNclass_" << clas->ident.name << " {\n";
+void Codegen::generateClassStart(OutputBuffer &os, const ast::ClassDecl *clas) {
+	os << "class FUNclass_" << clas->ident.name.str() << " {\n";
 	os << "constructor (";
 	generateParameters(os, clas->args);
 	os << ") {\n";
 	os << "let FUN_self = this;\n";
-	generateCodeBlock(os, clas->body.get());
+	generateCodeBlock(os, clas->body);
 	os << "}\n";
 }
 
-void Codegen::generateParameters(std::ostream &os, const std::vector<ast::Identifier> &args) {
+void Codegen::generateParameters(OutputBuffer &os, const ast::List<ast::Identifier> &args) {
 	if (!args.empty()) {
-		os << "FUN_" << args[0].name;
+		os << "FUN_" << args[0].name.str();
 		for (size_t i = 1; i < args.size(); i++) {
-			os << ", FUN_" << args[i].name;
+			os << ", FUN_" << args[i].name.str();
 		}
 	}
 }
 
-void Codegen::generateClassMethods(std::ostream &os, const ast::MethodDecl *method) {
-	os << method->ident.name << "(";
+void Codegen::generateClassMethods(OutputBuffer &os, const ast::MethodDecl *method) {
+	os << method->ident.name.str() << "(";
 	generateParameters(os, method->args);
 	os << ") {\n";
 	os << "let FUN_self = this;\n";
-	generateCodeBlock(os, method->body.get());
+	generateCodeBlock(os, method->body);
 	os << "}\n";
 }
 
-void Codegen::generateClassEnd(std::ostream &os, const ast::ClassDecl *clas) {
+void Codegen::generateClassEnd(OutputBuffer &os, const ast::ClassDecl *clas) {
 	os << "}\n";
 
-	os << "function FUN_" << clas->ident.name << "(";
+	os << "function FUN_" << clas->ident.name.str() << "(";
 	generateParameters(os, clas->args);
 	os << ") {\n";
-	os << "return new FUNclass_" << clas->ident.name << "(";
+	os << "return new FUNclass_" << clas->ident.name.str() << "(";
 	generateParameters(os, clas->args);
 	os << ");\n}\n";
 };
 
-void Codegen::generateStringLiteral(std::ostream &os, const std::string &str) {
+void Codegen::generateNumberLiteral(OutputBuffer &os, double num) {
+	// Literals too large for a double are infinite
+	if (std::isinf(num)) {
+		os << "Infinity";
+	} else {
+		os << num;
+	}
+}
+
+void Codegen::generateStringLiteral(OutputBuffer &os, std::string_view str) {
 	os << '"';
 
 	auto hexNibble = [](int nibble) {
@@ -2,12 +2,15 @@
 
 #include <unordered_set>
 #include <unordered_map>
+#include <map>
 #include <string>
 #include <variant>
 #include <sstream>
 
 #include "util.h"
 #include "ast.h"
+#include "walk.h"
+#include "OutputBuffer.h"
 
 namespace fun {
 
@@ -23,19 +26,27 @@ struct CodegenError: public std::exception {
 
 
 class Codegen {
-	using Methods = std::unordered_map<std::string, const ast::MethodDecl *>;
-	using ClassAndMethods = std::pair<const ast::ClassDecl *, std::unordered_map<std::string, const ast::MethodDecl *>>;
-	std::unordered_map<std::string, ClassAndMethods> classes_;
+	// Ordered maps, so that the output doesn't depend on hash table layout
+	using Methods = std::map<std::string, const ast::MethodDecl *>;
+	using ClassAndMethods = std::pair<const ast::ClassDecl *, Methods>;
+	std::map<std::string, ClassAndMethods> classes_;
 	std::vector<const ast::FuncDecl *> funs_;
 	std::vector<const ast::Statement *> statms_; // except decls
 
 	using TemporaryId = size_t;
-	using NameLookup = std::pair<TemporaryId, const std::string *>;
-	using ExpressionName = std::variant<TemporaryId, NameLookup, const ast::Identifier *, const ast::Expression *>;
+	using NameLookup = std::pair<TemporaryId, Symbol>;
+	using ExpressionName = std::variant<
+		TemporaryId, NameLookup, const ast::Identifier *, const ast::StringLiteralExpr *, const ast::NumberLiteralExpr *>;
 	// The name of "x := 5" is the subexpression "x"
 	// The name of "foo.bar := 5" is the subexpression "foo.bar" (when we support . operator)
 	// The name of "10 + (x := 5)" is some unique size_t not given to any other temporary
 
+	// Expressions are generated by a walk, which leaves the names of the
+	// subexpressions it has generated but not used yet on names_
+	class ExpressionPass;
+	walk::Walker<true, walk::EVALUATION_ORDER> walker_;
+	std::vector<ExpressionName> names_;
+
 public:
 	void add(const ast::Statement *statm) {
 		if (auto decl = std::get_if<ast::Declaration>(statm)) {
@@ -50,45 +61,51 @@ public:
 	}
 
 	void add(const ast::ClassDecl *decl) {
-		classes_[decl->ident.name].first = decl;
+		classes_[decl->ident.name.str()].first = decl;
 	}
 
 	void add(const ast::MethodDecl *decl) {
-		classes_[decl->classIdent.name].second[decl->ident.name] = decl;
+		classes_[decl->classIdent.name.str()].second[decl->ident.name.str()] = decl;
 	}
 
 	void add(const ast::FuncDecl *decl) {
 		funs_.push_back(decl);
 	}
 
-	void generate(std::ostream &os);
+	void generate(OutputBuffer &os);
+
+	// Generate one top-level declaration on its own, for streaming
+	// compilation. Methods are attached to their class's prototype,
+	// so the class must have been generated first.
+	void generateDetached(OutputBuffer &os, const ast::Declaration *decl);
 
 private:
-	std::unordered_set<std::string> alreadyDeclared_;
+	std::unordered_set<Symbol> alreadyDeclared_;
 
-	void generateStatement(std::ostream &os, const ast::Statement *statm);
-	void generateStatement(std::ostream &os, const ast::Expression *statm);
-	void generateStatement(std::ostream &os, const ast::IfStatm *statm);
-	void generateStatement(std::ostream &os, const ast::WhileStatm *statm);
-	void generateStatement(std::ostream &os, const ast::ReturnStatm *statm);
+	void generateStatement(OutputBuffer &os, const ast::Statement *statm);
+	void generateStatement(OutputBuffer &os, const ast::Expression *statm);
+	void generateStatement(OutputBuffer &os, const ast::IfStatm *statm);
+	void generateStatement(OutputBuffer &os, const ast::WhileStatm *statm);
+	void generateStatement(OutputBuffer &os, const ast::ReturnStatm *statm);
 
 	size_t counter_ = 0;
 	size_t count() {
 		return counter_++;
 	}
 
-	void generateExpressionName(std::ostream &os, ExpressionName name);
-	ExpressionName generateExpression(std::ostream &os, const ast::Expression *expr);
-	ExpressionName generateLvalue(std::ostream &os, const ast::Expression *expr);
-	void generateFun(std::ostream &os, const ast::FuncDecl *fun);
-	void generateCodeBlock(std::ostream &os, const ast::CodeBlock *block);
-	void generateClass(std::ostream &os, const ClassAndMethods &clas);
-	void generateClassStart(std::ostream &os, const ast::ClassDecl *clas);
-	void generateParameters(std::ostream &os, const std::vector<ast::Identifier> &args);
-	void generateClassMethods(std::ostream &os, const ast::MethodDecl *method);
-	void generateClassEnd(std::ostream &os, const ast::ClassDecl *clas);
-
-	void generateStringLiteral(std::ostream &os, const std::string &str);
+	void generateExpressionName(OutputBuffer &os, ExpressionName name);
+	ExpressionName generateExpression(OutputBuffer &os, const ast::Expression *expr);
+	void generateFun(OutputBuffer &os, const ast::FuncDecl *fun);
+	void generateCodeBlock(OutputBuffer &os, const ast::CodeBlock *block);
+	void generateClass(OutputBuffer &os, const ClassAndMethods &clas);
+	void generateClassStart(OutputBuffer &os, const ast::ClassDecl *clas);
+	void generateParameters(OutputBuffer &os, const ast::List<ast::Identifier> &args);
+	void generateClassMethods(OutputBuffer &os, const ast::MethodDecl *method);
+	void generateClassEnd(OutputBuffer &os, const ast::ClassDecl *clas);
+	void generateDetachedMethod(OutputBuffer &os, const ast::MethodDecl *method);
+
+	void generateNumberLiteral(OutputBuffer &os, double num);
+	void generateStringLiteral(OutputBuffer &os, std::string_view str);
 
 	[[noreturn]]
 	void error(std::string &&message) { throw CodegenError(std::move(message)); }
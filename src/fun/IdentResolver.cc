@@ -9,15 +9,108 @@ using namespace fun::ast;
 
 namespace fun {
 
-
 void ScopeStack::pushScope() {
-	scopes_.emplace_back();
+	scopes_.push_back({(uint32_t)defs_.size(), ++serial_});
 }
 
 void ScopeStack::popScope() {
+	unbind(scopes_.back().firstDef);
 	scopes_.pop_back();
 }
 
+void ScopeStack::truncate(size_t depth) {
+	if (depth < scopes_.size()) {
+		unbind(scopes_[depth].firstDef);
+		scopes_.resize(depth);
+	}
+}
+
+// Fibonacci hashing: symbol ids are dense, and the top bits of their
+// product with 2^32 / phi spread them over the table
+uint32_t ScopeStack::index(Symbol name) {
+	uint32_t mask = (uint32_t)slots_.size() - 1;
+	uint32_t idx = (name.id() * 2654435769u) >> (32 - slotBits_);
+	for (;; idx = (idx + 1) & mask) {
+		Slot &slot = slots_[idx];
+		if (slot.symbol == name.id()) {
+			return slot.index;
+		} else if (slot.symbol == NONE) {
+			break;
+		}
+	}
+
+	if ((names_.size() + 1) * 2 > slots_.size()) {
+		std::vector<Slot> old(slots_.size() * 2, {NONE, 0});
+		std::swap(old, slots_);
+		slotBits_ += 1;
+		for (const Slot &slot: old) {
+			if (slot.symbol != NONE) {
+				place(slot);
+			}
+		}
+	}
+
+	Slot slot{name.id(), (uint32_t)names_.size()};
+	place(slot);
+	names_.emplace_back();
+	return slot.index;
+}
+
+void ScopeStack::place(const Slot &slot) {
+	uint32_t mask = (uint32_t)slots_.size() - 1;
+	uint32_t idx = (slot.symbol * 2654435769u) >> (32 - slotBits_);
+	while (slots_[idx].symbol != NONE) {
+		idx = (idx + 1) & mask;
+	}
+
+	slots_[idx] = slot;
+}
+
+ScopeStack::Name &ScopeStack::entry(Symbol name) {
+	return names_[index(name)];
+}
+
+ScopeStack::Def &ScopeStack::bind(Symbol name, bool unique) {
+	uint32_t idx = index(name);
+	Name &entry = names_[idx];
+	uint32_t scope = (uint32_t)(scopes_.size() - 1);
+	if (entry.innermost != NONE && defs_[entry.innermost].scope == scope) {
+		if (unique) {
+			throw NameError("Duplicate definition of identifier " + name.str());
+		}
+
+		return defs_[entry.innermost];
+	}
+
+	if (defs_.size() >= NONE) {
+		throw NameError("Too many identifiers in scope");
+	}
+
+	defs_.push_back({0, idx, entry.innermost, scope, false});
+	entry.innermost = (uint32_t)(defs_.size() - 1);
+	return defs_.back();
+}
+
+void ScopeStack::unbind(size_t count) {
+	while (defs_.size() > count) {
+		names_[defs_.back().name].innermost = defs_.back().hidden;
+		defs_.pop_back();
+	}
+}
+
+// A lookup went past the scopes from this one in. Only the shallowest scope
+// lookups went past is kept, but a lookup from before that scope began
+// can't have hit a trap in any scope there is now, so it's forgotten.
+void ScopeStack::passed(Name &name, uint32_t scope) {
+	uint32_t earlier = name.passedScope;
+	if (earlier < scopes_.size() && scopes_[earlier].serial <= name.passedAt) {
+		scope = std::min(scope, earlier);
+	}
+
+	name.passedScope = scope;
+	name.passedAt = serial_;
+}
+
 void ScopeStack::addDef(Identifier &ident) {
 	ident.id = define(ident.name);
 	resolver_.addDef(&ident);
@@ -28,55 +121,74 @@ void ScopeStack::addRedef(Identifier &ident) {
 	resolver_.addDef(&ident);
 }
 
+void ScopeStack::addCheckedRedef(Identifier &ident) {
+	Def &def = bind(ident.name, false);
+	const Scope &scope = scopes_.back();
+	const Name &name = names_[def.name];
+	if (def.declared || (name.passedAt >= scope.serial && name.passedScope <= def.scope)) {
+		throw Unchecked();
+	}
+
+	ident.id = def.id = resolver_.nextId();
+	resolver_.addDef(&ident);
+}
+
 void ScopeStack::addRef(Identifier &ident) {
 	ident.id = find(ident.name);
 	resolver_.addRef(&ident);
 }
 
-void ScopeStack::addBuiltin(const std::string &name) {
-	scopes_[0][name] = BUILTIN;
+// Only looked for once nothing in scope matches, like the builtins
+// passed to addBuiltins()
+void ScopeStack::addBuiltin(Symbol name) {
+	ownBuiltins_.insert(name);
 }
 
-size_t ScopeStack::define(const std::string &name) {
-	Scope &scope = scopes_.back();
-	if (scope.find(name) != scope.end()) {
-		throw NameError("Duplicate definition of identifier " + name);
-	}
+size_t ScopeStack::define(Symbol name) {
+	Def &def = bind(name, true);
+	def.declared = true;
+	return def.id = resolver_.nextId();
+}
 
-	return scope[name] = resolver_.nextId();
+size_t ScopeStack::redefine(Symbol name) {
+	return bind(name, false).id = resolver_.nextId();
 }
 
-size_t ScopeStack::redefine(const std::string &name) {
-	Scope &scope = scopes_.back();
-	return scope[name] = resolver_.nextId();
+size_t ScopeStack::defineTrap(Symbol name) {
+	return bind(name, false).id = TRAP;
 }
 
-size_t ScopeStack::defineTrap(const std::string &name) {
-	Scope &scope = scopes_.back();
-	return scope[name] = TRAP;
+void ScopeStack::defineImport(Symbol name) {
+	bind(name, true).id = IMPORTED;
 }
 
-size_t ScopeStack::find(const std::string &name) {
+size_t ScopeStack::find(Symbol name) {
 	size_t id = tryFind(name);
 	if (id == 0) {
-		throw NameError("Undefined identifier " + name);
+		throw NameError("Undefined identifier " + name.str());
 	}
 
 	return id;
 }
 
-size_t ScopeStack::tryFind(const std::string &name) {
-	for (auto it = scopes_.rbegin(); it != scopes_.rend(); ++it) {
-		Scope &scope = *it;
-		auto idIt = scope.find(name);
-		if (idIt != scope.end()) {
-			size_t id = idIt->second;
-			if (id == TRAP) {
-				throw NameError("Reference of " + name + " before it's defined");
-			}
+size_t ScopeStack::tryFind(Symbol name) {
+	Name &entry = this->entry(name);
+	if (entry.innermost != NONE) {
+		const Def &def = defs_[entry.innermost];
+		if (def.id == TRAP) {
+			throw NameError("Reference of " + name.str() + " before it's defined");
+		}
 
-			return id;
+		if (def.scope + 1 < scopes_.size()) {
+			passed(entry, def.scope + 1);
 		}
+
+		return def.id;
+	}
+
+	passed(entry, 0);
+	if (ownBuiltins_.count(name) || (builtins_ && builtins_->find(name) != builtins_->end())) {
+		return BUILTIN;
 	}
 
 	return 0;
@@ -86,317 +198,367 @@ void IdentResolver::add(Declaration *decl) {
 	decls_.push_back(decl);
 }
 
-static void finalizeCodeBlock(ScopeStack &scope, CodeBlock &block);
-static void addDeclaration(ScopeStack &scope, Declaration &decl);
-static void finalizeDeclaration(ScopeStack &scope, Declaration &decl);
-
-static void addExpression(ScopeStack &scope, Expression &expr) {
+static void addDeclaration(ScopeStack &scope, Declaration &decl) {
 	std::visit(overloaded {
-		[&](StringLiteralExpr &) {},
-		[&](NumberLiteralExpr &) {},
-		[&](IdentifierExpr &) {},
-		[&](BinaryExpr &bin) {
-			addExpression(scope, *bin.lhs);
-			addExpression(scope, *bin.rhs);
-		},
-		[&](FuncCallExpr &call) {
-			addExpression(scope, *call.func);
-			for (std::unique_ptr<Expression> &arg: call.args) {
-				addExpression(scope, *arg);
-			}
-		},
-		[&](AssignmentExpr &assignment) {
-			addExpression(scope, *assignment.lhs);
-			addExpression(scope, *assignment.rhs);
-		},
-		[&](DeclAssignmentExpr &assignment) {
-			// Disallow temporal dead zones by registering the name
-			// in the 'add' step, but as a trap ID, so that it errors if
-			// anything tries to reference it
-			scope.defineTrap(assignment.ident.name);
-			addExpression(scope, *assignment.rhs);
+		[&](ClassDecl &decl) {
+			scope.addDef(decl.ident);
 		},
-		[&](LookupExpr &lookup) {
-			addExpression(scope, *lookup.lhs);
+		[&](FuncDecl &decl) {
+			scope.addDef(decl.ident);
 		},
-	}, expr);
+		[&](MethodDecl &) { },
+	}, decl);
 }
 
-static void finalizeExpression(ScopeStack &scope, Expression &expr) {
-	std::visit(overloaded {
-		[&](StringLiteralExpr &) {},
-		[&](NumberLiteralExpr &) {},
-		[&](IdentifierExpr &ident) {
-			scope.addRef(ident.ident);
-		},
-		[&](BinaryExpr &bin) {
-			finalizeExpression(scope, *bin.lhs);
-			finalizeExpression(scope, *bin.rhs);
-		},
-		[&](FuncCallExpr &call) {
-			finalizeExpression(scope, *call.func);
-			for (std::unique_ptr<Expression> &arg: call.args) {
-				finalizeExpression(scope, *arg);
-			}
-		},
-		[&](AssignmentExpr &assignment) {
-			finalizeExpression(scope, *assignment.lhs);
-			finalizeExpression(scope, *assignment.rhs);
-		},
-		[&](DeclAssignmentExpr &assignment) {
-			finalizeExpression(scope, *assignment.rhs);
-			scope.addRedef(assignment.ident);
-		},
-		[&](LookupExpr &lookup) {
-			finalizeExpression(scope, *lookup.lhs);
-		},
-	}, expr);
-}
+namespace {
 
-static void addStatement(ScopeStack &scope, Statement &statm) {
-	std::visit(overloaded {
-		[&](Expression &expr) { addExpression(scope, expr); },
-		[&](IfStatm &) {},
-		[&](WhileStatm &) {},
-		[&](ReturnStatm &ret) { addExpression(scope, ret.expr); },
-		[&](Declaration &decl) { addDeclaration(scope, decl); }
-	}, statm);
-}
+// Disallows temporal dead zones: the names an expression declares with ':='
+// are registered in the 'add' step, but as trap IDs, so that it errors if
+// anything tries to reference them before they're defined
+class TrapPass: public walk::Pass {
+public:
+	using walk::Pass::enter;
 
-static void finalizeStatement(ScopeStack &scope, Statement &statm) {
-	std::visit(overloaded {
-		[&](Expression &expr) { finalizeExpression(scope, expr); },
-		[&](IfStatm &ifStatm) {
-			scope.pushScope();
-			addExpression(scope, ifStatm.condition);
-			finalizeExpression(scope, ifStatm.condition);
-
-			finalizeCodeBlock(scope, *ifStatm.ifBody);
-			if (ifStatm.elseBody) {
-				finalizeCodeBlock(scope, *ifStatm.elseBody);
-			}
+	TrapPass(ScopeStack &scope): scope_(scope) {}
 
-			scope.popScope();
-		},
-		[&](WhileStatm &whileStatm) {
-			scope.pushScope();
-			addExpression(scope, whileStatm.condition);
-			finalizeExpression(scope, whileStatm.condition);
-			finalizeCodeBlock(scope, *whileStatm.body);
-			scope.popScope();
-		},
-		[&](ReturnStatm &ret) { finalizeExpression(scope, ret.expr); },
-		[&](Declaration &decl) { finalizeDeclaration(scope, decl); },
-	}, statm);
-}
+	void enter(DeclAssignmentExpr &assignment) {
+		scope_.defineTrap(assignment.ident.name);
+	}
 
-static void finalizeCodeBlock(ScopeStack &scope, CodeBlock &block) {
-	scope.pushScope();
+private:
+	ScopeStack &scope_;
+};
+
+// The 'finalize' step, which defines names and resolves references in the
+// order they're evaluated in. Each code block has the 'add' step done for
+// all of its statements first: their declarations are defined, and with
+// trap walks, the names their expressions declare are made traps. Without
+// them, the scope stack checks for what the traps would have caught.
+class FinalizePass: public walk::Pass {
+public:
+	using walk::Pass::enter;
+	using walk::Pass::leave;
+
+	FinalizePass(ScopeStack &scope, bool trapWalks):
+		scope_(scope), traps_(scope), trapWalks_(trapWalks) {}
+
+	void enter(ClassDecl &classDecl) {
+		scope_.pushScope();
+		scope_.define(sym::SELF);
+		addArgs(classDecl.args);
+	}
 
-	for (Statement &statm: block.statms) {
-		addStatement(scope, statm);
+	void enter(FuncDecl &funcDecl) {
+		scope_.pushScope();
+		addArgs(funcDecl.args);
 	}
 
-	for (Statement &statm: block.statms) {
-		finalizeStatement(scope, statm);
+	void enter(MethodDecl &methodDecl) {
+		scope_.addRef(methodDecl.classIdent);
+
+		scope_.pushScope();
+		scope_.define(sym::SELF);
+		addArgs(methodDecl.args);
 	}
 
-	scope.popScope();
+	void leave(Declaration &) {
+		scope_.popScope();
+	}
+
+	void enter(CodeBlock &block) {
+		scope_.pushScope();
+		for (Statement &statm: block.statms) {
+			addStatement(statm);
+		}
+	}
+
+	void leave(CodeBlock &) {
+		scope_.popScope();
+	}
+
+	// A condition's names are scoped to its statement
+	void enter(IfStatm &ifStatm) {
+		scope_.pushScope();
+		addExpression(ifStatm.condition);
+	}
+
+	void leave(IfStatm &) {
+		scope_.popScope();
+	}
+
+	void enter(WhileStatm &whileStatm) {
+		scope_.pushScope();
+		addExpression(whileStatm.condition);
+	}
+
+	void leave(WhileStatm &) {
+		scope_.popScope();
+	}
+
+	void enter(IdentifierExpr &ident) {
+		scope_.addRef(ident.ident);
+	}
+
+	// After its value, so that the value can't refer to it
+	void leave(DeclAssignmentExpr &assignment) {
+		if (trapWalks_) {
+			scope_.addRedef(assignment.ident);
+		} else {
+			scope_.addCheckedRedef(assignment.ident);
+		}
+	}
+
+private:
+	void addArgs(List<Identifier> &args) {
+		for (Identifier &arg: args) {
+			scope_.addDef(arg);
+		}
+	}
+
+	void addExpression(Expression &expr) {
+		if (trapWalks_) {
+			trapWalker_(expr, traps_);
+		}
+	}
+
+	void addStatement(Statement &statm) {
+		std::visit(overloaded {
+			[&](Expression &expr) { addExpression(expr); },
+			[&](IfStatm &) {},
+			[&](WhileStatm &) {},
+			[&](ReturnStatm &ret) { addExpression(ret.expr); },
+			[&](Declaration &decl) { addDeclaration(scope_, decl); }
+		}, statm);
+	}
+
+	ScopeStack &scope_;
+	TrapPass traps_;
+	bool trapWalks_;
+
+	// The main walk is paused while a trap walk runs, so they can't share a walker
+	walk::Walker<false> trapWalker_;
+};
+
+// Lists every identifier in a declaration which can be the target of
+// a LaFuN reference, in the order the upwards/downwards search sees them.
+// Identifiers are listed before their ids are set when this shares a walk
+// with FinalizePass, so the ids are read once the walk is over.
+class TargetPass: public walk::Pass {
+public:
+	using walk::Pass::enter;
+
+	TargetPass(std::vector<const Identifier *> &targets): targets_(targets) {}
+
+	void enter(const ClassDecl &classDecl) {
+		targets_.push_back(&classDecl.ident);
+		addArgs(classDecl.args);
+	}
+
+	void enter(const FuncDecl &funcDecl) {
+		targets_.push_back(&funcDecl.ident);
+		addArgs(funcDecl.args);
+	}
+
+	void enter(const MethodDecl &methodDecl) {
+		targets_.push_back(&methodDecl.ident);
+		addArgs(methodDecl.args);
+	}
+
+	void enter(const IdentifierExpr &ident) {
+		targets_.push_back(&ident.ident);
+	}
+
+	void enter(const DeclAssignmentExpr &assignment) {
+		targets_.push_back(&assignment.ident);
+	}
+
+private:
+	void addArgs(const List<Identifier> &args) {
+		for (const Identifier &arg: args) {
+			targets_.push_back(&arg);
+		}
+	}
+
+	std::vector<const Identifier *> &targets_;
+};
+
 }
 
-static void finalizeDeclaration(ScopeStack &scope, Declaration &decl) {
-	std::visit(overloaded {
-		[&](ClassDecl &classDecl) {
-			scope.pushScope();
-			scope.define("self");
-			for (Identifier &arg: classDecl.args) {
-				scope.addDef(arg);
-			}
+static void addNames(const std::vector<const Identifier *> &targets, DeclNames &names) {
+	bool methods = false;
+	for (const Identifier *ident: targets) {
+		methods = methods || ident->id == 0;
+		auto it = names.find(ident->name);
+		if (it == names.end()) {
+			names.emplace(ident->name, std::make_pair(ident->id, ident->id));
+		} else {
+			it->second.second = ident->id;
+		}
+	}
 
-			finalizeCodeBlock(scope, *classDecl.body);
-			scope.popScope();
-		},
-		[&](FuncDecl &funcDecl) {
-			scope.pushScope();
-			for (Identifier &arg: funcDecl.args) {
-				scope.addDef(arg);
-			}
+	if (methods) {
+		dropMethodNames(names);
+	}
+}
 
-			finalizeCodeBlock(scope, *funcDecl.body);
-			scope.popScope();
-		},
-		[&](MethodDecl &methodDecl) {
-			scope.addRef(methodDecl.classIdent);
+void IdentResolver::addImport(Symbol name) {
+	if (streaming_) {
+		scope_.defineImport(name);
+	} else {
+		imports_.push_back(name);
+	}
+}
 
-			scope.pushScope();
-			scope.define("self");
-			for (Identifier &arg: methodDecl.args) {
-				scope.addDef(arg);
-			}
+// References are found in the order they're written in, and definitions
+// nearly so, so they're sorted by their offsets, which sit next to each
+// other, rather than by following each pointer, and only if they need it
+static void sortBySource(std::vector<const Identifier *> &idents) {
+	auto bySource = [](const Identifier *lhs, const Identifier *rhs) { return lhs->range.start < rhs->range.start; };
+	if (std::is_sorted(idents.begin(), idents.end(), bySource)) {
+		return;
+	}
 
-			finalizeCodeBlock(scope, *methodDecl.body);
-			scope.popScope();
-		},
-	}, decl);
+	std::vector<std::pair<size_t, const Identifier *>> keyed;
+	keyed.reserve(idents.size());
+	for (const Identifier *ident: idents) {
+		keyed.emplace_back(ident->range.start, ident);
+	}
+
+	std::sort(keyed.begin(), keyed.end(), [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+	for (size_t i = 0; i < keyed.size(); ++i) {
+		idents[i] = keyed[i].second;
+	}
 }
 
-static void addDeclaration(ScopeStack &scope, Declaration &decl) {
-	std::visit(overloaded {
-		[&](ClassDecl &decl) {
-			scope.addDef(decl.ident);
-		},
-		[&](FuncDecl &decl) {
-			scope.addDef(decl.ident);
-		},
-		[&](MethodDecl &) { },
-	}, decl);
+// Trap walks take about as long as the rest of the 'finalize' step, and
+// only change anything for declarations with name errors. So a declaration
+// is resolved without them first, and if it has a name error or the scope
+// stack's checks fail, resolved again with them, which gives the same ids
+// and the same errors as always resolving with them.
+void IdentResolver::finalizeDecl(Declaration &decl, walk::Walker<false> &walker, std::vector<const Identifier *> *targets) {
+	size_t id = id_;
+	size_t defCount = defs_.size();
+	size_t refCount = refs_.size();
+	size_t targetCount = targets ? targets->size() : 0;
+	size_t depth = scope_.depth();
+	for (bool trapWalks: {false, true}) {
+		FinalizePass pass(scope_, trapWalks);
+		try {
+			if (targets) {
+				TargetPass targetPass(*targets);
+				walker(decl, pass, targetPass);
+			} else {
+				walker(decl, pass);
+			}
+			return;
+		} catch (ScopeStack::Unchecked &) {
+		} catch (NameError &) {
+			// A name error leaves the declaration's scopes behind
+			if (trapWalks) {
+				scope_.truncate(depth);
+				throw;
+			}
+		}
+
+		id_ = id;
+		defs_.resize(defCount);
+		refs_.resize(refCount);
+		if (targets) {
+			targets->resize(targetCount);
+		}
+		scope_.truncate(depth);
+	}
 }
 
-void IdentResolver::finalize() {
+void IdentResolver::finalize(std::vector<const Identifier *> *targets) {
 	scope_.pushScope();
 
+	for (Symbol name: imports_) {
+		scope_.defineImport(name);
+	}
+
 	for (auto decl: decls_) {
 		addDeclaration(scope_, *decl);
 	}
 
+	walk::Walker<false> walker;
 	for (auto decl: decls_) {
-		finalizeDeclaration(scope_, *decl);
+		finalizeDecl(*decl, walker, targets);
+		if (targets) {
+			targets->push_back(nullptr);
+		}
 	}
 
-	std::sort(defs_.begin(), defs_.end(), [](const Identifier *lhs, const Identifier *rhs) { return lhs->range.start < rhs->range.start; });
-	std::sort(refs_.begin(), refs_.end(), [](const Identifier *lhs, const Identifier *rhs) { return lhs->range.start < rhs->range.start; });
+	sortBySource(defs_);
+	sortBySource(refs_);
 
 	scope_.popScope();
 }
 
-void IdentResolver::finalizeBlock(CodeBlock &block) {
-	finalizeCodeBlock(scope_, block);
+void IdentResolver::beginStreaming() {
+	scope_.pushScope();
+	streaming_ = true;
+	for (Symbol name: imports_) {
+		scope_.defineImport(name);
+	}
 }
 
-static void resolveInDecl(const Declaration &decl, const std::string &name, std::vector<size_t> &ids);
-static void resolveInCodeBlock(const CodeBlock &block, const std::string &name, std::vector<size_t> &ids);
-
-static void resolveInExpression(const Expression &expr, const std::string &name, std::vector<size_t> &ids) {
+void IdentResolver::declare(const Declaration &decl) {
 	std::visit(overloaded {
-		[&](const StringLiteralExpr &) {},
-		[&](const NumberLiteralExpr &) {},
-		[&](const IdentifierExpr &ident) {
-			if (ident.ident.name == name) {
-				ids.push_back(ident.ident.id);
-			}
+		[&](const ClassDecl &decl) {
+			scope_.define(decl.ident.name);
 		},
-		[&](const BinaryExpr &bin) {
-			resolveInExpression(*bin.lhs, name, ids);
-			resolveInExpression(*bin.rhs, name, ids);
+		[&](const FuncDecl &decl) {
+			scope_.define(decl.ident.name);
 		},
-		[&](const FuncCallExpr &call) {
-			resolveInExpression(*call.func, name, ids);
-			for (const std::unique_ptr<Expression> &arg: call.args) {
-				resolveInExpression(*arg, name, ids);
-			}
-		},
-		[&](const AssignmentExpr &assignment) {
-			resolveInExpression(*assignment.lhs, name, ids);
-			resolveInExpression(*assignment.rhs, name, ids);
-		},
-		[&](const DeclAssignmentExpr &assignment) {
-			if (assignment.ident.name == name) {
-				ids.push_back(assignment.ident.id);
-			}
-			resolveInExpression(*assignment.rhs, name, ids);
-		},
-		[&](const LookupExpr &lookup) {
-			resolveInExpression(*lookup.lhs, name, ids);
-		},
-	}, expr);
+		[&](const MethodDecl &) { },
+	}, decl);
 }
 
-static void resolveInStatement(const Statement &statm, const std::string &name, std::vector<size_t> &ids) {
+void IdentResolver::finalizeOne(Declaration &decl, DeclNames *names) {
 	std::visit(overloaded {
-		[&](const Expression &expr) {
-			resolveInExpression(expr, name, ids);
-		},
-		[&](const IfStatm &ifStatm) {
-			resolveInExpression(ifStatm.condition, name, ids);
-			resolveInCodeBlock(*ifStatm.ifBody, name, ids);
-			if (ifStatm.elseBody) {
-				resolveInCodeBlock(*ifStatm.elseBody, name, ids);
-			}
-		},
-		[&](const WhileStatm &whileStatm) {
-			resolveInExpression(whileStatm.condition, name, ids);
-			resolveInCodeBlock(*whileStatm.body, name, ids);
+		[&](ClassDecl &decl) {
+			decl.ident.id = scope_.find(decl.ident.name);
+			addDef(&decl.ident);
 		},
-		[&](const ReturnStatm &ret) {
-			resolveInExpression(ret.expr, name, ids);
+		[&](FuncDecl &decl) {
+			decl.ident.id = scope_.find(decl.ident.name);
+			addDef(&decl.ident);
 		},
-		[&](const Declaration &decl) {
-			resolveInDecl(decl, name, ids);
-		}
-	}, statm);
-}
+		[&](MethodDecl &) { },
+	}, decl);
 
-static void resolveInCodeBlock(const CodeBlock &block, const std::string &name, std::vector<size_t> &ids) {
-	for (const Statement &statm: block.statms) {
-		resolveInStatement(statm, name, ids);
+	std::vector<const Identifier *> targets;
+	walk::Walker<false> walker;
+	finalizeDecl(decl, walker, names ? &targets : nullptr);
+	if (names) {
+		addNames(targets, *names);
 	}
-}
-
-static void resolveInDecl(const Declaration &decl, const std::string &name, std::vector<size_t> &ids) {
-	auto resolveInArgs = [&](const std::vector<Identifier> &args) {
-		for (const Identifier &ident: args) {
-			if (ident.name == name) {
-				ids.push_back(ident.id);
-			}
-		}
-	};
-
-	std::visit(overloaded {
-		[&](const ClassDecl &classDecl) {
-			if (classDecl.ident.name == name) {
-				ids.push_back(classDecl.ident.id);
-			}
-
-			resolveInArgs(classDecl.args);
-			resolveInCodeBlock(*classDecl.body, name, ids);
-		},
-		[&](const FuncDecl &funcDecl) {
-			if (funcDecl.ident.name == name) {
-				ids.push_back(funcDecl.ident.id);
-			}
 
-			resolveInArgs(funcDecl.args);
-			resolveInCodeBlock(*funcDecl.body, name, ids);
-		},
-		[&](const MethodDecl &methodDecl) {
-			if (methodDecl.ident.name == name) {
-				ids.push_back(methodDecl.ident.id);
-			}
-
-			resolveInArgs(methodDecl.args);
-			resolveInCodeBlock(*methodDecl.body, name, ids);
-		},
-	}, decl);
+	sortBySource(defs_);
+	sortBySource(refs_);
 }
 
-size_t resolveUpwardsInDecl(Declaration &decl, const std::string &name) {
-	std::vector<size_t> ids;
-	resolveInDecl(decl, name, ids);
-	if (ids.size() > 0) {
-		return ids.back();
-	}
-
-	return 0;
+void IdentResolver::finalizeBlock(CodeBlock &block) {
+	FinalizePass pass(scope_, true);
+	walk::walk(block, pass);
 }
 
-size_t resolveDownwardsInDecl(Declaration &decl, const std::string &name) {
-	std::vector<size_t> ids;
-	resolveInDecl(decl, name, ids);
-	if (ids.size() > 0) {
-		return ids.front();
+void dropMethodNames(DeclNames &names) {
+	for (auto it = names.begin(); it != names.end();) {
+		if (it->second.first == 0 && it->second.second == 0) {
+			it = names.erase(it);
+		} else {
+			++it;
+		}
 	}
+}
 
-	return 0;
+void collectNamesInDecl(const Declaration &decl, DeclNames &names) {
+	std::vector<const Identifier *> targets;
+	TargetPass pass(targets);
+	walk::walk(decl, pass);
+	addNames(targets, names);
 }
 
 }
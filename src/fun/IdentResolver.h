@@ -1,9 +1,12 @@
 #pragma once
 
 #include <unordered_map>
+#include <unordered_set>
 #include <cstddef>
+#include <cstdint>
 
 #include "ast.h"
+#include "walk.h"
 
 namespace fun {
 
@@ -17,63 +20,183 @@ struct NameError: public std::exception {
 	}
 };
 
+// For every name in a declaration which a LaFuN reference can find, the id
+// of its first and of its last identifier, in the order '@' and '!' search
+// a declaration in: its names, its parameters, then its body in pre-order.
+// Method names have no id, so when the first or last identifier with a name
+// is a method's, that id is 0, and the search goes on past the declaration.
+// Names only methods have aren't listed.
+using DeclNames = std::unordered_map<Symbol, std::pair<size_t, size_t>>;
+
 class IdentResolver;
 
+// The names in scope, kept as one table from each name to its innermost
+// definition, rather than a table per scope: pushing and popping a scope
+// costs nothing but the names it defined, and finding a name takes one
+// lookup however deep the scope is. Names are numbered in the order the
+// scope stack first sees them, so that the table grows with the documents
+// it resolves rather than with every name the process has interned.
 class ScopeStack {
 public:
 	ScopeStack(IdentResolver &resolver): resolver_(resolver) {
-		scopes_.emplace_back();
+		scopes_.push_back({0, 0});
 	}
 
+	// Thrown by addCheckedRedef() when the name might have been referred to
+	// before this definition
+	struct Unchecked {};
+
 	void pushScope();
 	void popScope();
+	size_t depth() const { return scopes_.size(); }
+	void truncate(size_t depth);
 
 	void addDef(ast::Identifier &ident);
 	void addRedef(ast::Identifier &ident);
 	void addRef(ast::Identifier &ident);
 
-	void addBuiltin(const std::string &name);
+	// For when the names the scope's expressions declare weren't made traps
+	// beforehand. Resolving then gives the same ids, unless a trap would
+	// have been hit: either a reference to the name since the scope began
+	// found it outside the scope, or the scope declares a function or class
+	// of the same name.
+	void addCheckedRedef(ast::Identifier &ident);
+
+	void addBuiltin(Symbol name);
 
-	size_t define(const std::string &name);
-	size_t redefine(const std::string &name);
-	size_t defineTrap(const std::string &name);
+	// Names in this set resolve as builtins when nothing else matches.
+	// The set isn't copied, and must outlive the scope stack.
+	void addBuiltins(const std::unordered_set<Symbol> &names) { builtins_ = &names; }
 
-	size_t find(const std::string &name);
-	size_t tryFind(const std::string &name);
+	size_t define(Symbol name);
+	size_t redefine(Symbol name);
+	size_t defineTrap(Symbol name);
+	void defineImport(Symbol name);
+
+	size_t find(Symbol name);
+	size_t tryFind(Symbol name);
 
 private:
-	using Scope = std::unordered_map<std::string, size_t>;
+	static constexpr uint32_t NONE = ~(uint32_t)0;
+
+	struct Name {
+		uint32_t innermost = NONE;
+
+		// Lookups which found the name outside the innermost scope:
+		// the shallowest scope one went past, and when the last one was
+		uint32_t passedScope = NONE;
+		uint64_t passedAt = 0;
+	};
+
+	// A name's definition in one scope, and the definition it hides
+	struct Def {
+		size_t id;
+		uint32_t name; // in names_
+		uint32_t hidden;
+		uint32_t scope;
+		bool declared;
+	};
+
+	// Scopes are numbered in the order they begin
+	struct Scope {
+		uint32_t firstDef;
+		uint64_t serial;
+	};
+
+	// The name's definition in the innermost scope, which is a new one
+	// unless the name is already defined there
+	Def &bind(Symbol name, bool unique);
+	void unbind(size_t count);
+	void passed(Name &name, uint32_t scope);
+	Name &entry(Symbol name);
+	uint32_t index(Symbol name);
+
+	// From symbol ids to their number in names_, with open addressing
+	struct Slot {
+		uint32_t symbol;
+		uint32_t index;
+	};
+
+	void place(const Slot &slot);
+
+	std::vector<Slot> slots_ = std::vector<Slot>(64, {NONE, 0});
+	int slotBits_ = 6;
+	std::vector<Name> names_;
+	std::vector<Def> defs_;
 	std::vector<Scope> scopes_;
+	uint64_t serial_ = 0;
+	std::unordered_set<Symbol> ownBuiltins_;
+	const std::unordered_set<Symbol> *builtins_ = nullptr;
 	IdentResolver &resolver_;
 
 	static constexpr size_t TRAP = ~(size_t)0;
 	static constexpr size_t BUILTIN = ~(size_t)1;
+
+public:
+	// Names imported from another module all have this id
+	static constexpr size_t IMPORTED = ~(size_t)2;
 };
 
 class IdentResolver {
 public:
 	void add(ast::Declaration *decl);
-	void finalize();
+
+	// With targets, the identifiers collectNamesInDecl would go through are
+	// also listed while finalizing, instead of in a walk of their own: each
+	// declaration's, in order, followed by a null
+	void finalize(std::vector<const ast::Identifier *> *targets = nullptr);
 	size_t nextId() { return id_++; }
 
 	void finalizeBlock(ast::CodeBlock &block);
 
-	void addDef(const ast::Identifier *ident) { defs_.push_back(ident); }
-	void addRef(const ast::Identifier *ident) { refs_.push_back(ident); }
-	void addBuiltin(const std::string &name) { scope_.addBuiltin(name); }
+	// Streaming interface: after beginStreaming(), every top-level
+	// declaration is passed to declare() in document order, then to
+	// finalizeOne() in the same order. This assigns the same ids as add()
+	// and finalize() would, without keeping every declaration alive.
+	// If finalizeOne() throws, the next declaration can still be finalized.
+	// With names, it also collects the declaration's names, in the same walk.
+	void beginStreaming();
+	void declare(const ast::Declaration &decl);
+	void finalizeOne(ast::Declaration &decl, DeclNames *names = nullptr);
+	void clearDefsAndRefs() { defs_.clear(); refs_.clear(); }
+
+	// For callers which reuse a declaration's earlier results instead of
+	// finalizing it again: the ids it would have used are skipped
+	size_t peekId() const { return id_; }
+	void skipIds(size_t n) { id_ += n; }
+
+	// For callers which only need the ids, getDefs() and getRefs() stay empty
+	void skipDefsAndRefs() { keepDefsAndRefs_ = false; }
+
+	void addDef(const ast::Identifier *ident) { if (keepDefsAndRefs_) defs_.push_back(ident); }
+	void addRef(const ast::Identifier *ident) { if (keepDefsAndRefs_) refs_.push_back(ident); }
+	void addBuiltin(Symbol name) { scope_.addBuiltin(name); }
+	void addBuiltins(const std::unordered_set<Symbol> &names) { scope_.addBuiltins(names); }
+
+	// A name from another module's interface. It resolves like a builtin,
+	// but clashes with top-level names like another top-level name would.
+	void addImport(Symbol name);
 
 	const std::vector<const ast::Identifier *> &getDefs() const { return defs_; }
 	const std::vector<const ast::Identifier *> &getRefs() const { return refs_; }
 
 private:
+	void finalizeDecl(ast::Declaration &decl, walk::Walker<false> &walker, std::vector<const ast::Identifier *> *targets);
+
 	std::vector<ast::Declaration *> decls_;
+	std::vector<Symbol> imports_;
+	bool streaming_ = false;
 	std::vector<const ast::Identifier *> defs_;
 	std::vector<const ast::Identifier *> refs_;
+	bool keepDefsAndRefs_ = true;
 	size_t id_ = 1;
 	ScopeStack scope_{*this};
 };
 
-size_t resolveUpwardsInDecl(ast::Declaration &decl, const std::string &name);
-size_t resolveDownwardsInDecl(ast::Declaration &decl, const std::string &name);
+// Collect a resolved declaration's names, like finalizeOne() does
+void collectNamesInDecl(const ast::Declaration &decl, DeclNames &names);
+
+// Remove the names only methods have, once a declaration's names are collected
+void dropMethodNames(DeclNames &names);
 
 }
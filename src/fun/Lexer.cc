@@ -1,8 +1,14 @@
 #include "Lexer.h"
 
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <sstream>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 
+#include "Scan.h"
 #include "util.h"
 
 namespace fun {
@@ -26,124 +32,332 @@ static char parseDigit(char ch, int radix) {
 	return -1;
 }
 
-static double parseDigitString(const std::string &digits, int radix) {
+// The digits of a decimal literal, with an optional fraction, rounded to
+// the nearest double
+static double parseDecimal(std::string_view digits) {
 	double num = 0;
-	double mult = 1;
-	for (ssize_t idx = digits.size() - 1; idx >= 0; --idx) {
-		num += digits[idx] * mult;
-		mult *= radix;
+	auto result = std::from_chars(digits.data(), digits.data() + digits.size(), num);
+	if (result.ec == std::errc::result_out_of_range) {
+		// Too large for a double if there's anything before the point,
+		// otherwise too small
+		std::string_view integral = digits.substr(0, digits.find('.'));
+		num = integral.find_first_not_of('0') == std::string_view::npos ? 0 : HUGE_VAL;
 	}
 
 	return num;
 }
 
-std::string Token::toString() {
-	std::string str;
-	str += std::to_string(line);
-	str += ":";
-	str += std::to_string(column);
-	str += ": ";
-
-	str += kindToString(kind);
-
-	if (std::holds_alternative<std::string>(val)) {
-		str += "; string: '";
-		str += std::get<std::string>(val);
-		str += '\'';
-	} else if (std::holds_alternative<double>(val)) {
-		str += "; number: ";
-		str += std::to_string(std::get<double>(val));
+// The digits of a binary, octal or hexadecimal literal, with an optional
+// fraction, rounded to the nearest double. The first 64 bits of digits are
+// kept and the rest only matter for rounding, so they're folded into the
+// lowest bit, well below the 53 bits a double keeps.
+static double parseRadix(std::string_view digits, int radix) {
+	int bits = radix == 16 ? 4 : radix == 8 ? 3 : 1;
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	bool sticky = false;
+	bool fraction = false;
+	for (char ch: digits) {
+		if (ch == '.') {
+			fraction = true;
+			continue;
+		}
+
+		uint64_t digit = parseDigit(ch, radix);
+		if (mantissa >> (64 - bits) == 0) {
+			mantissa = mantissa << bits | digit;
+			if (fraction) {
+				exponent -= bits;
+			}
+		} else {
+			sticky = sticky || digit != 0;
+			if (!fraction) {
+				exponent += bits;
+			}
+		}
 	}
 
-	return str;
+	return std::ldexp((double)(mantissa | sticky), exponent);
 }
 
-std::string Token::kindToString(TokKind kind) {
-	switch (kind) {
-	case TokKind::IDENT: return "IDENT";
-	case TokKind::NUMBER: return "NUMBER";
-	case TokKind::STRING: return "STRING";
-	case TokKind::OPEN_BRACE: return "OPEN_BRACE";
-	case TokKind::CLOSE_BRACE: return "CLOSE_BRACE";
-	case TokKind::OPEN_PAREN: return "OPEN_PAREN";
-	case TokKind::CLOSE_PAREN: return "CLOSE_PAREN";
-	case TokKind::OPEN_BRACKET: return "OPEN_BRACKET";
-	case TokKind::CLOSE_BRACKET: return "CLOSE_BRACKET";
-	case TokKind::BACKSLASH: return "BACKSLASH";
-	case TokKind::SEMICOLON: return "SEMICOLON";
-	case TokKind::COMMA: return "COMMA";
-	case TokKind::DOT: return "DOT";
-	case TokKind::EQEQ: return "EQEQ";
-	case TokKind::NOTEQ: return "NOTEQ";
-	case TokKind::GT: return "GT";
-	case TokKind::GTEQ: return "GTEQ";
-	case TokKind::LT: return "LT";
-	case TokKind::LTEQ: return "LTEQ";
-	case TokKind::COLONEQ: return "COLONEQ";
-	case TokKind::EQ: return "EQ";
-	case TokKind::PLUS: return "PLUS";
-	case TokKind::PLUSEQ: return "PLUSEQ";
-	case TokKind::MINUS: return "MINUS";
-	case TokKind::MINUSEQ: return "MINUSEQ";
-	case TokKind::MULT: return "MULT";
-	case TokKind::MULTEQ: return "MULTEQ";
-	case TokKind::DIV: return "DIV";
-	case TokKind::DIVEQ: return "DIVEQ";
-	case TokKind::COLONCOLON: return "COLONCOLON";
-	case TokKind::IF: return "IF";
-	case TokKind::ELSE: return "ELSE";
-	case TokKind::WHILE: return "WHILE";
-	case TokKind::RETURN: return "RETURN";
-	case TokKind::E_O_F: return "E_O_F";
+namespace {
+
+// Every token kind, in the order of the TokKind enum, with its name and,
+// for operators and keywords, its spelling. The lexer's dispatch and
+// keyword tables below are generated from this at compile time, so adding
+// an operator or keyword only takes a line here and in the enum.
+struct Spelling {
+	TokKind kind;
+	const char *name;
+	std::string_view text;
+};
+
+constexpr Spelling spellings[] = {
+	{TokKind::IDENT, "IDENT", {}},
+	{TokKind::NUMBER, "NUMBER", {}},
+	{TokKind::STRING, "STRING", {}},
+
+	{TokKind::OPEN_BRACE, "OPEN_BRACE", "{"},
+	{TokKind::CLOSE_BRACE, "CLOSE_BRACE", "}"},
+	{TokKind::OPEN_PAREN, "OPEN_PAREN", "("},
+	{TokKind::CLOSE_PAREN, "CLOSE_PAREN", ")"},
+	{TokKind::OPEN_BRACKET, "OPEN_BRACKET", "["},
+	{TokKind::CLOSE_BRACKET, "CLOSE_BRACKET", "]"},
+
+	{TokKind::BACKSLASH, "BACKSLASH", "\\"},
+	{TokKind::SEMICOLON, "SEMICOLON", ";"},
+	{TokKind::COMMA, "COMMA", ","},
+	{TokKind::DOT, "DOT", "."},
+	{TokKind::EQEQ, "EQEQ", "=="},
+	{TokKind::NOTEQ, "NOTEQ", "!="},
+	{TokKind::GT, "GT", ">"},
+	{TokKind::GTEQ, "GTEQ", ">="},
+	{TokKind::LT, "LT", "<"},
+	{TokKind::LTEQ, "LTEQ", "<="},
+	{TokKind::COLONEQ, "COLONEQ", ":="},
+	{TokKind::EQ, "EQ", "="},
+	{TokKind::PLUS, "PLUS", "+"},
+	{TokKind::PLUSEQ, "PLUSEQ", "+="},
+	{TokKind::MINUS, "MINUS", "-"},
+	{TokKind::MINUSEQ, "MINUSEQ", "-="},
+	{TokKind::MULT, "MULT", "*"},
+	{TokKind::MULTEQ, "MULTEQ", "*="},
+	{TokKind::DIV, "DIV", "/"},
+	{TokKind::DIVEQ, "DIVEQ", "/="},
+	{TokKind::COLONCOLON, "COLONCOLON", "::"},
+
+	{TokKind::IF, "IF", "if"},
+	{TokKind::ELSE, "ELSE", "else"},
+	{TokKind::WHILE, "WHILE", "while"},
+	{TokKind::RETURN, "RETURN", "return"},
+
+	{TokKind::E_O_F, "E_O_F", {}},
+};
+
+constexpr size_t NUM_KINDS = sizeof(spellings) / sizeof(*spellings);
+
+constexpr bool spellingsInOrder() {
+	for (size_t i = 0; i < NUM_KINDS; ++i) {
+		if ((size_t)spellings[i].kind != i) {
+			return false;
+		}
 	}
 
-	return "(unknown)";
+	return true;
+}
+
+static_assert(spellingsInOrder(), "spellings must list every TokKind in order");
+static_assert(NUM_KINDS == (size_t)TokKind::E_O_F + 1, "spellings must list every TokKind");
+
+constexpr bool isIdentStart(int ch) {
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
 }
 
-Token &Lexer::peek(size_t n) {
-	assert(n < sizeof(buffer_) / sizeof(*buffer_));
-	while (n >= bufidx_) {
-		buffer_[bufidx_++] = readTok();
+// What the lexer does with a token's first byte
+enum class ByteClass: uint8_t {
+	INVALID,
+	OPERATOR,
+	STRING,
+	NUMBER,
+	IDENT,
+	E_O_F,
+};
+
+// For an OPERATOR byte, the operator spelled by the byte alone (or E_O_F
+// if there isn't one), and the range of two-byte operators in pairs which
+// start with it. A two-byte operator is tried before the one-byte one.
+struct ByteAction {
+	ByteClass cls = ByteClass::INVALID;
+	TokKind single = TokKind::E_O_F;
+	uint8_t firstPair = 0;
+	uint8_t numPairs = 0;
+};
+
+struct Pair {
+	char second = 0;
+	TokKind kind = TokKind::E_O_F;
+};
+
+struct Dispatch {
+	std::array<ByteAction, 256> actions{};
+	std::array<Pair, NUM_KINDS> pairs{};
+};
+
+constexpr Dispatch makeDispatch() {
+	Dispatch dispatch;
+	for (int ch = 0; ch < 256; ++ch) {
+		ByteAction &action = dispatch.actions[ch];
+		if (isIdentStart(ch)) {
+			action.cls = ByteClass::IDENT;
+		} else if (ch >= '0' && ch <= '9') {
+			action.cls = ByteClass::NUMBER;
+		} else if (ch == '"' || ch == '\'') {
+			action.cls = ByteClass::STRING;
+		}
 	}
 
-	return buffer_[n];
+	// EOF reads as -1, as does a 0xff byte
+	dispatch.actions[(unsigned char)EOF].cls = ByteClass::E_O_F;
+
+	size_t numPairs = 0;
+	for (int ch = 0; ch < 256; ++ch) {
+		ByteAction &action = dispatch.actions[ch];
+		action.firstPair = numPairs;
+		for (const Spelling &spelling: spellings) {
+			std::string_view text = spelling.text;
+			if (text.empty() || isIdentStart(text[0]) || (unsigned char)text[0] != ch) {
+				continue;
+			}
+
+			action.cls = ByteClass::OPERATOR;
+			if (text.size() == 1) {
+				action.single = spelling.kind;
+			} else {
+				dispatch.pairs[numPairs++] = {text[1], spelling.kind};
+			}
+		}
+		action.numPairs = numPairs - action.firstPair;
+	}
+
+	return dispatch;
+}
+
+constexpr Dispatch dispatch = makeDispatch();
+
+// Keywords are found with a perfect hash of their first and last bytes
+// and their length; the multiplier is searched for at compile time
+constexpr size_t KEYWORD_SLOTS = 8;
+
+constexpr size_t keywordHash(std::string_view text, unsigned mult) {
+	return ((unsigned char)text.front() * mult + (unsigned char)text.back() + text.size()) % KEYWORD_SLOTS;
 }
 
-Token Lexer::consume() {
-	if (bufidx_ == 0) {
-		buffer_[bufidx_++] = readTok();
+struct Keywords {
+	unsigned mult = 0;
+	size_t minSize = SIZE_MAX;
+	size_t maxSize = 0;
+	std::array<TokKind, KEYWORD_SLOTS> slots{};
+};
+
+constexpr Keywords makeKeywords() {
+	for (unsigned mult = 1; mult < 256; ++mult) {
+		Keywords keywords;
+		keywords.mult = mult;
+		for (TokKind &slot: keywords.slots) {
+			slot = TokKind::IDENT;
+		}
+
+		bool collision = false;
+		for (const Spelling &spelling: spellings) {
+			std::string_view text = spelling.text;
+			if (text.empty() || !isIdentStart(text[0])) {
+				continue;
+			}
+
+			TokKind &slot = keywords.slots[keywordHash(text, mult)];
+			if (slot != TokKind::IDENT) {
+				collision = true;
+				break;
+			}
+
+			slot = spelling.kind;
+			keywords.minSize = std::min(keywords.minSize, text.size());
+			keywords.maxSize = std::max(keywords.maxSize, text.size());
+		}
+
+		if (!collision) {
+			return keywords;
+		}
+	}
+
+	return Keywords();
+}
+
+constexpr Keywords keywords = makeKeywords();
+static_assert(keywords.mult != 0, "no perfect hash for the keywords; grow KEYWORD_SLOTS");
+
+// The keyword spelled by text, or IDENT
+TokKind findKeyword(std::string_view text) {
+	if (text.size() < keywords.minSize || text.size() > keywords.maxSize) {
+		return TokKind::IDENT;
 	}
 
-	Token tok = std::move(buffer_[0]);
-	for (size_t i = 0; i < bufidx_ - 1; ++i) {
-		buffer_[i] = std::move(buffer_[i + 1]);
+	TokKind kind = keywords.slots[keywordHash(text, keywords.mult)];
+	if (kind != TokKind::IDENT && spellings[(size_t)kind].text == text) {
+		return kind;
 	}
-	bufidx_ -= 1;
 
-	return tok;
+	return TokKind::IDENT;
 }
 
-void Lexer::reset() {
-	reader_.reset();
-	bufidx_ = 0;
 }
 
-void Lexer::skipWhitespace() {
-	while (true) {
-		int ch = peekCh(0);
-		if (ch != ' ' && ch != '\t' && ch != '\n') {
-			break;
+std::string kindToString(TokKind kind) {
+	if ((size_t)kind < NUM_KINDS) {
+		return spellings[(size_t)kind].name;
+	}
+
+	return "(unknown)";
+}
+
+Lexer::Lexer(const Reader &reader):
+		reader_(reader), source_(reader.string()),
+		startIdx_(reader.idx), idx_(reader.idx) {
+	// Most declarations are a few hundred tokens
+	kinds_.reserve(256);
+	starts_.reserve(256);
+	ends_.reserve(256);
+	payloads_.reserve(256);
+}
+
+void Lexer::lexMore(size_t idx) {
+	while (idx >= kinds_.size()) {
+		if (error_) {
+			std::rethrow_exception(error_);
 		}
 
-		readCh();
+		lexGroup();
 	}
 }
 
-Token Lexer::readString() {
+// Lex up to and including the '}' which closes the next top-level brace
+// group, or up to the end of the input
+void Lexer::lexGroup() {
+	size_t depth = 0;
+	try {
+		while (true) {
+			TokKind kind = readTok();
+			if (kind == TokKind::OPEN_BRACE) {
+				depth += 1;
+			} else if (kind == TokKind::CLOSE_BRACE) {
+				if (depth <= 1) {
+					return;
+				}
+
+				depth -= 1;
+			} else if (kind == TokKind::E_O_F) {
+				return;
+			}
+		}
+	} catch (LexError &) {
+		error_ = std::current_exception();
+	}
+}
+
+void Lexer::skipWhitespace() {
+	idx_ = scan::whitespace(source_, idx_);
+}
+
+TokKind Lexer::readString() {
 	std::string str;
 	char terminator = readCh();
 
 	while (true) {
+		// Copy everything up to the next quote or escape at once
+		size_t end = scan::string(source_, idx_, terminator);
+		str.append(source_, idx_, end - idx_);
+		idx_ = end;
+
 		int ch = readCh();
 		if (ch == EOF) {
 			error("Unexpected EOF");
@@ -169,22 +383,23 @@ Token Lexer::readString() {
 				error(concat("Unexpected escape character '", (char)ch, '\''));
 			}
 		} else if (ch == terminator) {
-			return makeTok(TokKind::STRING, std::move(str));
+			strings_.push_back(std::move(str));
+			return makeTok(TokKind::STRING, strings_.size() - 1);
 		} else {
 			str += ch;
 		}
 	}
 }
 
-Token Lexer::readNumber() {
+TokKind Lexer::readNumber() {
 	int radix = 10;
-	if (peekCh(0) == 0 && peekCh(1) == 'x') {
+	if (peekCh(0) == '0' && peekCh(1) == 'x') {
 		radix = 16;
 		readCh(); readCh();
-	} else if (peekCh(0) == 0 && peekCh(1) == 'b') {
+	} else if (peekCh(0) == '0' && peekCh(1) == 'b') {
 		radix = 2;
 		readCh(); readCh();
-	} else if (peekCh(0) == 0 && peekCh(1) == 'o') {
+	} else if (peekCh(0) == '0' && peekCh(1) == 'o') {
 		radix = 8;
 		readCh(); readCh();
 	}
@@ -193,165 +408,69 @@ Token Lexer::readNumber() {
 		error("Invalid number");
 	}
 
-	char digit;
-	std::string digits = "";
-
-	double integral;
-	while ((digit = parseDigit(peekCh(0), radix)) >= 0) {
-		digits += digit;
+	size_t start = idx_;
+	while (parseDigit(peekCh(0), radix) >= 0) {
 		readCh();
 	}
-	integral = parseDigitString(digits, radix);
 
-	double fractional = 0;
 	if (peekCh(0) == '.' && parseDigit(peekCh(1), radix) >= 0) {
 		readCh();
-		digits = "";
-		while ((digit = parseDigit(peekCh(0), radix)) >= 0) {
-			digits += digit;
+		while (parseDigit(peekCh(0), radix) >= 0) {
 			readCh();
 		}
-		fractional = parseDigitString(digits, radix);
-
-		double div = 1;
-		for (size_t i = 0; i < digits.size(); ++i) {
-			div *= radix;
-		}
-
-		fractional /= div;
 	}
 
-	return makeTok(TokKind::NUMBER, integral + fractional);
+	std::string_view digits = source_.substr(start, idx_ - start);
+	numbers_.push_back(radix == 10 ? parseDecimal(digits) : parseRadix(digits, radix));
+	return makeTok(TokKind::NUMBER, numbers_.size() - 1);
 }
 
-Token Lexer::readIdent() {
-	std::string str;
-	str += readCh();
-
-	while (true) {
-		int ch = peekCh(0);
-		if (!(
-				(ch >= 'a' && ch <= 'z') ||
-				(ch >= 'A' && ch <= 'Z') ||
-				(ch >= '0' && ch <= '9') ||
-				ch == '_')) {
-			break;
-		}
+TokKind Lexer::readIdent() {
+	readCh();
+	idx_ = scan::ident(source_, idx_);
 
-		str += ch;
-		readCh();
+	std::string_view text = source_.substr(tokStartIdx_, idx_ - tokStartIdx_);
+	TokKind keyword = findKeyword(text);
+	if (keyword != TokKind::IDENT) {
+		return makeTok(keyword);
 	}
 
-	return makeTok(TokKind::IDENT, std::move(str));
+	return makeTok(TokKind::IDENT, Symbol(text).id());
 }
 
-Token Lexer::readTok() {
+TokKind Lexer::readTok() {
 	skipWhitespace();
 
-	tokStartIdx_ = reader_.idx;
+	tokStartIdx_ = idx_;
 
 	int ch = peekCh(0);
-	switch (ch) {
-	case '{': readCh(); return makeTok(TokKind::OPEN_BRACE);
-	case '}': readCh(); return makeTok(TokKind::CLOSE_BRACE);
-	case '(': readCh(); return makeTok(TokKind::OPEN_PAREN);
-	case ')': readCh(); return makeTok(TokKind::CLOSE_PAREN);
-	case '[': readCh(); return makeTok(TokKind::OPEN_BRACKET);
-	case ']': readCh(); return makeTok(TokKind::CLOSE_BRACKET);
-	case '\\': readCh(); return makeTok(TokKind::BACKSLASH);
-	case ';': readCh(); return makeTok(TokKind::SEMICOLON);
-	case ',': readCh(); return makeTok(TokKind::COMMA);
-	case '.': readCh(); return makeTok(TokKind::DOT);
-	case EOF: readCh(); return makeTok(TokKind::E_O_F);
-	}
-
-	int ch2 = peekCh(1);
-	if (ch == '=' && ch2 == '=') {
-		readCh(); readCh();
-		return makeTok(TokKind::EQEQ);
-	} else if (ch == '!' && ch2 == '=') {
-		readCh(); readCh();
-		return makeTok(TokKind::NOTEQ);
-	} else if (ch == '>' && ch2 == '=') {
-		readCh(); readCh();
-		return makeTok(TokKind::GTEQ);
-	} else if (ch == '>') {
-		readCh();
-		return makeTok(TokKind::GT);
-	} else if (ch == '<' && ch2 == '=') {
-		readCh(); readCh();
-		return makeTok(TokKind::LTEQ);
-	} else if (ch == '<') {
-		readCh();
-		return makeTok(TokKind::LT);
-	} else if (ch == ':' && ch2 == '=') {
-		readCh(); readCh();
-		return makeTok(TokKind::COLONEQ);
-	} else if (ch == '=') {
-		readCh();
-		return makeTok(TokKind::EQ);
-	} else if (ch == '+' && ch2 == '=') {
-		readCh(); readCh();
-		return makeTok(TokKind::PLUSEQ);
-	} else if (ch == '+') {
-		readCh();
-		return makeTok(TokKind::PLUS);
-	} else if (ch == '-' && ch2 == '=') {
-		readCh(); readCh();
-		return makeTok(TokKind::MINUSEQ);
-	} else if (ch == '-') {
-		readCh();
-		return makeTok(TokKind::MINUS);
-	} else if (ch == '*' && ch2 == '=') {
-		readCh(); readCh();
-		return makeTok(TokKind::MULTEQ);
-	} else if (ch == '*') {
-		readCh(); readCh();
-		return makeTok(TokKind::MULT);
-	} else if (ch == '/' && ch2 == '=') {
-		readCh(); readCh();
-		return makeTok(TokKind::DIVEQ);
-	} else if (ch == '/') {
-		readCh();
-		return makeTok(TokKind::DIV);
-	} else if (ch == ':' && ch2 == ':') {
-		readCh(); readCh();
-		return makeTok(TokKind::COLONCOLON);
-	}
-
-	if (ch == '"' || ch == '\'') {
-		return readString();
-	} else if (ch >= '0' && ch <= '9') {
-		return readNumber();
-	} else if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_') {
-		Token ident = readIdent();
-		if (ident.kind != TokKind::IDENT) {
-			return ident;
+	const ByteAction &action = dispatch.actions[(unsigned char)ch];
+	switch (action.cls) {
+	case ByteClass::OPERATOR: {
+		int ch2 = peekCh(1);
+		for (size_t i = action.firstPair; i < action.firstPair + action.numPairs; ++i) {
+			if (dispatch.pairs[i].second == ch2) {
+				idx_ += 2;
+				return makeTok(dispatch.pairs[i].kind);
+			}
 		}
 
-		std::string str = std::get<std::string>(ident.val);
-		if (str == "if") {
-			return makeTok(TokKind::IF);
-		} else if (str == "else") {
-			return makeTok(TokKind::ELSE);
-		} else if (str == "while") {
-			return makeTok(TokKind::WHILE);
-		} else if (str == "return") {
-			return makeTok(TokKind::RETURN);
+		if (action.single == TokKind::E_O_F) {
+			break;
 		}
 
-		return ident;
+		readCh();
+		return makeTok(action.single);
+	}
+
+	case ByteClass::STRING: return readString();
+	case ByteClass::NUMBER: return readNumber();
+	case ByteClass::IDENT: return readIdent();
+	case ByteClass::E_O_F: readCh(); return makeTok(TokKind::E_O_F);
+	case ByteClass::INVALID: break;
 	}
 
 	error(concat("Unexpected character: '", (char)ch, '\''));
 }
 
-int Lexer::readCh() {
-	return reader_.readCh();
-}
-
-int Lexer::peekCh(size_t n) {
-	return reader_.peekCh(n);
-}
-
 }
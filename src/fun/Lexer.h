@@ -1,18 +1,22 @@
 #pragma once
 
+#include <exception>
 #include <string>
-#include <cstddef>
-#include <variant>
+#include <string_view>
 #include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 
 #include "Reader.h"
 #include "ByteRange.h"
+#include "Symbol.h"
 
 namespace fun {
 
 struct LexError: public std::exception {
 	LexError(int line, int column, std::string message):
-			line(line), column(column) {
+			line(line), column(column), message(message) {
 		error = std::to_string(line);
 		error += ":";
 		error += std::to_string(column);
@@ -20,8 +24,12 @@ struct LexError: public std::exception {
 		error += message;
 	}
 
+	LexError(Location loc, std::string message):
+		LexError(loc.line, loc.column, std::move(message)) {}
+
 	int line;
 	int column;
+	std::string message;
 	std::string error;
 
 	const char *what() const noexcept override {
@@ -29,7 +37,7 @@ struct LexError: public std::exception {
 	}
 };
 
-enum class TokKind {
+enum class TokKind: uint8_t {
 	IDENT,
 	NUMBER,
 	STRING,
@@ -59,64 +67,98 @@ enum class TokKind {
 	E_O_F,
 };
 
-struct Token {
-	TokKind kind;
-	int line;
-	int column;
-	ByteRange range;
+std::string kindToString(TokKind kind);
 
-	struct Empty {};
-	std::variant<Empty, std::string, double> val;
+// The tokens of a FuN declaration, lexed ahead of the parser into parallel
+// arrays, so that looking at a token is an index rather than a copy.
+// Lexing goes one top-level brace group at a time, so a declaration is
+// lexed up to its closing brace and no further, unless the parser asks for
+// more. A lex error is kept until the parser reaches the token it's in.
+class Lexer {
+public:
+	Lexer(std::string_view string): Lexer(Reader(string)) {}
+	Lexer(const Reader &reader);
 
-	std::string &getStr() { return std::get<std::string>(val); }
-	double getNum() { return std::get<double>(val); }
+	TokKind kind(size_t n = 0) { fill(n); return kinds_[pos_ + n]; }
+	ByteRange range(size_t n = 0) { fill(n); return {starts_[pos_ + n], ends_[pos_ + n]}; }
 
-	std::string toString();
-	static std::string kindToString(TokKind kind);
-};
+	// Identifiers are interned as they're lexed
+	Symbol ident(size_t n = 0) { fill(n); return Symbol::fromId(payloads_[pos_ + n]); }
 
-class Lexer {
-public:
-	Lexer(std::string_view string): reader_(string) {}
-	Lexer(const Reader &reader): reader_(reader) {}
+	// The contents of a string literal, with its escapes replaced
+	std::string &str(size_t n = 0) { fill(n); return strings_[payloads_[pos_ + n]]; }
+	double num(size_t n = 0) { fill(n); return numbers_[payloads_[pos_ + n]]; }
 
-	Token &peek(size_t n);
-	Token consume();
+	void consume() { fill(0); pos_ += 1; }
 
-	void reset();
+	// Just past the last consumed token
+	size_t offset() const { return pos_ == 0 ? startIdx_ : ends_[pos_ - 1]; }
 
-	Reader reader_;
+	Location location(size_t offset) const { return reader_.location(offset); }
 
 private:
+	void fill(size_t n) {
+		if (pos_ + n >= kinds_.size()) {
+			lexMore(pos_ + n);
+		}
+	}
+
+	void lexMore(size_t idx);
+	void lexGroup();
+
 	void skipWhitespace();
 
-	Token readString();
-	Token readNumber();
-	Token readIdent();
+	TokKind readString();
+	TokKind readNumber();
+	TokKind readIdent();
 
-	Token readTok();
+	TokKind readTok();
 
-	Token makeTok(TokKind kind) {
-		return {kind, reader_.line, reader_.column, {tokStartIdx_, reader_.idx}, {}};
+	TokKind makeTok(TokKind kind, size_t payload = 0) {
+		kinds_.push_back(kind);
+		starts_.push_back(tokStartIdx_);
+		ends_.push_back(idx_);
+		payloads_.push_back(payload);
+		return kind;
 	}
 
-	Token makeTok(TokKind kind, std::string &&str) {
-		return {kind, reader_.line, reader_.column, {tokStartIdx_, reader_.idx}, std::move(str)};
-	}
+	[[noreturn]]
+	void error(std::string &&message) { throw LexError(reader_.location(idx_), std::move(message)); }
+
+	int readCh() {
+		if (idx_ >= source_.size()) {
+			return EOF;
+		}
 
-	Token makeTok(TokKind kind, double num) {
-		return {kind, reader_.line, reader_.column, {tokStartIdx_, reader_.idx}, num};
+		return source_[idx_++];
 	}
 
-	[[noreturn]]
-	void error(std::string &&message) { throw LexError(reader_.line, reader_.column, std::move(message)); }
+	int peekCh(size_t n) const {
+		if (idx_ + n >= source_.size()) {
+			return EOF;
+		}
 
-	int readCh();
-	int peekCh(size_t n);
+		return source_[idx_ + n];
+	}
 
-	Token buffer_[4];
-	size_t bufidx_ = 0;
+	Reader reader_;
+	std::string_view source_;
+	size_t startIdx_;
+	size_t idx_;
 	size_t tokStartIdx_;
+
+	// One entry per token; the payload is an identifier's symbol id,
+	// or indexes strings_ or numbers_
+	std::vector<TokKind> kinds_;
+	std::vector<size_t> starts_;
+	std::vector<size_t> ends_;
+	std::vector<uint32_t> payloads_;
+
+	std::vector<std::string> strings_;
+	std::vector<double> numbers_;
+
+	size_t pos_ = 0;
+	std::exception_ptr error_;
 };
 
 }
@@ -0,0 +1,191 @@
+#include "Symbol.h"
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <shared_mutex>
+#include <unordered_map>
+#include <cassert>
+#include <cstring>
+
+namespace fun {
+
+namespace {
+
+// Names are stored in chunks which double in size and never move,
+// so that a symbol's name can be read without taking the lock
+class Interner {
+public:
+	Interner() {
+		// The empty name is id 0, then the ids in sym
+		for (std::string_view name: {"", "if", "else", "while", "return", "class", "fun", "self"}) {
+			intern(name);
+		}
+
+		assert(*find("self") == sym::SELF.id());
+	}
+
+	uint32_t intern(std::string_view name) {
+		if (auto id = find(name)) {
+			return *id;
+		}
+
+		std::unique_lock<std::shared_mutex> lock(mut_);
+		auto it = ids_.find(name);
+		if (it != ids_.end()) {
+			return it->second;
+		}
+
+		if (count_ >= MAX_SYMBOLS) {
+			throw std::runtime_error("Too many distinct names");
+		}
+
+		uint32_t id = count_;
+		auto [chunk, offset] = locate(id);
+		std::string *strings = chunks_[chunk].load(std::memory_order_relaxed);
+		if (!strings) {
+			strings = new std::string[FIRST_CHUNK_SIZE << chunk];
+			chunks_[chunk].store(strings, std::memory_order_release);
+		}
+
+		strings[offset] = name;
+		ids_.emplace(strings[offset], id);
+		count_ += 1;
+		return id;
+	}
+
+	std::optional<uint32_t> find(std::string_view name) {
+		std::shared_lock<std::shared_mutex> lock(mut_);
+		auto it = ids_.find(name);
+		if (it == ids_.end()) {
+			return std::nullopt;
+		}
+
+		return it->second;
+	}
+
+	// Whoever has an id got it after it was stored
+	const std::string &str(uint32_t id) const {
+		auto [chunk, offset] = locate(id);
+		return chunks_[chunk].load(std::memory_order_acquire)[offset];
+	}
+
+private:
+	static constexpr size_t FIRST_CHUNK_BITS = 10;
+	static constexpr size_t FIRST_CHUNK_SIZE = (size_t)1 << FIRST_CHUNK_BITS;
+	static constexpr size_t NUM_CHUNKS = 32 - FIRST_CHUNK_BITS + 1;
+
+	// Well short of 2^32, so that ids never wrap and tables indexed by
+	// them can use ~0 as a marker
+	static constexpr uint32_t MAX_SYMBOLS = (uint32_t)1 << 28;
+
+	// Chunk n holds ids from FIRST_CHUNK_SIZE * (2^n - 1)
+	static std::pair<size_t, size_t> locate(uint32_t id) {
+		uint64_t idx = (uint64_t)id + FIRST_CHUNK_SIZE;
+		size_t bit = 63 - __builtin_clzll(idx);
+		return {bit - FIRST_CHUNK_BITS, idx - ((uint64_t)1 << bit)};
+	}
+
+	std::atomic<std::string *> chunks_[NUM_CHUNKS] = {};
+	std::shared_mutex mut_;
+	std::unordered_map<std::string_view, uint32_t> ids_;
+	uint32_t count_ = 0;
+};
+
+// Never destroyed, so that symbols can be used while other statics are
+// destroyed
+Interner &interner() {
+	static Interner *interner = new Interner;
+	return *interner;
+}
+
+// Names this thread has already interned, so that most names are found
+// without taking the lock. The names point into the interner's chunks.
+// Open addressing, as this is looked up for every identifier lexed.
+class LocalIds {
+public:
+	std::optional<uint32_t> find(std::string_view name) const {
+		for (size_t idx = hash(name) & mask_;; idx = (idx + 1) & mask_) {
+			const Entry &entry = entries_[idx];
+			if (!entry.name) {
+				return std::nullopt;
+			} else if (entry.name->size() == name.size() &&
+					memcmp(entry.name->data(), name.data(), name.size()) == 0) {
+				return entry.id;
+			}
+		}
+	}
+
+	void insert(const std::string *name, uint32_t id) {
+		if ((count_ + 1) * 2 > entries_.size()) {
+			std::vector<Entry> old(entries_.size() * 2);
+			std::swap(old, entries_);
+			mask_ = entries_.size() - 1;
+			for (const Entry &entry: old) {
+				if (entry.name) {
+					place(entry);
+				}
+			}
+		}
+
+		place({name, id});
+		count_ += 1;
+	}
+
+private:
+	struct Entry {
+		const std::string *name = nullptr;
+		uint32_t id = 0;
+	};
+
+	// FNV-1a; names are short
+	static size_t hash(std::string_view name) {
+		uint64_t hash = 0xcbf29ce484222325;
+		for (char ch: name) {
+			hash = (hash ^ (unsigned char)ch) * 0x100000001b3;
+		}
+
+		return hash ^ (hash >> 32);
+	}
+
+	void place(const Entry &entry) {
+		size_t idx = hash(*entry.name) & mask_;
+		while (entries_[idx].name) {
+			idx = (idx + 1) & mask_;
+		}
+
+		entries_[idx] = entry;
+	}
+
+	std::vector<Entry> entries_ = std::vector<Entry>(1024);
+	size_t mask_ = 1024 - 1;
+	size_t count_ = 0;
+};
+
+thread_local LocalIds localIds;
+
+}
+
+Symbol::Symbol(std::string_view name) {
+	if (auto id = localIds.find(name)) {
+		id_ = *id;
+		return;
+	}
+
+	id_ = interner().intern(name);
+	localIds.insert(&str(), id_);
+}
+
+std::optional<Symbol> Symbol::find(std::string_view name) {
+	if (auto id = interner().find(name)) {
+		return fromId(*id);
+	}
+
+	return std::nullopt;
+}
+
+const std::string &Symbol::str() const {
+	return interner().str(id_);
+}
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+namespace fun {
+
+// An interned name. Each distinct name is given a dense 32-bit id the first
+// time it's seen, from one table shared by every thread, so that names are
+// compared and hashed as integers. Interned names are never freed, so a
+// long-running --serve, --lsp or --watch process keeps every name it has
+// seen, and interning throws once there are 2^28 of them.
+// Ids depend on the order names were first seen in, so anything whose
+// output must not depend on that orders symbols by str().
+class Symbol {
+public:
+	// The empty name
+	constexpr Symbol() = default;
+
+	// Intern a name
+	explicit Symbol(std::string_view name);
+
+	// A name's symbol if it has been interned, without interning it
+	static std::optional<Symbol> find(std::string_view name);
+
+	// The symbol with an id from id()
+	static constexpr Symbol fromId(uint32_t id) {
+		Symbol sym;
+		sym.id_ = id;
+		return sym;
+	}
+
+	const std::string &str() const;
+	uint32_t id() const { return id_; }
+
+	bool operator==(Symbol other) const { return id_ == other.id_; }
+	bool operator!=(Symbol other) const { return id_ != other.id_; }
+
+private:
+	uint32_t id_ = 0;
+};
+
+// Interned before anything else, with fixed ids
+namespace sym {
+
+inline constexpr Symbol IF = Symbol::fromId(1);
+inline constexpr Symbol ELSE = Symbol::fromId(2);
+inline constexpr Symbol WHILE = Symbol::fromId(3);
+inline constexpr Symbol RETURN = Symbol::fromId(4);
+inline constexpr Symbol CLASS = Symbol::fromId(5);
+inline constexpr Symbol FUN = Symbol::fromId(6);
+inline constexpr Symbol SELF = Symbol::fromId(7);
+
+}
+
+}
+
+template<>
+struct std::hash<fun::Symbol> {
+	size_t operator()(fun::Symbol sym) const noexcept { return sym.id(); }
+};
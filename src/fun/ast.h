@@ -1,17 +1,37 @@
 #pragma once
 
-#include <string>
-#include <vector>
-#include <memory>
+#include <string_view>
 #include <variant>
+#include <vector>
 #include <cstddef>
 
 #include "ByteRange.h"
+#include "Symbol.h"
 
+// The nodes of a declaration live in an Arena, which owns them and frees
+// them all at once: nodes point at each other with plain pointers, lists
+// are spans of the arena, and nothing in a tree has a destructor to run.
 namespace fun::ast {
 
+// A list of nodes in an arena
+template<typename T>
+struct List {
+	T *items = nullptr;
+	size_t count = 0;
+
+	T *begin() { return items; }
+	T *end() { return items + count; }
+	const T *begin() const { return items; }
+	const T *end() const { return items + count; }
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T &operator[](size_t idx) { return items[idx]; }
+	const T &operator[](size_t idx) const { return items[idx]; }
+};
+
 struct Identifier {
-	std::string name;
+	Symbol name;
 	ByteRange range;
 	size_t id = 0;
 };
@@ -35,7 +55,7 @@ using Expression = std::variant<
 	LookupExpr>;
 
 struct StringLiteralExpr {
-	std::string str;
+	std::string_view str;
 };
 
 struct NumberLiteralExpr {
@@ -50,28 +70,53 @@ struct BinaryExpr {
 	enum Oper {ADD, SUB, MULT, DIV, EQ, NEQ, GT, GTEQ, LT, LTEQ};
 
 	Oper op;
-	std::unique_ptr<Expression> lhs;
-	std::unique_ptr<Expression> rhs;
-};
+	Expression *lhs = nullptr;
+	Expression *rhs = nullptr;
+};
+
+// A chain of binary operators like a + b - c is a tree as deep as the chain
+// is long, down its left hand side, so passes go down it with a loop rather
+// than recursing once per operator. This calls lhsFunc on the operand at the
+// bottom of the chain, then opFunc on each operator from the bottom up, which
+// is the order a recursive pass would visit them in. Bin is BinaryExpr or
+// const BinaryExpr.
+template<typename Bin, typename LhsFunc, typename OpFunc>
+void forEachInChain(Bin &top, LhsFunc &&lhsFunc, OpFunc &&opFunc) {
+	if (!std::holds_alternative<BinaryExpr>(*top.lhs)) {
+		lhsFunc(*top.lhs);
+		opFunc(top);
+		return;
+	}
+
+	std::vector<Bin *> chain{&top};
+	while (Bin *lhs = std::get_if<BinaryExpr>(chain.back()->lhs)) {
+		chain.push_back(lhs);
+	}
+
+	lhsFunc(*chain.back()->lhs);
+	for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+		opFunc(**it);
+	}
+}
 
 struct FuncCallExpr {
-	std::unique_ptr<Expression> func;
-	std::vector<std::unique_ptr<Expression>> args;
+	Expression *func = nullptr;
+	List<Expression> args;
 };
 
 struct AssignmentExpr {
-	std::unique_ptr<Expression> lhs;
-	std::unique_ptr<Expression> rhs;
+	Expression *lhs = nullptr;
+	Expression *rhs = nullptr;
 };
 
 struct DeclAssignmentExpr {
 	Identifier ident;
-	std::unique_ptr<Expression> rhs;
+	Expression *rhs = nullptr;
 };
 
 struct LookupExpr {
-	std::unique_ptr<Expression> lhs;
-	std::string name;
+	Expression *lhs = nullptr;
+	Symbol name;
 };
 
 struct ClassDecl;
@@ -92,13 +137,13 @@ using Statement = std::variant<
 
 struct IfStatm {
 	Expression condition;
-	std::unique_ptr<CodeBlock> ifBody;
-	std::unique_ptr<CodeBlock> elseBody;
+	CodeBlock *ifBody = nullptr;
+	CodeBlock *elseBody = nullptr;
 };
 
 struct WhileStatm {
 	Expression condition;
-	std::unique_ptr<CodeBlock> body;
+	CodeBlock *body = nullptr;
 };
 
 struct ReturnStatm {
@@ -107,25 +152,25 @@ struct ReturnStatm {
 
 struct ClassDecl {
 	Identifier ident;
-	std::vector<Identifier> args;
-	std::unique_ptr<CodeBlock> body;
+	List<Identifier> args;
+	CodeBlock *body = nullptr;
 };
 
 struct FuncDecl {
 	Identifier ident;
-	std::vector<Identifier> args;
-	std::unique_ptr<CodeBlock> body;
+	List<Identifier> args;
+	CodeBlock *body = nullptr;
 };
 
 struct MethodDecl {
 	Identifier classIdent;
 	Identifier ident;
-	std::vector<Identifier> args;
-	std::unique_ptr<CodeBlock> body;
+	List<Identifier> args;
+	CodeBlock *body = nullptr;
 };
 
 struct CodeBlock {
-	std::vector<Statement> statms;
+	List<Statement> statms;
 };
 
 }
@@ -0,0 +1,207 @@
+#include "flat.h"
+
+#include <stdexcept>
+
+#include "walk.h"
+
+using namespace fun::ast;
+
+namespace fun::flat {
+
+namespace {
+
+// Adds each node as it's entered, and sets its end once it's left
+class Flattener: public walk::Pass {
+public:
+	using walk::Pass::enter;
+	using walk::Pass::leave;
+
+	Flattener(Tree &tree): tree_(tree) {}
+
+	void enter(const StringLiteralExpr &str) {
+		finish(start(STRING_LITERAL, checked(tree_.strings.size())));
+		tree_.strings.push_back(str.str);
+	}
+
+	void enter(const NumberLiteralExpr &num) {
+		finish(start(NUMBER_LITERAL, checked(tree_.numbers.size())));
+		tree_.numbers.push_back(num.num);
+	}
+
+	void enter(const IdentifierExpr &ident) {
+		finish(start(IDENTIFIER, this->ident(ident.ident, REF)));
+	}
+
+	// The operators down a chain's left hand side come first, top down
+	void enter(const BinaryExpr &bin) { open(BINARY, 0, 0, (uint8_t)bin.op); }
+	void leave(const BinaryExpr &) { close(); }
+
+	void enter(const FuncCallExpr &call) { open(FUNC_CALL, 0, checked(call.args.size())); }
+	void leave(const FuncCallExpr &) { close(); }
+
+	void enter(const AssignmentExpr &) { open(ASSIGNMENT); }
+	void leave(const AssignmentExpr &) { close(); }
+
+	void enter(const DeclAssignmentExpr &assignment) { open(DECL_ASSIGNMENT, ident(assignment.ident, DEF)); }
+	void leave(const DeclAssignmentExpr &) { close(); }
+
+	void enter(const LookupExpr &lookup) {
+		open(LOOKUP, checked(tree_.names.size()));
+		tree_.names.push_back(lookup.name);
+	}
+
+	void leave(const LookupExpr &) { close(); }
+
+	void enter(const IfStatm &ifStatm) { open(IF, 0, 0, ifStatm.elseBody ? 1 : 0); }
+	void leave(const IfStatm &) { close(); }
+
+	void enter(const WhileStatm &) { open(WHILE); }
+	void leave(const WhileStatm &) { close(); }
+
+	void enter(const ReturnStatm &) { open(RETURN); }
+	void leave(const ReturnStatm &) { close(); }
+
+	void enter(const CodeBlock &block) { open(CODE_BLOCK, 0, checked(block.statms.size())); }
+	void leave(const CodeBlock &) { close(); }
+
+	void enter(const ClassDecl &classDecl) {
+		uint32_t first = ident(classDecl.ident, DEF);
+		open(CLASS_DECL, first, params(classDecl.args));
+	}
+
+	void enter(const FuncDecl &funcDecl) {
+		uint32_t first = ident(funcDecl.ident, DEF);
+		open(FUNC_DECL, first, params(funcDecl.args));
+	}
+
+	void enter(const MethodDecl &methodDecl) {
+		uint32_t first = ident(methodDecl.classIdent, METHOD_CLASS);
+		ident(methodDecl.ident, DEF);
+		open(METHOD_DECL, first, params(methodDecl.args));
+	}
+
+	void leave(const Declaration &) { close(); }
+
+private:
+	uint32_t checked(size_t num);
+	uint32_t id(size_t id);
+	uint32_t ident(const Identifier &ident, IdentRole role);
+	uint32_t params(const List<Identifier> &args);
+
+	// Adds a node, whose end is set by finish() once its children are added
+	uint32_t start(NodeKind kind, uint32_t value = 0, uint32_t count = 0, uint8_t op = 0);
+	void finish(uint32_t node) { tree_.nodes[node].end = checked(tree_.nodes.size()); }
+
+	// The same, for nodes with children, which are finished when they're left
+	void open(NodeKind kind, uint32_t value = 0, uint32_t count = 0, uint8_t op = 0) {
+		open_.push_back(start(kind, value, count, op));
+	}
+
+	void close() {
+		finish(open_.back());
+		open_.pop_back();
+	}
+
+	Tree &tree_;
+	std::vector<uint32_t> open_;
+};
+
+uint32_t Flattener::checked(size_t num) {
+	if (num >= NONE) {
+		throw std::runtime_error("Syntax tree too large to flatten");
+	}
+
+	return (uint32_t)num;
+}
+
+uint32_t Flattener::id(size_t id) {
+	if (id > ~(size_t)0 - SPECIAL_IDS) {
+		return NONE - (uint32_t)(~(size_t)0 - id);
+	} else if (id > NONE - SPECIAL_IDS) {
+		throw std::runtime_error("Identifier id too large to flatten");
+	}
+
+	return (uint32_t)id;
+}
+
+uint32_t Flattener::ident(const Identifier &ident, IdentRole role) {
+	uint32_t idx = checked(tree_.idents.size());
+	tree_.idents.push_back({
+		ident.name, checked(ident.range.start), checked(ident.range.end), id(ident.id), role});
+	return idx;
+}
+
+uint32_t Flattener::params(const List<Identifier> &args) {
+	for (const Identifier &arg: args) {
+		ident(arg, DEF);
+	}
+
+	return checked(args.size());
+}
+
+uint32_t Flattener::start(NodeKind kind, uint32_t value, uint32_t count, uint8_t op) {
+	uint32_t idx = checked(tree_.nodes.size());
+	tree_.nodes.push_back({kind, op, 0, idx + 1, value, count});
+	return idx;
+}
+
+}
+
+size_t Tree::bytes() const {
+	return
+		nodes.size() * sizeof(Node) +
+		idents.size() * sizeof(Ident) +
+		strings.size() * sizeof(std::string_view) +
+		numbers.size() * sizeof(double) +
+		names.size() * sizeof(Symbol) +
+		decls.size() * sizeof(Decl);
+}
+
+size_t flatten(const Declaration &decl, Tree &tree) {
+	// A failed flatten leaves the tree as it was
+	size_t nodeCount = tree.nodes.size();
+	size_t identCount = tree.idents.size();
+	size_t stringCount = tree.strings.size();
+	size_t numberCount = tree.numbers.size();
+	size_t nameCount = tree.names.size();
+
+	Flattener flattener(tree);
+	try {
+		walk::walk(decl, flattener);
+	} catch (...) {
+		tree.nodes.resize(nodeCount);
+		tree.idents.resize(identCount);
+		tree.strings.resize(stringCount);
+		tree.numbers.resize(numberCount);
+		tree.names.resize(nameCount);
+		throw;
+	}
+
+	tree.decls.push_back({(uint32_t)nodeCount, (uint32_t)identCount, (uint32_t)tree.idents.size()});
+	return tree.decls.size() - 1;
+}
+
+void collectNames(const Tree &tree, const Decl &decl, DeclNames &names) {
+	bool methods = false;
+	for (uint32_t i = decl.firstIdent; i < decl.endIdent; ++i) {
+		const Ident &ident = tree.idents[i];
+		if (ident.role == METHOD_CLASS) {
+			continue;
+		}
+
+		size_t id = wideId(ident.id);
+		methods = methods || id == 0;
+		auto it = names.find(ident.name);
+		if (it == names.end()) {
+			names.emplace(ident.name, std::make_pair(id, id));
+		} else {
+			it->second.second = id;
+		}
+	}
+
+	if (methods) {
+		dropMethodNames(names);
+	}
+}
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "ast.h"
+#include "IdentResolver.h"
+
+// A compact copy of resolved syntax trees, for passes which only read them.
+// Nodes sit in one array in pre-order, so a pass which visits every node
+// reads memory front to back, and children are found by 32-bit index
+// instead of by pointer. Identifiers sit in an array of their own, also in
+// pre-order, which is the order the '@' and '!' searches visit them in.
+//
+// Source offsets and ids are 32 bits, so flattening throws
+// std::runtime_error for a tree which doesn't fit.
+namespace fun::flat {
+
+static constexpr uint32_t NONE = ~(uint32_t)0;
+
+enum NodeKind: uint8_t {
+	STRING_LITERAL, // value: index into strings
+	NUMBER_LITERAL, // value: index into numbers
+	IDENTIFIER, // value: ident
+	BINARY, // op: ast::BinaryExpr::Oper; children: lhs, rhs
+	FUNC_CALL, // count: arguments; children: func, then the arguments
+	ASSIGNMENT, // children: lhs, rhs
+	DECL_ASSIGNMENT, // value: ident; children: rhs
+	LOOKUP, // value: index into names; children: lhs
+	IF, // op: 1 if there's an else body; children: condition, if body, else body
+	WHILE, // children: condition, body
+	RETURN, // children: expression
+	CLASS_DECL, // value: ident, followed by count parameter idents; children: body
+	FUNC_DECL, // same as CLASS_DECL
+	METHOD_DECL, // value: class ident, followed by ident and count parameter idents; children: body
+	CODE_BLOCK, // count: statements; children: the statements
+};
+
+// A node's first child, if it has any, is the next node, and each child's
+// subtree ends where its next sibling starts
+struct Node {
+	NodeKind kind;
+	uint8_t op;
+	uint16_t reserved;
+	uint32_t end; // one past the last node of this subtree
+	uint32_t value;
+	uint32_t count;
+};
+
+enum IdentRole: uint8_t {
+	DEF,
+	REF,
+	METHOD_CLASS, // the class a method is declared on, which '@' and '!' don't find
+};
+
+struct Ident {
+	Symbol name;
+	uint32_t start;
+	uint32_t end;
+	uint32_t id;
+	IdentRole role;
+};
+
+// A top-level declaration: its root node, and its idents
+struct Decl {
+	uint32_t node;
+	uint32_t firstIdent;
+	uint32_t endIdent;
+};
+
+struct Tree {
+	std::vector<Node> nodes;
+	std::vector<Ident> idents;
+	std::vector<std::string_view> strings; // still pointing into the original tree
+	std::vector<double> numbers;
+	std::vector<Symbol> names;
+	std::vector<Decl> decls;
+
+	size_t bytes() const;
+};
+
+// Append a copy of a resolved declaration, returning its index in decls.
+// String literals aren't copied, so they must outlive the tree.
+size_t flatten(const ast::Declaration &decl, Tree &tree);
+
+// The few special ids at the top of size_t's range (builtins and imports)
+// map to the top of uint32_t's range, and back
+static constexpr size_t SPECIAL_IDS = 16;
+
+inline size_t wideId(uint32_t id) {
+	return id > NONE - SPECIAL_IDS ? ~(size_t)0 - (NONE - id) : id;
+}
+
+// Like collectNamesInDecl, but for a flattened declaration
+void collectNames(const Tree &tree, const Decl &decl, DeclNames &names);
+
+}
@@ -1,6 +1,7 @@
 #include "parse.h"
 
 #include <utility>
+#include <vector>
 #include <cassert>
 
 #include "util.h"
@@ -9,15 +10,19 @@ using namespace fun::ast;
 
 namespace fun {
 
-static void fail(Token &tok, TokKind kind) {
+static ParseError parseError(Lexer &lexer, ByteRange range, std::string message) {
+	return ParseError(lexer.location(range.start), std::move(message));
+}
+
+static void fail(Lexer &lexer, TokKind kind) {
 	std::string message = "Expected ";
-	message += Token::kindToString(kind);
+	message += kindToString(kind);
 	message += ", got ";
-	message += Token::kindToString(tok.kind);
-	throw ParseError(tok.line, tok.column, std::move(message));
+	message += kindToString(lexer.kind());
+	throw parseError(lexer, lexer.range(), std::move(message));
 }
 
-static void fail(Token &tok, std::initializer_list<TokKind> kinds) {
+static void fail(Lexer &lexer, std::initializer_list<TokKind> kinds) {
 	std::string message = "Expected ";
 	bool first = true;
 	for (const TokKind &kind: kinds) {
@@ -25,128 +30,141 @@ static void fail(Token &tok, std::initializer_list<TokKind> kinds) {
 			message += " or ";
 		}
 
-		message += Token::kindToString(kind);
+		message += kindToString(kind);
 		first = false;
 	}
 
 	message += ", got ";
-	message += Token::kindToString(tok.kind);
-	throw ParseError(tok.line, tok.column, std::move(message));
+	message += kindToString(lexer.kind());
+	throw parseError(lexer, lexer.range(), std::move(message));
 }
 
 static void expect(Lexer &lexer, TokKind kind) {
-	Token &tok = lexer.peek(0);
-	if (tok.kind != kind) {
-		fail(tok, kind);
+	if (lexer.kind() != kind) {
+		fail(lexer, kind);
+	}
+}
+
+// Lists are built on a stack shared by every parse on the thread, then
+// copied into the arena in one piece. A list is always finished before the
+// list it's part of carries on, so each only ever adds to the top.
+template<typename T>
+class ListBuilder {
+public:
+	ListBuilder(): base_(stack().size()) {}
+	~ListBuilder() { stack().resize(base_); }
+
+	void push(const T &item) { stack().push_back(item); }
+
+	List<T> finish(Arena &arena) {
+		std::vector<T> &items = stack();
+		size_t count = items.size() - base_;
+		return {arena.copy(items.data() + base_, count), count};
+	}
+
+private:
+	static std::vector<T> &stack() {
+		static thread_local std::vector<T> items;
+		return items;
 	}
+
+	size_t base_;
+};
+
+// Consume an identifier
+static Identifier readIdentifier(Lexer &lexer) {
+	Identifier ident{lexer.ident(), lexer.range()};
+	lexer.consume();
+	return ident;
 }
 
-static void parseExpression(Lexer &lexer, Expression &expr);
+// Parentheses and call arguments each nest one level deeper, and recurse;
+// binary operators and assignments don't. Code blocks have MAX_NESTING as
+// a limit of their own: every pass which goes down statements by recursion
+// recurses once per block, so the limit keeps them all in bounds.
+static void checkNesting(Lexer &lexer, int depth) {
+	if (depth > MAX_NESTING) {
+		throw parseError(lexer, lexer.range(), "Code nested too deeply");
+	}
+}
 
-static void parseArgumentList(Lexer &lexer, std::vector<std::unique_ptr<Expression>> &args) {
+static void parseExpression(Lexer &lexer, Arena &arena, Expression &expr, int depth = 0);
+
+static void parseArgumentList(Lexer &lexer, Arena &arena, List<Expression> &args, int depth) {
 	lexer.consume(); // '('
 
+	ListBuilder<Expression> list;
 	while (true) {
-		if (lexer.peek(0).kind == TokKind::CLOSE_PAREN) {
+		if (lexer.kind() == TokKind::CLOSE_PAREN) {
 			break;
 		}
 
-		std::unique_ptr<Expression> param = std::make_unique<Expression>();
-		parseExpression(lexer, *param);
-		args.push_back(std::move(param));
+		Expression param;
+		parseExpression(lexer, arena, param, depth + 1);
+		list.push(param);
 
-		Token &tok = lexer.peek(0);
-		if (tok.kind == TokKind::COMMA) {
+		TokKind kind = lexer.kind();
+		if (kind == TokKind::COMMA) {
 			lexer.consume(); // ','
-		} else if (tok.kind == TokKind::CLOSE_PAREN) {
+		} else if (kind == TokKind::CLOSE_PAREN) {
 			break;
 		} else {
-			fail(tok, {TokKind::COMMA, TokKind::CLOSE_PAREN});
+			fail(lexer, {TokKind::COMMA, TokKind::CLOSE_PAREN});
 		}
 	}
 
 	lexer.consume(); // ')'
+	args = list.finish(arena);
 }
 
-static void parseExpression(Lexer &lexer, Expression &expr) {
-	TokKind kind = lexer.peek(0).kind;
+// An operand of a binary operator: a literal, identifier or parenthesized
+// expression, followed by any calls and look-ups, and maybe an assignment.
+// An assignment's right hand side is the rest of the expression, so it's
+// left for the caller to parse, into *rhs.
+static void parseOperand(Lexer &lexer, Arena &arena, Expression &expr, int depth, Expression *&rhs) {
+	if (depth > MAX_NESTING) {
+		throw parseError(lexer, lexer.range(), "Expression nested too deeply");
+	}
+
+	TokKind kind = lexer.kind();
 	if (kind == TokKind::STRING) {
-		expr = StringLiteralExpr{std::move(lexer.consume().getStr())};
+		expr = StringLiteralExpr{arena.copy(lexer.str())};
+		lexer.consume();
 	} else if (kind == TokKind::NUMBER) {
-		expr = NumberLiteralExpr{lexer.consume().getNum()};
+		expr = NumberLiteralExpr{lexer.num()};
+		lexer.consume();
 	} else if (kind == TokKind::IDENT) {
-		Token tok = lexer.consume();
-		Identifier ident{std::move(tok.getStr()), tok.range};
-		expr = IdentifierExpr{ident};
+		expr = IdentifierExpr{readIdentifier(lexer)};
 	} else if (kind == TokKind::OPEN_PAREN) {
-		Token tok = lexer.consume();
-		parseExpression(lexer, expr);
+		lexer.consume();
+		parseExpression(lexer, arena, expr, depth + 1);
 		expect(lexer, TokKind::CLOSE_PAREN);
 		lexer.consume();
 	} else {
-		fail(lexer.peek(0), {
+		fail(lexer, {
 			TokKind::STRING, TokKind::NUMBER, TokKind::IDENT,
 			TokKind::OPEN_PAREN
 		});
 	}
 
 	while (true) {
-		kind = lexer.peek(0).kind;
-		if (
-				kind == TokKind::EQEQ || kind == TokKind::NOTEQ ||
-				kind == TokKind::GT || kind == TokKind::GTEQ ||
-				kind == TokKind::LT || kind == TokKind::LTEQ ||
-				kind == TokKind::PLUS || kind == TokKind::MINUS ||
-				kind == TokKind::MULT || kind == TokKind::DIV) {
-			lexer.consume(); // operator
-
-			BinaryExpr bin;
-			bin.lhs = std::make_unique<Expression>(std::move(expr));
-			bin.rhs = std::make_unique<Expression>();
-			parseExpression(lexer, *bin.rhs);
-
-			if (kind == TokKind::EQEQ) {
-				bin.op = BinaryExpr::EQ;
-			} else if (kind == TokKind::NOTEQ) {
-				bin.op = BinaryExpr::NEQ;
-			} else if (kind == TokKind::GT) {
-				bin.op = BinaryExpr::GT;
-			} else if (kind == TokKind::GTEQ) {
-				bin.op = BinaryExpr::GTEQ;
-			} else if (kind == TokKind::LT) {
-				bin.op = BinaryExpr::LT;
-			} else if (kind == TokKind::LTEQ) {
-				bin.op = BinaryExpr::LTEQ;
-			} else if (kind == TokKind::PLUS) {
-				bin.op = BinaryExpr::ADD;
-			} else if (kind == TokKind::MINUS) {
-				bin.op = BinaryExpr::SUB;
-			} else if (kind == TokKind::MULT) {
-				bin.op = BinaryExpr::MULT;
-			} else if (kind == TokKind::DIV) {
-				bin.op = BinaryExpr::DIV;
-			} else {
-				assert(false);
-			}
-
-			expr = std::move(bin);
-		} else if (kind == TokKind::OPEN_PAREN) {
+		kind = lexer.kind();
+		if (kind == TokKind::OPEN_PAREN) {
 			FuncCallExpr call;
-			call.func = std::make_unique<Expression>(std::move(expr));
-			parseArgumentList(lexer, call.args);
-			expr = std::move(call);
+			call.func = arena.make<Expression>(expr);
+			parseArgumentList(lexer, arena, call.args, depth);
+			expr = call;
 		} else if (kind == TokKind::EQ) {
 			lexer.consume(); // '='
 
 			AssignmentExpr assignment;
-			assignment.lhs = std::make_unique<Expression>(std::move(expr));
-			assignment.rhs = std::make_unique<Expression>();
-			parseExpression(lexer, *assignment.rhs);
-			expr = std::move(assignment);
+			assignment.lhs = arena.make<Expression>(expr);
+			assignment.rhs = rhs = arena.make<Expression>();
+			expr = assignment;
+			break;
 		} else if (kind == TokKind::COLONEQ) {
 			if (!std::holds_alternative<IdentifierExpr>(expr)) {
-				Token &tok = lexer.peek(0);
-				throw ParseError(tok.line, tok.column, "':=' must follow an identifier");
+				throw parseError(lexer, lexer.range(), "':=' must follow an identifier");
 			}
 
 			lexer.consume(); // ':='
@@ -155,54 +173,137 @@ static void parseExpression(Lexer &lexer, Expression &expr) {
 
 			DeclAssignmentExpr assignment;
 			assignment.ident = ident;
-			assignment.rhs = std::make_unique<Expression>();
-			parseExpression(lexer, *assignment.rhs);
-			expr = std::move(assignment);
+			assignment.rhs = rhs = arena.make<Expression>();
+			expr = assignment;
+			break;
 		} else if (kind == TokKind::DOT) {
 			lexer.consume(); // '.'
 
 			expect(lexer, TokKind::IDENT);
-			Token tok = lexer.consume();
-
 			LookupExpr lookup;
-			lookup.lhs = std::make_unique<Expression>(std::move(expr));
-			lookup.name = std::move(tok.getStr());
-			expr = std::move(lookup);
+			lookup.lhs = arena.make<Expression>(expr);
+			lookup.name = lexer.ident();
+			lexer.consume();
+			expr = lookup;
 		} else {
 			break;
 		}
 	}
 }
 
-static void parseIfStatm(Lexer &lexer, IfStatm &statm) {
+static bool binaryOper(TokKind kind, BinaryExpr::Oper &op) {
+	switch (kind) {
+	case TokKind::EQEQ: op = BinaryExpr::EQ; return true;
+	case TokKind::NOTEQ: op = BinaryExpr::NEQ; return true;
+	case TokKind::GT: op = BinaryExpr::GT; return true;
+	case TokKind::GTEQ: op = BinaryExpr::GTEQ; return true;
+	case TokKind::LT: op = BinaryExpr::LT; return true;
+	case TokKind::LTEQ: op = BinaryExpr::LTEQ; return true;
+	case TokKind::PLUS: op = BinaryExpr::ADD; return true;
+	case TokKind::MINUS: op = BinaryExpr::SUB; return true;
+	case TokKind::MULT: op = BinaryExpr::MULT; return true;
+	case TokKind::DIV: op = BinaryExpr::DIV; return true;
+	default: return false;
+	}
+}
+
+// Indexed by BinaryExpr::Oper
+static constexpr int precedences[] = {
+	3, 3, // ADD, SUB
+	4, 4, // MULT, DIV
+	1, 1, // EQ, NEQ
+	2, 2, 2, 2, // GT, GTEQ, LT, LTEQ
+};
+static constexpr int MAX_PRECEDENCE = 4;
+
+int precedence(BinaryExpr::Oper op) {
+	return precedences[op];
+}
+
+// Binary operators are parsed with a stack of the operators still waiting
+// for their right hand side. Every operator is left associative, so an
+// operator first takes, as its left hand side, the operators on the stack
+// which bind at least as tightly. The stack's precedence always goes up,
+// so it never holds more than one operator of each precedence.
+//
+// Assignments are right associative, and take everything after them, so
+// once an operand ends with one, the operators before it are reduced, and
+// the expression carries on in its right hand side. A chain of assignments
+// is parsed with a loop, however long it is.
+static void parseExpression(Lexer &lexer, Arena &arena, Expression &result, int depth) {
+	struct Pending {
+		Expression lhs;
+		BinaryExpr::Oper op;
+	};
+
+	Pending stack[MAX_PRECEDENCE];
+	size_t size = 0;
+
+	Expression *target = &result;
+	while (target) {
+		Expression &expr = *target;
+		target = nullptr;
+
+		auto reduce = [&](int minPrecedence) {
+			while (size > 0 && precedence(stack[size - 1].op) >= minPrecedence) {
+				Pending &top = stack[--size];
+				BinaryExpr bin;
+				bin.op = top.op;
+				bin.lhs = arena.make<Expression>(top.lhs);
+				bin.rhs = arena.make<Expression>(expr);
+				expr = bin;
+			}
+		};
+
+		parseOperand(lexer, arena, expr, depth, target);
+
+		BinaryExpr::Oper op;
+		while (!target && binaryOper(lexer.kind(), op)) {
+			lexer.consume(); // operator
+
+			reduce(precedence(op));
+			assert(size < MAX_PRECEDENCE);
+			stack[size++] = {expr, op};
+			parseOperand(lexer, arena, expr, depth, target);
+		}
+
+		reduce(0);
+	}
+}
+
+static void parseCodeBlock(Lexer &lexer, Arena &arena, CodeBlock &block, int depth);
+static void parseDeclaration(Lexer &lexer, Arena &arena, Declaration &decl, int depth);
+
+// An 'else if' is nested in the 'else' block like any other statement
+static void parseIfStatm(Lexer &lexer, Arena &arena, IfStatm &statm, int depth) {
 	lexer.consume(); // 'if'
 
 	// condition
-	parseExpression(lexer, statm.condition);
+	parseExpression(lexer, arena, statm.condition);
 
 	// '{'
 	expect(lexer, TokKind::OPEN_BRACE);
 	lexer.consume(); // '{'
 
 	// <code block>
-	statm.ifBody = std::make_unique<CodeBlock>();
-	parseCodeBlock(lexer, *statm.ifBody);
+	statm.ifBody = arena.make<CodeBlock>();
+	parseCodeBlock(lexer, arena, *statm.ifBody, depth + 1);
 
 	// '}'
 	expect(lexer, TokKind::CLOSE_BRACE);
 	lexer.consume(); // '}'
 
 	// optional: 'else'
-	if (lexer.peek(0).kind == TokKind::ELSE) {
+	if (lexer.kind() == TokKind::ELSE) {
 		lexer.consume(); // 'if'
-		statm.elseBody = std::make_unique<CodeBlock>();
+		statm.elseBody = arena.make<CodeBlock>();
 
 		// either: '{'
-		if (lexer.peek(0).kind == TokKind::OPEN_BRACE) {
+		if (lexer.kind() == TokKind::OPEN_BRACE) {
 			lexer.consume(); // '{'
 
 			// <code block>
-			parseCodeBlock(lexer, *statm.elseBody);
+			parseCodeBlock(lexer, arena, *statm.elseBody, depth + 1);
 
 			// '}'
 			expect(lexer, TokKind::CLOSE_BRACE);
@@ -210,10 +311,12 @@ static void parseIfStatm(Lexer &lexer, IfStatm &statm) {
 		}
 
 		// or: 'if'
-		else if (lexer.peek(0).kind == TokKind::IF) {
+		else if (lexer.kind() == TokKind::IF) {
 			// <if statement>
-			statm.elseBody->statms.push_back(IfStatm{});
-			parseIfStatm(lexer, std::get<IfStatm>(statm.elseBody->statms.back()));
+			Statement *elseIf = arena.make<Statement>(IfStatm{});
+			statm.elseBody->statms = {elseIf, 1};
+			checkNesting(lexer, depth + 1);
+			parseIfStatm(lexer, arena, std::get<IfStatm>(*elseIf), depth + 1);
 
 			// Tail-recurse here, don't look for a '}'
 			return;
@@ -221,195 +324,183 @@ static void parseIfStatm(Lexer &lexer, IfStatm &statm) {
 
 		// or: error
 		else {
-			fail(lexer.peek(0), {TokKind::OPEN_BRACE, TokKind::IF});
+			fail(lexer, {TokKind::OPEN_BRACE, TokKind::IF});
 		}
 	}
 }
 
-static void parseWhileStatm(Lexer &lexer, WhileStatm &statm) {
+static void parseWhileStatm(Lexer &lexer, Arena &arena, WhileStatm &statm, int depth) {
 	lexer.consume(); // 'while'
 
 	// condition
-	parseExpression(lexer, statm.condition);
+	parseExpression(lexer, arena, statm.condition);
 
 	// '{'
 	expect(lexer, TokKind::OPEN_BRACE);
 	lexer.consume(); // '{'
 
 	// <code block>
-	statm.body = std::make_unique<CodeBlock>();
-	parseCodeBlock(lexer, *statm.body);
+	statm.body = arena.make<CodeBlock>();
+	parseCodeBlock(lexer, arena, *statm.body, depth + 1);
 
 	// '}'
 	expect(lexer, TokKind::CLOSE_BRACE);
 	lexer.consume(); // '}'
 }
 
-static void parseStatement(Lexer &lexer, Statement &statm) {
-	TokKind kind = lexer.peek(0).kind;
+static void parseStatement(Lexer &lexer, Arena &arena, Statement &statm, int depth) {
+	TokKind kind = lexer.kind();
 	if (kind == TokKind::IF) {
 		statm.emplace<IfStatm>();
-		parseIfStatm(lexer, std::get<IfStatm>(statm));
+		parseIfStatm(lexer, arena, std::get<IfStatm>(statm), depth);
 	} else if (kind == TokKind::WHILE) {
 		statm.emplace<WhileStatm>();
-		parseWhileStatm(lexer, std::get<WhileStatm>(statm));
+		parseWhileStatm(lexer, arena, std::get<WhileStatm>(statm), depth);
 	} else if (kind == TokKind::RETURN) {
 		lexer.consume(); // 'return'
 		statm.emplace<ReturnStatm>();
-		parseExpression(lexer, std::get<ReturnStatm>(statm).expr);
+		parseExpression(lexer, arena, std::get<ReturnStatm>(statm).expr);
 		expect(lexer, TokKind::SEMICOLON);
 		lexer.consume(); // ';'
 	} else if (kind == TokKind::BACKSLASH) {
 		statm.emplace<Declaration>();
-		parseDeclaration(lexer, std::get<Declaration>(statm));
+		parseDeclaration(lexer, arena, std::get<Declaration>(statm), depth);
 	} else {
 		statm.emplace<Expression>();
-		parseExpression(lexer, std::get<Expression>(statm));
+		parseExpression(lexer, arena, std::get<Expression>(statm));
 		expect(lexer, TokKind::SEMICOLON);
 		lexer.consume(); // ';'
 	}
 }
 
-void parseCodeBlock(Lexer &lexer, CodeBlock &block) {
+static void parseCodeBlock(Lexer &lexer, Arena &arena, CodeBlock &block, int depth) {
+	checkNesting(lexer, depth);
+
+	ListBuilder<Statement> list;
 	while (true) {
-		TokKind kind = lexer.peek(0).kind;
+		TokKind kind = lexer.kind();
 		if (kind == TokKind::E_O_F || kind == TokKind::CLOSE_BRACE) {
 			break;
 		}
 
-		block.statms.emplace_back();
-		parseStatement(lexer, block.statms.back());
+		Statement statm;
+		parseStatement(lexer, arena, statm, depth);
+		list.push(statm);
 	}
+
+	block.statms = list.finish(arena);
 }
 
-void parseDeclaration(Lexer &lexer, Declaration &decl) {
-	expect(lexer, TokKind::BACKSLASH);
-	lexer.consume(); // '\'
+void parseCodeBlock(Lexer &lexer, Arena &arena, CodeBlock &block) {
+	parseCodeBlock(lexer, arena, block, 0);
+}
 
-	// ident
-	expect(lexer, TokKind::IDENT);
-	Token identTok = lexer.consume();
+static void parseArgs(Lexer &lexer, Arena &arena, List<Identifier> &args) {
+	expect(lexer, TokKind::OPEN_BRACE);
+	lexer.consume(); // '{'
 
-	if (identTok.getStr() == "class") {
-		expect(lexer, TokKind::OPEN_BRACE);
-		lexer.consume(); // '{'
+	ListBuilder<Identifier> list;
+	while (true) {
+		if (lexer.kind() == TokKind::CLOSE_BRACE) {
+			break;
+		}
 
 		expect(lexer, TokKind::IDENT);
-		Token nameTok = lexer.consume();
-		Identifier ident{std::move(nameTok.getStr()), nameTok.range};
+		list.push(readIdentifier(lexer));
 
-		expect(lexer, TokKind::CLOSE_BRACE);
-		lexer.consume(); // '}'
-
-		expect(lexer, TokKind::OPEN_BRACE);
-		lexer.consume(); // '{'
+		if (lexer.kind() == TokKind::COMMA) {
+			lexer.consume(); // ','
+			continue;
+		} else if (lexer.kind() == TokKind::CLOSE_BRACE) {
+			break;
+		} else {
+			fail(lexer, {TokKind::COMMA, TokKind::CLOSE_BRACE});
+		}
+	}
 
-		// <args>
-		std::vector<Identifier> args;
-		while (true) {
-			if (lexer.peek(0).kind == TokKind::CLOSE_BRACE) {
-				break;
-			}
+	lexer.consume(); // '}'
+	args = list.finish(arena);
+}
 
-			expect(lexer, TokKind::IDENT);
-			Token tok = lexer.consume();
-			args.push_back({std::move(tok.getStr()), tok.range});
-
-			if (lexer.peek(0).kind == TokKind::COMMA) {
-				lexer.consume(); // ','
-				continue;
-			} else if (lexer.peek(0).kind == TokKind::CLOSE_BRACE) {
-				break;
-			} else {
-				fail(lexer.peek(0), {TokKind::COMMA, TokKind::CLOSE_BRACE});
-			}
-		}
+void parseDeclarationHeader(Lexer &lexer, Arena &arena, Declaration &decl) {
+	expect(lexer, TokKind::BACKSLASH);
+	lexer.consume(); // '\'
 
-		lexer.consume(); // '}'
+	// ident
+	expect(lexer, TokKind::IDENT);
+	Symbol keyword = lexer.ident();
+	ByteRange keywordRange = lexer.range();
+	lexer.consume();
 
+	if (keyword == sym::CLASS) {
 		expect(lexer, TokKind::OPEN_BRACE);
 		lexer.consume(); // '{'
 
-		// <code block>
-		std::unique_ptr<CodeBlock> body = std::make_unique<CodeBlock>();
-		parseCodeBlock(lexer, *body);
+		expect(lexer, TokKind::IDENT);
+		Identifier ident = readIdentifier(lexer);
 
 		expect(lexer, TokKind::CLOSE_BRACE);
 		lexer.consume(); // '}'
 
-		decl = ClassDecl{ident, std::move(args), std::move(body)};
-	} else if (identTok.getStr() == "fun") {
+		// <args>
+		List<Identifier> args;
+		parseArgs(lexer, arena, args);
+
+		decl = ClassDecl{ident, args, nullptr};
+	} else if (keyword == sym::FUN) {
 		expect(lexer, TokKind::OPEN_BRACE);
 		lexer.consume(); // '{'
 
 		expect(lexer, TokKind::IDENT);
-		Token name1Tok = lexer.consume();
-		Token name2Tok;
+		Identifier name1 = readIdentifier(lexer);
+		Identifier name2;
 		bool isMethod = false;
 
-		if (lexer.peek(0).kind == TokKind::COLONCOLON) {
+		if (lexer.kind() == TokKind::COLONCOLON) {
 			isMethod = true;
 			lexer.consume(); // '::'
 
 			expect(lexer, TokKind::IDENT);
-			name2Tok = lexer.consume();
+			name2 = readIdentifier(lexer);
 		}
 
 		expect(lexer, TokKind::CLOSE_BRACE);
 		lexer.consume(); // '}'
 
-		expect(lexer, TokKind::OPEN_BRACE);
-		lexer.consume(); // '{'
-
 		// <args>
-		std::vector<Identifier> args;
-		while (true) {
-			if (lexer.peek(0).kind == TokKind::CLOSE_BRACE) {
-				break;
-			}
+		List<Identifier> args;
+		parseArgs(lexer, arena, args);
 
-			expect(lexer, TokKind::IDENT);
-			Token tok = lexer.consume();
-			args.push_back({std::move(tok.getStr()), tok.range});
-
-			if (lexer.peek(0).kind == TokKind::COMMA) {
-				lexer.consume(); // ','
-				continue;
-			} else if (lexer.peek(0).kind == TokKind::CLOSE_BRACE) {
-				break;
-			} else {
-				fail(lexer.peek(0), {TokKind::COMMA, TokKind::CLOSE_BRACE});
-			}
+		if (isMethod) {
+			decl = MethodDecl{name1, name2, args, nullptr};
+		} else {
+			decl = FuncDecl{name1, args, nullptr};
 		}
+	} else {
+		throw parseError(
+				lexer, keywordRange,
+				"Expected 'class' or 'fun', got " + keyword.str());
+	}
+}
 
-		lexer.consume(); // '}'
+static void parseDeclaration(Lexer &lexer, Arena &arena, Declaration &decl, int depth) {
+	parseDeclarationHeader(lexer, arena, decl);
 
-		expect(lexer, TokKind::OPEN_BRACE);
-		lexer.consume(); // '{'
+	expect(lexer, TokKind::OPEN_BRACE);
+	lexer.consume(); // '{'
 
-		// <code block>
-		std::unique_ptr<CodeBlock> body = std::make_unique<CodeBlock>();
-		parseCodeBlock(lexer, *body);
+	// <code block>
+	CodeBlock *body = arena.make<CodeBlock>();
+	parseCodeBlock(lexer, arena, *body, depth + 1);
 
-		expect(lexer, TokKind::CLOSE_BRACE);
-		lexer.consume(); // '}'
+	expect(lexer, TokKind::CLOSE_BRACE);
+	lexer.consume(); // '}'
 
-		if (isMethod) {
-			Identifier classIdent{std::move(name1Tok.getStr()), name1Tok.range};
-			Identifier ident{std::move(name2Tok.getStr()), name2Tok.range};
-			decl = MethodDecl{
-				std::move(classIdent), std::move(ident),
-				std::move(args), std::move(body),
-			};
-		} else {
-			Identifier ident{std::move(name1Tok.getStr()), name1Tok.range};
-			decl = FuncDecl{std::move(ident), std::move(args), std::move(body)};
-		}
-	} else {
-		throw ParseError(
-				identTok.line, identTok.column,
-				"Expected 'class' or 'fun', got " + identTok.getStr());
-	}
+	std::visit([&](auto &decl) { decl.body = body; }, decl);
+}
+
+void parseDeclaration(Lexer &lexer, Arena &arena, Declaration &decl) {
+	parseDeclaration(lexer, arena, decl, 0);
 }
 
 }
@@ -5,12 +5,13 @@
 
 #include "ast.h"
 #include "Lexer.h"
+#include "Arena.h"
 
 namespace fun {
 
 struct ParseError: public std::exception {
 	ParseError(int line, int column, std::string message):
-			line(line), column(column) {
+			line(line), column(column), message(message) {
 		error = std::to_string(line);
 		error += ":";
 		error += std::to_string(column);
@@ -18,8 +19,12 @@ struct ParseError: public std::exception {
 		error += message;
 	}
 
+	ParseError(Location loc, std::string message):
+		ParseError(loc.line, loc.column, std::move(message)) {}
+
 	int line;
 	int column;
+	std::string message;
 	std::string error;
 
 	const char *what() const noexcept override {
@@ -27,7 +32,18 @@ struct ParseError: public std::exception {
 	}
 };
 
-void parseCodeBlock(Lexer &lexer, ast::CodeBlock &block);
-void parseDeclaration(Lexer &lexer, ast::Declaration &decl);
+// How deeply parentheses and call arguments may nest in an expression,
+// and code blocks in a declaration
+inline constexpr int MAX_NESTING = 1000;
+
+// How tightly a binary operator binds; higher binds tighter, as in Javascript
+int precedence(ast::BinaryExpr::Oper op);
+
+// The nodes are allocated in the arena, which must outlive the tree
+void parseCodeBlock(Lexer &lexer, Arena &arena, ast::CodeBlock &block);
+void parseDeclaration(Lexer &lexer, Arena &arena, ast::Declaration &decl);
+
+// Parse a declaration up to its body, leaving the body null
+void parseDeclarationHeader(Lexer &lexer, Arena &arena, ast::Declaration &decl);
 
 }
@@ -2,7 +2,7 @@
 
 namespace fun {
 
-std::string jsPrelude = R"javascript(/* <Prelude> */
+const std::string jsPrelude = R"javascript(/* <Prelude> */
 class FUNclass_Array {
 	constructor() {
 		this.data = [];
@@ -91,7 +91,7 @@ let FUN_none = null;
 /* </Prelude> */
 )javascript";
 
-std::string jsPostlude = R"javascript(
+const std::string jsPostlude = R"javascript(
 FUN_main();
 )javascript";
 
@@ -99,4 +99,13 @@ const std::vector<std::string> preludeNames = {
 	"Array", "Map", "print", "typeof", "math", "true", "false", "none",
 };
 
+const std::unordered_set<Symbol> preludeNameSet = [] {
+	std::unordered_set<Symbol> names;
+	for (const std::string &name: preludeNames) {
+		names.insert(Symbol(name));
+	}
+
+	return names;
+}();
+
 }
@@ -2,11 +2,17 @@
 
 #include <vector>
 #include <string>
+#include <unordered_set>
+
+#include "Symbol.h"
 
 namespace fun {
 
-extern std::string jsPrelude;
-extern std::string jsPostlude;
+extern const std::string jsPrelude;
+extern const std::string jsPostlude;
 extern const std::vector<std::string> preludeNames;
 
+// The same names, built once and shared by every resolver
+extern const std::unordered_set<Symbol> preludeNameSet;
+
 }
@@ -1,13 +1,11 @@
 #include "print.h"
 
+#include <charconv>
 #include <cassert>
 
-using namespace fun::ast;
+#include "walk.h"
 
-// helper type for the visitor #4
-template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
-// explicit deduction guide (not needed as of C++20)
-template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+using namespace fun::ast;
 
 namespace fun {
 
@@ -19,179 +17,347 @@ static void indent(std::ostream &os, int depth) {
 
 static std::ostream &operator<<(std::ostream &os, const Identifier &ident) {
 	if (ident.id == 0) {
-		os << ident.name;
+		os << ident.name.str();
 	} else {
-		os << '<' << ident.name << ':' << ident.id << ';'
+		os << '<' << ident.name.str() << ':' << ident.id << ';'
 			<< ident.range.start << '-' << ident.range.end << '>';
 	}
 
 	return os;
 }
 
-void printExpression(std::ostream &os, const Expression &expr, int depth) {
-	os << '(';
-	std::visit(overloaded {
-		[&](const StringLiteralExpr &str) { os << '"' << str.str << '"'; },
-		[&](const NumberLiteralExpr &num) { os << num.num; },
-		[&](const IdentifierExpr &ident) { os << ident.ident; },
-		[&](const BinaryExpr &bin) {
-			printExpression(os, *bin.lhs, depth);
-
-			switch (bin.op) {
-			case BinaryExpr::EQ: os << " == "; break;
-			case BinaryExpr::NEQ: os << " != "; break;
-			case BinaryExpr::GT: os << " > "; break;
-			case BinaryExpr::GTEQ: os << " >= "; break;
-			case BinaryExpr::LT: os << " < "; break;
-			case BinaryExpr::LTEQ: os << " <= "; break;
-			case BinaryExpr::ADD: os << " + "; break;
-			case BinaryExpr::SUB: os << " - "; break;
-			case BinaryExpr::MULT: os << " * "; break;
-			case BinaryExpr::DIV: os << " / "; break;
-			}
+static const char *operatorString(BinaryExpr::Oper op) {
+	switch (op) {
+	case BinaryExpr::EQ: return " == ";
+	case BinaryExpr::NEQ: return " != ";
+	case BinaryExpr::GT: return " > ";
+	case BinaryExpr::GTEQ: return " >= ";
+	case BinaryExpr::LT: return " < ";
+	case BinaryExpr::LTEQ: return " <= ";
+	case BinaryExpr::ADD: return " + ";
+	case BinaryExpr::SUB: return " - ";
+	case BinaryExpr::MULT: return " * ";
+	case BinaryExpr::DIV: return " / ";
+	}
+
+	assert(false);
+	return "";
+}
+
+namespace {
+
+// Every expression is in parentheses, and every statement on a line of its
+// own, indented by its depth
+class PrintPass: public walk::Pass {
+public:
+	using walk::Pass::enter;
+	using walk::Pass::between;
+	using walk::Pass::leave;
+
+	PrintPass(std::ostream &os, int depth): os_(os), depth_(depth) {}
+
+	void enter(const Expression &) { os_ << '('; }
+	void leave(const Expression &) { os_ << ')'; }
+
+	void enter(const StringLiteralExpr &str) { os_ << '"' << str.str << '"'; }
+
+	void enter(const NumberLiteralExpr &num) {
+		// The shortest form which reads back as the same double
+		char buf[32];
+		auto result = std::to_chars(buf, buf + sizeof(buf), num.num);
+		os_.write(buf, result.ptr - buf);
+	}
+
+	void enter(const IdentifierExpr &ident) { os_ << ident.ident; }
+
+	void between(const BinaryExpr &bin, size_t) { os_ << operatorString(bin.op); }
+
+	// The first child is the function, and the arguments follow it
+	void between(const FuncCallExpr &, size_t i) {
+		if (i > 1) {
+			os_ << ", ";
+		}
+	}
+
+	void leave(const FuncCallExpr &) { os_ << ')'; }
+
+	void between(const AssignmentExpr &, size_t) { os_ << " = "; }
+
+	void enter(const DeclAssignmentExpr &assignment) { os_ << assignment.ident << " := "; }
+
+	void leave(const LookupExpr &lookup) { os_ << '.' << lookup.name.str(); }
+
+	void enter(const Statement &) { indent(os_, depth_); }
+
+	void leave(const Statement &statm) {
+		if (std::holds_alternative<Expression>(statm)) {
+			os_ << ';';
+		}
+		os_ << '\n';
+	}
+
+	void enter(const IfStatm &) { os_ << "if "; }
+
+	void between(const IfStatm &, size_t i) {
+		if (i == 1) {
+			os_ << " {\n";
+		} else {
+			closeBody();
+			os_ << " else {\n";
+		}
+		depth_ += 1;
+	}
 
-			printExpression(os, *bin.rhs, depth);
-		},
-		[&](const FuncCallExpr &call) {
-			printExpression(os, *call.func, 0);
+	void leave(const IfStatm &) { closeBody(); }
+
+	void enter(const WhileStatm &) { os_ << "while "; }
+
+	void between(const WhileStatm &, size_t) {
+		os_ << " {\n";
+		depth_ += 1;
+	}
 
-			bool first = true;
-			for (const std::unique_ptr<Expression> &arg: call.args) {
-				if (!first) {
-					os << ", ";
-				}
+	void leave(const WhileStatm &) { closeBody(); }
 
-				printExpression(os, *arg, depth);
-				first = false;
+	void enter(const ReturnStatm &) { os_ << "return "; }
+	void leave(const ReturnStatm &) { os_ << ';'; }
+
+	void enter(const ClassDecl &classDecl) {
+		os_ << "\\class{" << classDecl.ident << "}{";
+		openBody(classDecl.args);
+	}
+
+	void enter(const FuncDecl &funcDecl) {
+		os_ << "\\fun{" << funcDecl.ident << "}{";
+		openBody(funcDecl.args);
+	}
+
+	void enter(const MethodDecl &methodDecl) {
+		os_ << "\\fun{" << methodDecl.classIdent << "::" << methodDecl.ident << "}{";
+		openBody(methodDecl.args);
+	}
+
+	void leave(const Declaration &) { closeBody(); }
+
+private:
+	void openBody(const List<Identifier> &args) {
+		bool first = true;
+		for (const Identifier &arg: args) {
+			if (!first) {
+				os_ << ", ";
 			}
 
-			os << ')';
-		},
-		[&](const AssignmentExpr &assignment) {
-			printExpression(os, *assignment.lhs, depth);
-			os << " = ";
-			printExpression(os, *assignment.rhs, depth);
-		},
-		[&](const DeclAssignmentExpr &assignment) {
-			os << assignment.ident;
-			os << " := ";
-			printExpression(os, *assignment.rhs, depth);
-		},
-		[&](const LookupExpr &lookup) {
-			printExpression(os, *lookup.lhs, depth);
-			os << '.' << lookup.name;
-		},
-	}, expr);
-	os << ')';
+			os_ << arg;
+			first = false;
+		}
+
+		os_ << "}{\n";
+		depth_ += 1;
+	}
+
+	void closeBody() {
+		depth_ -= 1;
+		indent(os_, depth_);
+		os_ << '}';
+	}
+
+	std::ostream &os_;
+	int depth_;
+};
+
 }
 
-static void printIfStatm(std::ostream &os, const IfStatm &statm, int depth) {
-	os << "if ";
-	printExpression(os, statm.condition, depth);
+void printExpression(std::ostream &os, const Expression &expr, int depth) {
+	PrintPass pass(os, depth);
+	walk::walk(expr, pass);
+}
 
-	os << " {\n";
-	printCodeBlock(os, *statm.ifBody, depth + 1);
-	indent(os, depth);
-	os << "}";
+void printDeclaration(std::ostream &os, const Declaration &decl, int depth) {
+	PrintPass pass(os, depth);
+	walk::walk(decl, pass);
+}
 
-	if (statm.elseBody) {
-		os << " else {\n";
-		printCodeBlock(os, *statm.elseBody, depth + 1);
-		indent(os, depth);
-		os << "}";
+void printCodeBlock(std::ostream &os, const CodeBlock &block, int depth) {
+	PrintPass pass(os, depth);
+	walk::walk(block, pass);
+}
+
+static std::ostream &operator<<(std::ostream &os, const flat::Ident &ident) {
+	if (ident.id == 0) {
+		os << ident.name.str();
+	} else {
+		os << '<' << ident.name.str() << ':' << flat::wideId(ident.id) << ';'
+			<< ident.start << '-' << ident.end << '>';
 	}
+
+	return os;
 }
 
-void printDeclaration(std::ostream &os, const Declaration &decl, int depth) {
-	std::visit(overloaded {
-		[&](const ClassDecl &classDecl) {
-			os << "\\class{" << classDecl.ident << "}{";
-
-			bool first = true;
-			for (const Identifier &arg: classDecl.args) {
-				if (!first) {
-					os << ", ";
-				}
-
-				os << arg;
-				first = false;
-			}
+// The flat printers take a node's index, and return the index after its subtree
+static uint32_t printFlatCodeBlock(std::ostream &os, const flat::Tree &tree, uint32_t idx, int depth);
 
-			os << "}{\n";
-			printCodeBlock(os, *classDecl.body, depth + 1);
-			indent(os, depth);
-			os << '}';
-		},
-		[&](const FuncDecl &funcDecl) {
-			os << "\\fun{" << funcDecl.ident << "}{";
-
-			bool first = true;
-			for (const Identifier &arg: funcDecl.args) {
-				if (!first) {
-					os << ", ";
-				}
-
-				os << arg;
-				first = false;
-			}
+static uint32_t printFlatExpression(std::ostream &os, const flat::Tree &tree, uint32_t idx, int depth) {
+	const flat::Node &node = tree.nodes[idx];
+	uint32_t child = idx + 1;
 
-			os << "}{\n";
-			printCodeBlock(os, *funcDecl.body, depth + 1);
-			indent(os, depth);
-			os << '}';
-		},
-		[&](const MethodDecl &methodDecl) {
-			os << "\\fun{" << methodDecl.classIdent << "::" << methodDecl.ident << "}{";
-
-			bool first = true;
-			for (const Identifier &arg: methodDecl.args) {
-				if (!first) {
-					os << ", ";
-				}
-
-				os << arg;
-				first = false;
+	os << '(';
+	switch (node.kind) {
+	case flat::STRING_LITERAL:
+		os << '"' << tree.strings[node.value] << '"';
+		break;
+	case flat::NUMBER_LITERAL: {
+		char buf[32];
+		auto result = std::to_chars(buf, buf + sizeof(buf), tree.numbers[node.value]);
+		os.write(buf, result.ptr - buf);
+		break;
+	}
+	case flat::IDENTIFIER:
+		os << tree.idents[node.value];
+		break;
+	case flat::BINARY: {
+		// A chain's operators are the nodes down its left hand side, so
+		// they're in a row, followed by the operand at the bottom
+		uint32_t bottom = idx;
+		while (tree.nodes[bottom + 1].kind == flat::BINARY) {
+			bottom += 1;
+			os << '(';
+		}
+
+		child = printFlatExpression(os, tree, bottom + 1, depth);
+		for (uint32_t op = bottom; ; --op) {
+			os << operatorString((BinaryExpr::Oper)tree.nodes[op].op);
+			child = printFlatExpression(os, tree, child, depth);
+			if (op == idx) {
+				break;
+			}
+			os << ')';
+		}
+		break;
+	}
+	case flat::FUNC_CALL:
+		child = printFlatExpression(os, tree, child, 0);
+		for (uint32_t i = 0; i < node.count; ++i) {
+			if (i != 0) {
+				os << ", ";
 			}
 
-			os << "}{\n";
-			printCodeBlock(os, *methodDecl.body, depth + 1);
-			indent(os, depth);
-			os << '}';
-		},
-	}, decl);
+			child = printFlatExpression(os, tree, child, depth);
+		}
+
+		os << ')';
+		break;
+	case flat::ASSIGNMENT:
+		child = printFlatExpression(os, tree, child, depth);
+		os << " = ";
+		printFlatExpression(os, tree, child, depth);
+		break;
+	case flat::DECL_ASSIGNMENT:
+		os << tree.idents[node.value];
+		os << " := ";
+		printFlatExpression(os, tree, child, depth);
+		break;
+	case flat::LOOKUP:
+		printFlatExpression(os, tree, child, depth);
+		os << '.' << tree.names[node.value].str();
+		break;
+	default:
+		assert(false);
+	}
+	os << ')';
+
+	return node.end;
 }
 
-static void printWhileStatm(std::ostream &os, const WhileStatm &whileStatm, int depth) {
-	os << "while ";
-	printExpression(os, whileStatm.condition, depth);
-	os << " {\n";
-	printCodeBlock(os, *whileStatm.body, depth + 1);
+static uint32_t printFlatDeclaration(std::ostream &os, const flat::Tree &tree, uint32_t idx, int depth) {
+	const flat::Node &node = tree.nodes[idx];
+	uint32_t ident = node.value;
+
+	if (node.kind == flat::CLASS_DECL) {
+		os << "\\class{" << tree.idents[ident++] << "}{";
+	} else if (node.kind == flat::FUNC_DECL) {
+		os << "\\fun{" << tree.idents[ident++] << "}{";
+	} else {
+		os << "\\fun{" << tree.idents[ident] << "::" << tree.idents[ident + 1] << "}{";
+		ident += 2;
+	}
+
+	for (uint32_t i = 0; i < node.count; ++i) {
+		if (i != 0) {
+			os << ", ";
+		}
+
+		os << tree.idents[ident + i];
+	}
+
+	os << "}{\n";
+	printFlatCodeBlock(os, tree, idx + 1, depth + 1);
 	indent(os, depth);
 	os << '}';
-}
 
-static void printReturnStatm(std::ostream &os, const ReturnStatm &ret, int depth) {
-	os << "return ";
-	printExpression(os, ret.expr, depth);
-	os << ';';
+	return node.end;
 }
 
-static void printStatement(std::ostream &os, const Statement &statm, int depth) {
-	std::visit(overloaded {
-		[&](const Expression &expr) { printExpression(os, expr, depth); os << ';'; },
-		[&](const IfStatm &ifStatm) { printIfStatm(os, ifStatm, depth); },
-		[&](const WhileStatm &whileStatm) { printWhileStatm(os, whileStatm, depth); },
-		[&](const ReturnStatm &ret) { printReturnStatm(os, ret, depth); },
-		[&](const Declaration &decl) { printDeclaration(os, decl, depth); },
-	}, statm);
+static uint32_t printFlatStatement(std::ostream &os, const flat::Tree &tree, uint32_t idx, int depth) {
+	const flat::Node &node = tree.nodes[idx];
+	uint32_t child = idx + 1;
+
+	switch (node.kind) {
+	case flat::IF:
+		os << "if ";
+		child = printFlatExpression(os, tree, child, depth);
+
+		os << " {\n";
+		child = printFlatCodeBlock(os, tree, child, depth + 1);
+		indent(os, depth);
+		os << "}";
+
+		if (node.op) {
+			os << " else {\n";
+			printFlatCodeBlock(os, tree, child, depth + 1);
+			indent(os, depth);
+			os << "}";
+		}
+		break;
+	case flat::WHILE:
+		os << "while ";
+		child = printFlatExpression(os, tree, child, depth);
+		os << " {\n";
+		printFlatCodeBlock(os, tree, child, depth + 1);
+		indent(os, depth);
+		os << '}';
+		break;
+	case flat::RETURN:
+		os << "return ";
+		printFlatExpression(os, tree, child, depth);
+		os << ';';
+		break;
+	case flat::CLASS_DECL:
+	case flat::FUNC_DECL:
+	case flat::METHOD_DECL:
+		printFlatDeclaration(os, tree, idx, depth);
+		break;
+	default:
+		printFlatExpression(os, tree, idx, depth);
+		os << ';';
+	}
+
+	return node.end;
 }
 
-void printCodeBlock(std::ostream &os, const CodeBlock &block, int depth) {
-	for (const Statement &statm: block.statms) {
+static uint32_t printFlatCodeBlock(std::ostream &os, const flat::Tree &tree, uint32_t idx, int depth) {
+	const flat::Node &node = tree.nodes[idx];
+	uint32_t child = idx + 1;
+	for (uint32_t i = 0; i < node.count; ++i) {
 		indent(os, depth);
-		printStatement(os, statm, depth);
+		child = printFlatStatement(os, tree, child, depth);
 		os << '\n';
 	}
+
+	return node.end;
+}
+
+void printDeclaration(std::ostream &os, const flat::Tree &tree, const flat::Decl &decl) {
+	printFlatDeclaration(os, tree, decl.node, 0);
 }
 
 }
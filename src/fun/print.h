@@ -3,6 +3,7 @@
 #include <iostream>
 
 #include "ast.h"
+#include "flat.h"
 
 namespace fun {
 
@@ -10,4 +11,7 @@ void printExpression(std::ostream &os, const ast::Expression &expr, int depth =
 void printCodeBlock(std::ostream &os, const ast::CodeBlock &block, int depth = 0);
 void printDeclaration(std::ostream &os, const ast::Declaration &decl, int depth = 0);
 
+// Print a flattened declaration, the same way as the tree it came from
+void printDeclaration(std::ostream &os, const flat::Tree &tree, const flat::Decl &decl);
+
 }
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "ast.h"
+
+// Passes over syntax trees. A Walker goes down a tree in pre-order, keeping
+// the nodes still to be visited on a stack of its own rather than recursing,
+// so no tree is too deep to walk. It calls every pass it's given at each
+// node, so several passes can share one walk instead of each walking the
+// tree again.
+//
+// A pass derives from Pass, and overloads enter(), between() and leave() for
+// the nodes it acts on, with 'using Pass::enter;' and so on to keep the
+// others as no-ops. enter(node) is called before a node's children,
+// between(node, i) before each child i after the first, and leave(node)
+// after the last child. The nodes are CodeBlock, and the Expression,
+// Statement and Declaration variants, which are entered before and left
+// after the alternative they hold (a statement holding an expression or
+// a declaration has that as its only child). At every node, the passes are
+// called in the order they were given in.
+namespace fun::walk {
+
+// The defaults take const nodes, so that a pass's own overloads are picked
+// over them whether they take const nodes or not. They return NoOp so that
+// the walker can tell when no pass leaves a node, or acts between its
+// children, and not keep track of it for them.
+struct Pass {
+	struct NoOp {};
+
+	template<typename Node> NoOp enter(const Node &) { return {}; }
+	template<typename Node> NoOp between(const Node &, size_t) { return {}; }
+	template<typename Node> NoOp leave(const Node &) { return {}; }
+};
+
+// Children are walked in the order they're written in, except that the
+// generated code evaluates an assignment's value before what it assigns to
+enum Order { SOURCE_ORDER, EVALUATION_ORDER };
+
+// A walker keeps its stack's memory from one walk to the next, so passes
+// which walk many small trees keep one around, but a walk can't use the
+// walker it's running on
+template<bool Const, Order order = SOURCE_ORDER>
+class Walker {
+public:
+	template<typename T>
+	using Node = std::conditional_t<Const, const T, T>;
+
+	template<typename Root, typename... Passes>
+	void operator()(Root &root, Passes &...passes) {
+		stack_.clear();
+		stack_.push_back(item(root));
+		while (!stack_.empty()) {
+			Item top = stack_.back();
+			stack_.pop_back();
+			switch (top.kind) {
+			case EXPRESSION: {
+				auto &expr = *static_cast<Node<ast::Expression> *>(top.node);
+				std::visit([&](auto &node) { visit(top, expr, node, passes...); }, expr);
+				break;
+			}
+			case STATEMENT: {
+				auto &statm = *static_cast<Node<ast::Statement> *>(top.node);
+				std::visit([&](auto &node) { visit(top, statm, node, passes...); }, statm);
+				break;
+			}
+			case DECLARATION: {
+				auto &decl = *static_cast<Node<ast::Declaration> *>(top.node);
+				std::visit([&](auto &node) { visit(top, decl, node, passes...); }, decl);
+				break;
+			}
+			case CODE_BLOCK:
+				visitBlock(top, *static_cast<Node<ast::CodeBlock> *>(top.node), passes...);
+				break;
+			}
+		}
+	}
+
+private:
+	enum Kind: uint8_t { EXPRESSION, STATEMENT, DECLARATION, CODE_BLOCK };
+	enum Phase: uint8_t { ENTER, BETWEEN, LEAVE };
+
+	// A node to enter, or to call between() or leave() on
+	struct Item {
+		void *node;
+		uint32_t child;
+		Kind kind;
+		Phase phase;
+	};
+
+	std::vector<Item> stack_;
+
+	static void *ptr(const void *node) { return const_cast<void *>(node); }
+	static Item item(Node<ast::Expression> &expr) { return {ptr(&expr), 0, EXPRESSION, ENTER}; }
+	static Item item(Node<ast::Statement> &statm) { return {ptr(&statm), 0, STATEMENT, ENTER}; }
+	static Item item(Node<ast::Declaration> &decl) { return {ptr(&decl), 0, DECLARATION, ENTER}; }
+	static Item item(Node<ast::CodeBlock> &block) { return {ptr(&block), 0, CODE_BLOCK, ENTER}; }
+
+	template<typename P, typename N>
+	static constexpr bool leaves =
+		!std::is_same_v<decltype(std::declval<P &>().leave(std::declval<N &>())), Pass::NoOp>;
+
+	template<typename P, typename N>
+	static constexpr bool actsBetween =
+		!std::is_same_v<decltype(std::declval<P &>().between(std::declval<N &>(), size_t())), Pass::NoOp>;
+
+	// A statement's expression or declaration is a node of its own
+	template<typename Alt>
+	static constexpr bool isVariant =
+		std::is_same_v<std::remove_const_t<Alt>, ast::Expression> ||
+		std::is_same_v<std::remove_const_t<Alt>, ast::Declaration>;
+
+	template<typename Variant, typename Alt, typename... Passes>
+	void visit(const Item &self, Variant &variant, Alt &node, Passes &...passes) {
+		constexpr bool leave = (leaves<Passes, Variant> || ...) || (!isVariant<Alt> && (leaves<Passes, Alt> || ...));
+
+		switch (self.phase) {
+		case ENTER:
+			(passes.enter(variant), ...);
+			if constexpr (!isVariant<Alt>) {
+				(passes.enter(node), ...);
+			}
+
+			if constexpr (leave) {
+				stack_.push_back({self.node, 0, self.kind, LEAVE});
+			}
+			pushChildren<(actsBetween<Passes, Alt> || ...)>(self, node);
+			break;
+		case BETWEEN:
+			(passes.between(node, self.child), ...);
+			break;
+		case LEAVE:
+			if constexpr (!isVariant<Alt>) {
+				(passes.leave(node), ...);
+			}
+			(passes.leave(variant), ...);
+			break;
+		}
+	}
+
+	template<typename... Passes>
+	void visitBlock(const Item &self, Node<ast::CodeBlock> &block, Passes &...passes) {
+		switch (self.phase) {
+		case ENTER:
+			(passes.enter(block), ...);
+			if constexpr ((leaves<Passes, Node<ast::CodeBlock>> || ...)) {
+				stack_.push_back({self.node, 0, self.kind, LEAVE});
+			}
+			pushChildren<(actsBetween<Passes, Node<ast::CodeBlock>> || ...)>(self, block);
+			break;
+		case BETWEEN:
+			(passes.between(block, self.child), ...);
+			break;
+		case LEAVE:
+			(passes.leave(block), ...);
+			break;
+		}
+	}
+
+	// The last child goes on the stack first, so that the first comes off
+	// first, and the call to between() before each child goes on after it
+	template<bool between, typename N>
+	void pushChildren(const Item &self, N &node) {
+		children(node, [&](uint32_t i, Item child) {
+			stack_.push_back(child);
+			if constexpr (between) {
+				if (i > 0) {
+					stack_.push_back({self.node, i, self.kind, BETWEEN});
+				}
+			}
+		});
+	}
+
+	// Call push(i, child) for each of a node's children, from the last to the first
+	template<typename Push>
+	static void children(Node<ast::StringLiteralExpr> &, Push &&) {}
+	template<typename Push>
+	static void children(Node<ast::NumberLiteralExpr> &, Push &&) {}
+	template<typename Push>
+	static void children(Node<ast::IdentifierExpr> &, Push &&) {}
+
+	template<typename Push>
+	static void children(Node<ast::BinaryExpr> &bin, Push &&push) {
+		push(1, item(*bin.rhs));
+		push(0, item(*bin.lhs));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::FuncCallExpr> &call, Push &&push) {
+		for (size_t i = call.args.size(); i > 0; --i) {
+			push((uint32_t)i, item(call.args[i - 1]));
+		}
+		push(0, item(*call.func));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::AssignmentExpr> &assignment, Push &&push) {
+		if constexpr (order == SOURCE_ORDER) {
+			push(1, item(*assignment.rhs));
+			push(0, item(*assignment.lhs));
+		} else {
+			push(1, item(*assignment.lhs));
+			push(0, item(*assignment.rhs));
+		}
+	}
+
+	template<typename Push>
+	static void children(Node<ast::DeclAssignmentExpr> &assignment, Push &&push) {
+		push(0, item(*assignment.rhs));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::LookupExpr> &lookup, Push &&push) {
+		push(0, item(*lookup.lhs));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::Expression> &expr, Push &&push) {
+		push(0, item(expr));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::IfStatm> &ifStatm, Push &&push) {
+		if (ifStatm.elseBody) {
+			push(2, item(*ifStatm.elseBody));
+		}
+		push(1, item(*ifStatm.ifBody));
+		push(0, item(ifStatm.condition));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::WhileStatm> &whileStatm, Push &&push) {
+		push(1, item(*whileStatm.body));
+		push(0, item(whileStatm.condition));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::ReturnStatm> &ret, Push &&push) {
+		push(0, item(ret.expr));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::Declaration> &decl, Push &&push) {
+		push(0, item(decl));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::ClassDecl> &decl, Push &&push) {
+		push(0, item(*decl.body));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::FuncDecl> &decl, Push &&push) {
+		push(0, item(*decl.body));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::MethodDecl> &decl, Push &&push) {
+		push(0, item(*decl.body));
+	}
+
+	template<typename Push>
+	static void children(Node<ast::CodeBlock> &block, Push &&push) {
+		for (size_t i = block.statms.size(); i > 0; --i) {
+			push((uint32_t)(i - 1), item(block.statms[i - 1]));
+		}
+	}
+};
+
+// Walk a tree once, with any number of passes
+template<typename Root, typename... Passes>
+void walk(Root &root, Passes &...passes) {
+	Walker<std::is_const_v<Root>> walker;
+	walker(root, passes...);
+}
+
+}
@@ -1,18 +1,26 @@
-#include "lafun/parse.h"
-#include "lafun/resolve.h"
-#include "lafun/codegen.h"
-#include "lafun/print.h"
-#include "lafun/prelude.h"
-#include "fun/IdentResolver.h"
-#include "fun/prelude.h"
-#include "fun/Codegen.h"
-#include "fun/print.h"
-#include "Reader.h"
+#include "lafun/compile.h"
+#include "lafun/batch.h"
+#include "lafun/server.h"
+#include "lafun/cache.h"
+#include "lafun/watch.h"
+#include "lafun/lsp.h"
+#include "lafun/astfile.h"
+#include "lafun/module.h"
+#include "Input.h"
 
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
 #include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <cerrno>
+#include <memory>
+#include <unistd.h>
+#include <sys/stat.h>
 
 bool streq(const char *a, const char *b) {
 	return strcmp(a, b) == 0;
@@ -20,165 +28,448 @@ bool streq(const char *a, const char *b) {
 
 void usage(const char *argv0) {
 	std::cout << "Usage: " << argv0 << " [options] <input file>\n";
+	std::cout << "       " << argv0 << " [options] <input files...>\n";
 	std::cout << "\n";
 	std::cout << "Options:\n";
 	std::cout << "  --help|-h:          Show this help text\n";
 	std::cout << "  --latex <file>:     Write latex to <file>\n";
 	std::cout << "  --output|-o <file>: Write generated javascript to <file>\n";
 	std::cout << "  --no-latex-prelude: Generate latex code without a prelude\n";
+	std::cout << "  --no-js-prelude:    Generate javascript for a module, without a prelude or main call\n";
+	std::cout << "  --interface <file>: Write the document's module interface to <file>\n";
+	std::cout << "  --module-dir <dir>: Look for imported module interfaces in <dir>\n";
 	std::cout << "  --dump-ast:         Dump the parsed syntax tree\n";
+	std::cout << "  --stream:           Compile one top-level block at a time, in bounded memory\n";
+	std::cout << "  --watch:            Compile again every time the input file changes\n";
+	std::cout << "  --cache <dir>:      Reuse compiled blocks from <dir>, and store new ones there\n";
+	std::cout << "  --save-ast <file>:  Write the analyzed document to <file>, in binary\n";
+	std::cout << "  --from-ast:         The input file was written by --save-ast\n";
+	std::cout << "  --jobs|-j <n>:      Compile on <n> threads (default: one, or one per core\n";
+	std::cout << "                      for batches and servers)\n";
+	std::cout << "\n";
+	std::cout << "Batch options, used when compiling more than one input file:\n";
+	std::cout << "  --manifest <file>:  Read input files from <file>, one per line\n";
+	std::cout << "  --js-dir <dir>:     Write generated javascript to <dir>/<name>.js\n";
+	std::cout << "  --latex-dir <dir>:  Write latex to <dir>/<name>.tex\n";
+	std::cout << "  --interface-dir <dir>: Write interfaces to <dir>/<name>.funi, and only\n";
+	std::cout << "                      compile files whose outputs are out of date\n";
+	std::cout << "\n";
+	std::cout << "Server options:\n";
+	std::cout << "  --serve <socket>:   Serve compile requests on a unix socket\n";
+	std::cout << "  --connect <socket>: Compile through a server, with the other options as usual\n";
+	std::cout << "  --lsp:              Run a language server on stdin and stdout\n";
 }
 
-int main(int argc, const char **argv) {
-	std::ofstream jsFile;
-	std::ostream *jsStream = nullptr;
+static bool readManifest(const char *path, std::vector<std::string> &inputs) {
+	std::ifstream manifest(path);
+	if (!manifest) {
+		return false;
+	}
 
-	std::ofstream latexFile;
-	std::ostream *latexStream = nullptr;
+	std::string line;
+	while (std::getline(manifest, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		inputs.push_back(std::move(line));
+	}
+
+	return !manifest.bad();
+}
+
+static int runBatch(
+		const char *argv0, const std::vector<std::string> &inputs,
+		const char *jsDir, const char *latexDir, const char *interfaceDir,
+		lafun::CompileOptions opts, size_t threads) {
+	std::vector<lafun::BatchJob> jobs;
+	std::unordered_set<std::string> stems;
+	for (const std::string &input: inputs) {
+		if (input == "-") {
+			std::cerr << "Can't read stdin in batch mode\n";
+			usage(argv0);
+			return 1;
+		}
+
+		std::string stem = lafun::moduleName(input);
+		if (!stems.insert(stem).second) {
+			std::cerr << "Multiple input files would write outputs named " << stem << '\n';
+			return 1;
+		}
+
+		lafun::BatchJob job;
+		job.input = input;
+		if (jsDir) {
+			job.jsOutput = std::string(jsDir) + '/' + stem + ".js";
+		}
+		if (latexDir) {
+			job.latexOutput = std::string(latexDir) + '/' + stem + ".tex";
+		}
+		if (interfaceDir) {
+			job.interfaceOutput = std::string(interfaceDir) + '/' + stem + ".funi";
+		}
+
+		jobs.push_back(std::move(job));
+	}
+
+	// The batch's own modules come first
+	if (interfaceDir) {
+		opts.moduleDirs.insert(opts.moduleDirs.begin(), interfaceDir);
+	}
+
+	if (!lafun::compileBatch(jobs, opts, threads, std::cerr)) {
+		return 1;
+	}
+
+	return 0;
+}
+
+static int runClient(
+		const char *socketPath, const std::string &inputPath,
+		std::ostream *jsStream, std::ostream *latexStream, bool doDumpAst,
+		const lafun::CompileOptions &opts) {
+	lafun::RemoteRequest req;
+	req.opts = opts;
+	req.js = jsStream != nullptr;
+	req.latex = latexStream != nullptr;
+	req.ast = doDumpAst;
+
+	// The server has its own working directory
+	for (std::string &dir: req.opts.moduleDirs) {
+		char path[PATH_MAX];
+		if (realpath(dir.c_str(), path)) {
+			dir = path;
+		}
+	}
+
+	if (inputPath == "-") {
+		Input input;
+		if (!input.openFd(STDIN_FILENO)) {
+			std::cerr << "Reading stdin failed\n";
+			return 1;
+		}
+
+		req.source = input.view();
+	} else {
+		char path[PATH_MAX];
+		if (!realpath(inputPath.c_str(), path)) {
+			std::cerr << "Opening file " << inputPath << " failed\n";
+			return 1;
+		}
+
+		req.path = path;
+	}
+
+	lafun::RemoteResult result;
+	try {
+		result = lafun::compileRemote(socketPath, req);
+	} catch (std::exception &ex) {
+		std::cerr << ex.what() << '\n';
+		return 1;
+	}
+
+	if (!result.ok) {
+		std::cerr << result.error << '\n';
+		return 1;
+	}
 
-	std::ifstream inputFile;
-	std::istream *inputStream = nullptr;
+	if (doDumpAst) {
+		std::cout << result.ast;
+	}
+	if (jsStream) {
+		*jsStream << result.js;
+	}
+	if (latexStream) {
+		*latexStream << result.latex;
+	}
+
+	return 0;
+}
+
+int main(int argc, const char **argv) {
+	const char *jsPath = nullptr;
+	const char *latexPath = nullptr;
+	const char *jsDir = nullptr;
+	const char *latexDir = nullptr;
+	std::vector<std::string> inputs;
+	bool haveManifest = false;
+	size_t threads = 0;
+	const char *servePath = nullptr;
+	const char *connectPath = nullptr;
+	const char *astFilePath = nullptr;
+	const char *interfacePath = nullptr;
+	const char *interfaceDir = nullptr;
+	std::unique_ptr<lafun::BlockCache> cache;
 
 	bool doDumpAst = false;
-	bool doAddLatexPrelude = true;
+	bool watchMode = false;
+	bool lspMode = false;
+	bool fromAst = false;
+	lafun::CompileOptions opts;
 
 	bool dashes = false;
 	for (int i = 1; i < argc; ++i) {
 		const char *opt = argv[i];
+
+		auto takeArgument = [&]() -> const char * {
+			if (i == argc - 1) {
+				std::cerr << "Option requires an argument: " << opt << '\n';
+				exit(1);
+			}
+
+			return argv[++i];
+		};
+
 		if (!dashes && streq(opt, "--")) {
 			dashes = true;
 		} else if (!dashes && (streq(opt, "-h") || streq(opt, "--help"))) {
 			usage(argv[0]);
 			return 0;
 		} else if (!dashes && streq(opt, "--latex")) {
-			if (i == argc - 1) {
-				std::cerr << "Option requires an argument: " << opt << '\n';
+			latexPath = takeArgument();
+		} else if (!dashes && (streq(opt, "--output") || streq(opt, "-o"))) {
+			jsPath = takeArgument();
+		} else if (!dashes && streq(opt, "--no-latex-prelude")) {
+			opts.latexPrelude = false;
+		} else if (!dashes && streq(opt, "--no-js-prelude")) {
+			opts.jsPrelude = false;
+		} else if (!dashes && streq(opt, "--interface")) {
+			interfacePath = takeArgument();
+		} else if (!dashes && streq(opt, "--module-dir")) {
+			opts.moduleDirs.push_back(takeArgument());
+		} else if (!dashes && streq(opt, "--dump-ast")) {
+			doDumpAst = true;
+		} else if (!dashes && streq(opt, "--stream")) {
+			opts.stream = true;
+		} else if (!dashes && streq(opt, "--watch")) {
+			watchMode = true;
+		} else if (!dashes && streq(opt, "--cache")) {
+			const char *dir = takeArgument();
+			if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+				std::cerr << "Creating cache directory " << dir << " failed: " << strerror(errno) << '\n';
 				return 1;
 			}
 
-			if (streq(argv[i + 1], "-")) {
-				latexStream = &std::cout;
-			} else {
-				latexStream = &latexFile;
-				latexFile.open(argv[i + 1]);
-				if (!latexFile) {
-					std::cerr << "Opening file " << argv[i + 1] << " failed\n";
-					return 1;
-				}
-			}
-
-			i += 1;
-		} else if (!dashes && (streq(opt, "--output") || streq(opt, "-o"))) {
-			if (i == argc - 1) {
-				std::cerr << "Option requires an argument: " << opt << '\n';
+			cache = std::make_unique<lafun::BlockCache>(dir);
+			opts.cache = cache.get();
+		} else if (!dashes && streq(opt, "--save-ast")) {
+			astFilePath = takeArgument();
+		} else if (!dashes && streq(opt, "--from-ast")) {
+			fromAst = true;
+		} else if (!dashes && streq(opt, "--manifest")) {
+			const char *path = takeArgument();
+			if (!readManifest(path, inputs)) {
+				std::cerr << "Reading manifest " << path << " failed\n";
 				return 1;
 			}
 
-			if (streq(argv[i + 1], "-")) {
-				jsStream = &std::cout;
-			} else {
-				jsStream = &jsFile;
-				jsFile.open(argv[i + 1]);
-				if (!jsFile) {
-					std::cerr << "Opening file " << argv[i + 1] << " failed\n";
-					return 1;
-				}
+			haveManifest = true;
+		} else if (!dashes && streq(opt, "--js-dir")) {
+			jsDir = takeArgument();
+		} else if (!dashes && streq(opt, "--latex-dir")) {
+			latexDir = takeArgument();
+		} else if (!dashes && streq(opt, "--interface-dir")) {
+			interfaceDir = takeArgument();
+		} else if (!dashes && (streq(opt, "--jobs") || streq(opt, "-j"))) {
+			const char *arg = takeArgument();
+			char *end;
+			threads = strtoul(arg, &end, 10);
+			if (*arg == '\0' || *end != '\0' || threads == 0) {
+				std::cerr << "Invalid number of jobs: " << arg << '\n';
+				return 1;
 			}
-
-			i += 1;
-		} else if (!dashes && streq(opt, "--no-latex-prelude")) {
-			doAddLatexPrelude = false;
-		} else if (!dashes && streq(opt, "--dump-ast")) {
-			doDumpAst = true;
+		} else if (!dashes && streq(opt, "--serve")) {
+			servePath = takeArgument();
+		} else if (!dashes && streq(opt, "--connect")) {
+			connectPath = takeArgument();
+		} else if (!dashes && streq(opt, "--lsp")) {
+			lspMode = true;
 		} else if (!dashes && opt[0] == '-' && opt[1] != '\0') {
 			std::cerr << "Unknown option: " << opt << '\n';
 			usage(argv[0]);
 			return 1;
-		} else if (!inputStream) {
-			if (streq(opt, "-")) {
-				inputStream = &std::cin;
-			} else {
-				inputStream = &inputFile;
-				inputFile.open(opt);
-				if (!inputFile) {
-					std::cerr << "Opening file " << opt << " failed\n";
-					return 1;
-				}
-			}
 		} else {
-			std::cerr << "Only one input file, please\n";
+			inputs.push_back(opt);
+		}
+	}
+
+	if (cache && (servePath || connectPath)) {
+		std::cerr << "--cache can't be used with --serve or --connect\n";
+		usage(argv[0]);
+		return 1;
+	}
+
+	if ((astFilePath || fromAst) &&
+			(opts.stream || cache || watchMode || servePath || connectPath || lspMode)) {
+		std::cerr << "--save-ast and --from-ast can't be used with --stream, --cache or other modes\n";
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (lspMode) {
+		if (!inputs.empty() || haveManifest || servePath || connectPath || watchMode) {
+			std::cerr << "--lsp doesn't take input files, and can't be used with other modes\n";
 			usage(argv[0]);
 			return 1;
 		}
+
+		return lafun::serveLsp(std::cin, std::cout);
 	}
 
-	if (!inputStream) {
+	if (servePath) {
+		if (!inputs.empty() || haveManifest || connectPath) {
+			std::cerr << "--serve doesn't take input files\n";
+			usage(argv[0]);
+			return 1;
+		}
+
+		return lafun::serve(servePath, threads);
+	}
+
+	if (haveManifest || inputs.size() > 1) {
+		if (watchMode) {
+			std::cerr << "--watch takes one input file\n";
+			usage(argv[0]);
+			return 1;
+		}
+
+		if (jsPath || latexPath || doDumpAst || astFilePath || fromAst || interfacePath) {
+			std::cerr << "Use --js-dir, --latex-dir and --interface-dir with multiple input files\n";
+			usage(argv[0]);
+			return 1;
+		}
+
+		return runBatch(argv[0], inputs, jsDir, latexDir, interfaceDir, opts, threads);
+	}
+
+	if (inputs.empty()) {
 		std::cerr << "Missing required input file option\n";
 		usage(argv[0]);
 		return 1;
 	}
 
-	std::stringstream ss;
-	ss << inputFile.rdbuf();
-	std::string str = ss.str();
+	if (jsDir || latexDir || interfaceDir) {
+		std::cerr << "--js-dir, --latex-dir and --interface-dir are only used with multiple input files\n";
+		usage(argv[0]);
+		return 1;
+	}
 
-	Reader reader{str};
-	fun::IdentResolver resolver;
-	for (const std::string &name: fun::preludeNames) {
-		resolver.addBuiltin(name);
+	const std::string &inputPath = inputs.front();
+	if (threads != 0) {
+		opts.threads = threads;
 	}
+	opts.moduleDirs.push_back(inputPath == "-" ? "." : lafun::documentDir(inputPath));
 
-	lafun::ast::LafunDocument document;
-	lafun::parseLafun(reader, document);
+	if (interfacePath && (watchMode || connectPath)) {
+		std::cerr << "--interface can't be used with --watch or --connect\n";
+		usage(argv[0]);
+		return 1;
+	}
+	if (watchMode) {
+		if (connectPath || doDumpAst || inputPath == "-") {
+			std::cerr << "--watch needs an input file, and can't be used with --connect or --dump-ast\n";
+			usage(argv[0]);
+			return 1;
+		}
 
-	for (auto &block: document.blocks) {
-		if (std::holds_alternative<lafun::ast::FunBlock>(block)) {
-			resolver.add(&std::get<lafun::ast::FunBlock>(block).decl);
+		if ((!jsPath && !latexPath) || (jsPath && streq(jsPath, "-")) || (latexPath && streq(latexPath, "-"))) {
+			std::cerr << "--watch needs output files\n";
+			usage(argv[0]);
+			return 1;
 		}
+
+		return lafun::watch(inputPath.c_str(), jsPath, latexPath, opts);
 	}
 
-	resolver.finalize();
+	std::ofstream jsFile;
+	std::ostream *jsStream = nullptr;
+	if (jsPath && streq(jsPath, "-")) {
+		jsStream = &std::cout;
+	} else if (jsPath) {
+		jsStream = &jsFile;
+		jsFile.open(jsPath);
+		if (!jsFile) {
+			std::cerr << "Opening file " << jsPath << " failed\n";
+			return 1;
+		}
+	}
+
+	std::ofstream latexFile;
+	std::ostream *latexStream = nullptr;
+	if (latexPath && streq(latexPath, "-")) {
+		latexStream = &std::cout;
+	} else if (latexPath) {
+		latexStream = &latexFile;
+		latexFile.open(latexPath);
+		if (!latexFile) {
+			std::cerr << "Opening file " << latexPath << " failed\n";
+			return 1;
+		}
+	}
 
-	document.defs = resolver.getDefs();
-	document.refs = resolver.getRefs();
+	if (connectPath) {
+		return runClient(connectPath, inputPath, jsStream, latexStream, doDumpAst, opts);
+	}
 
-	lafun::resolveLafunReferences(document);
+	std::ofstream astFile;
+	if (astFilePath) {
+		astFile.open(astFilePath, std::ios::binary);
+		if (!astFile) {
+			std::cerr << "Opening file " << astFilePath << " failed\n";
+			return 1;
+		}
+	}
 
+	lafun::CompileOutputs out;
+	out.js = jsStream;
+	out.latex = latexStream;
 	if (doDumpAst) {
-		for (lafun::ast::LafunBlock &block: document.blocks) {
-			if (std::holds_alternative<lafun::ast::FunBlock>(block)) {
-				lafun::ast::FunBlock &funBlock = std::get<lafun::ast::FunBlock>(block);
-				fun::printDeclaration(std::cout, funBlock.decl);
-				std::cout << '\n';
-			}
-		}
+		out.ast = &std::cout;
+	}
+	if (astFilePath) {
+		out.astFile = &astFile;
 	}
 
-	if (jsStream) {
-		fun::Codegen gen;
-		for (lafun::ast::LafunBlock &block: document.blocks) {
-			if (std::holds_alternative<lafun::ast::FunBlock>(block)) {
-				lafun::ast::FunBlock &funBlock = std::get<lafun::ast::FunBlock>(block);
-				gen.add(&funBlock.decl);
-			}
+	// Written afterwards, and only if it changed, so that an unchanged
+	// interface doesn't make dependents look out of date
+	std::ostringstream interface;
+	if (interfacePath) {
+		out.interface = &interface;
+	}
+
+	auto writeInterface = [&] {
+		if (interfacePath && !lafun::updateFile(interfacePath, interface.str())) {
+			std::cerr << "Writing file " << interfacePath << " failed\n";
+			return 1;
 		}
 
-		*jsStream << fun::jsPrelude;
-		gen.generate(*jsStream);
-		*jsStream << fun::jsPostlude;
-	}
+		return 0;
+	};
 
-	if (latexStream) {
-		if (doAddLatexPrelude) {
-			*latexStream << lafun::latexPrelude;
+	if (fromAst) {
+		lafun::AstFile file;
+		try {
+			file.open(inputPath.c_str());
+			lafun::compileAstFile(file, opts, out);
+		} catch (std::exception &ex) {
+			std::cerr << ex.what() << '\n';
+			return 1;
 		}
 
-		lafun::codegen(*latexStream, str, document);
+		return writeInterface();
+	}
 
-		if (doAddLatexPrelude) {
-			*latexStream << lafun::latexPostlude;
+	Input input;
+	if (inputPath == "-") {
+		if (!input.openFd(STDIN_FILENO)) {
+			std::cerr << "Reading stdin failed\n";
+			return 1;
 		}
+	} else if (!input.open(inputPath.c_str())) {
+		std::cerr << "Opening file " << inputPath << " failed\n";
+		return 1;
 	}
 
-	return 0;
+	lafun::compile(input.view(), opts, out);
+	return writeInterface();
 }
@@ -1,19 +1,26 @@
 #pragma once
 
+#include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
 #include "fun/ast.h"
+#include "Arena.h"
 
 namespace lafun::ast {
 
 struct FunBlock {
 	fun::ast::Declaration decl;
 	fun::ByteRange range;
+
+	// Owns everything decl points to
+	Arena arena;
 };
 
+// Refers into the source
 struct RawLatex {
-	std::string str;
+	std::string_view str;
 };
 
 struct IdentifierUpwardsRef {
@@ -26,11 +33,17 @@ struct IdentifierDownwardsRef {
 	size_t id = 0;
 };
 
+// \import{module}: the names in the module's interface can be used
+struct ModuleImport {
+	std::string module;
+};
+
 using LafunBlock = std::variant<
 	FunBlock,
 	RawLatex,
 	IdentifierUpwardsRef,
-	IdentifierDownwardsRef>;
+	IdentifierDownwardsRef,
+	ModuleImport>;
 
 struct LafunDocument {
 	std::vector<LafunBlock> blocks;
@@ -0,0 +1,844 @@
+#include "astfile.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <climits>
+#include <cstring>
+
+#include "fun/parse.h"
+#include "util.h"
+
+using namespace lafun::ast;
+using namespace lafun::astfile;
+namespace fa = fun::ast;
+
+namespace lafun {
+
+namespace {
+
+class Writer {
+public:
+	Writer(std::string_view source): source_(source) {
+		if (source.size() > NONE) {
+			throw std::runtime_error("Document too large for an AST file");
+		}
+	}
+
+	void document(const LafunDocument &document);
+	void write(std::ostream &os);
+
+private:
+	StrRef string(std::string_view str);
+	StrRef sourceString(std::string_view str, size_t offset);
+	uint32_t ident(const fa::Identifier &ident);
+	uint32_t node(const Node &node);
+	uint32_t expression(const fa::Expression &top);
+	uint32_t statement(const fa::Statement &statm);
+	uint32_t declaration(const fa::Declaration &decl);
+	uint32_t codeBlock(const fa::CodeBlock *block);
+	uint32_t params(const fa::List<fa::Identifier> &args);
+	uint32_t list(const std::vector<uint32_t> &items);
+	uint32_t checked(size_t num);
+
+	std::string_view source_;
+	std::string pool_;
+	std::vector<Node> nodes_;
+	std::vector<Ident> idents_;
+	std::vector<uint32_t> lists_;
+	std::vector<Block> blocks_;
+	std::vector<uint32_t> defs_;
+	std::vector<uint32_t> refs_;
+	std::unordered_map<const fa::Identifier *, uint32_t> identIndex_;
+
+	// Expressions still to be written, and the nodes of those which have
+	// been, until their parent is
+	struct Pending {
+		const fa::Expression *expr;
+		bool expanded;
+	};
+
+	std::vector<Pending> pending_;
+	std::vector<uint32_t> written_;
+};
+
+uint32_t Writer::checked(size_t num) {
+	if (num >= NONE) {
+		throw std::runtime_error("Document too large for an AST file");
+	}
+
+	return (uint32_t)num;
+}
+
+StrRef Writer::string(std::string_view str) {
+	StrRef ref{checked(source_.size() + pool_.size()), checked(str.size())};
+	pool_ += str;
+	checked(source_.size() + pool_.size());
+	return ref;
+}
+
+// Most strings are already in the source, so only the others go in the pool
+StrRef Writer::sourceString(std::string_view str, size_t offset) {
+	if (offset <= source_.size() && source_.substr(offset, str.size()) == str) {
+		return {(uint32_t)offset, (uint32_t)str.size()};
+	}
+
+	return string(str);
+}
+
+uint32_t Writer::ident(const fa::Identifier &ident) {
+	uint32_t idx = checked(idents_.size());
+	idents_.push_back({
+		sourceString(ident.name.str(), ident.range.start),
+		checked(ident.range.start), checked(ident.range.end), ident.id});
+	identIndex_[&ident] = idx;
+	return idx;
+}
+
+uint32_t Writer::node(const Node &node) {
+	uint32_t idx = checked(nodes_.size());
+	nodes_.push_back(node);
+	return idx;
+}
+
+uint32_t Writer::list(const std::vector<uint32_t> &items) {
+	uint32_t start = checked(lists_.size());
+	lists_.insert(lists_.end(), items.begin(), items.end());
+	checked(lists_.size());
+	return start;
+}
+
+uint32_t Writer::params(const fa::List<fa::Identifier> &args) {
+	std::vector<uint32_t> items;
+	items.reserve(args.size());
+	for (const fa::Identifier &arg: args) {
+		items.push_back(ident(arg));
+	}
+
+	return list(items);
+}
+
+// Children are always written before their parent. Chains of calls,
+// look-ups, operators and assignments make trees as deep as the chains are
+// long, so expressions are written with a stack of their own, rather than
+// by recursion: each expression is pushed, then its children, and it's
+// written once they have been.
+uint32_t Writer::expression(const fa::Expression &top) {
+	pending_.push_back({&top, false});
+	while (!pending_.empty()) {
+		const fa::Expression &expr = *pending_.back().expr;
+		if (!pending_.back().expanded) {
+			pending_.back().expanded = true;
+			auto push = [&](const fa::Expression &child) { pending_.push_back({&child, false}); };
+
+			// Backwards, so that they are written in order
+			std::visit(overloaded {
+				[&](const fa::BinaryExpr &expr) { push(*expr.rhs); push(*expr.lhs); },
+				[&](const fa::FuncCallExpr &expr) {
+					for (size_t i = expr.args.size(); i-- > 0;) {
+						push(expr.args[i]);
+					}
+					push(*expr.func);
+				},
+				[&](const fa::AssignmentExpr &expr) { push(*expr.rhs); push(*expr.lhs); },
+				[&](const fa::DeclAssignmentExpr &expr) { push(*expr.rhs); },
+				[&](const fa::LookupExpr &expr) { push(*expr.lhs); },
+				[&](const auto &) {},
+			}, expr);
+			continue;
+		}
+
+		pending_.pop_back();
+		auto pop = [&] {
+			uint32_t idx = written_.back();
+			written_.pop_back();
+			return idx;
+		};
+
+		written_.push_back(std::visit(overloaded {
+			[&](const fa::StringLiteralExpr &expr) {
+				StrRef str = string(expr.str);
+				return node({STRING_LITERAL, 0, 0, str.offset, str.size, 0, 0, 0});
+			},
+			[&](const fa::NumberLiteralExpr &expr) {
+				uint64_t bits;
+				memcpy(&bits, &expr.num, sizeof(bits));
+				return node({NUMBER_LITERAL, 0, 0, (uint32_t)bits, (uint32_t)(bits >> 32), 0, 0, 0});
+			},
+			[&](const fa::IdentifierExpr &expr) {
+				return node({IDENTIFIER, 0, 0, ident(expr.ident), 0, 0, 0, 0});
+			},
+			[&](const fa::BinaryExpr &expr) {
+				uint32_t rhs = pop();
+				uint32_t lhs = pop();
+				return node({BINARY, (uint8_t)expr.op, 0, lhs, rhs, 0, 0, 0});
+			},
+			[&](const fa::FuncCallExpr &expr) {
+				size_t first = written_.size() - expr.args.size();
+				std::vector<uint32_t> args(written_.begin() + first, written_.end());
+				written_.resize(first);
+				uint32_t func = pop();
+				uint32_t start = list(args);
+				return node({FUNC_CALL, 0, 0, func, 0, start, (uint32_t)args.size(), 0});
+			},
+			[&](const fa::AssignmentExpr &) {
+				uint32_t rhs = pop();
+				uint32_t lhs = pop();
+				return node({ASSIGNMENT, 0, 0, lhs, rhs, 0, 0, 0});
+			},
+			[&](const fa::DeclAssignmentExpr &expr) {
+				uint32_t rhs = pop();
+				return node({DECL_ASSIGNMENT, 0, 0, ident(expr.ident), rhs, 0, 0, 0});
+			},
+			[&](const fa::LookupExpr &expr) {
+				uint32_t lhs = pop();
+				StrRef name = string(expr.name.str());
+				return node({LOOKUP, 0, 0, lhs, name.offset, name.size, 0, 0});
+			},
+		}, expr));
+	}
+
+	uint32_t idx = written_.back();
+	written_.pop_back();
+	return idx;
+}
+
+uint32_t Writer::codeBlock(const fa::CodeBlock *block) {
+	std::vector<uint32_t> statms;
+	statms.reserve(block->statms.size());
+	for (const fa::Statement &statm: block->statms) {
+		statms.push_back(statement(statm));
+	}
+
+	uint32_t start = list(statms);
+	return node({CODE_BLOCK, 0, 0, 0, 0, start, (uint32_t)statms.size(), 0});
+}
+
+uint32_t Writer::statement(const fa::Statement &statm) {
+	return std::visit(overloaded {
+		[&](const fa::Expression &expr) {
+			return expression(expr);
+		},
+		[&](const fa::IfStatm &statm) {
+			uint32_t cond = expression(statm.condition);
+			uint32_t ifBody = codeBlock(statm.ifBody);
+			uint32_t elseBody = statm.elseBody ? codeBlock(statm.elseBody) : NONE;
+			return node({IF, 0, 0, cond, ifBody, elseBody, 0, 0});
+		},
+		[&](const fa::WhileStatm &statm) {
+			uint32_t cond = expression(statm.condition);
+			uint32_t body = codeBlock(statm.body);
+			return node({WHILE, 0, 0, cond, body, 0, 0, 0});
+		},
+		[&](const fa::ReturnStatm &statm) {
+			return node({RETURN, 0, 0, expression(statm.expr), 0, 0, 0, 0});
+		},
+		[&](const fa::Declaration &decl) {
+			return declaration(decl);
+		},
+	}, statm);
+}
+
+uint32_t Writer::declaration(const fa::Declaration &decl) {
+	return std::visit(overloaded {
+		[&](const fa::ClassDecl &decl) {
+			uint32_t id = ident(decl.ident);
+			uint32_t args = params(decl.args);
+			uint32_t body = codeBlock(decl.body);
+			return node({CLASS_DECL, 0, 0, id, 0, args, (uint32_t)decl.args.size(), body});
+		},
+		[&](const fa::FuncDecl &decl) {
+			uint32_t id = ident(decl.ident);
+			uint32_t args = params(decl.args);
+			uint32_t body = codeBlock(decl.body);
+			return node({FUNC_DECL, 0, 0, id, 0, args, (uint32_t)decl.args.size(), body});
+		},
+		[&](const fa::MethodDecl &decl) {
+			uint32_t classId = ident(decl.classIdent);
+			uint32_t id = ident(decl.ident);
+			uint32_t args = params(decl.args);
+			uint32_t body = codeBlock(decl.body);
+			return node({METHOD_DECL, 0, 0, classId, id, args, (uint32_t)decl.args.size(), body});
+		},
+	}, decl);
+}
+
+void Writer::document(const LafunDocument &document) {
+	// Blocks other than FunBlocks have no range, so track where they start
+	size_t offset = 0;
+	for (const LafunBlock &block: document.blocks) {
+		std::visit(overloaded {
+			[&](const FunBlock &block) {
+				uint32_t decl = declaration(block.decl);
+				blocks_.push_back({
+					FUN_BLOCK, decl, checked(block.range.start), checked(block.range.end), {0, 0}, 0});
+				offset = block.range.end;
+			},
+			[&](const RawLatex &block) {
+				blocks_.push_back({RAW_LATEX, 0, 0, 0, sourceString(block.str, offset), 0});
+				offset += block.str.size();
+			},
+			[&](const IdentifierUpwardsRef &block) {
+				blocks_.push_back({UPWARDS_REF, 0, 0, 0, sourceString(block.ident, offset + 1), block.id});
+				offset += block.ident.size() + 1;
+			},
+			[&](const IdentifierDownwardsRef &block) {
+				blocks_.push_back({DOWNWARDS_REF, 0, 0, 0, sourceString(block.ident, offset + 1), block.id});
+				offset += block.ident.size() + 1;
+			},
+			[&](const ModuleImport &block) {
+				static const std::string_view keyword = "\\import{";
+				blocks_.push_back({MODULE_IMPORT, 0, 0, 0, sourceString(block.module, offset + keyword.size()), 0});
+				offset += keyword.size() + block.module.size() + 1;
+			},
+		}, block);
+	}
+
+	for (const fa::Identifier *def: document.defs) {
+		defs_.push_back(identIndex_.at(def));
+	}
+	for (const fa::Identifier *ref: document.refs) {
+		refs_.push_back(identIndex_.at(ref));
+	}
+}
+
+static size_t align(size_t offset) {
+	return (offset + 7) & ~(size_t)7;
+}
+
+template<typename T>
+static void writeSection(std::ostream &os, size_t &pos, Section section, const T *data) {
+	static const char zeros[8] = {};
+	os.write(zeros, section.offset - pos);
+	os.write((const char *)data, section.count * sizeof(T));
+	pos = section.offset + section.count * sizeof(T);
+}
+
+void Writer::write(std::ostream &os) {
+	Header header{};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.byteOrder = ENDIAN_MARK;
+	header.sourceSize = source_.size();
+
+	size_t pos = sizeof(header);
+	auto place = [&](Section &section, size_t count, size_t size) {
+		section = {align(pos), count};
+		pos = section.offset + count * size;
+	};
+	place(header.blob, source_.size() + pool_.size(), 1);
+	place(header.nodes, nodes_.size(), sizeof(Node));
+	place(header.idents, idents_.size(), sizeof(Ident));
+	place(header.lists, lists_.size(), sizeof(uint32_t));
+	place(header.blocks, blocks_.size(), sizeof(Block));
+	place(header.defs, defs_.size(), sizeof(uint32_t));
+	place(header.refs, refs_.size(), sizeof(uint32_t));
+
+	os.write((const char *)&header, sizeof(header));
+	pos = sizeof(header);
+	writeSection(os, pos, {header.blob.offset, source_.size()}, source_.data());
+	writeSection(os, pos, {pos, pool_.size()}, pool_.data());
+	writeSection(os, pos, header.nodes, nodes_.data());
+	writeSection(os, pos, header.idents, idents_.data());
+	writeSection(os, pos, header.lists, lists_.data());
+	writeSection(os, pos, header.blocks, blocks_.data());
+	writeSection(os, pos, header.defs, defs_.data());
+	writeSection(os, pos, header.refs, refs_.data());
+}
+
+}
+
+void writeAstFile(std::ostream &os, std::string_view source, const LafunDocument &document) {
+	Writer writer(source);
+	writer.document(document);
+	writer.write(os);
+}
+
+[[noreturn]] static void invalid(const char *what) {
+	throw std::runtime_error(std::string("Invalid AST file: ") + what);
+}
+
+template<typename T>
+static const T *section(std::string_view file, const Section &section, size_t &count) {
+	if (section.offset % alignof(T) != 0 || section.offset > file.size() ||
+			section.count > (file.size() - section.offset) / sizeof(T)) {
+		invalid("section out of bounds");
+	}
+
+	count = section.count;
+	return (const T *)(file.data() + section.offset);
+}
+
+void AstFile::open(const char *path) {
+	if (!input_.open(path)) {
+		throw std::runtime_error(std::string("Opening file ") + path + " failed");
+	}
+
+	std::string_view file = input_.view();
+	if (file.size() < sizeof(Header) || memcmp(file.data(), MAGIC, sizeof(MAGIC)) != 0) {
+		invalid("bad magic");
+	}
+
+	// The mapping (or read buffer) is page aligned, so the header is too
+	const Header &header = *(const Header *)file.data();
+	if (header.version != VERSION) {
+		throw std::runtime_error(
+				"Unsupported AST file version " + std::to_string(header.version) +
+				", expected " + std::to_string(VERSION));
+	}
+	if (header.byteOrder != ENDIAN_MARK) {
+		invalid("wrong byte order");
+	}
+
+	size_t blobSize;
+	const char *blob = section<char>(file, header.blob, blobSize);
+	if (blobSize > NONE || header.sourceSize > blobSize) {
+		invalid("bad source size");
+	}
+
+	blob_ = std::string_view(blob, blobSize);
+	sourceSize_ = header.sourceSize;
+	nodes_ = section<Node>(file, header.nodes, nodeCount_);
+	idents_ = section<Ident>(file, header.idents, identCount_);
+	lists_ = section<uint32_t>(file, header.lists, listCount_);
+	blocks_ = section<Block>(file, header.blocks, blockCount_);
+	defs_ = section<uint32_t>(file, header.defs, defCount_);
+	refs_ = section<uint32_t>(file, header.refs, refCount_);
+
+	validate();
+}
+
+static bool isExpression(uint8_t kind) {
+	return kind <= LOOKUP;
+}
+
+static bool isDeclaration(uint8_t kind) {
+	return kind == CLASS_DECL || kind == FUNC_DECL || kind == METHOD_DECL;
+}
+
+static bool isAssignment(uint8_t kind) {
+	return kind == ASSIGNMENT || kind == DECL_ASSIGNMENT;
+}
+
+void AstFile::validate() {
+	auto checkStr = [&](uint32_t offset, uint32_t size) {
+		if ((uint64_t)offset + size > blob_.size()) {
+			invalid("string out of bounds");
+		}
+	};
+
+	auto checkList = [&](uint32_t start, uint32_t count) {
+		if ((uint64_t)start + count > listCount_) {
+			invalid("list out of bounds");
+		}
+	};
+
+	for (size_t i = 0; i < identCount_; ++i) {
+		const Ident &ident = idents_[i];
+		checkStr(ident.name.offset, ident.name.size);
+		if (ident.start > ident.end || ident.end > sourceSize_) {
+			invalid("identifier range out of bounds");
+		}
+	}
+
+	// Children come before their parents, which rules out cycles, and no
+	// node has two parents, so loading a tree takes time in proportion to
+	// its size. Nodes are nested no deeper than the parser allows: heights
+	// count, for an expression, the parentheses and argument lists it needs,
+	// and for anything else, its code blocks. Each identifier is in one node.
+	std::vector<uint32_t> parents(nodeCount_, NONE);
+	std::vector<uint16_t> heights(nodeCount_, 0);
+	std::vector<uint32_t> owners(identCount_, NONE);
+	for (size_t i = 0; i < nodeCount_; ++i) {
+		const Node &node = nodes_[i];
+		uint32_t height = 0;
+		auto child = [&](uint32_t idx, bool ok) {
+			if (idx >= i || !ok) {
+				invalid("bad child node");
+			}
+			if (parents[idx] != NONE) {
+				invalid("node with more than one parent");
+			}
+
+			parents[idx] = (uint32_t)i;
+		};
+		auto expr = [&](uint32_t idx) {
+			child(idx, idx < i && isExpression(nodes_[idx].kind));
+		};
+		// An operand, which needs parentheses if it's an assignment, or an
+		// operator which binds less tightly than minPrecedence
+		auto operand = [&](uint32_t idx, int minPrecedence, bool assignments) {
+			expr(idx);
+			const Node &operand = nodes_[idx];
+			bool grouped = isAssignment(operand.kind) ? assignments :
+					operand.kind == BINARY && fun::precedence((fa::BinaryExpr::Oper)operand.op) < minPrecedence;
+			height = std::max<uint32_t>(height, heights[idx] + grouped);
+		};
+		auto body = [&](uint32_t idx) {
+			child(idx, idx < i && nodes_[idx].kind == CODE_BLOCK);
+			height = std::max<uint32_t>(height, heights[idx] + 1);
+		};
+		auto ident = [&](uint32_t idx) {
+			if (idx >= identCount_) {
+				invalid("identifier out of bounds");
+			}
+			if (owners[idx] != NONE) {
+				invalid("identifier in more than one node");
+			}
+
+			owners[idx] = (uint32_t)i;
+		};
+
+		static constexpr int ANY = INT_MAX;
+		switch (node.kind) {
+		case STRING_LITERAL:
+			checkStr(node.a, node.b);
+			break;
+		case NUMBER_LITERAL:
+			break;
+		case IDENTIFIER:
+			ident(node.a);
+			break;
+		case BINARY: {
+			if (node.op > fa::BinaryExpr::LTEQ) {
+				invalid("bad operator");
+			}
+
+			// Operators of the same precedence group from left to right
+			int precedence = fun::precedence((fa::BinaryExpr::Oper)node.op);
+			operand(node.a, precedence, true);
+			operand(node.b, precedence + 1, false);
+			break;
+		}
+		case FUNC_CALL:
+			operand(node.a, ANY, true);
+			checkList(node.c, node.d);
+			for (uint32_t j = 0; j < node.d; ++j) {
+				uint32_t arg = lists_[node.c + j];
+				expr(arg);
+				height = std::max<uint32_t>(height, heights[arg] + 1);
+			}
+			break;
+		case ASSIGNMENT:
+			operand(node.a, ANY, true);
+			operand(node.b, 0, false);
+			break;
+		case DECL_ASSIGNMENT:
+			ident(node.a);
+			operand(node.b, 0, false);
+			break;
+		case LOOKUP:
+			operand(node.a, ANY, true);
+			checkStr(node.b, node.c);
+			break;
+		case IF:
+			expr(node.a);
+			body(node.b);
+			if (node.c != NONE) {
+				body(node.c);
+			}
+			break;
+		case WHILE:
+			expr(node.a);
+			body(node.b);
+			break;
+		case RETURN:
+			expr(node.a);
+			break;
+		case METHOD_DECL:
+			ident(node.b);
+			// Fallthrough
+		case CLASS_DECL:
+		case FUNC_DECL:
+			ident(node.a);
+			checkList(node.c, node.d);
+			for (uint32_t j = 0; j < node.d; ++j) {
+				ident(lists_[node.c + j]);
+			}
+			body(node.e);
+			break;
+		case CODE_BLOCK:
+			checkList(node.c, node.d);
+			for (uint32_t j = 0; j < node.d; ++j) {
+				uint32_t idx = lists_[node.c + j];
+				child(idx, idx < i && nodes_[idx].kind != CODE_BLOCK);
+				if (!isExpression(nodes_[idx].kind)) {
+					height = std::max<uint32_t>(height, heights[idx]);
+				}
+			}
+			break;
+		default:
+			invalid("bad node kind");
+		}
+
+		if (height > fun::MAX_NESTING) {
+			invalid(isExpression(node.kind) ? "expression nested too deeply" : "code nested too deeply");
+		}
+
+		heights[i] = (uint16_t)height;
+	}
+
+	// A declaration is in at most one block, and a node is in the block its
+	// parent is in
+	std::vector<bool> inBlock(nodeCount_, false);
+	for (size_t i = 0; i < blockCount_; ++i) {
+		const Block &block = blocks_[i];
+		switch (block.kind) {
+		case FUN_BLOCK:
+			if (block.decl >= nodeCount_ || !isDeclaration(nodes_[block.decl].kind) ||
+					parents[block.decl] != NONE || inBlock[block.decl]) {
+				invalid("bad block declaration");
+			}
+			if (block.start > block.end || block.end > sourceSize_) {
+				invalid("block range out of bounds");
+			}
+
+			inBlock[block.decl] = true;
+			break;
+		case RAW_LATEX:
+		case UPWARDS_REF:
+		case DOWNWARDS_REF:
+		case MODULE_IMPORT:
+			checkStr(block.str.offset, block.str.size);
+			break;
+		default:
+			invalid("bad block kind");
+		}
+	}
+
+	for (size_t i = nodeCount_; i-- > 0;) {
+		if (parents[i] != NONE) {
+			inBlock[i] = inBlock[parents[i]];
+		}
+	}
+
+	// Loading points defs and refs into the trees, and the LaTeX output
+	// walks them in order
+	auto checkSorted = [&](const uint32_t *idents, size_t count) {
+		for (size_t i = 0; i < count; ++i) {
+			if (idents[i] >= identCount_) {
+				invalid("identifier out of bounds");
+			}
+			if (owners[idents[i]] == NONE || !inBlock[owners[idents[i]]]) {
+				invalid("def or ref outside of any block");
+			}
+			if (i > 0 && idents_[idents[i]].start < idents_[idents[i - 1]].end) {
+				invalid("identifiers out of order");
+			}
+		}
+	};
+	checkSorted(defs_, defCount_);
+	checkSorted(refs_, refCount_);
+}
+
+namespace {
+
+class Loader {
+public:
+	Loader(const AstFile &file, size_t identCount):
+		file_(file), identPtrs_(identCount, nullptr) {}
+
+	void document(LafunDocument &document);
+
+private:
+	void ident(uint32_t idx, fa::Identifier &ident);
+	void params(const Node &node, fa::List<fa::Identifier> &args);
+	void expression(uint32_t top, fa::Expression &topExpr);
+	void statement(uint32_t idx, fa::Statement &statm);
+	void declaration(uint32_t idx, fa::Declaration &decl);
+	fa::CodeBlock *codeBlock(uint32_t idx);
+
+	const AstFile &file_;
+
+	// The arena of the block being loaded
+	Arena *arena_ = nullptr;
+	std::vector<const fa::Identifier *> identPtrs_;
+
+	// Expressions still to be built, and where
+	std::vector<std::pair<uint32_t, fa::Expression *>> pending_;
+};
+
+// Every tree is built in place, so that defs and refs can point into it
+void Loader::ident(uint32_t idx, fa::Identifier &ident) {
+	const Ident &rec = file_.ident(idx);
+	ident.name = fun::Symbol(file_.str(rec.name));
+	ident.range = {rec.start, rec.end};
+	ident.id = rec.id;
+	identPtrs_[idx] = &ident;
+}
+
+void Loader::params(const Node &node, fa::List<fa::Identifier> &args) {
+	args = {arena_->makeArray<fa::Identifier>(node.d), node.d};
+	for (uint32_t i = 0; i < node.d; ++i) {
+		ident(file_.listItem(node.c, i), args[i]);
+	}
+}
+
+// With a stack of its own, like Writer::expression: each node is built in
+// place, and its children are pushed to be built in theirs
+void Loader::expression(uint32_t top, fa::Expression &topExpr) {
+	pending_.push_back({top, &topExpr});
+	while (!pending_.empty()) {
+		auto [idx, expr] = pending_.back();
+		pending_.pop_back();
+
+		auto child = [&](uint32_t idx) {
+			fa::Expression *expr = arena_->make<fa::Expression>();
+			pending_.push_back({idx, expr});
+			return expr;
+		};
+
+		const Node &node = file_.node(idx);
+		switch (node.kind) {
+		case STRING_LITERAL:
+			expr->emplace<fa::StringLiteralExpr>().str = arena_->copy(file_.str({node.a, node.b}));
+			break;
+		case NUMBER_LITERAL: {
+			uint64_t bits = node.a | (uint64_t)node.b << 32;
+			memcpy(&expr->emplace<fa::NumberLiteralExpr>().num, &bits, sizeof(bits));
+			break;
+		}
+		case IDENTIFIER:
+			ident(node.a, expr->emplace<fa::IdentifierExpr>().ident);
+			break;
+		case BINARY: {
+			auto &binary = expr->emplace<fa::BinaryExpr>();
+			binary.op = (fa::BinaryExpr::Oper)node.op;
+			binary.lhs = child(node.a);
+			binary.rhs = child(node.b);
+			break;
+		}
+		case FUNC_CALL: {
+			auto &call = expr->emplace<fa::FuncCallExpr>();
+			call.func = child(node.a);
+			call.args = {arena_->makeArray<fa::Expression>(node.d), node.d};
+			for (uint32_t i = 0; i < node.d; ++i) {
+				pending_.push_back({file_.listItem(node.c, i), &call.args[i]});
+			}
+			break;
+		}
+		case ASSIGNMENT: {
+			auto &assignment = expr->emplace<fa::AssignmentExpr>();
+			assignment.lhs = child(node.a);
+			assignment.rhs = child(node.b);
+			break;
+		}
+		case DECL_ASSIGNMENT: {
+			auto &assignment = expr->emplace<fa::DeclAssignmentExpr>();
+			ident(node.a, assignment.ident);
+			assignment.rhs = child(node.b);
+			break;
+		}
+		case LOOKUP: {
+			auto &lookup = expr->emplace<fa::LookupExpr>();
+			lookup.lhs = child(node.a);
+			lookup.name = fun::Symbol(file_.str({node.b, node.c}));
+			break;
+		}
+		}
+	}
+}
+
+void Loader::statement(uint32_t idx, fa::Statement &statm) {
+	const Node &node = file_.node(idx);
+	if (isExpression(node.kind)) {
+		expression(idx, statm.emplace<fa::Expression>());
+	} else if (isDeclaration(node.kind)) {
+		declaration(idx, statm.emplace<fa::Declaration>());
+	} else if (node.kind == IF) {
+		auto &ifStatm = statm.emplace<fa::IfStatm>();
+		expression(node.a, ifStatm.condition);
+		ifStatm.ifBody = codeBlock(node.b);
+		if (node.c != NONE) {
+			ifStatm.elseBody = codeBlock(node.c);
+		}
+	} else if (node.kind == WHILE) {
+		auto &whileStatm = statm.emplace<fa::WhileStatm>();
+		expression(node.a, whileStatm.condition);
+		whileStatm.body = codeBlock(node.b);
+	} else if (node.kind == RETURN) {
+		expression(node.a, statm.emplace<fa::ReturnStatm>().expr);
+	}
+}
+
+void Loader::declaration(uint32_t idx, fa::Declaration &decl) {
+	const Node &node = file_.node(idx);
+	if (node.kind == CLASS_DECL) {
+		auto &classDecl = decl.emplace<fa::ClassDecl>();
+		ident(node.a, classDecl.ident);
+		params(node, classDecl.args);
+		classDecl.body = codeBlock(node.e);
+	} else if (node.kind == FUNC_DECL) {
+		auto &funcDecl = decl.emplace<fa::FuncDecl>();
+		ident(node.a, funcDecl.ident);
+		params(node, funcDecl.args);
+		funcDecl.body = codeBlock(node.e);
+	} else {
+		auto &methodDecl = decl.emplace<fa::MethodDecl>();
+		ident(node.a, methodDecl.classIdent);
+		ident(node.b, methodDecl.ident);
+		params(node, methodDecl.args);
+		methodDecl.body = codeBlock(node.e);
+	}
+}
+
+fa::CodeBlock *Loader::codeBlock(uint32_t idx) {
+	const Node &node = file_.node(idx);
+	fa::CodeBlock *block = arena_->make<fa::CodeBlock>();
+	block->statms = {arena_->makeArray<fa::Statement>(node.d), node.d};
+	for (uint32_t i = 0; i < node.d; ++i) {
+		statement(file_.listItem(node.c, i), block->statms[i]);
+	}
+
+	return block;
+}
+
+void Loader::document(LafunDocument &document) {
+	document.blocks.clear();
+	document.blocks.reserve(file_.blockCount());
+	for (size_t i = 0; i < file_.blockCount(); ++i) {
+		const Block &block = file_.block(i);
+		LafunBlock &out = document.blocks.emplace_back();
+		switch (block.kind) {
+		case FUN_BLOCK: {
+			auto &funBlock = out.emplace<FunBlock>();
+			arena_ = &funBlock.arena;
+			declaration(block.decl, funBlock.decl);
+			funBlock.range = {block.start, block.end};
+			break;
+		}
+		case RAW_LATEX:
+			out.emplace<RawLatex>().str = file_.str(block.str);
+			break;
+		case UPWARDS_REF:
+			out = IdentifierUpwardsRef{std::string(file_.str(block.str)), block.id};
+			break;
+		case DOWNWARDS_REF:
+			out = IdentifierDownwardsRef{std::string(file_.str(block.str)), block.id};
+			break;
+		case MODULE_IMPORT:
+			out = ModuleImport{std::string(file_.str(block.str))};
+			break;
+		}
+	}
+
+	document.defs.clear();
+	document.refs.clear();
+	for (size_t i = 0; i < file_.defCount(); ++i) {
+		document.defs.push_back(identPtrs_[file_.def(i)]);
+	}
+	for (size_t i = 0; i < file_.refCount(); ++i) {
+		document.refs.push_back(identPtrs_[file_.ref(i)]);
+	}
+}
+
+}
+
+void AstFile::load(LafunDocument &document) const {
+	Loader loader(*this, identCount_);
+	loader.document(document);
+}
+
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <iostream>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+#include "ast.h"
+#include "Input.h"
+
+// A binary file format for analyzed documents, which is used in place,
+// straight from a memory mapping. It holds the source, every syntax tree
+// with resolved identifier ids, and the resolved '@' and '!' references.
+//
+// The file is a Header, followed by sections of fixed-size records which
+// refer to each other by index. Children always come before their parent,
+// so a tree can't loop, and each node has at most one parent. Strings are StrRefs into the blob section, which
+// starts with the source itself. Everything is little endian.
+
+namespace lafun::astfile {
+
+static constexpr char MAGIC[8] = {'L', 'A', 'F', 'U', 'N', 'A', 'S', 'T'};
+static constexpr uint32_t VERSION = 2;
+static constexpr uint32_t ENDIAN_MARK = 0x01020304;
+static constexpr uint32_t NONE = ~(uint32_t)0;
+
+struct Section {
+	uint64_t offset;
+	uint64_t count;
+};
+
+struct Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t sourceSize;
+	Section blob; // bytes
+	Section nodes;
+	Section idents;
+	Section lists; // uint32_t indices, for statements, arguments and parameters
+	Section blocks;
+	Section defs; // uint32_t ident indices, sorted by position
+	Section refs; // likewise
+};
+
+struct StrRef {
+	uint32_t offset;
+	uint32_t size;
+};
+
+enum NodeKind: uint8_t {
+	STRING_LITERAL, // a, b: the string, as a StrRef
+	NUMBER_LITERAL, // a, b: the bits of the double, low word first
+	IDENTIFIER, // a: ident
+	BINARY, // op: fun::ast::BinaryExpr::Oper, a: lhs, b: rhs
+	FUNC_CALL, // a: func, c, d: list of arguments
+	ASSIGNMENT, // a: lhs, b: rhs
+	DECL_ASSIGNMENT, // a: ident, b: rhs
+	LOOKUP, // a: lhs, b, c: the name, as a StrRef
+	IF, // a: condition, b: if body, c: else body or NONE
+	WHILE, // a: condition, b: body
+	RETURN, // a: expression
+	CLASS_DECL, // a: ident, c, d: list of parameter idents, e: body
+	FUNC_DECL, // same as CLASS_DECL
+	METHOD_DECL, // a: class ident, b: ident, c, d: parameters, e: body
+	CODE_BLOCK, // c, d: list of statements
+	NODE_KIND_COUNT,
+};
+
+// Lists are a start index into the lists section, and a count
+struct Node {
+	uint8_t kind;
+	uint8_t op;
+	uint16_t reserved;
+	uint32_t a, b, c, d, e;
+};
+
+struct Ident {
+	StrRef name;
+	uint32_t start;
+	uint32_t end;
+	uint64_t id;
+};
+
+enum BlockKind: uint32_t {
+	FUN_BLOCK, // decl, start, end
+	RAW_LATEX, // str
+	UPWARDS_REF, // str: the name, id
+	DOWNWARDS_REF, // str: the name, id
+	MODULE_IMPORT, // str: the module name (since version 2)
+	BLOCK_KIND_COUNT,
+};
+
+struct Block {
+	uint32_t kind;
+	uint32_t decl;
+	uint32_t start;
+	uint32_t end;
+	StrRef str;
+	uint64_t id;
+};
+
+}
+
+namespace lafun {
+
+// Write an analyzed document, along with the source it refers into.
+// Throws std::runtime_error if the document is too big for the format.
+void writeAstFile(std::ostream &os, std::string_view source, const ast::LafunDocument &document);
+
+// A mapped AST file. Opening it checks every index and range, that the
+// trees are trees, nested no deeper than the parser allows, and that every
+// def and ref is in one, so that the records can be used without further
+// checks.
+class AstFile {
+public:
+	// Throws std::runtime_error if the file can't be read or isn't valid
+	void open(const char *path);
+
+	std::string_view source() const { return blob_.substr(0, sourceSize_); }
+	std::string_view str(astfile::StrRef ref) const { return blob_.substr(ref.offset, ref.size); }
+
+	const astfile::Node &node(uint32_t idx) const { return nodes_[idx]; }
+	const astfile::Ident &ident(uint32_t idx) const { return idents_[idx]; }
+	uint32_t listItem(uint32_t start, uint32_t idx) const { return lists_[start + idx]; }
+
+	size_t blockCount() const { return blockCount_; }
+	const astfile::Block &block(size_t idx) const { return blocks_[idx]; }
+
+	// Defs and refs are ident indices, sorted by position
+	size_t defCount() const { return defCount_; }
+	uint32_t def(size_t idx) const { return defs_[idx]; }
+	size_t refCount() const { return refCount_; }
+	uint32_t ref(size_t idx) const { return refs_[idx]; }
+
+	// Build the regular syntax trees, for passes which need them.
+	// Identifier ranges still refer into source().
+	void load(ast::LafunDocument &document) const;
+
+private:
+	void validate();
+
+	Input input_;
+	std::string_view blob_;
+	size_t sourceSize_ = 0;
+	const astfile::Node *nodes_ = nullptr;
+	size_t nodeCount_ = 0;
+	const astfile::Ident *idents_ = nullptr;
+	size_t identCount_ = 0;
+	const uint32_t *lists_ = nullptr;
+	size_t listCount_ = 0;
+	const astfile::Block *blocks_ = nullptr;
+	size_t blockCount_ = 0;
+	const uint32_t *defs_ = nullptr;
+	size_t defCount_ = 0;
+	const uint32_t *refs_ = nullptr;
+	size_t refCount_ = 0;
+};
+
+}
@@ -0,0 +1,299 @@
+#include "batch.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "module.h"
+#include "parse.h"
+#include "ThreadPool.h"
+#include "Input.h"
+#include "Reader.h"
+
+namespace lafun {
+
+struct BatchResult {
+	bool ok = false;
+	bool upToDate = false;
+	std::string error;
+	double millis = 0;
+};
+
+static void runJob(const BatchJob &job, const CompileOptions &opts, BatchResult &result) {
+	auto start = std::chrono::steady_clock::now();
+
+	try {
+		Input input;
+		if (!input.open(job.input.c_str())) {
+			throw std::runtime_error("Opening file " + job.input + " failed");
+		}
+
+		CompileOutputs out;
+
+		std::ofstream jsFile;
+		if (!job.jsOutput.empty()) {
+			jsFile.open(job.jsOutput);
+			if (!jsFile) {
+				throw std::runtime_error("Opening file " + job.jsOutput + " failed");
+			}
+
+			out.js = &jsFile;
+		}
+
+		std::ofstream latexFile;
+		if (!job.latexOutput.empty()) {
+			latexFile.open(job.latexOutput);
+			if (!latexFile) {
+				throw std::runtime_error("Opening file " + job.latexOutput + " failed");
+			}
+
+			out.latex = &latexFile;
+		}
+
+		std::ostringstream interface;
+		if (!job.interfaceOutput.empty()) {
+			out.interface = &interface;
+		}
+
+		compile(input.view(), opts, out);
+
+		if ((out.js && !jsFile.flush()) || (out.latex && !latexFile.flush())) {
+			throw std::runtime_error("Writing output failed");
+		}
+
+		if (out.interface && !updateFile(job.interfaceOutput, interface.str())) {
+			throw std::runtime_error("Writing file " + job.interfaceOutput + " failed");
+		}
+
+		result.ok = true;
+	} catch (std::exception &ex) {
+		result.error = ex.what();
+
+		// A half written output would look up to date next time
+		if (!job.interfaceOutput.empty()) {
+			for (const std::string *path: {&job.jsOutput, &job.latexOutput}) {
+				if (!path->empty()) {
+					unlink(path->c_str());
+				}
+			}
+		}
+	}
+
+	std::chrono::duration<double, std::milli> duration =
+		std::chrono::steady_clock::now() - start;
+	result.millis = duration.count();
+}
+
+static void scanImports(const std::string &path, std::vector<std::string> &modules) {
+	Input input;
+	if (!input.open(path.c_str())) {
+		return;
+	}
+
+	try {
+		Reader reader{input.view()};
+		ast::LafunBlock block;
+		while (scanLafunBlock(reader, block)) {
+			if (auto import = std::get_if<ast::ModuleImport>(&block)) {
+				modules.push_back(import->module);
+			}
+		}
+	} catch (std::exception &) {
+		// Compiling the file will report the error
+	}
+}
+
+static bool modifiedAt(const std::string &path, struct timespec &time) {
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0) {
+		return false;
+	}
+
+	time = st.st_mtim;
+	return true;
+}
+
+static bool older(const struct timespec &a, const struct timespec &b) {
+	return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+// Like make: outputs are up to date unless something they're made from
+// is newer than one of them
+static bool upToDate(
+		const BatchJob &job, const CompileOptions &opts,
+		const std::vector<std::string> &imports) {
+	// An unchanged interface keeps its old timestamp,
+	// so it's only compared when there's no other output
+	std::vector<std::string> outputs;
+	for (const std::string *path: {&job.jsOutput, &job.latexOutput}) {
+		if (!path->empty()) {
+			outputs.push_back(*path);
+		}
+	}
+	if (outputs.empty()) {
+		outputs.push_back(job.interfaceOutput);
+	} else if (access(job.interfaceOutput.c_str(), F_OK) < 0) {
+		return false;
+	}
+
+	struct timespec oldest{}, time;
+	for (size_t i = 0; i < outputs.size(); ++i) {
+		if (!modifiedAt(outputs[i], time)) {
+			return false;
+		} else if (i == 0 || older(time, oldest)) {
+			oldest = time;
+		}
+	}
+
+	std::vector<std::string> inputs{job.input};
+	for (const std::string &module: imports) {
+		inputs.push_back(findInterface(module, opts.moduleDirs));
+	}
+
+	for (const std::string &input: inputs) {
+		if (!modifiedAt(input, time) || older(oldest, time)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool compileBatch(
+		const std::vector<BatchJob> &jobs, const CompileOptions &opts,
+		size_t threads, std::ostream &summary) {
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<BatchResult> results(jobs.size());
+	std::vector<CompileOptions> jobOpts(jobs.size(), opts);
+	std::vector<std::vector<std::string>> imports(jobs.size());
+	std::vector<std::vector<size_t>> dependencies(jobs.size());
+	std::vector<std::vector<size_t>> dependents(jobs.size());
+	std::vector<std::atomic<size_t>> waiting(jobs.size());
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		waiting[i] = 0;
+	}
+
+	bool modules = false;
+	std::unordered_map<std::string, size_t> jobByModule;
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		// The batch's threads each compile a document of their own, rather
+		// than each starting more threads for one document
+		jobOpts[i].threads = 1;
+		jobOpts[i].moduleDirs.push_back(documentDir(jobs[i].input));
+		if (!jobs[i].interfaceOutput.empty()) {
+			jobByModule[moduleName(jobs[i].input)] = i;
+			modules = true;
+		}
+	}
+
+	// Without interfaces, nothing can import anything from the batch
+	if (modules) {
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			scanImports(jobs[i].input, imports[i]);
+			for (const std::string &module: imports[i]) {
+				auto it = jobByModule.find(module);
+				if (it != jobByModule.end() && it->second != i) {
+					dependencies[i].push_back(it->second);
+					dependents[it->second].push_back(i);
+					waiting[i] += 1;
+
+					// Its javascript is loaded before the importer's, which brings the prelude
+					jobOpts[it->second].jsPrelude = false;
+				}
+			}
+		}
+
+		// Jobs which can't be ordered are in (or behind) an import cycle
+		std::vector<size_t> remaining(jobs.size()), ready;
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			remaining[i] = waiting[i];
+			if (remaining[i] == 0) {
+				ready.push_back(i);
+			}
+		}
+		while (!ready.empty()) {
+			size_t i = ready.back();
+			ready.pop_back();
+			for (size_t dependent: dependents[i]) {
+				if (--remaining[dependent] == 0) {
+					ready.push_back(dependent);
+				}
+			}
+		}
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			if (remaining[i] != 0) {
+				results[i].error = "Import cycle";
+			}
+		}
+	}
+
+	{
+		ThreadPool pool(threads);
+		std::function<void(size_t)> run = [&](size_t i) {
+			bool importsOk = true;
+			for (size_t dependency: dependencies[i]) {
+				if (!results[dependency].ok) {
+					results[i].error = "Imported module " + moduleName(jobs[dependency].input) + " failed";
+					importsOk = false;
+					break;
+				}
+			}
+
+			if (importsOk && modules && upToDate(jobs[i], jobOpts[i], imports[i])) {
+				results[i].ok = true;
+				results[i].upToDate = true;
+			} else if (importsOk) {
+				runJob(jobs[i], jobOpts[i], results[i]);
+			}
+
+			for (size_t dependent: dependents[i]) {
+				if (--waiting[dependent] == 0) {
+					pool.submit([&, dependent] { run(dependent); });
+				}
+			}
+		};
+
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			if (waiting[i] == 0) {
+				pool.submit([&, i] { run(i); });
+			}
+		}
+
+		pool.wait();
+	}
+
+	std::chrono::duration<double, std::milli> duration =
+		std::chrono::steady_clock::now() - start;
+
+	size_t failed = 0;
+	size_t upToDate = 0;
+	summary << std::fixed << std::setprecision(2);
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		const BatchResult &result = results[i];
+		upToDate += result.upToDate;
+		summary << (result.upToDate ? "-      " : result.ok ? "ok     " : "FAILED ")
+			<< std::setw(10) << result.millis << " ms  " << jobs[i].input;
+		if (!result.ok) {
+			summary << ": " << result.error;
+			failed += 1;
+		}
+		summary << '\n';
+	}
+
+	summary << jobs.size() << " files, " << failed << " failed, ";
+	if (modules) {
+		summary << upToDate << " up to date, ";
+	}
+	summary << duration.count() << " ms\n";
+	return failed == 0;
+}
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "compile.h"
+
+namespace lafun {
+
+struct BatchJob {
+	std::string input;
+	std::string jsOutput; // empty for no javascript output
+	std::string latexOutput; // empty for no latex output
+
+	// The module interface, empty for none. Jobs with an interface are
+	// modules: the module named after the input file's stem can be
+	// imported by the other jobs.
+	std::string interfaceOutput;
+};
+
+// Compile every job on a pool of threads, and write a per-file status and
+// timing summary to 'summary'. Returns false if any job failed.
+//
+// A job which imports another job's module waits for it, and a module
+// which is imported gets no javascript prelude; load its script before the
+// importer's. Modules are only compiled when an output is older than the
+// input or than an interface it imports. Interfaces are only written when
+// they change, so a change to a module which leaves its interface alone
+// doesn't recompile its dependents.
+bool compileBatch(
+		const std::vector<BatchJob> &jobs, const CompileOptions &opts,
+		size_t threads, std::ostream &summary);
+
+}
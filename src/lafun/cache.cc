@@ -0,0 +1,144 @@
+#include "cache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "Input.h"
+
+namespace lafun {
+
+static const char magic[] = "lafun-block-cache 4\n";
+
+static void writeString(std::string &buf, const std::string &str) {
+	buf += std::to_string(str.size());
+	buf += '\n';
+	buf += str;
+}
+
+static void writeNumber(std::string &buf, size_t num) {
+	buf += std::to_string(num);
+	buf += '\n';
+}
+
+class EntryReader {
+public:
+	EntryReader(std::string_view data): data_(data) {}
+
+	bool readNumber(size_t &num) {
+		size_t newline = data_.find('\n', pos_);
+		if (newline == std::string_view::npos || newline == pos_) {
+			return false;
+		}
+
+		num = 0;
+		for (size_t i = pos_; i < newline; ++i) {
+			if (data_[i] < '0' || data_[i] > '9') {
+				return false;
+			}
+
+			num = num * 10 + (data_[i] - '0');
+		}
+
+		pos_ = newline + 1;
+		return true;
+	}
+
+	bool readString(std::string &str) {
+		size_t len;
+		if (!readNumber(len) || len > data_.size() - pos_) {
+			return false;
+		}
+
+		str = data_.substr(pos_, len);
+		pos_ += len;
+		return true;
+	}
+
+	bool atEnd() const { return pos_ == data_.size(); }
+
+private:
+	std::string_view data_;
+	size_t pos_ = 0;
+};
+
+bool BlockCache::load(const std::string &key, BlockResult &result) {
+	Input input;
+	if (!input.open((dir_ + '/' + key).c_str())) {
+		return false;
+	}
+
+	std::string_view data = input.view();
+	std::string_view magicStr = magic;
+	if (data.substr(0, magicStr.size()) != magicStr) {
+		return false;
+	}
+
+	EntryReader reader(data.substr(magicStr.size()));
+	size_t kind, numNames;
+	if (
+			!reader.readNumber(kind) || kind > BlockResult::METHOD ||
+			!reader.readString(result.name) ||
+			!reader.readNumber(result.idsUsed) ||
+			!reader.readString(result.js) ||
+			!reader.readString(result.latex) ||
+			!reader.readNumber(numNames)) {
+		return false;
+	}
+
+	result.kind = (BlockResult::Kind)kind;
+	result.names.clear();
+	for (size_t i = 0; i < numNames; ++i) {
+		std::string name;
+		size_t first, last;
+		if (!reader.readString(name) || !reader.readNumber(first) || !reader.readNumber(last)) {
+			return false;
+		}
+
+		result.names[fun::Symbol(name)] = {first, last};
+	}
+
+	return reader.atEnd();
+}
+
+void BlockCache::store(const std::string &key, const BlockResult &result) {
+	std::string buf = magic;
+	writeNumber(buf, result.kind);
+	writeString(buf, result.name);
+	writeNumber(buf, result.idsUsed);
+	writeString(buf, result.js);
+	writeString(buf, result.latex);
+	writeNumber(buf, result.names.size());
+	for (const auto &[name, ids]: result.names) {
+		writeString(buf, name.str());
+		writeNumber(buf, ids.first);
+		writeNumber(buf, ids.second);
+	}
+
+	std::string tmpPath = dir_ + "/.tmp-XXXXXX";
+	int fd = mkstemp(tmpPath.data());
+	if (fd < 0) {
+		return;
+	}
+
+	const char *data = buf.data();
+	size_t len = buf.size();
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n <= 0) {
+			close(fd);
+			unlink(tmpPath.c_str());
+			return;
+		}
+
+		data += n;
+		len -= n;
+	}
+
+	close(fd);
+	if (rename(tmpPath.c_str(), (dir_ + '/' + key).c_str()) < 0) {
+		unlink(tmpPath.c_str());
+	}
+}
+
+}
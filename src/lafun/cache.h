@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+#include "fun/IdentResolver.h"
+
+namespace lafun {
+
+// Everything a compile needs from one top-level block, once it has been
+// resolved and generated
+struct BlockResult {
+	enum Kind {CLASS, FUNC, METHOD};
+
+	Kind kind = FUNC;
+	std::string name; // the class name, for methods
+	size_t idsUsed = 0;
+	std::string js;
+	std::string latex;
+	fun::DeclNames names;
+};
+
+// A directory of block results, named by a hash of everything that went
+// into them. Entries are written atomically, so the directory can be
+// shared by concurrent compiles.
+class BlockCache {
+public:
+	BlockCache(std::string dir): dir_(std::move(dir)) {}
+
+	bool load(const std::string &key, BlockResult &result);
+
+	// Failing to store an entry isn't an error; it will just miss next time
+	void store(const std::string &key, const BlockResult &result);
+
+private:
+	std::string dir_;
+};
+
+}
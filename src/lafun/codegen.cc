@@ -2,74 +2,137 @@
 
 #include "util.h"
 #include "ast.h"
+#include "astfile.h"
 
 namespace lafun {
 
-static void genFun(std::ostream &os, std::string_view source, size_t start, size_t end);
-static void genFunPipe(std::ostream &os);
-static void genFunChunk(std::ostream &os, std::string_view source, size_t start, size_t end);
-static void genDef(std::ostream &os, const std::string &name, size_t id);
-static void genRef(std::ostream &os, const std::string &name, size_t id);
+static void genFun(OutputBuffer &os, std::string_view source, size_t start, size_t end);
+static void genFunPipe(OutputBuffer &os);
+static void genFunChunk(OutputBuffer &os, std::string_view source, size_t start, size_t end);
+static void genDef(OutputBuffer &os, std::string_view name, size_t id);
+static void genRef(OutputBuffer &os, std::string_view name, size_t id);
 
-void codegen(std::ostream &os, std::string_view source, const ast::LafunDocument &doc) {
+using Idents = std::vector<const fun::ast::Identifier *>;
+
+struct IdentSpan {
+	std::string_view name;
+	size_t start;
+	size_t end;
+	size_t id;
+};
+
+// Defs and refs, either from syntax trees or from an AST file
+struct TreeIdents {
+	const Idents &idents;
+
+	size_t size() const { return idents.size(); }
+	IdentSpan operator[](size_t idx) const {
+		const fun::ast::Identifier *ident = idents[idx];
+		return {ident->name.str(), ident->range.start, ident->range.end, ident->id};
+	}
+};
+
+struct FileIdents {
+	const AstFile &file;
+	bool defs;
+
+	size_t size() const { return defs ? file.defCount() : file.refCount(); }
+	IdentSpan operator[](size_t idx) const {
+		const astfile::Ident &ident = file.ident(defs ? file.def(idx) : file.ref(idx));
+		return {file.str(ident.name), ident.start, ident.end, ident.id};
+	}
+};
+
+template<typename Idents>
+static void genFunBlock(
+		OutputBuffer &os, std::string_view source, fun::ByteRange range,
+		const Idents &defs, size_t &nextDef, const Idents &refs, size_t &nextRef) {
+	os << "~\\\\\n{\\parindent0pt\n";
+	size_t curByte = range.start;
+	while (curByte < range.end) {
+		// Determine if the next identifier is a def or a ref
+		size_t nextDefStart = -1;
+		size_t nextRefStart = -1;
+		if (nextDef < defs.size()) {
+			nextDefStart = defs[nextDef].start;
+		}
+		if (nextRef < refs.size()) {
+			nextRefStart = refs[nextRef].start;
+		}
+
+		if (nextDefStart > range.end && nextRefStart > range.end) {
+			// Generate to end of FunBlock
+			genFun(os, source, curByte, range.end);
+			break;
+		}
+
+		// Generate to next identifier, then generate the next identifier
+		IdentSpan ident;
+		if (nextDefStart > nextRefStart) {
+			ident = refs[nextRef++];
+			genFun(os, source, curByte, ident.start);
+			genRef(os, ident.name, ident.id);
+		} else {
+			ident = defs[nextDef++];
+			genFun(os, source, curByte, ident.start);
+			genDef(os, ident.name, ident.id);
+		}
+		curByte = ident.end;
+	}
+	os << "}\n";
+}
+
+static void genBlock(
+		OutputBuffer &os, std::string_view source, const ast::LafunBlock &block,
+		const Idents &defs, size_t &nextDef, const Idents &refs, size_t &nextRef) {
+	std::visit(overloaded {
+		[&](const ast::FunBlock &block2) {
+			genFunBlock(os, source, block2.range, TreeIdents{defs}, nextDef, TreeIdents{refs}, nextRef);
+		},
+		[&](const ast::RawLatex &block2) { os << block2.str; },
+		[&](const ast::IdentifierUpwardsRef &block2) { genRef(os, block2.ident, block2.id); },
+		[&](const ast::IdentifierDownwardsRef &block2) { genRef(os, block2.ident, block2.id); },
+		[&](const ast::ModuleImport &) {},
+	}, block);
+}
+
+void codegen(OutputBuffer &os, std::string_view source, const ast::LafunDocument &doc) {
 	size_t nextDef = 0;
 	size_t nextRef = 0;
 
 	for (const auto &block : doc.blocks) {
-		std::visit(overloaded {
-			[&](const ast::FunBlock &block2) {
-				os << "~\\\\\n{\\parindent0pt\n";
-				size_t curByte = block2.range.start;
-				while (curByte < block2.range.end) {
-					// Determine if the next identifier is a def or a ref
-					size_t nextDefStart = -1;
-					size_t nextDefEnd = -1;
-					size_t nextRefStart = -1;
-					size_t nextRefEnd = -1;
-					if (nextDef < doc.defs.size()) {
-						nextDefStart = doc.defs[nextDef]->range.start;
-						nextDefEnd = doc.defs[nextDef]->range.end;
-					}
-					if (nextRef < doc.refs.size()) {
-						nextRefStart = doc.refs[nextRef]->range.start;
-						nextRefEnd = doc.refs[nextRef]->range.end;
-					}
-
-					if (nextDefStart > block2.range.end && nextRefStart > block2.range.end) {
-						// Generate to end of FunBlock
-						genFun(os, source, curByte, block2.range.end);
-						break;
-					}
-
-					// Generate to next identifier, then generate the next identifier
-					size_t nextIdentStart;
-					size_t nextIdentEnd;
-					if (nextDefStart > nextRefStart) {
-						nextIdentStart = nextRefStart;
-						nextIdentEnd = nextRefEnd;
-						genFun(os, source, curByte, nextIdentStart);
-						genRef(os, doc.refs[nextRef]->name, doc.refs[nextRef]->id);
-						curByte = nextIdentEnd;
-						nextRef++;
-					} else {
-						nextIdentStart = nextDefStart;
-						nextIdentEnd = nextDefEnd;
-						genFun(os, source, curByte, nextIdentStart);
-						genDef(os, doc.defs[nextDef]->name, doc.defs[nextDef]->id);
-						curByte = nextIdentEnd;
-						nextDef++;
-					}
-				}
-				os << "}\n";
-			},
-			[&](const ast::RawLatex &block2) { os << block2.str; },
-			[&](const ast::IdentifierUpwardsRef &block2) { genRef(os, block2.ident, block2.id); },
-			[&](const ast::IdentifierDownwardsRef &block2) { genRef(os, block2.ident, block2.id); },
-		}, block);
+		genBlock(os, source, block, doc.defs, nextDef, doc.refs, nextRef);
 	}
 }
 
-static void genFun(std::ostream &os, std::string_view source, size_t start, size_t end) {
+void codegen(OutputBuffer &os, const AstFile &file) {
+	std::string_view source = file.source();
+	FileIdents defs{file, true};
+	FileIdents refs{file, false};
+	size_t nextDef = 0;
+	size_t nextRef = 0;
+
+	for (size_t i = 0; i < file.blockCount(); ++i) {
+		const astfile::Block &block = file.block(i);
+		if (block.kind == astfile::FUN_BLOCK) {
+			genFunBlock(os, source, {block.start, block.end}, defs, nextDef, refs, nextRef);
+		} else if (block.kind == astfile::RAW_LATEX) {
+			os << file.str(block.str);
+		} else if (block.kind != astfile::MODULE_IMPORT) {
+			genRef(os, file.str(block.str), block.id);
+		}
+	}
+}
+
+void codegenBlock(
+		OutputBuffer &os, std::string_view source, const ast::LafunBlock &block,
+		const Idents &defs, const Idents &refs) {
+	size_t nextDef = 0;
+	size_t nextRef = 0;
+	genBlock(os, source, block, defs, nextDef, refs, nextRef);
+}
+
+static void genFun(OutputBuffer &os, std::string_view source, size_t start, size_t end) {
 	while (start < end) {
 		size_t endOfChunk = start;
 		while (endOfChunk < end && source[endOfChunk] != '\n' && source[endOfChunk] != '|') {
@@ -87,19 +150,19 @@ static void genFun(std::ostream &os, std::string_view source, size_t start, size
 	}
 }
 
-static void genFunPipe(std::ostream &os) {
+static void genFunPipe(OutputBuffer &os) {
 	os << "\\lstinline+|+";
 }
 
-static void genFunChunk(std::ostream &os, std::string_view source, size_t start, size_t end) {
+static void genFunChunk(OutputBuffer &os, std::string_view source, size_t start, size_t end) {
 	os << "\\lstinline|" << source.substr(start, end - start) << "|";
 }
 
-static void genDef(std::ostream &os, const std::string &name, size_t id) {
+static void genDef(OutputBuffer &os, std::string_view name, size_t id) {
 	os << "\\label{lafun-def:" << id << "}\\lstinline|" << name << "|";
 }
 
-static void genRef(std::ostream &os, const std::string &name, size_t id) {
+static void genRef(OutputBuffer &os, std::string_view name, size_t id) {
 	os << "\\hyperref[lafun-def:" << id << "]{\\lstinline|" << name << "|}";
 }
 
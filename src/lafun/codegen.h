@@ -1,9 +1,21 @@
 #pragma once
 
 #include "ast.h"
+#include "OutputBuffer.h"
 
 namespace lafun {
 
-void codegen(std::ostream &os, std::string_view source, const ast::LafunDocument &doc);
+class AstFile;
+
+void codegen(OutputBuffer &os, std::string_view source, const ast::LafunDocument &doc);
+
+// Generate straight from an AST file, without building syntax trees
+void codegen(OutputBuffer &os, const AstFile &file);
+
+// Generate a single block, given the sorted defs and refs within it
+void codegenBlock(
+		OutputBuffer &os, std::string_view source, const ast::LafunBlock &block,
+		const std::vector<const fun::ast::Identifier *> &defs,
+		const std::vector<const fun::ast::Identifier *> &refs);
 
 }
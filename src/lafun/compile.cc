@@ -0,0 +1,292 @@
+#include "compile.h"
+
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "parse.h"
+#include "astfile.h"
+#include "cache.h"
+#include "emit.h"
+#include "module.h"
+#include "pipeline.h"
+#include "resolve.h"
+#include "codegen.h"
+#include "prelude.h"
+#include "fun/IdentResolver.h"
+#include "fun/Codegen.h"
+#include "fun/prelude.h"
+#include "fun/print.h"
+#include "OutputBuffer.h"
+#include "Reader.h"
+#include "Sha256.h"
+#include "util.h"
+
+using namespace lafun::ast;
+
+namespace lafun {
+
+void analyze(std::string_view source, LafunDocument &document, const CompileOptions &opts) {
+	Reader reader{source};
+	fun::IdentResolver resolver;
+	resolver.addBuiltins(fun::preludeNameSet);
+	if (!opts.keepLatex) {
+		resolver.skipDefsAndRefs();
+	}
+
+	parseLafun(reader, document, opts.threads);
+
+	// Nothing here depends on the top-level names, so the hash isn't used
+	Sha256 topLevelHash;
+	for (auto &block: document.blocks) {
+		if (std::holds_alternative<FunBlock>(block)) {
+			resolver.add(&std::get<FunBlock>(block).decl);
+		} else if (auto import = std::get_if<ModuleImport>(&block)) {
+			ModuleInterface iface;
+			loadInterface(import->module, opts.moduleDirs, iface);
+			importModule(resolver, import->module, iface, topLevelHash);
+		}
+	}
+
+	if (opts.keepLatex) {
+		std::vector<const fun::ast::Identifier *> targets;
+		resolver.finalize(&targets);
+		resolveLafunReferences(document, targets);
+	} else {
+		resolver.finalize();
+	}
+
+	document.defs = resolver.getDefs();
+	document.refs = resolver.getRefs();
+}
+
+void generate(
+		std::string_view source, const LafunDocument &document,
+		const CompileOptions &opts, const CompileOutputs &out) {
+	if (out.ast) {
+		for (const LafunBlock &block: document.blocks) {
+			if (std::holds_alternative<FunBlock>(block)) {
+				const FunBlock &funBlock = std::get<FunBlock>(block);
+				fun::printDeclaration(*out.ast, funBlock.decl);
+				*out.ast << '\n';
+			}
+		}
+	}
+
+	OutputBuffer js;
+	auto generateJs = [&] {
+		fun::Codegen gen;
+		for (const LafunBlock &block: document.blocks) {
+			if (std::holds_alternative<FunBlock>(block)) {
+				const FunBlock &funBlock = std::get<FunBlock>(block);
+				gen.add(&funBlock.decl);
+			}
+		}
+
+		if (opts.jsPrelude) {
+			js << fun::jsPrelude;
+		}
+		gen.generate(js);
+		if (opts.jsPrelude) {
+			js << fun::jsPostlude;
+		}
+	};
+
+	OutputBuffer latex;
+	auto generateLatex = [&] {
+		if (opts.latexPrelude) {
+			latex << latexPrelude;
+		}
+
+		codegen(latex, source, document);
+
+		if (opts.latexPrelude) {
+			latex << latexPostlude;
+		}
+	};
+
+	// The backends only read the document, so with both outputs wanted,
+	// the javascript is generated on another thread
+	if (out.js && out.latex) {
+		std::exception_ptr jsError;
+		std::thread jsThread([&] {
+			try {
+				generateJs();
+			} catch (...) {
+				jsError = std::current_exception();
+			}
+		});
+
+		// The javascript comes first in the output, so its error wins
+		std::exception_ptr latexError;
+		try {
+			generateLatex();
+		} catch (...) {
+			latexError = std::current_exception();
+		}
+
+		jsThread.join();
+		if (jsError || latexError) {
+			std::rethrow_exception(jsError ? jsError : latexError);
+		}
+	} else if (out.js) {
+		generateJs();
+	} else if (out.latex) {
+		generateLatex();
+	}
+
+	if (out.js) {
+		js.writeTo(*out.js);
+	}
+	if (out.latex) {
+		latex.writeTo(*out.latex);
+	}
+
+	if (out.astFile) {
+		writeAstFile(*out.astFile, source, document);
+	}
+
+	if (out.interface) {
+		ModuleInterface iface;
+		collectInterface(document, iface);
+		writeInterface(*out.interface, iface);
+	}
+}
+
+void compileAstFile(const AstFile &file, const CompileOptions &opts, const CompileOutputs &out) {
+	if (out.js || out.ast || out.astFile || out.interface) {
+		LafunDocument document;
+		file.load(document);
+
+		CompileOutputs treeOut;
+		treeOut.js = out.js;
+		treeOut.ast = out.ast;
+		treeOut.astFile = out.astFile;
+		treeOut.interface = out.interface;
+		generate(file.source(), document, opts, treeOut);
+	}
+
+	if (out.latex) {
+		OutputBuffer latex;
+		if (opts.latexPrelude) {
+			latex << latexPrelude;
+		}
+
+		codegen(latex, file);
+
+		if (opts.latexPrelude) {
+			latex << latexPostlude;
+		}
+
+		latex.writeTo(*out.latex);
+	}
+}
+
+static std::string blockKey(
+		const std::string &topLevelDigest, size_t firstId, std::string_view text) {
+	Sha256 hash;
+	hash.updateField("lafun block 1");
+	hash.updateField(topLevelDigest);
+	hash.updateField(firstId);
+	hash.updateField(text);
+	return hash.hexDigest();
+}
+
+static void compileStreaming(std::string_view source, const CompileOptions &opts, const CompileOutputs &out) {
+	fun::IdentResolver resolver;
+	resolver.addBuiltins(fun::preludeNameSet);
+
+	// First pass: only the top-level names are kept
+	resolver.beginStreaming();
+	Sha256 topLevelHash;
+	ModuleInterface iface;
+	std::vector<ModuleInterface> imports;
+	{
+		Reader reader{source};
+		LafunBlock block;
+		while (scanLafunBlock(reader, block)) {
+			if (std::holds_alternative<FunBlock>(block)) {
+				const fun::ast::Declaration &decl = std::get<FunBlock>(block).decl;
+				size_t id = resolver.peekId();
+				declareBlock(resolver, decl, topLevelHash);
+				addToInterface(decl, id, iface);
+			} else if (auto import = std::get_if<ModuleImport>(&block)) {
+				loadInterface(import->module, opts.moduleDirs, imports.emplace_back());
+				importModule(resolver, import->module, imports.back(), topLevelHash);
+			}
+		}
+	}
+
+	std::string topLevelDigest = topLevelHash.hexDigest();
+	if (out.interface) {
+		writeInterface(*out.interface, iface);
+	}
+
+	// Second pass: resolve and generate each block, then drop it
+	BlockEmitter emitter(opts, out);
+	for (const ModuleInterface &import: imports) {
+		emitter.addImports(import);
+	}
+	Reader reader{source};
+	LafunBlock block;
+	while (scanLafunBlock(reader, block)) {
+		if (!std::holds_alternative<FunBlock>(block)) {
+			emitter.add(block);
+			continue;
+		}
+
+		FunBlock &funBlock = std::get<FunBlock>(block);
+		BlockResult result;
+
+		// The AST dump needs the parsed block, so it always misses
+		std::string key;
+		bool cached = false;
+		if (opts.cache && !out.ast) {
+			key = blockKey(topLevelDigest, resolver.peekId(),
+					source.substr(funBlock.range.start, funBlock.range.end - funBlock.range.start));
+			cached = opts.cache->load(key, result);
+		}
+
+		if (cached) {
+			resolver.skipIds(result.idsUsed);
+		} else {
+			// Both outputs go in the cache, so that the entry is useful to any
+			// later compile
+			bool all = opts.cache != nullptr;
+			parseFunBlock(source, funBlock);
+			generateBlock(
+					source, block, resolver,
+					all || out.js, all || out.latex, out.ast, result);
+			if (opts.cache && !key.empty()) {
+				opts.cache->store(key, result);
+			}
+		}
+
+		emitter.add(result);
+	}
+
+	emitter.finish();
+}
+
+void compile(std::string_view source, const CompileOptions &opts, const CompileOutputs &out) {
+	if ((opts.stream || opts.cache) && out.astFile) {
+		throw std::runtime_error("An AST file can't be written while streaming");
+	}
+
+	if (opts.stream || opts.cache) {
+		compileStreaming(source, opts, out);
+	} else if (opts.threads > 1 && !out.astFile) {
+		// The AST file needs the whole document's defs and refs together
+		compilePipelined(source, opts, out);
+	} else {
+		CompileOptions analyzeOpts = opts;
+		analyzeOpts.keepLatex = opts.keepLatex && (out.latex || out.astFile);
+
+		LafunDocument document;
+		analyze(source, document, analyzeOpts);
+		generate(source, document, opts, out);
+	}
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.h"
+
+namespace lafun {
+
+class BlockCache;
+class AstFile;
+
+struct CompileOptions {
+	bool latexPrelude = true;
+
+	// Leave out the javascript prelude and the call to main, for modules
+	// which are loaded before the script of the document that imports them
+	bool jsPrelude = true;
+
+	// Where to look for the interfaces of imported modules, in order
+	std::vector<std::string> moduleDirs;
+
+	// Process the document one top-level block at a time, releasing each
+	// block's syntax tree once its output has been written
+	bool stream = false;
+
+	// With more than one thread, a compile which doesn't stream runs its
+	// phases concurrently, see pipeline.h
+	size_t threads = 1;
+
+	// Reuse compiled blocks from this cache, and store new ones in it.
+	// This implies stream.
+	BlockCache *cache = nullptr;
+
+	// Keep what only the LaTeX output and the AST file need: the defs and
+	// refs, and the ids of '@' and '!' references.
+	// compile() also leaves them out when neither is wanted.
+	bool keepLatex = true;
+};
+
+struct CompileOutputs {
+	std::ostream *js = nullptr;
+	std::ostream *latex = nullptr;
+	std::ostream *ast = nullptr;
+
+	// The analyzed document, in the format from astfile.h.
+	// Not available when streaming.
+	std::ostream *astFile = nullptr;
+
+	// The document's module interface, see module.h
+	std::ostream *interface = nullptr;
+};
+
+void compile(std::string_view source, const CompileOptions &opts, const CompileOutputs &out);
+
+// The two phases of a non-streaming compile, for callers which keep
+// analyzed documents around. The document refers into 'source'.
+void analyze(std::string_view source, ast::LafunDocument &document, const CompileOptions &opts = {});
+void generate(
+		std::string_view source, const ast::LafunDocument &document,
+		const CompileOptions &opts, const CompileOutputs &out);
+
+// Generate outputs from a saved AST file, skipping lexing, parsing and
+// resolution. The LaTeX output doesn't need syntax trees at all.
+void compileAstFile(const AstFile &file, const CompileOptions &opts, const CompileOutputs &out);
+
+}
@@ -0,0 +1,271 @@
+#include "emit.h"
+
+#include "codegen.h"
+#include "prelude.h"
+#include "fun/Codegen.h"
+#include "fun/prelude.h"
+#include "fun/print.h"
+#include "util.h"
+
+using namespace lafun::ast;
+
+namespace lafun {
+
+static const std::vector<const fun::ast::Identifier *> noIdents;
+
+// A reference or raw LaTeX, which isn't part of a block's result
+static void writeBlock(std::ostream &os, const LafunBlock &block) {
+	OutputBuffer buf;
+	codegenBlock(buf, {}, block, noIdents, noIdents);
+	buf.writeTo(os);
+}
+
+void declareBlock(fun::IdentResolver &resolver, const fun::ast::Declaration &decl, Sha256 &topLevelHash) {
+	resolver.declare(decl);
+	if (auto clas = std::get_if<fun::ast::ClassDecl>(&decl)) {
+		topLevelHash.updateField(clas->ident.name.str());
+	} else if (auto func = std::get_if<fun::ast::FuncDecl>(&decl)) {
+		topLevelHash.updateField(func->ident.name.str());
+	}
+}
+
+void generateBlock(
+		std::string_view source, LafunBlock &block, fun::IdentResolver &resolver,
+		bool wantJs, bool wantLatex, std::ostream *astOut, BlockResult &result) {
+	BlockIdents idents;
+	resolveBlock(block, resolver, wantLatex, idents, result);
+	generateResolvedBlock(source, block, idents, wantJs, wantLatex, astOut, result);
+}
+
+void resolveBlock(
+		LafunBlock &block, fun::IdentResolver &resolver, bool wantLatex,
+		BlockIdents &idents, BlockResult &result) {
+	FunBlock &funBlock = std::get<FunBlock>(block);
+
+	size_t firstId = resolver.peekId();
+	result.names.clear();
+	resolver.finalizeOne(funBlock.decl, wantLatex ? &result.names : nullptr);
+	result.idsUsed = resolver.peekId() - firstId;
+
+	idents.defs = resolver.getDefs();
+	idents.refs = resolver.getRefs();
+	resolver.clearDefsAndRefs();
+}
+
+void generateResolvedBlock(
+		std::string_view source, const LafunBlock &block, const BlockIdents &idents,
+		bool wantJs, bool wantLatex, std::ostream *astOut, BlockResult &result) {
+	const FunBlock &funBlock = std::get<FunBlock>(block);
+
+	std::visit(overloaded {
+		[&](const fun::ast::ClassDecl &clas) {
+			result.kind = BlockResult::CLASS;
+			result.name = clas.ident.name.str();
+		},
+		[&](const fun::ast::FuncDecl &) {
+			result.kind = BlockResult::FUNC;
+			result.name.clear();
+		},
+		[&](const fun::ast::MethodDecl &method) {
+			result.kind = BlockResult::METHOD;
+			result.name = method.classIdent.name.str();
+		},
+	}, funBlock.decl);
+
+	if (astOut) {
+		fun::printDeclaration(*astOut, funBlock.decl);
+		*astOut << '\n';
+	}
+
+	result.js.clear();
+	if (wantJs) {
+		fun::Codegen gen;
+		OutputBuffer buf;
+		gen.generateDetached(buf, &funBlock.decl);
+		result.js = buf.str();
+	}
+
+	result.latex.clear();
+	if (wantLatex) {
+		OutputBuffer buf;
+		codegenBlock(buf, source, block, idents.defs, idents.refs);
+		result.latex = buf.str();
+	}
+}
+
+static const std::string &refName(const LafunBlock &ref) {
+	if (auto up = std::get_if<IdentifierUpwardsRef>(&ref)) {
+		return up->ident;
+	}
+
+	return std::get<IdentifierDownwardsRef>(ref).ident;
+}
+
+static void setRefId(LafunBlock &ref, size_t id) {
+	if (auto up = std::get_if<IdentifierUpwardsRef>(&ref)) {
+		up->id = id;
+	} else {
+		std::get<IdentifierDownwardsRef>(ref).id = id;
+	}
+}
+
+void LatexBackpatcher::addPending(LafunBlock &&ref, size_t fallbackId) {
+	if (!pending_.empty()) {
+		pending_.back().following = tail_.str();
+		tail_.str("");
+	}
+
+	pending_.push_back({std::move(ref), fallbackId, false, ""});
+}
+
+void LatexBackpatcher::resolve(const fun::DeclNames &names) {
+	for (Pending &pending: pending_) {
+		if (pending.resolved) {
+			continue;
+		}
+
+		auto name = fun::Symbol::find(refName(pending.ref));
+		auto it = name ? names.find(*name) : names.end();
+		if (it != names.end() && it->second.first != 0) {
+			setRefId(pending.ref, it->second.first);
+			pending.resolved = true;
+		}
+	}
+
+	flush();
+}
+
+void LatexBackpatcher::finish() {
+	for (Pending &pending: pending_) {
+		if (!pending.resolved) {
+			setRefId(pending.ref, pending.fallbackId);
+			pending.resolved = true;
+		}
+	}
+
+	flush();
+}
+
+void LatexBackpatcher::flush() {
+	while (!pending_.empty() && pending_.front().resolved) {
+		Pending &pending = pending_.front();
+		writeBlock(os_, pending.ref);
+
+		if (pending_.size() == 1) {
+			os_ << tail_.str();
+			tail_.str("");
+		} else {
+			os_ << pending.following;
+		}
+
+		pending_.pop_front();
+	}
+}
+
+BlockEmitter::BlockEmitter(const CompileOptions &opts, const CompileOutputs &out):
+		opts_(opts), out_(out) {
+	if (out_.js && opts_.jsPrelude) {
+		*out_.js << fun::jsPrelude;
+	}
+
+	if (out_.latex) {
+		latex_.emplace(*out_.latex);
+		if (opts_.latexPrelude) {
+			*out_.latex << latexPrelude;
+		}
+	}
+}
+
+void BlockEmitter::addImports(const ModuleInterface &iface) {
+	for (const ModuleInterface::Name &name: iface.names) {
+		if (name.kind == ModuleInterface::Name::CLASS) {
+			generatedClasses_.insert(name.name);
+		}
+	}
+}
+
+size_t BlockEmitter::findLastId(const std::string &name) {
+	auto sym = fun::Symbol::find(name);
+	if (!sym) {
+		return 0;
+	}
+
+	auto it = lastIds_.find(*sym);
+	if (it == lastIds_.end()) {
+		return 0;
+	}
+
+	return it->second;
+}
+
+void BlockEmitter::add(const LafunBlock &block) {
+	if (!latex_) {
+		return;
+	}
+
+	if (auto up = std::get_if<IdentifierUpwardsRef>(&block)) {
+		IdentifierUpwardsRef ref{up->ident, findLastId(up->ident)};
+		if (ref.id == 0) {
+			latex_->addPending(std::move(ref), 0);
+		} else {
+			writeBlock(latex_->out(), std::move(ref));
+		}
+	} else if (auto down = std::get_if<IdentifierDownwardsRef>(&block)) {
+		size_t fallbackId = findLastId(down->ident);
+		latex_->addPending(IdentifierDownwardsRef{down->ident}, fallbackId);
+	} else {
+		writeBlock(latex_->out(), block);
+	}
+}
+
+void BlockEmitter::add(const BlockResult &result) {
+	if (out_.js) {
+		if (result.kind != BlockResult::METHOD) {
+			*out_.js << result.js;
+		} else if (generatedClasses_.find(result.name) != generatedClasses_.end()) {
+			*out_.js << result.js;
+		} else {
+			pendingMethods_[result.name] += result.js;
+		}
+
+		if (result.kind == BlockResult::CLASS) {
+			generatedClasses_.insert(result.name);
+			auto it = pendingMethods_.find(result.name);
+			if (it != pendingMethods_.end()) {
+				*out_.js << it->second;
+				pendingMethods_.erase(it);
+			}
+		}
+	}
+
+	if (latex_) {
+		latex_->out() << result.latex;
+		latex_->resolve(result.names);
+
+		for (auto &[name, ids]: result.names) {
+			if (ids.second != 0) {
+				lastIds_[name] = ids.second;
+			}
+		}
+	}
+}
+
+void BlockEmitter::finish() {
+	if (!pendingMethods_.empty()) {
+		throw fun::CodegenError(concat(
+				"Methods defined on unknown class ", pendingMethods_.begin()->first));
+	}
+
+	if (out_.js && opts_.jsPrelude) {
+		*out_.js << fun::jsPostlude;
+	}
+
+	if (latex_) {
+		latex_->finish();
+		if (opts_.latexPrelude) {
+			*out_.latex << latexPostlude;
+		}
+	}
+}
+
+}
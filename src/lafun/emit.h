@@ -0,0 +1,124 @@
+#pragma once
+
+#include <deque>
+#include <optional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast.h"
+#include "cache.h"
+#include "compile.h"
+#include "module.h"
+#include "fun/IdentResolver.h"
+#include "Sha256.h"
+
+// The pieces of a compile which works one top-level block at a time,
+// shared by --stream, the block cache and watch mode
+
+namespace lafun {
+
+// Declare a block's top-level name, and add it to a hash of all of them.
+// Every block's output depends on those names.
+void declareBlock(fun::IdentResolver &resolver, const fun::ast::Declaration &decl, Sha256 &topLevelHash);
+
+// Resolve one parsed block, and generate the requested outputs.
+// The resolver must have seen every block before this one.
+void generateBlock(
+		std::string_view source, ast::LafunBlock &block, fun::IdentResolver &resolver,
+		bool wantJs, bool wantLatex, std::ostream *astOut, BlockResult &result);
+
+// The definitions and references in one resolved block, sorted
+struct BlockIdents {
+	std::vector<const fun::ast::Identifier *> defs;
+	std::vector<const fun::ast::Identifier *> refs;
+};
+
+// generateBlock in two halves. Only resolving uses the resolver, so the
+// outputs can be generated on another thread once a block is resolved.
+// The names '@' and '!' references look for are collected while resolving.
+void resolveBlock(
+		ast::LafunBlock &block, fun::IdentResolver &resolver, bool wantLatex,
+		BlockIdents &idents, BlockResult &result);
+void generateResolvedBlock(
+		std::string_view source, const ast::LafunBlock &block, const BlockIdents &idents,
+		bool wantJs, bool wantLatex, std::ostream *astOut, BlockResult &result);
+
+// Holds back LaTeX output behind references which can't be resolved yet.
+// '!' refs always look downwards first, and '@' refs look downwards when
+// nothing above matches, so their ids are only known once a later block
+// using the name has been resolved. Everything generated after the oldest
+// unresolved reference is buffered, and written out once it's resolved.
+class LatexBackpatcher {
+public:
+	LatexBackpatcher(std::ostream &os): os_(os) {}
+
+	std::ostream &out() {
+		if (pending_.empty()) {
+			return os_;
+		}
+
+		return tail_;
+	}
+
+	void addPending(ast::LafunBlock &&ref, size_t fallbackId);
+
+	// Resolve pending references against a block which was just finalized
+	void resolve(const fun::DeclNames &names);
+
+	// At the end of the document, remaining references fall back to
+	// what was found above them
+	void finish();
+
+private:
+	struct Pending {
+		ast::LafunBlock ref;
+		size_t fallbackId;
+		bool resolved;
+		std::string following;
+	};
+
+	void flush();
+
+	std::ostream &os_;
+	std::deque<Pending> pending_;
+	std::ostringstream tail_;
+};
+
+// Writes the outputs from blocks in document order, including the preludes
+class BlockEmitter {
+public:
+	BlockEmitter(const CompileOptions &opts, const CompileOutputs &out);
+
+	// Classes from imported modules have been generated already
+	void addImports(const ModuleInterface &iface);
+
+	// Anything but a FunBlock
+	void add(const ast::LafunBlock &block);
+
+	// A FunBlock, once it has been generated
+	void add(const BlockResult &result);
+
+	void finish();
+
+private:
+	size_t findLastId(const std::string &name);
+
+	const CompileOptions &opts_;
+	const CompileOutputs &out_;
+	std::optional<LatexBackpatcher> latex_;
+
+	// Only the last id seen for each name is kept around, for '@' refs
+	std::unordered_map<fun::Symbol, size_t> lastIds_;
+
+	// Methods are attached to the prototype of their class,
+	// so they have to wait until it has been generated
+	std::unordered_set<std::string> generatedClasses_;
+	std::unordered_map<std::string, std::string> pendingMethods_;
+};
+
+}
@@ -0,0 +1,81 @@
+#include "incremental.h"
+
+#include "fun/walk.h"
+
+namespace lafun {
+
+SourceChange diffSources(std::string_view oldSource, std::string_view source) {
+	size_t limit = std::min(oldSource.size(), source.size());
+	size_t prefix = std::mismatch(
+			oldSource.begin(), oldSource.begin() + limit, source.begin()).first - oldSource.begin();
+	size_t suffix = 0;
+	while (suffix < limit - prefix &&
+			oldSource[oldSource.size() - suffix - 1] == source[source.size() - suffix - 1]) {
+		suffix += 1;
+	}
+
+	return {prefix, suffix};
+}
+
+namespace {
+
+// Moves every range in a tree from being relative to 'from', to being
+// relative to 'to'
+class ShiftPass: public fun::walk::Pass {
+public:
+	using fun::walk::Pass::enter;
+
+	ShiftPass(size_t from, size_t to): from_(from), to_(to) {}
+
+	void enter(fun::ast::IdentifierExpr &ident) { shift(ident.ident); }
+	void enter(fun::ast::DeclAssignmentExpr &assignment) { shift(assignment.ident); }
+
+	void enter(fun::ast::ClassDecl &classDecl) {
+		shift(classDecl.ident);
+		shiftArgs(classDecl.args);
+	}
+
+	void enter(fun::ast::FuncDecl &funcDecl) {
+		shift(funcDecl.ident);
+		shiftArgs(funcDecl.args);
+	}
+
+	void enter(fun::ast::MethodDecl &methodDecl) {
+		shift(methodDecl.classIdent);
+		shift(methodDecl.ident);
+		shiftArgs(methodDecl.args);
+	}
+
+private:
+	void shift(fun::ast::Identifier &ident) {
+		ident.range.start = ident.range.start - from_ + to_;
+		ident.range.end = ident.range.end - from_ + to_;
+	}
+
+	void shiftArgs(fun::ast::List<fun::ast::Identifier> &args) {
+		for (fun::ast::Identifier &ident: args) {
+			shift(ident);
+		}
+	}
+
+	size_t from_;
+	size_t to_;
+};
+
+}
+
+void rebaseBlock(ParsedBlock &block) {
+	if (block.parsedAt == block.start) {
+		return;
+	}
+
+	if (auto funBlock = std::get_if<ast::FunBlock>(&block.block)) {
+		ShiftPass pass(block.parsedAt, block.start);
+		fun::walk::walk(funBlock->decl, pass);
+		funBlock->range = {block.start, block.end};
+	}
+
+	block.parsedAt = block.start;
+}
+
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+#include "ast.h"
+#include "parse.h"
+#include "Reader.h"
+
+// Keeping a document's top-level blocks parsed while its source changes,
+// shared by watch mode and the language server
+
+namespace lafun {
+
+// A top-level block, and where it is in the current version of the source
+struct ParsedBlock {
+	ast::LafunBlock block;
+	size_t start = 0;
+	size_t end = 0;
+
+	// For FunBlocks: the offset which the identifier ranges are
+	// relative to, which is different from start once the block has moved
+	size_t parsedAt = 0;
+};
+
+// Which bytes changed between two versions of a source: all but the
+// first 'prefix' and the last 'suffix' bytes, which both versions share
+struct SourceChange {
+	size_t prefix;
+	size_t suffix;
+};
+
+SourceChange diffSources(std::string_view oldSource, std::string_view source);
+
+// Move every range in a FunBlock from being relative to parsedAt,
+// to being relative to start
+void rebaseBlock(ParsedBlock &block);
+
+// A block's extent can depend on a few bytes after its end,
+// through the parser's lookahead
+static constexpr size_t blockLookahead = 8;
+
+// Bring the blocks of a source which was 'oldSize' bytes long up to date
+// with its new version, given where the two differ. Only the blocks
+// which overlap the change are parsed again; the blocks after it are kept,
+// and only their positions are updated. Block must derive from ParsedBlock,
+// and parsed blocks are otherwise default constructed.
+// If the new source doesn't parse, this throws and leaves 'blocks' as it was.
+// Returns the number of blocks which were parsed.
+template<typename Block>
+size_t reparseBlocks(
+		std::vector<Block> &blocks, size_t oldSize,
+		std::string_view source, SourceChange change) {
+	size_t limit = std::min(oldSize, source.size());
+	change.prefix = std::min(change.prefix, limit);
+	change.suffix = std::min(change.suffix, limit - change.prefix);
+
+	// Blocks before 'first' are unchanged, and so are blocks from
+	// 'last' onwards, apart from their position
+	size_t first = std::partition_point(blocks.begin(), blocks.end(), [&](const Block &block) {
+		return block.end + blockLookahead <= change.prefix;
+	}) - blocks.begin();
+	size_t last = std::partition_point(blocks.begin() + first, blocks.end(), [&](const Block &block) {
+		return block.start < oldSize - change.suffix;
+	}) - blocks.begin();
+
+	auto moved = [&](size_t offset) {
+		return offset - oldSize + source.size();
+	};
+
+	// Parse from the first changed block, until we're back in step
+	// with an unchanged block
+	std::vector<Block> parsed;
+	Reader reader{source};
+	reader.idx = first < blocks.size() ? blocks[first].start : oldSize;
+	while (true) {
+		while (last < blocks.size() && moved(blocks[last].start) < reader.idx) {
+			last += 1;
+		}
+
+		if (last < blocks.size() && moved(blocks[last].start) == reader.idx) {
+			break;
+		}
+
+		Block block;
+		block.start = reader.idx;
+		if (!parseLafunBlock(reader, block.block)) {
+			last = blocks.size();
+			break;
+		}
+
+		block.end = reader.idx;
+		block.parsedAt = block.start;
+		parsed.push_back(std::move(block));
+	}
+
+	for (size_t i = last; i < blocks.size(); ++i) {
+		blocks[i].start = moved(blocks[i].start);
+		blocks[i].end = moved(blocks[i].end);
+	}
+
+	size_t count = parsed.size();
+	blocks.erase(blocks.begin() + first, blocks.begin() + last);
+	blocks.insert(
+			blocks.begin() + first,
+			std::make_move_iterator(parsed.begin()), std::make_move_iterator(parsed.end()));
+
+	// Raw LaTeX refers into the source, and the kept blocks still refer
+	// into the old version
+	for (Block &block: blocks) {
+		if (auto latex = std::get_if<ast::RawLatex>(&block.block)) {
+			latex->str = source.substr(block.start, block.end - block.start);
+		}
+	}
+
+	return count;
+}
+
+}
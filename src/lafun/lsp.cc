@@ -0,0 +1,878 @@
+#include "lsp.h"
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <strings.h>
+
+#include "emit.h"
+#include "incremental.h"
+#include "module.h"
+#include "parse.h"
+#include "fun/IdentResolver.h"
+#include "fun/parse.h"
+#include "fun/prelude.h"
+#include "Json.h"
+#include "LineIndex.h"
+#include "Sha256.h"
+#include "util.h"
+
+using namespace lafun::ast;
+
+namespace lafun {
+
+namespace {
+
+// How the client counts columns
+enum class Encoding {
+	UTF8,
+	UTF16,
+};
+
+struct Diagnostic {
+	fun::ByteRange range;
+	std::string message;
+};
+
+// What an identifier or a LaFuN reference refers to. Top-level names have
+// the same id in every block; other ids only mean something in the block
+// which uses them.
+struct Symbol {
+	enum Kind {NONE, TOP_LEVEL, LOCAL, BUILTIN, IMPORTED};
+
+	Kind kind = NONE;
+	size_t block = 0;
+	size_t id = 0;
+	std::string name;
+
+	bool operator==(const Symbol &other) const {
+		if (kind != other.kind) {
+			return false;
+		} else if (kind == BUILTIN || kind == IMPORTED) {
+			return name == other.name;
+		}
+
+		return id == other.id && block == other.block;
+	}
+};
+
+// Right after an update, no bytes have changed. Every edit after that
+// shrinks the unchanged prefix and suffix.
+static const SourceChange nothingChanged{SIZE_MAX, SIZE_MAX};
+
+static const fun::ast::Identifier &declIdent(const fun::ast::Declaration &decl) {
+	return std::visit([](auto &decl) -> const fun::ast::Identifier & {
+		return decl.ident;
+	}, decl);
+}
+
+// An open document. Between updates, the blocks and everything resolved
+// from them stay as they were after the last successful parse, while the
+// text follows the client's edits.
+class Document {
+public:
+	Document(std::string text, Encoding encoding, std::vector<std::string> moduleDirs):
+			encoding_(encoding), text_(std::move(text)), moduleDirs_(std::move(moduleDirs)) {
+		update();
+	}
+
+	// Apply the 'contentChanges' of a didChange notification
+	void change(const Json &changes);
+
+	// Parse the blocks which changed since the last update, and resolve
+	// them again. When the top-level names change, every block is resolved.
+	void update();
+
+	void diagnostics(std::vector<Diagnostic> &diags) const;
+
+	size_t offsetAt(const Json &position);
+	Json positionAt(size_t offset);
+	Json rangeJson(fun::ByteRange range);
+
+	Symbol symbolAt(size_t offset, fun::ByteRange &range) const;
+	bool findDefinition(const Symbol &sym, fun::ByteRange &range) const;
+	void findReferences(const Symbol &sym, bool includeDecl, std::vector<fun::ByteRange> &ranges) const;
+	std::string hover(const Symbol &sym);
+
+private:
+	// An identifier in a block, with its range relative to the block's start
+	struct Occurrence {
+		fun::ByteRange range;
+		size_t id;
+		bool def;
+	};
+
+	struct Block: ParsedBlock {
+		bool resolved = false;
+		size_t firstId = 0;
+		size_t idsUsed = 0;
+		std::string error;
+
+		// Sorted by position, so that positions can be looked up
+		std::vector<Occurrence> occurrences;
+
+		// For LaFuN references
+		fun::DeclNames names;
+	};
+
+	const LineIndex &lines();
+	std::string declareAll();
+	void resolveBlock(size_t idx);
+
+	fun::ByteRange absolute(const Block &block, fun::ByteRange range) const {
+		return {block.start + range.start, block.start + range.end};
+	}
+
+	// Ranges in the syntax tree are relative to where the block was parsed
+	fun::ByteRange fromTree(const Block &block, fun::ByteRange range) const {
+		return {block.start + range.start - block.parsedAt, block.start + range.end - block.parsedAt};
+	}
+
+	Symbol classify(size_t idx, size_t id, std::string name) const;
+	Symbol lookup(size_t offset, fun::ByteRange &range) const;
+	bool findName(size_t idx, const std::string &name, bool last, Symbol &sym) const;
+	Symbol resolveReference(size_t idx) const;
+
+	Encoding encoding_;
+	std::string text_;
+	std::vector<std::string> moduleDirs_;
+	std::optional<LineIndex> lineIndex_;
+
+	std::vector<Block> blocks_;
+	size_t parsedSize_ = 0;
+	SourceChange pending_{0, 0};
+	std::optional<Diagnostic> parseError_;
+	std::vector<Diagnostic> declareErrors_;
+
+	std::optional<fun::IdentResolver> resolver_;
+	std::string topLevelDigest_;
+
+	// The block which defines each top-level id, starting from id 1
+	std::vector<size_t> topLevel_;
+
+	// The module each imported name comes from
+	std::unordered_map<std::string, std::string> importedFrom_;
+};
+
+const LineIndex &Document::lines() {
+	if (!lineIndex_) {
+		lineIndex_.emplace(text_);
+	}
+
+	return *lineIndex_;
+}
+
+size_t Document::offsetAt(const Json &position) {
+	double line = position["line"].asNumber();
+	double character = position["character"].asNumber();
+	if (line < 0) {
+		return 0;
+	}
+
+	size_t start = lines().lineStart(line);
+	size_t end = text_.find('\n', start);
+	if (end == std::string::npos) {
+		end = text_.size();
+	}
+
+	if (character <= 0) {
+		return start;
+	} else if (encoding_ == Encoding::UTF8) {
+		return std::min(start + (size_t)character, end);
+	}
+
+	size_t idx = start;
+	size_t units = 0;
+	while (idx < end && units < character) {
+		unsigned char ch = text_[idx++];
+		units += ch >= 0xf0 ? 2 : 1;
+		while (idx < end && ((unsigned char)text_[idx] & 0xc0) == 0x80) {
+			idx += 1;
+		}
+	}
+
+	return idx;
+}
+
+Json Document::positionAt(size_t offset) {
+	Location loc = lines().locate(offset);
+	size_t character = loc.column;
+	if (encoding_ == Encoding::UTF16) {
+		character = 0;
+		for (size_t idx = offset - loc.column; idx < offset; ++idx) {
+			unsigned char ch = text_[idx];
+			if ((ch & 0xc0) != 0x80) {
+				character += ch >= 0xf0 ? 2 : 1;
+			}
+		}
+	}
+
+	return Json::Object{{"line", loc.line}, {"character", character}};
+}
+
+Json Document::rangeJson(fun::ByteRange range) {
+	return Json::Object{{"start", positionAt(range.start)}, {"end", positionAt(range.end)}};
+}
+
+void Document::change(const Json &changes) {
+	for (const Json &change: changes.asArray()) {
+		size_t start = 0;
+		size_t end = text_.size();
+		const Json &range = change["range"];
+		if (!range.isNull()) {
+			start = offsetAt(range["start"]);
+			end = std::max(start, offsetAt(range["end"]));
+		}
+
+		// Merge with the changes since the last update
+		pending_.prefix = std::min(pending_.prefix, start);
+		pending_.suffix = std::min(pending_.suffix, text_.size() - end);
+
+		text_.replace(start, end - start, change["text"].asString());
+		lineIndex_.reset();
+	}
+}
+
+void Document::update() {
+	Location errorLoc{};
+	std::string error;
+	try {
+		reparseBlocks(blocks_, parsedSize_, text_, pending_);
+	} catch (fun::LexError &err) {
+		errorLoc = {err.line, err.column};
+		error = err.message;
+	} catch (fun::ParseError &err) {
+		errorLoc = {err.line, err.column};
+		error = err.message;
+	} catch (LafunParseError &err) {
+		errorLoc = {err.line, err.column};
+		error = err.message;
+	}
+
+	if (!error.empty()) {
+		size_t offset = std::min(lines().lineStart(errorLoc.line) + errorLoc.column, text_.size());
+		parseError_ = Diagnostic{{offset, std::min(offset + 1, text_.size())}, std::move(error)};
+		return;
+	}
+
+	parseError_.reset();
+	parsedSize_ = text_.size();
+	pending_ = nothingChanged;
+
+	// A changed top-level name can change how any block resolves
+	std::string topLevelDigest = declareAll();
+	if (topLevelDigest != topLevelDigest_) {
+		for (Block &block: blocks_) {
+			block.resolved = false;
+		}
+
+		topLevelDigest_ = std::move(topLevelDigest);
+	}
+
+	for (size_t i = 0; i < blocks_.size(); ++i) {
+		if (!blocks_[i].resolved && std::holds_alternative<FunBlock>(blocks_[i].block)) {
+			resolveBlock(i);
+		}
+	}
+}
+
+std::string Document::declareAll() {
+	resolver_.emplace();
+	resolver_->addBuiltins(fun::preludeNameSet);
+	resolver_->beginStreaming();
+	topLevel_.clear();
+	declareErrors_.clear();
+	importedFrom_.clear();
+
+	Sha256 topLevelHash;
+	for (size_t i = 0; i < blocks_.size(); ++i) {
+		if (auto import = std::get_if<ModuleImport>(&blocks_[i].block)) {
+			try {
+				ModuleInterface iface;
+				loadInterface(import->module, moduleDirs_, iface);
+				importModule(*resolver_, import->module, iface, topLevelHash);
+				for (const ModuleInterface::Name &name: iface.names) {
+					importedFrom_[name.name] = import->module;
+				}
+			} catch (ModuleError &err) {
+				declareErrors_.push_back({{blocks_[i].start, blocks_[i].end}, err.message});
+			} catch (fun::NameError &err) {
+				declareErrors_.push_back({{blocks_[i].start, blocks_[i].end}, err.message});
+			}
+		}
+
+		auto funBlock = std::get_if<FunBlock>(&blocks_[i].block);
+		if (!funBlock) {
+			continue;
+		}
+
+		size_t id = resolver_->peekId();
+		try {
+			declareBlock(*resolver_, funBlock->decl, topLevelHash);
+		} catch (fun::NameError &err) {
+			fun::ByteRange range = fromTree(blocks_[i], declIdent(funBlock->decl).range);
+			declareErrors_.push_back({range, err.message});
+		}
+
+		if (resolver_->peekId() != id) {
+			topLevel_.push_back(i);
+		}
+	}
+
+	return topLevelHash.hexDigest();
+}
+
+void Document::resolveBlock(size_t idx) {
+	Block &block = blocks_[idx];
+	FunBlock &funBlock = std::get<FunBlock>(block.block);
+	block.occurrences.clear();
+	block.names.clear();
+	block.error.clear();
+
+	// Whatever was resolved before an error is still useful
+	block.firstId = resolver_->peekId();
+	try {
+		resolver_->finalizeOne(funBlock.decl, &block.names);
+	} catch (fun::NameError &err) {
+		block.error = err.message;
+	}
+
+	block.idsUsed = resolver_->peekId() - block.firstId;
+
+	auto add = [&](const fun::ast::Identifier *ident, bool def) {
+		fun::ByteRange range{ident->range.start - block.parsedAt, ident->range.end - block.parsedAt};
+		block.occurrences.push_back({range, ident->id, def});
+	};
+
+	for (const fun::ast::Identifier *ident: resolver_->getDefs()) {
+		add(ident, true);
+	}
+	for (const fun::ast::Identifier *ident: resolver_->getRefs()) {
+		add(ident, false);
+	}
+
+	std::sort(block.occurrences.begin(), block.occurrences.end(), [](const Occurrence &a, const Occurrence &b) {
+		return a.range.start < b.range.start;
+	});
+
+	resolver_->clearDefsAndRefs();
+	block.resolved = true;
+}
+
+void Document::diagnostics(std::vector<Diagnostic> &diags) const {
+	if (parseError_) {
+		diags.push_back(*parseError_);
+		return;
+	}
+
+	diags = declareErrors_;
+	for (const Block &block: blocks_) {
+		if (!block.error.empty()) {
+			const FunBlock &funBlock = std::get<FunBlock>(block.block);
+			diags.push_back({fromTree(block, declIdent(funBlock.decl).range), block.error});
+		}
+	}
+}
+
+Symbol Document::classify(size_t idx, size_t id, std::string name) const {
+	const Block &block = blocks_[idx];
+	Symbol sym;
+	sym.name = std::move(name);
+	if (id == 0) {
+		return sym;
+	} else if (id <= topLevel_.size()) {
+		sym.kind = Symbol::TOP_LEVEL;
+		sym.id = id;
+	} else if (id >= block.firstId && id < block.firstId + block.idsUsed) {
+		sym.kind = Symbol::LOCAL;
+		sym.block = idx;
+		sym.id = id;
+	} else if (id == fun::ScopeStack::IMPORTED) {
+		sym.kind = Symbol::IMPORTED;
+	} else {
+		sym.kind = Symbol::BUILTIN;
+	}
+
+	return sym;
+}
+
+bool Document::findName(size_t idx, const std::string &name, bool last, Symbol &sym) const {
+	const Block &block = blocks_[idx];
+	if (!std::holds_alternative<FunBlock>(block.block)) {
+		return false;
+	}
+
+	auto symbol = fun::Symbol::find(name);
+	if (!symbol) {
+		return false;
+	}
+
+	auto it = block.names.find(*symbol);
+	if (it == block.names.end()) {
+		return false;
+	}
+
+	size_t id = last ? it->second.second : it->second.first;
+	if (id == 0) {
+		return false;
+	}
+
+	sym = classify(idx, id, name);
+	return true;
+}
+
+// Like resolveLafunReferences: '@' refs prefer the last match above,
+// '!' refs prefer the first match below
+Symbol Document::resolveReference(size_t idx) const {
+	const LafunBlock &ref = blocks_[idx].block;
+	bool upwards = std::holds_alternative<IdentifierUpwardsRef>(ref);
+	const std::string &name = upwards ?
+		std::get<IdentifierUpwardsRef>(ref).ident :
+		std::get<IdentifierDownwardsRef>(ref).ident;
+
+	Symbol sym;
+	for (int pass = 0; pass < 2; ++pass) {
+		if (upwards == (pass == 0)) {
+			for (size_t i = idx; i-- > 0;) {
+				if (findName(i, name, true, sym)) {
+					return sym;
+				}
+			}
+		} else {
+			for (size_t i = idx + 1; i < blocks_.size(); ++i) {
+				if (findName(i, name, false, sym)) {
+					return sym;
+				}
+			}
+		}
+	}
+
+	sym.name = name;
+	return sym;
+}
+
+Symbol Document::lookup(size_t offset, fun::ByteRange &range) const {
+	size_t idx = std::partition_point(blocks_.begin(), blocks_.end(), [&](const Block &block) {
+		return block.end <= offset;
+	}) - blocks_.begin();
+	if (idx == blocks_.size() || blocks_[idx].start > offset) {
+		return {};
+	}
+
+	const Block &block = blocks_[idx];
+	if (std::holds_alternative<IdentifierUpwardsRef>(block.block) ||
+			std::holds_alternative<IdentifierDownwardsRef>(block.block)) {
+		range = {block.start, block.end};
+		return resolveReference(idx);
+	} else if (!std::holds_alternative<FunBlock>(block.block)) {
+		return {};
+	}
+
+	size_t rel = offset - block.start;
+	auto it = std::partition_point(block.occurrences.begin(), block.occurrences.end(), [&](const Occurrence &occ) {
+		return occ.range.start <= rel;
+	});
+	if (it == block.occurrences.begin() || (it - 1)->range.end <= rel) {
+		return {};
+	}
+
+	const Occurrence &occ = *(it - 1);
+	range = absolute(block, occ.range);
+	return classify(idx, occ.id, text_.substr(range.start, range.end - range.start));
+}
+
+Symbol Document::symbolAt(size_t offset, fun::ByteRange &range) const {
+	// The cursor may well be just after the identifier
+	Symbol sym = lookup(offset, range);
+	if (sym.kind == Symbol::NONE && offset > 0) {
+		sym = lookup(offset - 1, range);
+	}
+
+	return sym;
+}
+
+bool Document::findDefinition(const Symbol &sym, fun::ByteRange &range) const {
+	if (sym.kind == Symbol::TOP_LEVEL) {
+		const Block &block = blocks_[topLevel_[sym.id - 1]];
+		range = fromTree(block, declIdent(std::get<FunBlock>(block.block).decl).range);
+		return true;
+	} else if (sym.kind != Symbol::LOCAL) {
+		return false;
+	}
+
+	const Block &block = blocks_[sym.block];
+	for (const Occurrence &occ: block.occurrences) {
+		if (occ.def && occ.id == sym.id) {
+			range = absolute(block, occ.range);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Document::findReferences(const Symbol &sym, bool includeDecl, std::vector<fun::ByteRange> &ranges) const {
+	if (sym.kind == Symbol::NONE) {
+		return;
+	}
+
+	for (size_t i = 0; i < blocks_.size(); ++i) {
+		const Block &block = blocks_[i];
+		if (std::holds_alternative<IdentifierUpwardsRef>(block.block) ||
+				std::holds_alternative<IdentifierDownwardsRef>(block.block)) {
+			const LafunBlock &ref = block.block;
+			const std::string &name = std::holds_alternative<IdentifierUpwardsRef>(ref) ?
+				std::get<IdentifierUpwardsRef>(ref).ident :
+				std::get<IdentifierDownwardsRef>(ref).ident;
+			if (name == sym.name && resolveReference(i) == sym) {
+				ranges.push_back({block.start, block.end});
+			}
+
+			continue;
+		} else if (sym.kind == Symbol::LOCAL && i != sym.block) {
+			continue;
+		}
+
+		for (const Occurrence &occ: block.occurrences) {
+			if (occ.def && !includeDecl) {
+				continue;
+			}
+
+			bool match;
+			if (sym.kind == Symbol::BUILTIN || sym.kind == Symbol::IMPORTED) {
+				fun::ByteRange range = absolute(block, occ.range);
+				match = text_.compare(range.start, range.end - range.start, sym.name) == 0 &&
+					classify(i, occ.id, {}).kind == sym.kind;
+			} else {
+				match = occ.id == sym.id;
+			}
+
+			if (match) {
+				ranges.push_back(absolute(block, occ.range));
+			}
+		}
+	}
+}
+
+std::string Document::hover(const Symbol &sym) {
+	if (sym.kind == Symbol::BUILTIN) {
+		return concat("`", sym.name, "` is a builtin");
+	} else if (sym.kind == Symbol::IMPORTED) {
+		auto it = importedFrom_.find(sym.name);
+		if (it != importedFrom_.end()) {
+			return concat("`", sym.name, "` is imported from `", it->second, "`");
+		}
+
+		return {};
+	}
+
+	fun::ByteRange range;
+	if (!findDefinition(sym, range)) {
+		return {};
+	}
+
+	// Show the line with the definition
+	int line = lines().locate(range.start).line;
+	size_t start = lines().lineStart(line);
+	size_t end = text_.find('\n', start);
+	if (end == std::string::npos) {
+		end = text_.size();
+	}
+
+	while (start < end && (text_[start] == ' ' || text_[start] == '\t')) {
+		start += 1;
+	}
+	while (end > start && (text_[end - 1] == ' ' || text_[end - 1] == '\t' || text_[end - 1] == '\r')) {
+		end -= 1;
+	}
+
+	return concat("```\n", text_.substr(start, end - start), "\n```");
+}
+
+// Imported modules are looked for next to the document,
+// when it's a file
+static std::vector<std::string> moduleDirs(const std::string &uri) {
+	static const std::string scheme = "file://";
+	if (uri.compare(0, scheme.size(), scheme) != 0) {
+		return {};
+	}
+
+	std::string path;
+	for (size_t i = scheme.size(); i < uri.size(); ++i) {
+		if (uri[i] == '%' && i + 2 < uri.size()) {
+			path += (char)strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16);
+			i += 2;
+		} else {
+			path += uri[i];
+		}
+	}
+
+	return {documentDir(path)};
+}
+
+class Server {
+public:
+	Server(std::ostream &out): out_(out) {}
+
+	// Returns false once the client has asked us to exit
+	bool handle(const Json &msg);
+
+	int exitCode() const { return shutdown_ ? 0 : 1; }
+
+private:
+	void send(const Json &msg);
+	void respond(const Json &id, Json result);
+	void respondError(const Json &id, int code, std::string message);
+	void publishDiagnostics(const std::string &uri, Document *doc);
+	Document *findDocument(const Json &params);
+	Json location(const std::string &uri, Document &doc, fun::ByteRange range);
+
+	Json handleRequest(const std::string &method, const Json &params);
+	void handleNotification(const std::string &method, const Json &params);
+
+	std::ostream &out_;
+	std::unordered_map<std::string, std::unique_ptr<Document>> docs_;
+	Encoding encoding_ = Encoding::UTF16;
+	bool shutdown_ = false;
+};
+
+struct MethodNotFound {};
+
+void Server::send(const Json &msg) {
+	std::string body = msg.toString();
+	out_ << "Content-Length: " << body.size() << "\r\n\r\n" << body << std::flush;
+}
+
+void Server::respond(const Json &id, Json result) {
+	send(Json::Object{{"jsonrpc", "2.0"}, {"id", id}, {"result", std::move(result)}});
+}
+
+void Server::respondError(const Json &id, int code, std::string message) {
+	Json error = Json::Object{{"code", code}, {"message", std::move(message)}};
+	send(Json::Object{{"jsonrpc", "2.0"}, {"id", id}, {"error", std::move(error)}});
+}
+
+void Server::publishDiagnostics(const std::string &uri, Document *doc) {
+	std::vector<Diagnostic> diags;
+	if (doc) {
+		doc->diagnostics(diags);
+	}
+
+	Json::Array arr;
+	for (Diagnostic &diag: diags) {
+		arr.push_back(Json::Object{
+			{"range", doc->rangeJson(diag.range)},
+			{"severity", 1},
+			{"source", "lafun"},
+			{"message", std::move(diag.message)},
+		});
+	}
+
+	Json params = Json::Object{{"uri", uri}, {"diagnostics", std::move(arr)}};
+	send(Json::Object{
+		{"jsonrpc", "2.0"},
+		{"method", "textDocument/publishDiagnostics"},
+		{"params", std::move(params)},
+	});
+}
+
+Document *Server::findDocument(const Json &params) {
+	auto it = docs_.find(params["textDocument"]["uri"].asString());
+	if (it == docs_.end()) {
+		return nullptr;
+	}
+
+	return it->second.get();
+}
+
+Json Server::location(const std::string &uri, Document &doc, fun::ByteRange range) {
+	return Json::Object{{"uri", uri}, {"range", doc.rangeJson(range)}};
+}
+
+Json Server::handleRequest(const std::string &method, const Json &params) {
+	if (method == "initialize") {
+		for (const Json &encoding: params["capabilities"]["general"]["positionEncodings"].asArray()) {
+			if (encoding.asString() == "utf-8") {
+				encoding_ = Encoding::UTF8;
+			}
+		}
+
+		Json sync = Json::Object{{"openClose", true}, {"change", 2}};
+		Json capabilities = Json::Object{
+			{"positionEncoding", encoding_ == Encoding::UTF8 ? "utf-8" : "utf-16"},
+			{"textDocumentSync", std::move(sync)},
+			{"definitionProvider", true},
+			{"referencesProvider", true},
+			{"hoverProvider", true},
+		};
+
+		return Json::Object{
+			{"capabilities", std::move(capabilities)},
+			{"serverInfo", Json::Object{{"name", "lafun"}}},
+		};
+	} else if (method == "shutdown") {
+		shutdown_ = true;
+		return nullptr;
+	} else if (
+			method != "textDocument/definition" &&
+			method != "textDocument/references" &&
+			method != "textDocument/hover") {
+		throw MethodNotFound();
+	}
+
+	Document *doc = findDocument(params);
+	if (!doc) {
+		return nullptr;
+	}
+
+	const std::string &uri = params["textDocument"]["uri"].asString();
+	fun::ByteRange range;
+	Symbol sym = doc->symbolAt(doc->offsetAt(params["position"]), range);
+	if (sym.kind == Symbol::NONE) {
+		return nullptr;
+	}
+
+	if (method == "textDocument/definition") {
+		fun::ByteRange def;
+		if (!doc->findDefinition(sym, def)) {
+			return nullptr;
+		}
+
+		return location(uri, *doc, def);
+	} else if (method == "textDocument/references") {
+		std::vector<fun::ByteRange> ranges;
+		doc->findReferences(sym, params["context"]["includeDeclaration"].asBool(), ranges);
+
+		Json::Array arr;
+		for (fun::ByteRange ref: ranges) {
+			arr.push_back(location(uri, *doc, ref));
+		}
+
+		return arr;
+	}
+
+	std::string text = doc->hover(sym);
+	if (text.empty()) {
+		return nullptr;
+	}
+
+	return Json::Object{
+		{"contents", Json::Object{{"kind", "markdown"}, {"value", std::move(text)}}},
+		{"range", doc->rangeJson(range)},
+	};
+}
+
+void Server::handleNotification(const std::string &method, const Json &params) {
+	const std::string &uri = params["textDocument"]["uri"].asString();
+	if (method == "textDocument/didOpen") {
+		auto doc = std::make_unique<Document>(
+				params["textDocument"]["text"].asString(), encoding_, moduleDirs(uri));
+		Document *ptr = doc.get();
+		docs_[uri] = std::move(doc);
+		publishDiagnostics(uri, ptr);
+	} else if (method == "textDocument/didChange") {
+		Document *doc = findDocument(params);
+		if (doc) {
+			doc->change(params["contentChanges"]);
+			doc->update();
+			publishDiagnostics(uri, doc);
+		}
+	} else if (method == "textDocument/didClose") {
+		docs_.erase(uri);
+		publishDiagnostics(uri, nullptr);
+	}
+}
+
+bool Server::handle(const Json &msg) {
+	const std::string &method = msg["method"].asString();
+	const Json &id = msg["id"];
+	if (method == "exit") {
+		return false;
+	} else if (method.empty()) {
+		// A response to a request we never sent
+		return true;
+	}
+
+	if (id.isNull()) {
+		try {
+			handleNotification(method, msg["params"]);
+		} catch (std::exception &ex) {
+			std::cerr << "lafun: " << method << ": " << ex.what() << '\n';
+		}
+
+		return true;
+	}
+
+	try {
+		respond(id, handleRequest(method, msg["params"]));
+	} catch (MethodNotFound &) {
+		respondError(id, -32601, "Unknown method " + method);
+	} catch (std::exception &ex) {
+		respondError(id, -32603, ex.what());
+	}
+
+	return true;
+}
+
+// Read the body of one message. Returns false on EOF or bad headers.
+static bool readMessage(std::istream &in, std::string &body) {
+	static const char header[] = "Content-Length:";
+	size_t length = SIZE_MAX;
+	std::string line;
+	while (std::getline(in, line)) {
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+
+		if (line.empty()) {
+			if (length == SIZE_MAX) {
+				return false;
+			}
+
+			body.resize(length);
+			return length == 0 || in.read(&body[0], length);
+		}
+
+		if (strncasecmp(line.c_str(), header, sizeof(header) - 1) == 0) {
+			char *end;
+			length = strtoull(line.c_str() + sizeof(header) - 1, &end, 10);
+			if (*end != '\0') {
+				return false;
+			}
+		}
+	}
+
+	return false;
+}
+
+}
+
+int serveLsp(std::istream &in, std::ostream &out) {
+	Server server(out);
+	std::string body;
+	while (readMessage(in, body)) {
+		Json msg;
+		try {
+			msg = Json::parse(body);
+		} catch (JsonError &err) {
+			Json error = Json::Object{{"code", -32700}, {"message", err.what()}};
+			Json response = Json::Object{{"jsonrpc", "2.0"}, {"id", nullptr}, {"error", std::move(error)}};
+			std::string str = response.toString();
+			out << "Content-Length: " << str.size() << "\r\n\r\n" << str << std::flush;
+			continue;
+		}
+
+		if (!server.handle(msg)) {
+			return server.exitCode();
+		}
+	}
+
+	return 1;
+}
+
+}
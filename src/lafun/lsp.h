@@ -0,0 +1,13 @@
+#pragma once
+
+#include <iostream>
+
+namespace lafun {
+
+// Run a language server which speaks LSP over 'in' and 'out', until the
+// client sends 'exit'. Open documents are kept parsed and resolved, and
+// edits only parse and resolve the top-level blocks they touch.
+// Returns an exit code.
+int serveLsp(std::istream &in, std::ostream &out);
+
+}
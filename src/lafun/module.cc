@@ -0,0 +1,231 @@
+#include "module.h"
+
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Input.h"
+#include "util.h"
+
+using namespace lafun::ast;
+
+namespace lafun {
+
+static const char magic[] = "lafun-interface 1\n";
+
+void addToInterface(const fun::ast::Declaration &decl, size_t id, ModuleInterface &iface) {
+	if (auto clas = std::get_if<fun::ast::ClassDecl>(&decl)) {
+		iface.names.push_back({ModuleInterface::Name::CLASS, clas->ident.name.str(), id, clas->args.size()});
+	} else if (auto func = std::get_if<fun::ast::FuncDecl>(&decl)) {
+		iface.names.push_back({ModuleInterface::Name::FUNC, func->ident.name.str(), id, func->args.size()});
+	}
+}
+
+void collectInterface(const LafunDocument &document, ModuleInterface &iface) {
+	for (const LafunBlock &block: document.blocks) {
+		if (auto funBlock = std::get_if<FunBlock>(&block)) {
+			std::visit([&](const auto &decl) {
+				addToInterface(funBlock->decl, decl.ident.id, iface);
+			}, funBlock->decl);
+		}
+	}
+}
+
+// One line per name: "<class|fun> <name> <id> <arity>"
+void writeInterface(std::ostream &os, const ModuleInterface &iface) {
+	os << magic;
+	for (const ModuleInterface::Name &name: iface.names) {
+		os << (name.kind == ModuleInterface::Name::CLASS ? "class" : "fun") << ' '
+			<< name.name << ' ' << name.id << ' ' << name.arity << '\n';
+	}
+}
+
+static bool parseNumber(std::string_view str, size_t &num) {
+	if (str.empty()) {
+		return false;
+	}
+
+	num = 0;
+	for (char ch: str) {
+		if (ch < '0' || ch > '9') {
+			return false;
+		}
+
+		num = num * 10 + (ch - '0');
+	}
+
+	return true;
+}
+
+static bool isName(std::string_view str) {
+	if (str.empty()) {
+		return false;
+	}
+
+	for (char ch: str) {
+		if (!(
+				(ch >= 'a' && ch <= 'z') ||
+				(ch >= 'A' && ch <= 'Z') ||
+				(ch >= '0' && ch <= '9') ||
+				ch == '_')) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void parseInterface(std::string_view text, ModuleInterface &iface) {
+	std::string_view magicStr = magic;
+	if (text.substr(0, magicStr.size()) != magicStr) {
+		throw ModuleError("Not a module interface file");
+	}
+
+	iface.names.clear();
+	size_t pos = magicStr.size();
+	size_t lineNum = 2;
+	while (pos < text.size()) {
+		size_t newline = text.find('\n', pos);
+		if (newline == std::string_view::npos) {
+			newline = text.size();
+		}
+
+		std::string_view line = text.substr(pos, newline - pos);
+		pos = newline + 1;
+
+		std::string_view fields[4];
+		size_t numFields = 0;
+		while (!line.empty() && numFields < 4) {
+			size_t space = line.find(' ');
+			fields[numFields++] = line.substr(0, space);
+			line = space == std::string_view::npos ? std::string_view() : line.substr(space + 1);
+		}
+
+		ModuleInterface::Name name;
+		if (
+				numFields != 4 || !line.empty() ||
+				(fields[0] != "class" && fields[0] != "fun") || !isName(fields[1]) ||
+				!parseNumber(fields[2], name.id) || !parseNumber(fields[3], name.arity)) {
+			throw ModuleError(concat("Invalid line ", lineNum, " in module interface"));
+		}
+
+		name.kind = fields[0] == "class" ? ModuleInterface::Name::CLASS : ModuleInterface::Name::FUNC;
+		name.name = fields[1];
+		iface.names.push_back(std::move(name));
+		lineNum += 1;
+	}
+}
+
+std::string findInterface(const std::string &module, const std::vector<std::string> &dirs) {
+	for (const std::string &dir: dirs) {
+		std::string path = dir + '/' + module + ".funi";
+		if (access(path.c_str(), F_OK) == 0) {
+			return path;
+		}
+	}
+
+	return "";
+}
+
+void loadInterface(
+		const std::string &module, const std::vector<std::string> &dirs,
+		ModuleInterface &iface) {
+	std::string path = findInterface(module, dirs);
+	if (path.empty()) {
+		throw ModuleError(concat("Can't find an interface for module ", module));
+	}
+
+	Input input;
+	if (!input.open(path.c_str(), false)) {
+		throw ModuleError(concat("Opening file ", path, " failed"));
+	}
+
+	try {
+		parseInterface(input.view(), iface);
+	} catch (ModuleError &err) {
+		throw ModuleError(concat(path, ": ", err.message));
+	}
+}
+
+void importModule(
+		fun::IdentResolver &resolver, const std::string &module,
+		const ModuleInterface &iface, Sha256 &topLevelHash) {
+	topLevelHash.updateField("import");
+	topLevelHash.updateField(module);
+	for (const ModuleInterface::Name &name: iface.names) {
+		resolver.addImport(fun::Symbol(name.name));
+		topLevelHash.updateField(name.name);
+	}
+}
+
+std::string documentDir(const std::string &path) {
+	size_t slash = path.rfind('/');
+	if (slash == std::string::npos) {
+		return ".";
+	} else if (slash == 0) {
+		return "/";
+	}
+
+	return path.substr(0, slash);
+}
+
+std::string moduleName(const std::string &path) {
+	size_t slash = path.rfind('/');
+	std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+	size_t dot = name.rfind('.');
+	if (dot != std::string::npos && dot != 0) {
+		name.resize(dot);
+	}
+
+	return name;
+}
+
+bool updateFile(const std::string &path, const std::string &content, bool *changed) {
+	if (changed) {
+		*changed = false;
+	}
+
+	Input old;
+	if (old.open(path.c_str(), false) && old.view() == content) {
+		return true;
+	}
+
+	std::string tmpPath = documentDir(path) + "/.tmp-XXXXXX";
+	int fd = mkstemp(tmpPath.data());
+	if (fd < 0) {
+		return false;
+	}
+
+	// mkstemp only gives the owner access
+	fchmod(fd, 0644);
+
+	const char *data = content.data();
+	size_t len = content.size();
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n <= 0) {
+			close(fd);
+			unlink(tmpPath.c_str());
+			return false;
+		}
+
+		data += n;
+		len -= n;
+	}
+
+	close(fd);
+	if (rename(tmpPath.c_str(), path.c_str()) < 0) {
+		unlink(tmpPath.c_str());
+		return false;
+	}
+
+	if (changed) {
+		*changed = true;
+	}
+
+	return true;
+}
+
+}
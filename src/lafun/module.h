@@ -0,0 +1,78 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+#include "ast.h"
+#include "fun/IdentResolver.h"
+#include "Sha256.h"
+
+// Separate compilation: a document compiled on its own can write an
+// interface file, which lists its top-level classes and functions.
+// Documents which \import{module} resolve against <module>.funi instead
+// of the module's source.
+
+namespace lafun {
+
+struct ModuleError: public std::exception {
+	ModuleError(std::string message): message(message) {}
+
+	std::string message;
+
+	const char *what() const noexcept override { return message.c_str(); }
+};
+
+struct ModuleInterface {
+	struct Name {
+		enum Kind {CLASS, FUNC};
+
+		Kind kind;
+		std::string name;
+		size_t id;
+		size_t arity;
+	};
+
+	// In document order
+	std::vector<Name> names;
+};
+
+// Add a top-level declaration which was given 'id', if it's exported
+void addToInterface(const fun::ast::Declaration &decl, size_t id, ModuleInterface &iface);
+void collectInterface(const ast::LafunDocument &document, ModuleInterface &iface);
+
+void writeInterface(std::ostream &os, const ModuleInterface &iface);
+
+// Throws ModuleError if the text isn't an interface file
+void parseInterface(std::string_view text, ModuleInterface &iface);
+
+// Read <dir>/<module>.funi from the first of 'dirs' which has it.
+// Throws ModuleError if there's none, or it can't be parsed.
+void loadInterface(
+		const std::string &module, const std::vector<std::string> &dirs,
+		ModuleInterface &iface);
+
+// The path loadInterface would read, or an empty string
+std::string findInterface(const std::string &module, const std::vector<std::string> &dirs);
+
+// Make a module's names resolvable, and add them to the hash of top-level
+// names, since every block's output depends on those
+void importModule(
+		fun::IdentResolver &resolver, const std::string &module,
+		const ModuleInterface &iface, Sha256 &topLevelHash);
+
+// The directory which holds the document at 'path'. Modules are looked
+// for there after any other module directories.
+std::string documentDir(const std::string &path);
+
+// The name a document is imported by: "path/to/doc.fun" -> "doc"
+std::string moduleName(const std::string &path);
+
+// Replace the file at 'path' with 'content', unless it already has exactly
+// that content. Leaving an unchanged interface alone keeps its timestamp,
+// so that dependents aren't rebuilt. Returns false if writing failed.
+bool updateFile(const std::string &path, const std::string &content, bool *changed = nullptr);
+
+}
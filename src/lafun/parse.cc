@@ -1,24 +1,92 @@
 #include "parse.h"
 
-#include <algorithm>
+#include <exception>
+#include <vector>
 
 #include "fun/parse.h"
+#include "Scan.h"
+#include "ThreadPool.h"
 
 using namespace lafun::ast;
 
 namespace lafun {
 
-#define MAX_TOP_LEVEL_KEYWORD_SIZE 5
+#define MAX_TOP_LEVEL_KEYWORD_SIZE 6
+
+// Skip over a brace-delimited group of FuN code without parsing it.
+// Braces within string literals don't count.
+static void skipBraceGroup(Reader &reader) {
+	std::string_view source = reader.string();
+	reader.idx = scan::whitespace(source, reader.idx);
+
+	size_t startIdx = reader.idx;
+	if (reader.readCh() != '{') {
+		throw LafunParseError(reader.location(startIdx), "Expected '{'");
+	}
+
+	size_t depth = 1;
+	while (depth > 0) {
+		reader.idx = scan::codeGroup(source, reader.idx);
+		int ch = reader.readCh();
+		if (ch == EOF) {
+			throw LafunParseError(reader.location(startIdx), "Unterminated '{'");
+		} else if (ch == '{') {
+			depth++;
+		} else if (ch == '}') {
+			depth--;
+		} else if (ch == '"' || ch == '\'') {
+			size_t stringIdx = reader.idx - 1;
+			while (true) {
+				reader.idx = scan::string(source, reader.idx, (char)ch);
+				int ch2 = reader.readCh();
+				if (ch2 == EOF) {
+					throw LafunParseError(reader.location(stringIdx), "Unterminated string");
+				} else if (ch2 == '\\') {
+					reader.readCh();
+				} else if (ch2 == ch) {
+					break;
+				}
+			}
+		}
+	}
+}
+
+// An identifier in a reference or an import, with the reader at its start
+static std::string readIdent(Reader &reader) {
+	size_t start = reader.idx;
+	reader.idx = scan::ident(reader.string(), start);
+	return std::string(reader.string().substr(start, reader.idx - start));
+}
+
+// \import{module}, with the reader at the '{'
+static void readImport(Reader &reader, LafunBlock &block) {
+	size_t startIdx = reader.idx;
+	reader.readCh();
+
+	std::string module = readIdent(reader);
+	if (module.empty() || reader.readCh() != '}') {
+		throw LafunParseError(reader.location(startIdx), "Expected a module name in \\import");
+	}
+
+	block = ModuleImport{std::move(module)};
+}
+
+// Raw LaTeX isn't copied: a block is the source from where it started
+// up to the reader. The parser only acts on a few bytes, and skips
+// everything between them in one go.
+static bool readBlock(Reader &reader, LafunBlock &block, bool parseBodies) {
+	std::string_view source = reader.string();
+	size_t start = reader.idx;
+	auto endRawLatex = [&] {
+		block = RawLatex{source.substr(start, reader.idx - start)};
+	};
 
-void parseLafun(Reader &reader, LafunDocument &document) {
-	std::string currentBlock;
 	while (true) {
 		int ch = reader.peekCh(0);
 		if (ch == '\\') {
 			if (reader.peekCh(1) == '\\') {
 				reader.readCh();
 				reader.readCh();
-				currentBlock += "\\\\";
 				continue;
 			}
 
@@ -38,76 +106,170 @@ void parseLafun(Reader &reader, LafunDocument &document) {
 				 possibleKeyword == "var") &&
 				reader.peekCh(i) == '{') {
 
-				if (!currentBlock.empty()) {
-					document.blocks.emplace_back(RawLatex{std::move(currentBlock)});
-					currentBlock = "";
+				if (reader.idx > start) {
+					endRawLatex();
+					return true;
 				}
 
 				size_t startIdx = reader.idx;
 				fun::Lexer lexer(reader);
-				fun::ast::Declaration decl;
-				parseDeclaration(lexer, decl);
-				reader = lexer.reader_;
-				size_t endIdx = reader.idx;
-				document.blocks.emplace_back(FunBlock{std::move(decl), fun::ByteRange{startIdx, endIdx}});
+				FunBlock funBlock;
+				if (parseBodies) {
+					parseDeclaration(lexer, funBlock.arena, funBlock.decl);
+					reader.idx = lexer.offset();
+				} else {
+					parseDeclarationHeader(lexer, funBlock.arena, funBlock.decl);
+					reader.idx = lexer.offset();
+					skipBraceGroup(reader);
+				}
+				funBlock.range = fun::ByteRange{startIdx, reader.idx};
+				block = std::move(funBlock);
+				return true;
+			} else if (possibleKeyword == "import" && reader.peekCh(i) == '{') {
+				if (reader.idx > start) {
+					endRawLatex();
+					return true;
+				}
+
+				reader.idx += i;
+				readImport(reader, block);
+				return true;
 			} else {
 				// skip it
-				for (size_t j = 0; j < i; j++) {
-					currentBlock += reader.readCh();
-				}
+				reader.idx += i;
 			}
 		} else if (ch == '@' || ch == '!') {
-			if (!currentBlock.empty()) {
-				document.blocks.emplace_back(RawLatex{std::move(currentBlock)});
+			if (reader.idx > start) {
+				endRawLatex();
+				return true;
 			}
 
 			reader.readCh();
-
-			// Parse downwards/upwards ref
-			std::string ident;
-
-			while (true) {
-				int ch = reader.peekCh(0);
-				if (!(
-						(ch >= 'a' && ch <= 'z') ||
-						(ch >= 'A' && ch <= 'Z') ||
-						(ch >= '0' && ch <= '9') ||
-						ch == '_')) {
-					break;
-				}
-				ident += reader.readCh();
-			}
-
+			std::string ident = readIdent(reader);
 			if (ch == '@') {
 				// Upwards ref
-				document.blocks.emplace_back(IdentifierUpwardsRef{std::move(ident)});
+				block = IdentifierUpwardsRef{std::move(ident)};
 			} else {
 				// Downwards ref
-				document.blocks.emplace_back(IdentifierDownwardsRef{std::move(ident)});
+				block = IdentifierDownwardsRef{std::move(ident)};
 			}
+
+			return true;
 		} else if (ch == '{') {
 			// Read till next *matching* }
-			currentBlock += reader.readCh();
+			size_t startIdx = reader.idx;
+			reader.readCh();
 			size_t numBracesToMatch = 1;
 			while (numBracesToMatch > 0) {
+				reader.idx = scan::latexGroup(source, reader.idx);
 				int ch = reader.readCh();
-				currentBlock += ch;
 				if (ch == EOF) {
-					break;
-				} else if (ch == '{') {
+					throw LafunParseError(reader.location(startIdx), "Unterminated '{'");
+				}
+
+				if (ch == '{') {
 					numBracesToMatch++;
 				} else if (ch == '}') {
 					numBracesToMatch--;
 				}
 			}
 		} else if (ch == EOF) {
-			if (!currentBlock.empty()) {
-				document.blocks.emplace_back(RawLatex{std::move(currentBlock)});
+			if (reader.idx > start) {
+				endRawLatex();
+				return true;
 			}
-			break;
+
+			return false;
 		} else {
-			currentBlock += reader.readCh();
+			reader.idx = scan::latex(source, reader.idx);
+		}
+	}
+}
+
+bool parseLafunBlock(Reader &reader, LafunBlock &block) {
+	return readBlock(reader, block, true);
+}
+
+bool scanLafunBlock(Reader &reader, LafunBlock &block) {
+	return readBlock(reader, block, false);
+}
+
+void parseFunBlock(std::string_view source, FunBlock &block) {
+	Reader reader{source};
+	reader.idx = block.range.start;
+
+	// The header from scanning the block isn't needed once the whole
+	// declaration is parsed, so it's freed along with the old arena
+	fun::Lexer lexer(reader);
+	Arena arena;
+	fun::ast::Declaration decl;
+	parseDeclaration(lexer, arena, decl);
+	if (lexer.offset() != block.range.end) {
+		throw LafunParseError(reader.location(block.range.start), "Mismatched braces in block");
+	}
+
+	block.decl = decl;
+	block.arena = std::move(arena);
+}
+
+void parseLafun(Reader &reader, LafunDocument &document, size_t threads) {
+	size_t base = document.blocks.size();
+	std::vector<size_t> starts;
+	Reader scanner = reader;
+	bool scanned = true;
+
+	if (threads > 1) {
+		size_t start = scanner.idx;
+		try {
+			LafunBlock block;
+			while (scanLafunBlock(scanner, block)) {
+				starts.push_back(start);
+				document.blocks.push_back(std::move(block));
+				start = scanner.idx;
+			}
+		} catch (...) {
+			starts.push_back(start);
+			scanned = false;
+		}
+
+		std::vector<std::exception_ptr> errors(starts.size());
+		{
+			ThreadPool pool(threads);
+			for (size_t i = 0; base + i < document.blocks.size(); ++i) {
+				if (auto funBlock = std::get_if<FunBlock>(&document.blocks[base + i])) {
+					pool.submit([&reader, &errors, funBlock, i] {
+						try {
+							parseFunBlock(reader.string(), *funBlock);
+						} catch (...) {
+							errors[i] = std::current_exception();
+						}
+					});
+				}
+			}
+
+			pool.wait();
+		}
+
+		// From the first block which failed, to scan or to parse, parse one
+		// block at a time, so that the error is the one a sequential parse
+		// would have thrown
+		size_t failed = 0;
+		while (failed < errors.size() && !errors[failed] && (scanned || failed + 1 < starts.size())) {
+			failed += 1;
+		}
+
+		if (failed == errors.size()) {
+			reader.idx = scanner.idx;
+			return;
 		}
+
+		document.blocks.resize(base + failed);
+		reader.idx = starts[failed];
+	}
+
+	LafunBlock block;
+	while (parseLafunBlock(reader, block)) {
+		document.blocks.push_back(std::move(block));
 	}
 }
 
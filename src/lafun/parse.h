@@ -10,14 +10,38 @@ namespace lafun {
 
 struct LafunParseError: public std::exception {
 	LafunParseError(int line, int column, std::string message):
-		line(line), column(column), message(message) {}
+			line(line), column(column), message(message) {
+		error = std::to_string(line);
+		error += ":";
+		error += std::to_string(column);
+		error += ": ";
+		error += message;
+	}
+
+	LafunParseError(Location loc, std::string message):
+		LafunParseError(loc.line, loc.column, std::move(message)) {}
+
 	int line;
 	int column;
 	std::string message;
+	std::string error;
 
-	const char *what() const noexcept override { return message.c_str(); }
+	const char *what() const noexcept override { return error.c_str(); }
 };
 
-void parseLafun(Reader &reader, ast::LafunDocument &document);
+// Parse the next top-level block, returns false on EOF.
+// Raw LaTeX blocks refer into the reader's string.
+bool parseLafunBlock(Reader &reader, ast::LafunBlock &block);
+
+// Like parseLafunBlock, but a FunBlock is only delimited by matching its
+// braces: its declaration has everything but the body. parseFunBlock
+// parses the whole declaration later.
+bool scanLafunBlock(Reader &reader, ast::LafunBlock &block);
+void parseFunBlock(std::string_view source, ast::FunBlock &block);
+
+// Parse a whole document. With more than one thread, the FuN blocks are
+// found by scanning, then parsed at the same time; the document, and the
+// error thrown if any, are the same as parsing it on one thread.
+void parseLafun(Reader &reader, ast::LafunDocument &document, size_t threads = 1);
 
 }
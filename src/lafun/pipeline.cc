@@ -0,0 +1,295 @@
+#include "pipeline.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <sstream>
+
+#include "parse.h"
+#include "emit.h"
+#include "module.h"
+#include "fun/Codegen.h"
+#include "fun/IdentResolver.h"
+#include "fun/prelude.h"
+#include "fun/print.h"
+#include "OutputBuffer.h"
+#include "Reader.h"
+#include "Sha256.h"
+#include "ThreadPool.h"
+
+using namespace lafun::ast;
+
+namespace lafun {
+
+namespace {
+
+// One top-level block on its way through the pipeline. The flags and
+// errors are set by workers, and guarded by the pipeline's mutex.
+struct Slot {
+	LafunBlock block;
+	BlockIdents idents;
+	BlockResult result;
+
+	bool parsed = false;
+	bool generated = false;
+	std::exception_ptr parseError;
+	std::exception_ptr generateError;
+};
+
+}
+
+void compilePipelined(std::string_view source, const CompileOptions &opts, const CompileOutputs &out) {
+	// Everything the jobs touch is declared before the pool, so that it
+	// outlives them when an error is thrown
+	std::deque<Slot> slots;
+	OutputBuffer js;
+	bool jsDone = false;
+	std::exception_ptr jsError;
+	std::mutex mut;
+	std::condition_variable cond;
+	size_t inFlight = 0;
+
+	ThreadPool pool(opts.threads);
+
+	// Scanning and resolving wait while this many jobs are queued or running,
+	// rather than running arbitrarily far ahead of the workers
+	const size_t maxInFlight = pool.size() * 4;
+
+	auto submit = [&](std::function<void()> stage, bool &done, std::exception_ptr &error) {
+		{
+			std::unique_lock<std::mutex> lock(mut);
+			cond.wait(lock, [&] { return inFlight < maxInFlight; });
+			inFlight += 1;
+		}
+
+		pool.submit([&, stage = std::move(stage)] {
+			std::exception_ptr ex;
+			try {
+				stage();
+			} catch (...) {
+				ex = std::current_exception();
+			}
+
+			{
+				std::unique_lock<std::mutex> lock(mut);
+				done = true;
+				error = ex;
+				inFlight -= 1;
+			}
+
+			cond.notify_all();
+		});
+	};
+
+	auto isDone = [&](const bool &done) {
+		std::unique_lock<std::mutex> lock(mut);
+		return done;
+	};
+
+	auto waitFor = [&](const bool &done) {
+		std::unique_lock<std::mutex> lock(mut);
+		cond.wait(lock, [&] { return done; });
+	};
+
+	// A compile without threads parses everything before it resolves
+	// anything, so any parse error wins over a later phase's error
+	auto throwFirst = [&](std::exception_ptr error) {
+		pool.wait();
+		for (Slot &slot: slots) {
+			if (slot.parseError) {
+				std::rethrow_exception(slot.parseError);
+			}
+		}
+
+		std::rethrow_exception(error);
+	};
+
+	fun::IdentResolver resolver;
+	resolver.addBuiltins(fun::preludeNameSet);
+	resolver.beginStreaming();
+
+	// Scan, declaring the top-level names, while the workers parse.
+	// Nothing is cached, so the hash of the names isn't used.
+	Sha256 topLevelHash;
+	ModuleInterface iface;
+	std::exception_ptr scanError, importError, declareError;
+	Reader reader{source};
+	Reader blockStart = reader;
+	try {
+		while (true) {
+			blockStart.idx = reader.idx;
+			Slot &slot = slots.emplace_back();
+			if (!scanLafunBlock(reader, slot.block)) {
+				slots.pop_back();
+				break;
+			}
+
+			if (auto funBlock = std::get_if<FunBlock>(&slot.block)) {
+				if (!declareError) {
+					try {
+						size_t id = resolver.peekId();
+						declareBlock(resolver, funBlock->decl, topLevelHash);
+						addToInterface(funBlock->decl, id, iface);
+					} catch (fun::NameError &) {
+						declareError = std::current_exception();
+					}
+				}
+
+				submit([&source, funBlock] { parseFunBlock(source, *funBlock); },
+						slot.parsed, slot.parseError);
+			} else if (auto import = std::get_if<ModuleImport>(&slot.block)) {
+				ModuleInterface imported;
+				try {
+					loadInterface(import->module, opts.moduleDirs, imported);
+				} catch (ModuleError &) {
+					if (!importError) {
+						importError = std::current_exception();
+					}
+					continue;
+				}
+
+				if (!declareError) {
+					try {
+						importModule(resolver, import->module, imported, topLevelHash);
+					} catch (fun::NameError &) {
+						declareError = std::current_exception();
+					}
+				}
+			}
+		}
+	} catch (...) {
+		scanError = std::current_exception();
+
+		// Parsing the block fails differently from only scanning it
+		try {
+			LafunBlock block;
+			parseLafunBlock(blockStart, block);
+		} catch (...) {
+			scanError = std::current_exception();
+		}
+	}
+
+	if (scanError || importError || declareError) {
+		throwFirst(scanError ? scanError : importError ? importError : declareError);
+	}
+
+	// LaTeX is written as it's generated, unless it has to come after
+	// other outputs in the same stream
+	std::ostringstream latexBuffer;
+	CompileOutputs latexOut;
+	if (out.latex && (out.latex == out.ast || out.latex == out.js || out.latex == out.interface)) {
+		latexOut.latex = &latexBuffer;
+	} else {
+		latexOut.latex = out.latex;
+	}
+
+	BlockEmitter emitter(opts, latexOut);
+	size_t emitted = 0;
+	std::exception_ptr generateError;
+	auto emit = [&](bool wait) {
+		for (; emitted < slots.size() && !generateError; ++emitted) {
+			Slot &slot = slots[emitted];
+			if (!std::holds_alternative<FunBlock>(slot.block)) {
+				emitter.add(slot.block);
+				continue;
+			}
+
+			if (wait) {
+				waitFor(slot.generated);
+			} else if (!isDone(slot.generated)) {
+				return;
+			}
+
+			if (slot.generateError) {
+				generateError = slot.generateError;
+				return;
+			}
+
+			emitter.add(slot.result);
+			slot.result = BlockResult();
+		}
+	};
+
+	// Resolve in document order, each block as soon as it's parsed
+	for (Slot &slot: slots) {
+		if (std::holds_alternative<FunBlock>(slot.block)) {
+			waitFor(slot.parsed);
+			if (slot.parseError) {
+				std::rethrow_exception(slot.parseError);
+			}
+
+			try {
+				resolveBlock(slot.block, resolver, out.latex != nullptr, slot.idents, slot.result);
+			} catch (fun::NameError &) {
+				throwFirst(std::current_exception());
+			}
+
+			if (out.latex) {
+				submit([&source, &slot] {
+					generateResolvedBlock(source, slot.block, slot.idents, false, true, nullptr, slot.result);
+					slot.idents = BlockIdents();
+				}, slot.generated, slot.generateError);
+			} else {
+				slot.generated = true;
+			}
+		}
+
+		emit(false);
+	}
+
+	if (out.js) {
+		submit([&] {
+			fun::Codegen gen;
+			for (Slot &slot: slots) {
+				if (auto funBlock = std::get_if<FunBlock>(&slot.block)) {
+					gen.add(&funBlock->decl);
+				}
+			}
+
+			if (opts.jsPrelude) {
+				js << fun::jsPrelude;
+			}
+			gen.generate(js);
+			if (opts.jsPrelude) {
+				js << fun::jsPostlude;
+			}
+		}, jsDone, jsError);
+	}
+
+	if (out.ast) {
+		for (Slot &slot: slots) {
+			if (auto funBlock = std::get_if<FunBlock>(&slot.block)) {
+				fun::printDeclaration(*out.ast, funBlock->decl);
+				*out.ast << '\n';
+			}
+		}
+	}
+
+	emit(true);
+
+	if (out.js) {
+		waitFor(jsDone);
+		if (jsError) {
+			std::rethrow_exception(jsError);
+		}
+
+		js.writeTo(*out.js);
+	}
+
+	if (generateError) {
+		std::rethrow_exception(generateError);
+	}
+
+	emitter.finish();
+	if (latexOut.latex == &latexBuffer) {
+		*out.latex << latexBuffer.str();
+	}
+
+	if (out.interface) {
+		writeInterface(*out.interface, iface);
+	}
+}
+
+}
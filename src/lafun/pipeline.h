@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string_view>
+
+#include "compile.h"
+
+namespace lafun {
+
+// Compile with the phases overlapping, on opts.threads threads. The calling
+// thread scans top-level blocks and declares their names, while workers
+// parse the blocks scanned so far. Once every top-level name is known, the
+// calling thread resolves the blocks in document order as their parses
+// finish, workers generate each resolved block's LaTeX, and it's written
+// out in order while later blocks are still being resolved. The javascript
+// is generated on a worker once the last block is resolved.
+//
+// The outputs are the same as compile()'s without threads, and so is the
+// error, except that output may already have been written when it's thrown.
+// It can't write an AST file.
+void compilePipelined(std::string_view source, const CompileOptions &opts, const CompileOutputs &out);
+
+}
@@ -2,7 +2,7 @@
 
 namespace lafun {
 
-std::string latexPrelude = R"latex(\documentclass{article}
+const std::string latexPrelude = R"latex(\documentclass{article}
 
 % Useful packages
 \usepackage{amsmath}
@@ -21,7 +21,7 @@ std::string latexPrelude = R"latex(\documentclass{article}
 \begin{document}
 )latex";
 
-std::string latexPostlude = R"latex(
+const std::string latexPostlude = R"latex(
 \end{document}
 )latex";
 
@@ -4,7 +4,7 @@
 
 namespace lafun {
 
-extern std::string latexPrelude;
-extern std::string latexPostlude;
+extern const std::string latexPrelude;
+extern const std::string latexPostlude;
 
 }
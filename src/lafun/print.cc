@@ -16,6 +16,7 @@ void printLafunDocument(std::ostream &os, const LafunDocument &document) {
 			[&](const RawLatex &block) { os << block.str; },
 			[&](const IdentifierUpwardsRef &ref) { os << '@' << ref.ident; },
 			[&](const IdentifierDownwardsRef &ref) { os << '!' << ref.ident; },
+			[&](const ModuleImport &import) { os << "\\import{" << import.module << '}'; },
 			[&](const FunBlock &block) { fun::printDeclaration(os, block.decl); },
 		}, block);
 	}
@@ -1,72 +1,126 @@
 #include "resolve.h"
 
-#include "fun/IdentResolver.h"
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
 #include "ast.h"
 
 using namespace lafun::ast;
 
 namespace lafun {
 
-static size_t findUpwards(LafunDocument &doc, size_t idx, const std::string &name) {
-	for (ssize_t i = idx - 1; i >= 0; --i) {
-		LafunBlock &block = doc.blocks[i];
-		if (std::holds_alternative<FunBlock>(block)) {
-			size_t id = fun::resolveUpwardsInDecl(std::get<FunBlock>(block).decl, name);
-			if (id != 0) {
-				return id;
-			}
-		}
-	}
+namespace {
 
-	for (size_t i = idx + 1; i < doc.blocks.size(); ++i) {
-		LafunBlock &block = doc.blocks[i];
-		if (std::holds_alternative<FunBlock>(block)) {
-			size_t id = fun::resolveDownwardsInDecl(std::get<FunBlock>(block).decl, name);
-			if (id != 0) {
-				return id;
-			}
-		}
-	}
+struct Ref {
+	size_t *id;
+	bool downwards;
+
+	// The last id of the name in the nearest block above that has it,
+	// and the first id in the nearest block below
+	size_t above;
+	size_t below;
+};
+
+// The last id of a name in the blocks so far, and the one before the
+// latest block with the name
+struct LastId {
+	size_t id;
+	size_t before;
+	size_t block;
+};
 
-	return 0;
 }
 
-static size_t findDownwards(LafunDocument &doc, size_t idx, const std::string &name) {
-	for (size_t i = idx + 1; i < doc.blocks.size(); ++i) {
-		LafunBlock &block = doc.blocks[i];
+// '@' refs take the id from above, and '!' refs the one from below,
+// each falling back to the other when there's none. Both are found in one
+// pass down the document, going through each block's identifiers once,
+// instead of searching the blocks around every reference.
+//
+// Method names have no id. A block whose first identifier with a name is
+// a method's isn't below the references to that name, and one whose last
+// is isn't above them, so the search goes on past it.
+void resolveLafunReferences(LafunDocument &document, const std::vector<const fun::ast::Identifier *> &targets) {
+	std::vector<Ref> refs;
+	std::unordered_map<fun::Symbol, LastId> lastIds;
+
+	// The references which haven't seen a block below them with their name,
+	// and those a method name in the current block kept from it
+	std::unordered_map<fun::Symbol, std::vector<size_t>> waiting;
+	std::unordered_map<fun::Symbol, std::vector<size_t>> heldBack;
+
+	auto target = targets.begin();
+	size_t blockIdx = 0;
+	for (LafunBlock &block: document.blocks) {
 		if (std::holds_alternative<FunBlock>(block)) {
-			size_t id = fun::resolveDownwardsInDecl(std::get<FunBlock>(block).decl, name);
-			if (id != 0) {
-				return id;
+			blockIdx += 1;
+
+			// The first identifier with a name is the one below the
+			// references waiting for it, and the last one is above the next
+			for (; *target; ++target) {
+				const fun::ast::Identifier &ident = **target;
+				LastId &last = lastIds[ident.name];
+				if (last.block != blockIdx) {
+					last.before = last.id;
+					last.block = blockIdx;
+				}
+				last.id = ident.id != 0 ? ident.id : last.before;
+
+				if (waiting.empty()) {
+					continue;
+				}
+
+				auto it = waiting.find(ident.name);
+				if (it == waiting.end()) {
+					continue;
+				} else if (ident.id == 0) {
+					heldBack.insert(std::move(*it));
+				} else {
+					for (size_t ref: it->second) {
+						refs[ref].below = ident.id;
+					}
+				}
+				waiting.erase(it);
 			}
-		}
-	}
 
-	for (ssize_t i = idx - 1; i >= 0; --i) {
-		LafunBlock &block = doc.blocks[i];
-		if (std::holds_alternative<FunBlock>(block)) {
-			size_t id = fun::resolveUpwardsInDecl(std::get<FunBlock>(block).decl, name);
-			if (id != 0) {
-				return id;
+			if (!heldBack.empty()) {
+				waiting.merge(heldBack);
+				heldBack.clear();
 			}
+
+			++target;
+			continue;
 		}
-	}
 
-	return 0;
-}
+		Ref ref;
+		std::optional<fun::Symbol> name;
+		if (auto up = std::get_if<IdentifierUpwardsRef>(&block)) {
+			ref = {&up->id, false, 0, 0};
+			name = fun::Symbol::find(up->ident);
+		} else if (auto down = std::get_if<IdentifierDownwardsRef>(&block)) {
+			ref = {&down->id, true, 0, 0};
+			name = fun::Symbol::find(down->ident);
+		} else {
+			continue;
+		}
 
-void resolveLafunReferences(LafunDocument &document) {
-	for (size_t i = 0; i < document.blocks.size(); ++i) {
-		auto &block = document.blocks[i];
-		if (std::holds_alternative<lafun::ast::IdentifierUpwardsRef>(block)) {
-			auto &ref = std::get<lafun::ast::IdentifierUpwardsRef>(block);
-			ref.id = findUpwards(document, i, ref.ident);
-		} else if (std::holds_alternative<lafun::ast::IdentifierDownwardsRef>(block)) {
-			auto &ref = std::get<lafun::ast::IdentifierDownwardsRef>(block);
-			ref.id = findDownwards(document, i, ref.ident);
+		if (name) {
+			auto it = lastIds.find(*name);
+			if (it != lastIds.end()) {
+				ref.above = it->second.id;
+			}
+			waiting[*name].push_back(refs.size());
 		}
+		refs.push_back(ref);
 	}
 
+	for (const Ref &ref: refs) {
+		if (ref.downwards) {
+			*ref.id = ref.below != 0 ? ref.below : ref.above;
+		} else {
+			*ref.id = ref.above != 0 ? ref.above : ref.below;
+		}
+	}
 }
 
 }
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <vector>
+
 #include "ast.h"
 
 namespace lafun {
 
-void resolveLafunReferences(ast::LafunDocument &document);
+// Targets are the identifiers fun::IdentResolver::finalize() lists
+// for the document's declarations
+void resolveLafunReferences(
+		ast::LafunDocument &document, const std::vector<const fun::ast::Identifier *> &targets);
 
 }
@@ -0,0 +1,611 @@
+#include "server.h"
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "ThreadPool.h"
+#include "Input.h"
+#include "module.h"
+
+namespace lafun {
+
+// Messages are a list of fields, each one a "<name> <length>\n" header
+// followed by <length> bytes of data, and terminated by an "end" field.
+using Message = std::vector<std::pair<std::string, std::string>>;
+
+static const size_t MAX_FIELD_SIZE = (size_t)1 << 31;
+
+static bool writeAll(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return false;
+		}
+
+		data += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static bool writeMessage(int fd, const Message &msg) {
+	std::string buf;
+	for (const auto &[name, data]: msg) {
+		buf += name;
+		buf += ' ';
+		buf += std::to_string(data.size());
+		buf += '\n';
+		buf += data;
+	}
+
+	buf += "end 0\n";
+	return writeAll(fd, buf.data(), buf.size());
+}
+
+class FdReader {
+public:
+	FdReader(int fd): fd_(fd) {}
+
+	bool readLine(std::string &line) {
+		line.clear();
+		while (true) {
+			if (pos_ == len_ && !fill()) {
+				return false;
+			}
+
+			char ch = buf_[pos_++];
+			if (ch == '\n') {
+				return true;
+			}
+
+			line += ch;
+			if (line.size() > 256) {
+				return false;
+			}
+		}
+	}
+
+	// The buffer grows as the bytes arrive, rather than taking the length
+	// on trust up front
+	bool readBytes(std::string &data, size_t n) {
+		data.clear();
+		while (data.size() < n) {
+			if (pos_ == len_ && !fill()) {
+				return false;
+			}
+
+			size_t chunk = std::min(n - data.size(), len_ - pos_);
+			data.append(buf_ + pos_, chunk);
+			pos_ += chunk;
+		}
+
+		return true;
+	}
+
+	// Whether bytes have been read which haven't been consumed yet
+	bool buffered() const { return pos_ < len_; }
+
+private:
+	bool fill() {
+		while (true) {
+			ssize_t n = read(fd_, buf_, sizeof(buf_));
+			if (n < 0 && errno == EINTR) {
+				continue;
+			} else if (n <= 0) {
+				return false;
+			}
+
+			pos_ = 0;
+			len_ = n;
+			return true;
+		}
+	}
+
+	int fd_;
+	char buf_[64 * 1024];
+	size_t pos_ = 0;
+	size_t len_ = 0;
+};
+
+// Returns false on EOF or a malformed message
+static bool readMessage(FdReader &reader, Message &msg) {
+	msg.clear();
+	std::string line;
+	while (reader.readLine(line)) {
+		size_t space = line.find(' ');
+		if (space == std::string::npos) {
+			return false;
+		}
+
+		std::string name = line.substr(0, space);
+		char *end;
+		unsigned long long len = strtoull(line.c_str() + space + 1, &end, 10);
+		if (*end != '\0' || len > MAX_FIELD_SIZE) {
+			return false;
+		}
+
+		if (name == "end") {
+			return true;
+		}
+
+		std::string data;
+		if (!reader.readBytes(data, len)) {
+			return false;
+		}
+
+		msg.emplace_back(std::move(name), std::move(data));
+	}
+
+	return false;
+}
+
+static sockaddr_un socketAddress(const char *path) {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		throw std::runtime_error(std::string("Socket path too long: ") + path);
+	}
+
+	strcpy(addr.sun_path, path);
+	return addr;
+}
+
+namespace {
+
+// An imported module's interface, as the analysis found it
+struct CachedInterface {
+	std::string module;
+	std::string path;
+	struct stat st;
+};
+
+struct CachedDocument {
+	Input input;
+	ast::LafunDocument document;
+	struct stat st;
+	std::vector<CachedInterface> interfaces;
+};
+
+// Analyzed documents, reused for as long as the file and the interfaces it
+// imports are unchanged. The analysis depends on where modules are looked
+// for, so documents are looked up by their path and module directories.
+class DocumentCache {
+public:
+	// The least recently used documents are dropped beyond this many
+	static const size_t MAX_DOCUMENTS = 64;
+
+	std::shared_ptr<const CachedDocument> get(const std::string &path, const CompileOptions &opts) {
+		struct stat st;
+		if (stat(path.c_str(), &st) < 0) {
+			throw std::runtime_error("Opening file " + path + " failed");
+		}
+
+		std::string key = path;
+		for (const std::string &dir: opts.moduleDirs) {
+			key += '\0';
+			key += dir;
+		}
+
+		std::shared_ptr<const CachedDocument> cached;
+		{
+			std::unique_lock<std::mutex> lock(mut_);
+			auto it = docs_.find(key);
+			if (it != docs_.end()) {
+				it->second.lastUsed = ++clock_;
+				cached = it->second.doc;
+			}
+		}
+
+		if (cached && sameFile(cached->st, st) && sameInterfaces(*cached, opts)) {
+			return cached;
+		}
+
+		// The file is read rather than mapped, since it may well be
+		// modified in place while we hold on to it
+		auto doc = std::make_shared<CachedDocument>();
+		if (!doc->input.open(path.c_str(), false)) {
+			throw std::runtime_error("Opening file " + path + " failed");
+		}
+
+		doc->st = st;
+		time_t started = time(nullptr);
+		analyze(doc->input.view(), doc->document, opts);
+
+		// Interfaces are only looked at once they've been read, so one
+		// changed since the analysis began might have been read before the
+		// change, and the analysis isn't kept. File times can lag the clock
+		// a little, hence the extra second.
+		bool keep = true;
+		for (const ast::LafunBlock &block: doc->document.blocks) {
+			if (auto import = std::get_if<ast::ModuleImport>(&block)) {
+				CachedInterface &iface = doc->interfaces.emplace_back();
+				iface.module = import->module;
+				iface.path = findInterface(import->module, opts.moduleDirs);
+				if (stat(iface.path.c_str(), &iface.st) < 0 || iface.st.st_mtim.tv_sec + 1 >= started) {
+					keep = false;
+				}
+			}
+		}
+
+		if (keep) {
+			std::unique_lock<std::mutex> lock(mut_);
+			docs_[key] = {doc, ++clock_};
+			if (docs_.size() > MAX_DOCUMENTS) {
+				evictOne();
+			}
+		}
+
+		return doc;
+	}
+
+private:
+	struct Entry {
+		std::shared_ptr<const CachedDocument> doc;
+		uint64_t lastUsed;
+	};
+
+	static bool sameFile(const struct stat &a, const struct stat &b) {
+		return
+			a.st_dev == b.st_dev && a.st_ino == b.st_ino &&
+			a.st_size == b.st_size &&
+			a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+			a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+	}
+
+	// An interface which appeared in an earlier module directory counts
+	// as a change, like one which was modified
+	static bool sameInterfaces(const CachedDocument &doc, const CompileOptions &opts) {
+		for (const CachedInterface &iface: doc.interfaces) {
+			struct stat st;
+			if (findInterface(iface.module, opts.moduleDirs) != iface.path ||
+					stat(iface.path.c_str(), &st) < 0 || !sameFile(iface.st, st)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void evictOne() {
+		auto oldest = docs_.begin();
+		for (auto it = docs_.begin(); it != docs_.end(); ++it) {
+			if (it->second.lastUsed < oldest->second.lastUsed) {
+				oldest = it;
+			}
+		}
+
+		docs_.erase(oldest);
+	}
+
+	std::mutex mut_;
+	std::unordered_map<std::string, Entry> docs_;
+	uint64_t clock_ = 0;
+};
+
+}
+
+static Message handleRequest(const Message &req, DocumentCache &cache) {
+	RemoteRequest request;
+	bool haveSource = false;
+	for (const auto &[name, data]: req) {
+		if (name == "path") {
+			request.path = data;
+		} else if (name == "source") {
+			request.source = data;
+			haveSource = true;
+		} else if (name == "js") {
+			request.js = true;
+		} else if (name == "latex") {
+			request.latex = true;
+		} else if (name == "ast") {
+			request.ast = true;
+		} else if (name == "no-js-prelude") {
+			request.opts.jsPrelude = false;
+		} else if (name == "module-dir") {
+			request.opts.moduleDirs.push_back(data);
+		} else if (name == "no-latex-prelude") {
+			request.opts.latexPrelude = false;
+		} else if (name == "stream") {
+			request.opts.stream = true;
+		}
+	}
+
+	std::ostringstream js, latex, ast;
+	CompileOutputs out;
+	if (request.js) {
+		out.js = &js;
+	}
+	if (request.latex) {
+		out.latex = &latex;
+	}
+	if (request.ast) {
+		out.ast = &ast;
+	}
+
+	Message resp;
+	try {
+		if (haveSource) {
+			compile(request.source, request.opts, out);
+		} else if (request.path.empty()) {
+			throw std::runtime_error("Request has neither a path nor a source");
+		} else if (request.opts.stream) {
+			// Streaming is for documents too big to keep around
+			Input input;
+			if (!input.open(request.path.c_str())) {
+				throw std::runtime_error("Opening file " + request.path + " failed");
+			}
+
+			compile(input.view(), request.opts, out);
+		} else {
+			std::shared_ptr<const CachedDocument> doc = cache.get(request.path, request.opts);
+			generate(doc->input.view(), doc->document, request.opts, out);
+		}
+	} catch (std::exception &ex) {
+		resp.emplace_back("status", "error");
+		resp.emplace_back("error", ex.what());
+		return resp;
+	}
+
+	resp.emplace_back("status", "ok");
+	if (request.js) {
+		resp.emplace_back("js", js.str());
+	}
+	if (request.latex) {
+		resp.emplace_back("latex", latex.str());
+	}
+	if (request.ast) {
+		resp.emplace_back("ast", ast.str());
+	}
+
+	return resp;
+}
+
+// A client's requests and responses time out after this long, so that a
+// client which stops partway through a request doesn't hold on to a worker
+static const int IO_TIMEOUT_SECONDS = 30;
+
+struct Connection {
+	Connection(int fd): fd(fd), reader(fd) {}
+	~Connection() { close(fd); }
+
+	int fd;
+	FdReader reader;
+};
+
+// Answer the requests a client has sent so far. Returns false once the
+// client has gone, or has timed out.
+static bool serveRequests(Connection &conn, DocumentCache &cache) {
+	Message req;
+	do {
+		if (!readMessage(conn.reader, req) || !writeMessage(conn.fd, handleRequest(req, cache))) {
+			return false;
+		}
+	} while (conn.reader.buffered());
+
+	return true;
+}
+
+static const char *servedSocketPath;
+
+static void onTerminate(int) {
+	unlink(servedSocketPath);
+	_exit(0);
+}
+
+int serve(const char *socketPath, size_t threads) {
+	sockaddr_un addr = socketAddress(socketPath);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		std::cerr << "socket: " << strerror(errno) << '\n';
+		return 1;
+	}
+
+	// A socket left behind by an earlier server is replaced, anything else isn't
+	struct stat st;
+	if (lstat(socketPath, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			std::cerr << socketPath << " exists and isn't a socket\n";
+			return 1;
+		}
+
+		unlink(socketPath);
+	}
+
+	if (bind(sock, (sockaddr *)&addr, sizeof(addr)) < 0) {
+		std::cerr << "Binding " << socketPath << " failed: " << strerror(errno) << '\n';
+		return 1;
+	}
+
+	if (listen(sock, 64) < 0) {
+		std::cerr << "listen: " << strerror(errno) << '\n';
+		return 1;
+	}
+
+	servedSocketPath = socketPath;
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, onTerminate);
+	signal(SIGTERM, onTerminate);
+
+	// Connections waiting for their next request are polled here, and only
+	// handed to a worker once a request arrives, so that idle clients don't
+	// keep workers from the others. Workers hand them back through 'wake'.
+	int wake[2];
+	if (pipe2(wake, O_CLOEXEC | O_NONBLOCK) < 0) {
+		std::cerr << "pipe: " << strerror(errno) << '\n';
+		return 1;
+	}
+
+	std::vector<std::unique_ptr<Connection>> idle;
+	std::mutex returnedMut;
+	std::vector<std::unique_ptr<Connection>> returned;
+
+	DocumentCache cache;
+	ThreadPool pool(threads);
+	std::vector<pollfd> fds;
+	while (true) {
+		fds.clear();
+		fds.push_back({sock, POLLIN, 0});
+		fds.push_back({wake[0], POLLIN, 0});
+		for (const auto &conn: idle) {
+			fds.push_back({conn->fd, POLLIN, 0});
+		}
+
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			std::cerr << "poll: " << strerror(errno) << '\n';
+			return 1;
+		}
+
+		// Clients which hung up are ready too, and are closed by the worker
+		size_t kept = 0;
+		for (size_t i = 0; i < idle.size(); ++i) {
+			if (fds[i + 2].revents == 0) {
+				idle[kept++] = std::move(idle[i]);
+				continue;
+			}
+
+			Connection *conn = idle[i].release();
+			pool.submit([conn, &cache, &returnedMut, &returned, &wake] {
+				std::unique_ptr<Connection> owned(conn);
+				if (serveRequests(*owned, cache)) {
+					std::unique_lock<std::mutex> lock(returnedMut);
+					returned.push_back(std::move(owned));
+
+					// If the pipe is full, the poller has been woken already
+					char ch = 0;
+					if (write(wake[1], &ch, 1) < 0) {
+						return;
+					}
+				}
+			});
+		}
+		idle.resize(kept);
+
+		if (fds[1].revents != 0) {
+			char buf[64];
+			while (read(wake[0], buf, sizeof(buf)) > 0) {}
+
+			std::unique_lock<std::mutex> lock(returnedMut);
+			for (auto &conn: returned) {
+				idle.push_back(std::move(conn));
+			}
+			returned.clear();
+		}
+
+		if (fds[0].revents != 0) {
+			int fd = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+			if (fd < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) {
+					continue;
+				}
+
+				std::cerr << "accept: " << strerror(errno) << '\n';
+				return 1;
+			}
+
+			timeval timeout{IO_TIMEOUT_SECONDS, 0};
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			idle.push_back(std::make_unique<Connection>(fd));
+		}
+	}
+}
+
+RemoteResult compileRemote(const char *socketPath, const RemoteRequest &request) {
+	sockaddr_un addr = socketAddress(socketPath);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throw std::runtime_error(std::string("socket: ") + strerror(errno));
+	}
+
+	if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+		int err = errno;
+		close(fd);
+		throw std::runtime_error(
+				std::string("Connecting to ") + socketPath + " failed: " + strerror(err));
+	}
+
+	Message req;
+	if (request.path.empty()) {
+		req.emplace_back("source", request.source);
+	} else {
+		req.emplace_back("path", request.path);
+	}
+	if (request.js) {
+		req.emplace_back("js", "");
+	}
+	if (request.latex) {
+		req.emplace_back("latex", "");
+	}
+	if (request.ast) {
+		req.emplace_back("ast", "");
+	}
+	if (!request.opts.latexPrelude) {
+		req.emplace_back("no-latex-prelude", "");
+	}
+	if (!request.opts.jsPrelude) {
+		req.emplace_back("no-js-prelude", "");
+	}
+	for (const std::string &dir: request.opts.moduleDirs) {
+		req.emplace_back("module-dir", dir);
+	}
+	if (request.opts.stream) {
+		req.emplace_back("stream", "");
+	}
+
+	Message resp;
+	FdReader reader(fd);
+	bool ok = writeMessage(fd, req) && readMessage(reader, resp);
+	close(fd);
+	if (!ok) {
+		throw std::runtime_error("Lost connection to the server");
+	}
+
+	RemoteResult result;
+	for (auto &[name, data]: resp) {
+		if (name == "status") {
+			result.ok = data == "ok";
+		} else if (name == "error") {
+			result.error = std::move(data);
+		} else if (name == "js") {
+			result.js = std::move(data);
+		} else if (name == "latex") {
+			result.latex = std::move(data);
+		} else if (name == "ast") {
+			result.ast = std::move(data);
+		}
+	}
+
+	return result;
+}
+
+}
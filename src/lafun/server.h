@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+#include "compile.h"
+
+namespace lafun {
+
+// Serve compile requests on a unix socket, until killed.
+// Prelude data and analyzed documents are kept warm between requests.
+// Returns an exit code.
+int serve(const char *socketPath, size_t threads);
+
+struct RemoteRequest {
+	std::string path; // compile this file, as seen by the server
+	std::string source; // or these bytes, if path is empty
+	CompileOptions opts;
+	bool js = false;
+	bool latex = false;
+	bool ast = false;
+};
+
+struct RemoteResult {
+	bool ok = false;
+	std::string error;
+	std::string js;
+	std::string latex;
+	std::string ast;
+};
+
+// Send a compile request to a server.
+// Throws std::runtime_error if the server can't be reached.
+RemoteResult compileRemote(const char *socketPath, const RemoteRequest &req);
+
+}
@@ -0,0 +1,227 @@
+#include "watch.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "emit.h"
+#include "fun/prelude.h"
+
+using namespace lafun::ast;
+
+namespace lafun {
+
+IncrementalCompiler::Stats IncrementalCompiler::update(Input &&input, const CompileOutputs &out) {
+	Stats stats;
+	std::string_view oldSource = input_.view();
+	std::string_view source = input.view();
+	stats.parsed = reparseBlocks(blocks_, oldSource.size(), source, diffSources(oldSource, source));
+	input_ = std::move(input);
+	source = input_.view();
+	stats.blocks = blocks_.size();
+
+	fun::IdentResolver resolver;
+	resolver.addBuiltins(fun::preludeNameSet);
+	resolver.beginStreaming();
+	Sha256 topLevelHash;
+	std::vector<ModuleInterface> imports;
+	for (Block &block: blocks_) {
+		if (auto funBlock = std::get_if<FunBlock>(&block.block)) {
+			declareBlock(resolver, funBlock->decl, topLevelHash);
+		} else if (auto import = std::get_if<ModuleImport>(&block.block)) {
+			loadInterface(import->module, opts_.moduleDirs, imports.emplace_back());
+			importModule(resolver, import->module, imports.back(), topLevelHash);
+		}
+	}
+
+	// A changed top-level name can change how any block resolves
+	std::string topLevelDigest = topLevelHash.hexDigest();
+	if (topLevelDigest != topLevelDigest_) {
+		for (Block &block: blocks_) {
+			block.generated = false;
+		}
+
+		topLevelDigest_ = std::move(topLevelDigest);
+	}
+
+	BlockEmitter emitter(opts_, out);
+	for (const ModuleInterface &import: imports) {
+		emitter.addImports(import);
+	}
+
+	for (Block &block: blocks_) {
+		auto funBlock = std::get_if<FunBlock>(&block.block);
+		if (!funBlock) {
+			emitter.add(block.block);
+			continue;
+		}
+
+		if (block.generated && block.firstId == resolver.peekId()) {
+			resolver.skipIds(block.result.idsUsed);
+		} else {
+			rebaseBlock(block);
+			block.generated = false;
+			block.firstId = resolver.peekId();
+			generateBlock(source, block.block, resolver, out.js, out.latex, nullptr, block.result);
+			block.generated = true;
+			stats.generated += 1;
+		}
+
+		emitter.add(block.result);
+	}
+
+	emitter.finish();
+	return stats;
+}
+
+// Write a file through a temporary file, so that readers
+// never see it half written
+static bool replaceFile(const std::string &path, const std::string &content) {
+	std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream os(tmpPath);
+		os << content;
+		if (!os) {
+			return false;
+		}
+	}
+
+	return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+static void rebuild(
+		IncrementalCompiler &compiler, const char *inputPath,
+		const char *jsPath, const char *latexPath) {
+	auto startTime = std::chrono::steady_clock::now();
+
+	// The file may change under us, so it's read rather than mapped
+	Input input;
+	if (!input.open(inputPath, false)) {
+		std::cerr << "Opening file " << inputPath << " failed\n";
+		return;
+	}
+
+	std::ostringstream js, latex;
+	CompileOutputs out;
+	if (jsPath) {
+		out.js = &js;
+	}
+	if (latexPath) {
+		out.latex = &latex;
+	}
+
+	IncrementalCompiler::Stats stats;
+	try {
+		stats = compiler.update(std::move(input), out);
+	} catch (std::exception &ex) {
+		std::cerr << inputPath << ':' << ex.what() << '\n';
+		return;
+	}
+
+	if (jsPath && !replaceFile(jsPath, js.str())) {
+		std::cerr << "Writing file " << jsPath << " failed\n";
+	}
+	if (latexPath && !replaceFile(latexPath, latex.str())) {
+		std::cerr << "Writing file " << latexPath << " failed\n";
+	}
+
+	std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - startTime;
+	char buf[128];
+	snprintf(
+			buf, sizeof(buf), "%.2f ms, %zu of %zu blocks parsed, %zu generated",
+			duration.count(), stats.parsed, stats.blocks, stats.generated);
+	std::cerr << "Compiled " << inputPath << ": " << buf << '\n';
+}
+
+#ifdef __linux__
+int watch(const char *inputPath, const char *jsPath, const char *latexPath, const CompileOptions &opts) {
+	// Editors often save by writing a new file and renaming it over the
+	// old one, so watch the directory rather than the file
+	std::string dir = ".";
+	std::string name = inputPath;
+	size_t slash = name.rfind('/');
+	if (slash != std::string::npos) {
+		dir = slash == 0 ? "/" : name.substr(0, slash);
+		name = name.substr(slash + 1);
+	}
+
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0) {
+		perror("inotify_init1");
+		return 1;
+	}
+
+	if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+		std::cerr << "Watching " << dir << " failed: " << strerror(errno) << '\n';
+		close(fd);
+		return 1;
+	}
+
+	IncrementalCompiler compiler(opts);
+	rebuild(compiler, inputPath, jsPath, latexPath);
+
+	alignas(inotify_event) char buf[4096];
+	while (true) {
+		bool changed = false;
+
+		// After the first event, keep reading until things have been quiet
+		// for a moment, since one save can be several writes
+		int timeout = -1;
+		while (true) {
+			pollfd pfd{fd, POLLIN, 0};
+			int ret = poll(&pfd, 1, timeout);
+			if (ret < 0 && errno == EINTR) {
+				continue;
+			} else if (ret < 0) {
+				perror("poll");
+				close(fd);
+				return 1;
+			} else if (ret == 0) {
+				break;
+			}
+
+			ssize_t len = read(fd, buf, sizeof(buf));
+			if (len < 0 && errno == EINTR) {
+				continue;
+			} else if (len < 0) {
+				perror("read");
+				close(fd);
+				return 1;
+			}
+
+			for (char *ptr = buf; ptr < buf + len;) {
+				inotify_event *event = (inotify_event *)ptr;
+				if (event->len > 0 && name == event->name) {
+					changed = true;
+				}
+
+				ptr += sizeof(inotify_event) + event->len;
+			}
+
+			if (changed) {
+				timeout = 20;
+			}
+		}
+
+		rebuild(compiler, inputPath, jsPath, latexPath);
+	}
+}
+
+#else
+int watch(const char *, const char *, const char *, const CompileOptions &) {
+	std::cerr << "--watch needs inotify, which is only available on Linux\n";
+	return 1;
+}
+#endif
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "cache.h"
+#include "compile.h"
+#include "incremental.h"
+#include "Input.h"
+
+namespace lafun {
+
+// Keeps a parsed document and its generated output around between
+// compiles. When the source changes, only the top-level blocks which
+// overlap the changed bytes are parsed again, and only blocks whose
+// identifier ids moved are resolved and generated again.
+class IncrementalCompiler {
+public:
+	struct Stats {
+		size_t blocks = 0;
+		size_t parsed = 0;
+		size_t generated = 0;
+	};
+
+	IncrementalCompiler(const CompileOptions &opts): opts_(opts) {}
+
+	// Compile a new version of the source. If it doesn't parse, the
+	// previous version is kept, and the next update starts from that.
+	Stats update(Input &&input, const CompileOutputs &out);
+
+private:
+	struct Block: ParsedBlock {
+		bool generated = false;
+		size_t firstId = 0;
+		BlockResult result;
+	};
+
+	const CompileOptions &opts_;
+	Input input_;
+	std::vector<Block> blocks_;
+	std::string topLevelDigest_;
+};
+
+// Compile a file, then compile it again every time it changes.
+// Only returns on errors which aren't errors in the document.
+int watch(const char *inputPath, const char *jsPath, const char *latexPath, const CompileOptions &opts);
+
+}
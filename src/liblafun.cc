@@ -0,0 +1,63 @@
+#include "liblafun.h"
+
+#include "lafun/compile.h"
+#include "lafun/module.h"
+#include "lafun/parse.h"
+#include "fun/Codegen.h"
+#include "fun/IdentResolver.h"
+#include "fun/parse.h"
+
+namespace lafun {
+
+template<typename Error>
+static void addDiagnostic(
+		std::vector<Diagnostic> &diagnostics, Diagnostic::Kind kind, const Error &err) {
+	diagnostics.push_back({kind, err.line, err.column, err.message});
+}
+
+bool compileDocument(
+		std::string_view source, const DocumentOptions &opts,
+		std::vector<Diagnostic> &diagnostics) {
+	CompileOptions compileOpts;
+	compileOpts.latexPrelude = opts.latexPrelude;
+	compileOpts.stream = opts.stream;
+	compileOpts.threads = opts.threads;
+	compileOpts.jsPrelude = opts.jsPrelude;
+	compileOpts.moduleDirs = opts.moduleDirs;
+
+	CompileOutputs out;
+	out.js = opts.js;
+	out.latex = opts.latex;
+	out.ast = opts.ast;
+	out.interface = opts.interface;
+
+	size_t count = diagnostics.size();
+	try {
+		compile(source, compileOpts, out);
+	} catch (fun::LexError &err) {
+		addDiagnostic(diagnostics, Diagnostic::LEX_ERROR, err);
+	} catch (fun::ParseError &err) {
+		addDiagnostic(diagnostics, Diagnostic::PARSE_ERROR, err);
+	} catch (LafunParseError &err) {
+		addDiagnostic(diagnostics, Diagnostic::PARSE_ERROR, err);
+	} catch (fun::NameError &err) {
+		diagnostics.push_back({Diagnostic::NAME_ERROR, -1, -1, err.message});
+	} catch (fun::CodegenError &err) {
+		diagnostics.push_back({Diagnostic::CODEGEN_ERROR, -1, -1, err.error});
+	} catch (ModuleError &err) {
+		diagnostics.push_back({Diagnostic::MODULE_ERROR, -1, -1, err.message});
+	} catch (std::exception &ex) {
+		diagnostics.push_back({Diagnostic::INTERNAL_ERROR, -1, -1, ex.what()});
+	}
+
+	for (std::ostream *os: {opts.js, opts.latex, opts.ast, opts.interface}) {
+		if (os && !os->flush()) {
+			diagnostics.push_back({Diagnostic::OUTPUT_ERROR, -1, -1, "Writing output failed"});
+			break;
+		}
+	}
+
+	return diagnostics.size() == count;
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The interface of liblafun, for programs which compile LaFuN documents
+// without running the lafun binary. It doesn't depend on any other header
+// in the source tree. Every function here may be called from any number
+// of threads at once.
+
+namespace lafun {
+
+struct Diagnostic {
+	enum Kind {
+		LEX_ERROR,
+		PARSE_ERROR,
+		NAME_ERROR,
+		CODEGEN_ERROR,
+		OUTPUT_ERROR,
+		INTERNAL_ERROR,
+		MODULE_ERROR,
+	};
+
+	Kind kind;
+
+	// Both count from zero, the column in bytes.
+	// They're -1 for errors which have no position.
+	int line = -1;
+	int column = -1;
+
+	std::string message;
+};
+
+struct DocumentOptions {
+	// Where to write each output, or null for outputs which aren't wanted
+	std::ostream *js = nullptr;
+	std::ostream *latex = nullptr;
+	std::ostream *ast = nullptr;
+
+	// The document's module interface, listing its top-level names
+	std::ostream *interface = nullptr;
+
+	bool latexPrelude = true;
+
+	// Without the prelude, the javascript is a module to load
+	// before the documents which import it
+	bool jsPrelude = true;
+
+	// Where to look for <module>.funi, for each \import{module}
+	std::vector<std::string> moduleDirs;
+
+	// Process the document one top-level block at a time
+	bool stream = false;
+
+	// More than one thread overlaps the phases of the compile
+	size_t threads = 1;
+};
+
+// Compile a document from memory. Errors in the document are returned in
+// 'diagnostics' rather than thrown; when there are any, the outputs may
+// have been partially written. Returns true on success.
+bool compileDocument(
+		std::string_view source, const DocumentOptions &opts,
+		std::vector<Diagnostic> &diagnostics);
+
+}